@@ -1,3 +1,4 @@
+#include <unordered_map>
 #include <celutil/logger.h>
 #include "parseobject.h"
 #include "astroobj.h"
@@ -5,6 +6,61 @@
 
 using celestia::util::GetLogger;
 
+namespace
+{
+
+std::unordered_map<const AstroObject*, AstroObject::CategorySet>& categorySets()
+{
+    static std::unordered_map<const AstroObject*, AstroObject::CategorySet> sets;
+    return sets;
+}
+
+// Give to the categories of from, removing it from any others
+void copyCategories(const AstroObject* from, const AstroObject* to)
+{
+    auto& sets = categorySets();
+    if (sets.empty())
+        return;
+
+    if (auto it = sets.find(from); it != sets.end())
+    {
+        AstroObject::CategorySet cats = it->second;
+        sets[to] = std::move(cats);
+    }
+    else
+    {
+        sets.erase(to);
+    }
+}
+
+} // end unnamed namespace
+
+// Stars are copied while the database is built, after their categories
+// have been loaded, so the categories follow the copies.
+AstroObject::AstroObject(const AstroObject& other) :
+    m_mainIndexNumber(other.m_mainIndexNumber)
+{
+    copyCategories(&other, this);
+}
+
+AstroObject& AstroObject::operator=(const AstroObject& other)
+{
+    if (this != &other)
+    {
+        m_mainIndexNumber = other.m_mainIndexNumber;
+        copyCategories(&other, this);
+    }
+    return *this;
+}
+
+AstroObject::~AstroObject()
+{
+    // Objects created later at the same address must not inherit the
+    // categories
+    if (auto& sets = categorySets(); !sets.empty())
+        sets.erase(this);
+}
+
 void AstroObject::setIndex(AstroCatalog::IndexNumber nr)
 {
     if (m_mainIndexNumber != AstroCatalog::InvalidIndex)
@@ -17,11 +73,22 @@ Selection AstroObject::toSelection()
     return Selection(this);
 }
 
+AstroObject::CategorySet *AstroObject::getCategories() const
+{
+    auto& sets = categorySets();
+    auto it = sets.find(this);
+    return it == sets.end() ? nullptr : &it->second;
+}
+
+int AstroObject::categoriesCount() const
+{
+    const CategorySet *cats = getCategories();
+    return cats == nullptr ? 0 : cats->size();
+}
+
 bool AstroObject::_addToCategory(UserCategory *c)
 {
-    if (m_cats == nullptr)
-        m_cats = new CategorySet;
-    m_cats->insert(c);
+    categorySets()[this].insert(c);
     return true;
 }
 
@@ -47,14 +114,12 @@ bool AstroObject::addToCategory(const std::string &s, bool create, const std::st
 
 bool AstroObject::_removeFromCategory(UserCategory *c)
 {
-    if (!isInCategory(c))
+    auto& sets = categorySets();
+    auto it = sets.find(this);
+    if (it == sets.end() || it->second.erase(c) == 0)
         return false;
-    m_cats->erase(c);
-    if (m_cats->empty())
-    {
-        delete m_cats;
-        m_cats = nullptr;
-    }
+    if (it->second.empty())
+        sets.erase(it);
     return true;
 }
 
@@ -76,9 +141,9 @@ bool AstroObject::removeFromCategory(const std::string &s)
 bool AstroObject::clearCategories()
 {
     bool ret = true;
-    while(m_cats != nullptr)
+    while (CategorySet *cats = getCategories())
     {
-        UserCategory *c = *(m_cats->begin());
+        UserCategory *c = *(cats->begin());
         if (!removeFromCategory(c))
             ret = false;
     }
@@ -87,9 +152,10 @@ bool AstroObject::clearCategories()
 
 bool AstroObject::isInCategory(UserCategory *c) const
 {
-    if (m_cats == nullptr)
+    const CategorySet *cats = getCategories();
+    if (cats == nullptr)
         return false;
-    return m_cats->count(c) > 0;
+    return cats->count(c) > 0;
 }
 
 bool AstroObject::isInCategory(const std::string &s) const
@@ -18,7 +18,11 @@ class AstroObject
 {
     AstroCatalog::IndexNumber m_mainIndexNumber { AstroCatalog::InvalidIndex };
 public:
-    virtual ~AstroObject() = default;
+    AstroObject() = default;
+    // Copies take the categories of the original along
+    AstroObject(const AstroObject&);
+    AstroObject& operator=(const AstroObject&);
+    virtual ~AstroObject();
 
     AstroCatalog::IndexNumber getIndex() const { return m_mainIndexNumber; }
     void setIndex(AstroCatalog::IndexNumber);
@@ -26,8 +30,6 @@ public:
 // Category stuff
     typedef std::unordered_set<UserCategory*> CategorySet;
 
-private:
-    CategorySet *m_cats { nullptr };
 protected:
     bool _addToCategory(UserCategory*);
     bool _removeFromCategory(UserCategory*);
@@ -40,8 +42,10 @@ public:
     bool clearCategories();
     bool isInCategory(UserCategory*) const;
     bool isInCategory(const std::string&) const;
-    int categoriesCount() const { return m_cats == nullptr ? 0 : m_cats->size(); }
-    CategorySet *getCategories() const { return m_cats; };
+    // The categories of the few objects which have any are kept in a
+    // table rather than in each object, which keeps stars small.
+    int categoriesCount() const;
+    CategorySet *getCategories() const;
     bool loadCategories(const Hash*, DataDisposition = DataDisposition::Add, const std::string &domain = "");
     friend UserCategory;
 };
@@ -0,0 +1,461 @@
+// compactstarstore.cpp
+//
+// Copyright (C) 2026-present, the Celestia Development Team
+//
+// Star catalog stored as separate compact arrays rather than Star objects.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "compactstarstore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+#include <celcompat/numbers.h>
+#include <celutil/logger.h>
+#include "astro.h"
+#include "star.h"
+
+using celestia::util::GetLogger;
+
+namespace
+{
+
+// Stars with orbits closer than this are passed to the handler whatever
+// their magnitude; same as MAX_STAR_ORBIT_RADIUS in staroctree.cpp.
+constexpr float MaxStarOrbitRadius = 1.0f;
+
+constexpr float MagnitudeScale = 256.0f;
+
+constexpr float Sqrt3 = celestia::numbers::sqrt3_v<float>;
+
+// Release the unused capacity of v. shrink_to_fit() is a no-op in
+// libstdc++ when building without exceptions.
+template<typename T>
+void
+shrinkToFit(std::vector<T>& v)
+{
+    std::vector<T>(v.begin(), v.end()).swap(v);
+}
+
+} // end unnamed namespace
+
+
+AstroCatalog::IndexNumber
+StarView::getIndex() const
+{
+    return m_store->m_catalogNumbers[m_index];
+}
+
+
+Eigen::Vector3f
+StarView::getPosition() const
+{
+    return m_store->position(m_store->m_nodes[m_node], m_index);
+}
+
+
+float
+StarView::getAbsoluteMagnitude() const
+{
+    return static_cast<float>(m_store->m_absMags[m_index]) / MagnitudeScale;
+}
+
+
+float
+StarView::getApparentMagnitude(float ly) const
+{
+    return astro::absToAppMag(getAbsoluteMagnitude(), ly) + getExtinction() * ly;
+}
+
+
+float
+StarView::getExtinction() const
+{
+    return m_store->m_nodes[m_node].hasExtinction ? m_store->extinction(m_index) : 0.0f;
+}
+
+
+StarDetails*
+StarView::getDetails() const
+{
+    return m_store->m_details[m_store->m_detailsIndexes[m_index]];
+}
+
+
+celestia::ephem::Orbit*
+StarView::getOrbit() const
+{
+    return getDetails()->getOrbit();
+}
+
+
+std::unique_ptr<CompactStarStore>
+CompactStarStore::create(const std::vector<OctreeNodeRecord<float>>& nodes,
+                         float rootScale,
+                         std::uint32_t nStars,
+                         const std::function<StarRecord(std::uint32_t)>& getStar,
+                         float positionTolerance)
+{
+    std::unique_ptr<CompactStarStore> store(new CompactStarStore());
+
+    // Check that the records describe a tree whose object ranges follow
+    // each other in depth first order, and work out the size of each node
+    // and where its subtree ends.
+    store->m_nodes.resize(nodes.size());
+    std::size_t nodeIndex = 0;
+    std::uint32_t nextStar = 0;
+    std::function<bool(float)> addNode = [&](float scale)
+    {
+        if (nodeIndex >= nodes.size())
+            return false;
+
+        std::size_t index = nodeIndex++;
+        const OctreeNodeRecord<float>& record = nodes[index];
+        if (record.firstObject != nextStar || record.nObjects > nStars - nextStar)
+            return false;
+        nextStar += record.nObjects;
+
+        if (record.hasChildren)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                if (!addNode(scale * 0.5f))
+                    return false;
+            }
+        }
+
+        Node& node = store->m_nodes[index];
+        node.center = record.cellCenterPos;
+        node.scale = scale;
+        node.exclusionFactor = record.exclusionFactor;
+        node.firstStar = record.firstObject;
+        node.nStars = record.nObjects;
+        node.next = static_cast<std::uint32_t>(nodeIndex);
+        node.step = 0.0f;
+        node.positionOffset = 0;
+        node.hasExtinction = false;
+        return true;
+    };
+
+    if (!addNode(rootScale) || nodeIndex != nodes.size() || nextStar != nStars)
+        return nullptr;
+
+    store->m_absMags.resize(nStars);
+    store->m_detailsIndexes.resize(nStars);
+    store->m_catalogNumbers.resize(nStars);
+
+    std::unordered_map<StarDetails*, std::uint16_t> detailsIndexes;
+    std::vector<StarRecord> records;
+    for (std::uint32_t n = 0; n < store->m_nodes.size(); ++n)
+    {
+        Node& node = store->m_nodes[n];
+        if (node.nStars == 0)
+            continue;
+        store->m_starNodes.push_back(n);
+
+        records.clear();
+        float maxOffset = 0.0f;
+        for (std::uint32_t i = node.firstStar; i < node.firstStar + node.nStars; ++i)
+        {
+            const StarRecord& record = records.emplace_back(getStar(i));
+            maxOffset = std::max(maxOffset, (record.position - node.center).cwiseAbs().maxCoeff());
+        }
+
+        // Quantize the offsets from the node center, and keep them unless
+        // the positions they give back are too far off.
+        if (positionTolerance > 0.0f)
+        {
+            node.step = maxOffset > 0.0f ? maxOffset / 32767.0f : 1.0f;
+            node.positionOffset = static_cast<std::uint32_t>(store->m_x.size());
+            float maxError = 0.0f;
+            for (std::uint32_t i = 0; i < node.nStars; ++i)
+            {
+                Eigen::Vector3f q = ((records[i].position - node.center) / node.step).array().round();
+                store->m_x.push_back(static_cast<std::int16_t>(q.x()));
+                store->m_y.push_back(static_cast<std::int16_t>(q.y()));
+                store->m_z.push_back(static_cast<std::int16_t>(q.z()));
+                maxError = std::max(maxError, (store->position(node, node.firstStar + i) - records[i].position).norm());
+            }
+
+            if (maxError > positionTolerance)
+            {
+                store->m_x.resize(node.positionOffset);
+                store->m_y.resize(node.positionOffset);
+                store->m_z.resize(node.positionOffset);
+                node.step = 0.0f;
+            }
+        }
+
+        if (node.step == 0.0f)
+        {
+            node.positionOffset = static_cast<std::uint32_t>(store->m_exactPositions.size());
+            for (const StarRecord& record : records)
+                store->m_exactPositions.push_back(record.position);
+        }
+
+        for (std::uint32_t i = 0; i < node.nStars; ++i)
+        {
+            const StarRecord& record = records[i];
+            std::uint32_t index = node.firstStar + i;
+
+            store->m_catalogNumbers[index] = record.catalogNumber;
+            store->m_absMags[index] = static_cast<std::int16_t>(std::round(record.absMag * MagnitudeScale));
+
+            auto details = detailsIndexes.try_emplace(record.details,
+                                                      static_cast<std::uint16_t>(store->m_details.size()));
+            if (details.second)
+            {
+                if (store->m_details.size() > std::numeric_limits<std::uint16_t>::max())
+                {
+                    GetLogger()->error("Too many distinct star details for a compact star store\n");
+                    return nullptr;
+                }
+                store->m_details.push_back(record.details);
+            }
+            store->m_detailsIndexes[index] = details.first->second;
+
+            if (record.extinction != 0.0f)
+            {
+                node.hasExtinction = true;
+                store->m_extinctionStars.push_back(index);
+                store->m_extinctions.push_back(record.extinction);
+            }
+        }
+    }
+
+    store->m_catalogIndex.resize(nStars);
+    std::iota(store->m_catalogIndex.begin(), store->m_catalogIndex.end(), UINT32_C(0));
+    std::sort(store->m_catalogIndex.begin(), store->m_catalogIndex.end(),
+              [&catalogNumbers = store->m_catalogNumbers](std::uint32_t a, std::uint32_t b)
+              {
+                  return catalogNumbers[a] < catalogNumbers[b];
+              });
+
+    shrinkToFit(store->m_x);
+    shrinkToFit(store->m_y);
+    shrinkToFit(store->m_z);
+    shrinkToFit(store->m_exactPositions);
+    shrinkToFit(store->m_starNodes);
+    shrinkToFit(store->m_extinctionStars);
+    shrinkToFit(store->m_extinctions);
+    shrinkToFit(store->m_details);
+
+    return store;
+}
+
+
+CompactStarStore::~CompactStarStore() = default;
+
+
+StarView
+CompactStarStore::getStarView(std::uint32_t index) const
+{
+    return StarView(this, index, nodeOf(index));
+}
+
+
+std::uint32_t
+CompactStarStore::find(AstroCatalog::IndexNumber catalogNumber) const
+{
+    auto it = std::lower_bound(m_catalogIndex.begin(), m_catalogIndex.end(), catalogNumber,
+                               [this](std::uint32_t index, AstroCatalog::IndexNumber n)
+                               {
+                                   return m_catalogNumbers[index] < n;
+                               });
+    if (it == m_catalogIndex.end() || m_catalogNumbers[*it] != catalogNumber)
+        return size();
+    return *it;
+}
+
+
+Star*
+CompactStarStore::getStar(std::uint32_t index) const
+{
+    std::lock_guard<std::mutex> lock(m_starsMutex);
+
+    std::unique_ptr<Star>& star = m_stars[index];
+    if (star == nullptr)
+    {
+        StarView view = getStarView(index);
+        star = std::make_unique<Star>();
+        star->setIndex(view.getIndex());
+        star->setPosition(view.getPosition());
+        star->setAbsoluteMagnitude(view.getAbsoluteMagnitude());
+        star->setExtinction(view.getExtinction());
+        star->setDetails(view.getDetails());
+    }
+
+    return star.get();
+}
+
+
+void
+CompactStarStore::findVisibleStars(CompactStarHandler& starHandler,
+                                   const Eigen::Vector3f& obsPosition,
+                                   const Eigen::Quaternionf& obsOrientation,
+                                   float fovY,
+                                   float aspectRatio,
+                                   float limitingMag) const
+{
+    // Compute the bounding planes of an infinite view frustum, the same way
+    // as StarDatabase::findVisibleStars()
+    Eigen::Hyperplane<float, 3> frustumPlanes[5];
+    Eigen::Vector3f planeNormals[5];
+    Eigen::Matrix3f rot = obsOrientation.toRotationMatrix();
+    float h = (float) tan(fovY / 2);
+    float w = h * aspectRatio;
+    planeNormals[0] = Eigen::Vector3f(0.0f, 1.0f, -h);
+    planeNormals[1] = Eigen::Vector3f(0.0f, -1.0f, -h);
+    planeNormals[2] = Eigen::Vector3f(1.0f, 0.0f, -w);
+    planeNormals[3] = Eigen::Vector3f(-1.0f, 0.0f, -w);
+    planeNormals[4] = Eigen::Vector3f(0.0f, 0.0f, -1.0f);
+    for (int i = 0; i < 5; i++)
+    {
+        planeNormals[i] = rot.transpose() * planeNormals[i].normalized();
+        frustumPlanes[i] = Eigen::Hyperplane<float, 3>(planeNormals[i], obsPosition);
+    }
+
+    // Nodes are in depth first order, so the children of a node follow it
+    // and skipping a subtree means jumping to its next node.
+    std::uint32_t i = 0;
+    while (i < m_nodes.size())
+    {
+        const Node& node = m_nodes[i];
+        if (processVisibleNode(node, starHandler, obsPosition, frustumPlanes, limitingMag))
+            ++i;
+        else
+            i = node.next;
+    }
+}
+
+
+void
+CompactStarStore::findCloseStars(CompactStarHandler& starHandler,
+                                 const Eigen::Vector3f& obsPosition,
+                                 float radius) const
+{
+    float radiusSquared = radius * radius;
+
+    std::uint32_t i = 0;
+    while (i < m_nodes.size())
+    {
+        const Node& node = m_nodes[i];
+        float nodeDistance = (obsPosition - node.center).norm() - node.scale * Sqrt3;
+        if (nodeDistance > radius)
+        {
+            i = node.next;
+            continue;
+        }
+
+        for (std::uint32_t j = node.firstStar; j < node.firstStar + node.nStars; ++j)
+        {
+            Eigen::Vector3f pos = position(node, j);
+            if ((obsPosition - pos).squaredNorm() < radiusSquared)
+            {
+                StarView star(this, j, i);
+                float distance = (obsPosition - pos).norm();
+                starHandler.process(star, distance, star.getApparentMagnitude(distance));
+            }
+        }
+
+        ++i;
+    }
+}
+
+
+std::size_t
+CompactStarStore::memoryUsage() const
+{
+    return m_nodes.capacity() * sizeof(Node)
+         + m_starNodes.capacity() * sizeof(std::uint32_t)
+         + (m_x.capacity() + m_y.capacity() + m_z.capacity()) * sizeof(std::int16_t)
+         + m_exactPositions.capacity() * sizeof(Eigen::Vector3f)
+         + m_absMags.capacity() * sizeof(std::int16_t)
+         + m_detailsIndexes.capacity() * sizeof(std::uint16_t)
+         + m_details.capacity() * sizeof(StarDetails*)
+         + m_catalogNumbers.capacity() * sizeof(AstroCatalog::IndexNumber)
+         + m_catalogIndex.capacity() * sizeof(std::uint32_t)
+         + m_extinctionStars.capacity() * sizeof(std::uint32_t)
+         + m_extinctions.capacity() * sizeof(float);
+}
+
+
+// Same tests as StarOctree::processVisibleNode()
+bool
+CompactStarStore::processVisibleNode(const Node& node,
+                                     CompactStarHandler& starHandler,
+                                     const Eigen::Vector3f& obsPosition,
+                                     const Eigen::Hyperplane<float, 3>* frustumPlanes,
+                                     float limitingMag) const
+{
+    for (unsigned int i = 0; i < 5; ++i)
+    {
+        const Eigen::Hyperplane<float, 3>& plane = frustumPlanes[i];
+        float r = node.scale * plane.normal().cwiseAbs().sum();
+        if (plane.signedDistance(node.center) < -r)
+            return false;
+    }
+
+    float minDistance = (obsPosition - node.center).norm() - node.scale * Sqrt3;
+    float dimmest = minDistance > 0 ? astro::appToAbsMag(limitingMag, minDistance) : 1000;
+
+    // Compare magnitudes in the stored units to reject dim stars before
+    // anything else about them is read.
+    float dimmestScaled = dimmest * MagnitudeScale;
+    auto nodeIndex = static_cast<std::uint32_t>(&node - m_nodes.data());
+    for (std::uint32_t i = node.firstStar; i < node.firstStar + node.nStars; ++i)
+    {
+        if (static_cast<float>(m_absMags[i]) >= dimmestScaled)
+            continue;
+
+        StarView star(this, i, nodeIndex);
+        float distance = (obsPosition - position(node, i)).norm();
+        float appMag = star.getApparentMagnitude(distance);
+        if (appMag < limitingMag || (distance < MaxStarOrbitRadius && star.getOrbit()))
+            starHandler.process(star, distance, appMag);
+    }
+
+    return minDistance <= 0 || astro::absToAppMag(node.exclusionFactor, minDistance) <= limitingMag;
+}
+
+
+std::uint32_t
+CompactStarStore::nodeOf(std::uint32_t index) const
+{
+    auto it = std::upper_bound(m_starNodes.begin(), m_starNodes.end(), index,
+                               [this](std::uint32_t i, std::uint32_t n)
+                               {
+                                   return i < m_nodes[n].firstStar;
+                               });
+    return *(it - 1);
+}
+
+
+Eigen::Vector3f
+CompactStarStore::position(const Node& node, std::uint32_t index) const
+{
+    std::uint32_t i = node.positionOffset + (index - node.firstStar);
+    if (node.step == 0.0f)
+        return m_exactPositions[i];
+
+    return node.center + Eigen::Vector3f(static_cast<float>(m_x[i]),
+                                         static_cast<float>(m_y[i]),
+                                         static_cast<float>(m_z[i])) * node.step;
+}
+
+
+float
+CompactStarStore::extinction(std::uint32_t index) const
+{
+    auto it = std::lower_bound(m_extinctionStars.begin(), m_extinctionStars.end(), index);
+    if (it == m_extinctionStars.end() || *it != index)
+        return 0.0f;
+    return m_extinctions[it - m_extinctionStars.begin()];
+}
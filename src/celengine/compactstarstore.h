@@ -0,0 +1,206 @@
+// compactstarstore.h
+//
+// Copyright (C) 2026-present, the Celestia Development Team
+//
+// Star catalog stored as separate compact arrays rather than Star objects.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <celengine/astroobj.h>
+#include <celengine/octree.h>
+
+class CompactStarStore;
+class Star;
+class StarDetails;
+
+namespace celestia::ephem
+{
+class Orbit;
+}
+
+// Reference to a star of a CompactStarStore, with the accessors of Star
+// that the store can answer from its arrays. It is only valid as long as
+// the store.
+class StarView
+{
+ public:
+    StarView(const CompactStarStore* store, std::uint32_t index, std::uint32_t node) :
+        m_store(store), m_index(index), m_node(node)
+    {}
+
+    // Position of the star in the octree order of the store
+    std::uint32_t getStoreIndex() const { return m_index; }
+
+    AstroCatalog::IndexNumber getIndex() const;
+    Eigen::Vector3f getPosition() const;
+    float getAbsoluteMagnitude() const;
+    float getApparentMagnitude(float ly) const;
+    float getExtinction() const;
+    StarDetails* getDetails() const;
+    celestia::ephem::Orbit* getOrbit() const;
+
+ private:
+    const CompactStarStore* m_store;
+    std::uint32_t m_index;
+    // Octree node holding the star
+    std::uint32_t m_node;
+};
+
+
+class CompactStarHandler
+{
+ public:
+    virtual ~CompactStarHandler() = default;
+
+    virtual void process(const StarView& star, float distance, float appMag) = 0;
+};
+
+
+// The stars of a star octree, sorted the same way, with each property in an
+// array of its own:
+//
+// - positions are kept as floats, or, if a position tolerance is given,
+//   quantized to 16 bits per coordinate relative to the center of the
+//   octree node holding the star in the nodes where that grid is fine
+//   enough;
+// - absolute magnitudes are stored in 1/256ths of a magnitude, like the
+//   binary star database;
+// - details are 16 bit indexes into a table of the distinct StarDetails;
+// - extinctions, which few stars have, are stored for those stars only.
+//
+// Visible star searches run over these arrays and pass StarView references
+// to the handler. Full Star objects, which stars need once they are
+// selected or rendered in detail, are created on demand by getStar().
+class CompactStarStore
+{
+ public:
+    // Default upper bound for the error of quantized positions, in light
+    // years. Positions are only stored exactly by default: the grid of a
+    // node is about 1/30000 of its size, which is coarser than the precision
+    // of the float positions for most nodes.
+    static constexpr float DefaultPositionTolerance = 0.0f;
+
+    struct StarRecord
+    {
+        AstroCatalog::IndexNumber catalogNumber;
+        Eigen::Vector3f position;
+        float absMag;
+        float extinction;
+        StarDetails* details;
+    };
+
+    // Build a store from octree nodes in depth first order, as produced by
+    // StaticOctree::flatten(), and the stars they refer to, given by
+    // getStar for each index. rootScale is the half size of the root node.
+    // Returns nullptr if the nodes don't describe a consistent tree, or if
+    // the stars have more distinct details than a 16 bit index can tell
+    // apart.
+    static std::unique_ptr<CompactStarStore> create(const std::vector<OctreeNodeRecord<float>>& nodes,
+                                                    float rootScale,
+                                                    std::uint32_t nStars,
+                                                    const std::function<StarRecord(std::uint32_t)>& getStar,
+                                                    float positionTolerance = DefaultPositionTolerance);
+
+    ~CompactStarStore();
+
+    CompactStarStore(const CompactStarStore&) = delete;
+    CompactStarStore& operator=(const CompactStarStore&) = delete;
+
+    std::uint32_t size() const { return static_cast<std::uint32_t>(m_catalogNumbers.size()); }
+    StarView getStarView(std::uint32_t index) const;
+
+    // Index of the star with the catalog number, or size() if there is none
+    std::uint32_t find(AstroCatalog::IndexNumber catalogNumber) const;
+
+    // The star as a full Star object, created on first use and kept for the
+    // lifetime of the store
+    Star* getStar(std::uint32_t index) const;
+
+    void findVisibleStars(CompactStarHandler& starHandler,
+                          const Eigen::Vector3f& obsPosition,
+                          const Eigen::Quaternionf& obsOrientation,
+                          float fovY,
+                          float aspectRatio,
+                          float limitingMag) const;
+
+    void findCloseStars(CompactStarHandler& starHandler,
+                        const Eigen::Vector3f& obsPosition,
+                        float radius) const;
+
+    // Bytes used by the arrays of the store, not counting the stars
+    // created by getStar()
+    std::size_t memoryUsage() const;
+
+ private:
+    friend class StarView;
+
+    struct Node
+    {
+        Eigen::Vector3f center;
+        // Half the size of the node's cell
+        float scale;
+        float exclusionFactor;
+        std::uint32_t firstStar;
+        std::uint32_t nStars;
+        // Index of the node following the subtree of this node
+        std::uint32_t next;
+        // Size of the quantization step of positions, or 0 if the positions
+        // of the node's stars are stored as floats
+        float step;
+        // Index of the position of the node's first star in the quantized
+        // or exact position arrays
+        std::uint32_t positionOffset;
+        bool hasExtinction;
+    };
+
+    CompactStarStore() = default;
+
+    bool processVisibleNode(const Node& node,
+                            CompactStarHandler& starHandler,
+                            const Eigen::Vector3f& obsPosition,
+                            const Eigen::Hyperplane<float, 3>* frustumPlanes,
+                            float limitingMag) const;
+
+    std::uint32_t nodeOf(std::uint32_t index) const;
+    Eigen::Vector3f position(const Node& node, std::uint32_t index) const;
+    float extinction(std::uint32_t index) const;
+
+    std::vector<Node> m_nodes;
+    // Node index of the nodes holding stars, by their first star, to find
+    // the node of a star
+    std::vector<std::uint32_t> m_starNodes;
+
+    // Positions of the stars of the quantized nodes, then of the others
+    std::vector<std::int16_t> m_x;
+    std::vector<std::int16_t> m_y;
+    std::vector<std::int16_t> m_z;
+    std::vector<Eigen::Vector3f> m_exactPositions;
+    std::vector<std::int16_t> m_absMags;
+    std::vector<std::uint16_t> m_detailsIndexes;
+    std::vector<StarDetails*> m_details;
+    std::vector<AstroCatalog::IndexNumber> m_catalogNumbers;
+    // Star indexes sorted by catalog number
+    std::vector<std::uint32_t> m_catalogIndex;
+    // Stars with a nonzero extinction, sorted, and their extinctions
+    std::vector<std::uint32_t> m_extinctionStars;
+    std::vector<float> m_extinctions;
+
+    mutable std::mutex m_starsMutex;
+    mutable std::map<std::uint32_t, std::unique_ptr<Star>> m_stars;
+};
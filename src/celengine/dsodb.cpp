@@ -22,6 +22,7 @@
 #include "parser.h"
 #include "dsodb.h"
 #include "dsoname.h"
+#include "octreecache.h"
 #include "nebula.h"
 #include "opencluster.h"
 #include "value.h"
@@ -136,7 +137,8 @@ void DSODatabase::findVisibleDSOs(DSOHandler& dsoHandler,
                                   float fovY,
                                   float aspectRatio,
                                   float limitingMag,
-                                  OctreeProcStats *stats) const
+                                  OctreeProcStats *stats,
+                                  celestia::util::ThreadPool* pool) const
 {
     // Compute the bounding planes of an infinite view frustum
     Eigen::Hyperplane<double, 3> frustumPlanes[5];
@@ -159,6 +161,18 @@ void DSODatabase::findVisibleDSOs(DSOHandler& dsoHandler,
         frustumPlanes[i]   = Eigen::Hyperplane<double, 3>(planeNormals[i], obsPos);
     }
 
+    if (pool != nullptr)
+    {
+        octreeRoot->processVisibleObjects(dsoHandler,
+                                          obsPos,
+                                          frustumPlanes,
+                                          limitingMag,
+                                          DSO_OCTREE_ROOT_SIZE,
+                                          *pool,
+                                          stats);
+        return;
+    }
+
     octreeRoot->processVisibleObjects(dsoHandler,
                                       obsPos,
                                       frustumPlanes,
@@ -191,10 +205,23 @@ void DSODatabase::setNameDatabase(DSONameDatabase* _namesDB)
 }
 
 
+void DSODatabase::setOctreeCacheFile(const fs::path& path)
+{
+    octreeCacheFile = path;
+}
+
+
 bool DSODatabase::load(std::istream& in, const fs::path& resourcePath)
 {
-    Tokenizer tokenizer(&in);
-    Parser    parser(&tokenizer);
+    ParsedCatalog catalog = ParsedCatalog::read(in);
+    return load(catalog, resourcePath);
+}
+
+
+bool DSODatabase::load(ParsedCatalog& catalog, const fs::path& resourcePath)
+{
+    Tokenizer tokenizer(catalog.getTokens());
+    Parser    parser(&tokenizer, &catalog);
 
 #ifdef ENABLE_NLS
     std::string s = resourcePath.string();
@@ -339,38 +366,96 @@ void DSODatabase::finish()
 
 void DSODatabase::buildOctree()
 {
-    GetLogger()->debug("Sorting DSOs into octree . . .\n");
-    float absMag             = astro::appToAbsMag(DSO_OCTREE_MAGNITUDE, DSO_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
+    DeepSkyObject** sortedDSOs    = new DeepSkyObject*[nDSOs];
 
-    // TODO: investigate using a different center--it's possible that more
-    // objects end up straddling the base level nodes when the center of the
-    // octree is at the origin.
-    DynamicDSOOctree* root   = new DynamicDSOOctree(Eigen::Vector3d::Zero(), absMag);
-    for (int i = 0; i < nDSOs; ++i)
+    std::uint64_t cacheKey = 0;
+    if (!octreeCacheFile.empty())
     {
-        root->insertObject(DSOs[i], DSO_OCTREE_ROOT_SIZE);
+        cacheKey = computeOctreeCacheKey();
+
+        std::vector<std::uint32_t> order;
+        std::vector<OctreeNodeRecord<double>> nodes;
+        if (LoadOctreeCache(octreeCacheFile, cacheKey, nDSOs, order, nodes))
+        {
+            for (int i = 0; i < nDSOs; ++i)
+                sortedDSOs[i] = DSOs[order[i]];
+
+            octreeRoot = DSOOctree::unflatten(nodes, sortedDSOs, nDSOs);
+            if (octreeRoot != nullptr)
+                GetLogger()->debug("Loaded DSO octree from cache {}\n", octreeCacheFile);
+        }
     }
 
-    GetLogger()->debug("Spatially sorting DSOs for improved locality of reference . . .\n");
-    DeepSkyObject** sortedDSOs    = new DeepSkyObject*[nDSOs];
-    DeepSkyObject** firstDSO      = sortedDSOs;
+    if (octreeRoot == nullptr)
+    {
+        GetLogger()->debug("Sorting DSOs into octree . . .\n");
+        float absMag             = astro::appToAbsMag(DSO_OCTREE_MAGNITUDE, DSO_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
+
+        // TODO: investigate using a different center--it's possible that more
+        // objects end up straddling the base level nodes when the center of the
+        // octree is at the origin.
+        DynamicDSOOctree* root   = new DynamicDSOOctree(Eigen::Vector3d::Zero(), absMag);
+        for (int i = 0; i < nDSOs; ++i)
+        {
+            root->insertObject(DSOs[i], DSO_OCTREE_ROOT_SIZE);
+        }
+
+        GetLogger()->debug("Spatially sorting DSOs for improved locality of reference . . .\n");
+        DeepSkyObject** firstDSO      = sortedDSOs;
+
+        // The spatial sorting part is useless for DSOs since we
+        // are storing pointers to objects and not the objects themselves:
+        std::vector<DeepSkyObject* const*> sources;
+        root->rebuildAndSort(octreeRoot, firstDSO, octreeCacheFile.empty() ? nullptr : &sources);
 
-    // The spatial sorting part is useless for DSOs since we
-    // are storing pointers to objects and not the objects themselves:
-    root->rebuildAndSort(octreeRoot, firstDSO);
+        GetLogger()->debug("{} DSOs total.\nOctree has {} nodes and {} DSOs.\n",
+                           static_cast<int>(firstDSO - sortedDSOs),
+                           1 + octreeRoot->countChildren(),
+                           octreeRoot->countObjects());
 
-    GetLogger()->debug("{} DSOs total.\nOctree has {} nodes and {} DSOs.\n",
-                       static_cast<int>(firstDSO - sortedDSOs),
-                       1 + octreeRoot->countChildren(),
-                       octreeRoot->countObjects());
+        delete   root;
+
+        if (!octreeCacheFile.empty())
+        {
+            std::vector<std::uint32_t> order;
+            order.reserve(sources.size());
+            for (DeepSkyObject* const* dso : sources)
+                order.push_back(static_cast<std::uint32_t>(dso - DSOs));
+
+            std::vector<OctreeNodeRecord<double>> nodes;
+            octreeRoot->flatten(nodes, sortedDSOs);
+            SaveOctreeCache(octreeCacheFile, cacheKey, order, nodes);
+        }
+    }
 
     // Clean up . . .
     delete[] DSOs;
-    delete   root;
 
     DSOs = sortedDSOs;
 }
 
+
+std::uint64_t DSODatabase::computeOctreeCacheKey() const
+{
+    OctreeCacheKey key;
+    key.add(DSO_OCTREE_ROOT_SIZE);
+    key.add(DSO_OCTREE_MAGNITUDE);
+    key.add(nDSOs);
+    for (int i = 0; i < nDSOs; ++i)
+    {
+        const DeepSkyObject* dso = DSOs[i];
+        Eigen::Vector3d position = dso->getPosition();
+        key.add(dso->getIndex());
+        key.add(position.x());
+        key.add(position.y());
+        key.add(position.z());
+        key.add(dso->getAbsoluteMagnitude());
+        key.add(dso->getBoundingSphereRadius());
+    }
+
+    return key.value();
+}
+
 void DSODatabase::calcAvgAbsMag()
 {
     uint32_t nDSOeff = size();
@@ -24,6 +24,7 @@
 #include <celengine/dsooctree.h>
 
 class DSONameDatabase;
+class ParsedCatalog;
 
 constexpr inline unsigned int MAX_DSO_NAMES = 10;
 
@@ -52,7 +53,8 @@ class DSODatabase
                          float fovY,
                          float aspectRatio,
                          float limitingMag,
-                         OctreeProcStats * = nullptr) const;
+                         OctreeProcStats * = nullptr,
+                         celestia::util::ThreadPool* pool = nullptr) const;
 
     void findCloseDSOs(DSOHandler& dsoHandler,
                        const Eigen::Vector3d& obsPosition,
@@ -64,7 +66,11 @@ class DSODatabase
     DSONameDatabase* getNameDatabase() const;
     void setNameDatabase(DSONameDatabase*);
 
+    // Reuse or save the sorted octree in this file when finishing loading
+    void setOctreeCacheFile(const fs::path&);
+
     bool load(std::istream&, const fs::path& resourcePath = fs::path());
+    bool load(ParsedCatalog&, const fs::path& resourcePath = fs::path());
     bool loadBinary(std::istream&);
     void finish();
 
@@ -76,6 +82,7 @@ private:
     void buildIndexes();
     void buildOctree();
     void calcAvgAbsMag();
+    std::uint64_t computeOctreeCacheKey() const;
 
     int              nDSOs{ 0 };
     int              capacity{ 0 };
@@ -86,6 +93,8 @@ private:
     AstroCatalog::IndexNumber nextAutoCatalogNumber{ 0xfffffffe };
 
     double           avgAbsMag{ 0.0 };
+
+    fs::path         octreeCacheFile;
 };
 
 
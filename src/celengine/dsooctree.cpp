@@ -67,20 +67,16 @@ template<> DynamicDSOOctree::ExclusionFactorDecayFunction*
 
 // total specialization of the StaticOctree template process*() methods for DSOs:
 template<>
-void DSOOctree::processVisibleObjects(DSOHandler&    processor,
-                                      const PointType& obsPosition,
-                                      const Hyperplane<double, 3>*  frustumPlanes,
-                                      float          limitingFactor,
-                                      double         scale,
-                                      OctreeProcStats *stats) const
+bool DSOOctree::processVisibleNode(DSOHandler&    processor,
+                                   const PointType& obsPosition,
+                                   const Hyperplane<double, 3>*  frustumPlanes,
+                                   float          limitingFactor,
+                                   double         scale,
+                                   OctreeProcStats *stats) const
 {
 #ifdef OCTREE_DEBUG
-    size_t h;
     if (stats != nullptr)
-    {
-        h = stats->height + 1;
         stats->nodes++;
-    }
 #endif
     // See if this node lies within the view frustum
 
@@ -92,7 +88,7 @@ void DSOOctree::processVisibleObjects(DSOHandler&    processor,
 
         double r = scale * plane.normal().cwiseAbs().sum();
         if (plane.signedDistance(cellCenterPos) < -r)
-            return;
+            return false;
     }
 
     // Compute the distance to node; this is equal to the distance to
@@ -108,7 +104,9 @@ void DSOOctree::processVisibleObjects(DSOHandler&    processor,
         if (stats != nullptr)
             stats->objects++;
 #endif
-        DeepSkyObject* _obj = _firstObject[i];
+        // The object is passed by reference to its slot in the sorted
+        // array, which outlives the traversal.
+        DeepSkyObject* const& _obj = _firstObject[i];
         float  absMag      = _obj->getAbsoluteMagnitude();
         if (absMag < dimmest)
         {
@@ -122,30 +120,7 @@ void DSOOctree::processVisibleObjects(DSOHandler&    processor,
 
     // See if any of the objects in child nodes are potentially included
     // that we need to recurse deeper.
-    if (minDistance <= 0.0 || astro::absToAppMag((double) exclusionFactor, minDistance) <= limitingFactor)
-    {
-        // Recurse into the child nodes
-        if (_children != nullptr)
-        {
-            for (int i = 0; i < 8; ++i)
-            {
-                _children[i]->processVisibleObjects(processor,
-                                                    obsPosition,
-                                                    frustumPlanes,
-                                                    limitingFactor,
-                                                    scale * 0.5f,
-                                                    stats);
-#ifdef OCTREE_DEBUG
-                if (stats != nullptr && stats->height > h)
-                    h = stats->height;
-#endif
-            }
-#ifdef OCTREE_DEBUG
-            if (stats != nullptr)
-                stats->height = h;
-#endif
-        }
-    }
+    return minDistance <= 0.0 || astro::absToAppMag((double) exclusionFactor, minDistance) <= limitingFactor;
 }
 
 
@@ -19,3 +19,7 @@
 using DynamicDSOOctree = DynamicOctree<DeepSkyObject*, double>;
 using DSOOctree = StaticOctree<DeepSkyObject*, double>;
 using DSOHandler = OctreeProcessor<DeepSkyObject*, double>;
+
+template<> bool DSOOctree::processVisibleNode(DSOHandler&, const Eigen::Vector3d&,
+                                              const Eigen::Hyperplane<double, 3>*,
+                                              float, double, OctreeProcStats*) const;
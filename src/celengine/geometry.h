@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 #include <Eigen/Geometry>
 
 #include <celmodel/material.h>
@@ -51,4 +53,12 @@ public:
     virtual void loadTextures()
     {
     }
+
+    /*! Return the approximate amount of memory used by the geometry
+     *  data in bytes, or 0 if unknown.
+     */
+    virtual std::size_t getMemoryUsage() const
+    {
+        return 0;
+    }
 };
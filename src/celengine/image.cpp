@@ -8,13 +8,19 @@
 // of the License, or (at your option) any later version.
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <vector>
 #include <celengine/glsupport.h>
 #include <celutil/logger.h>
 #include <celutil/filetype.h>
 #include <celutil/gettext.h>
+#include <celutil/threadpool.h>
 #include <celimage/imageformats.h>
 #include "image.h"
 
@@ -77,6 +83,273 @@ int calcMipLevelSize(PixelFormat fmt, int w, int h, int mip)
         return h * pad(w * formatComponents(fmt));
     }
 }
+
+// Rows of large images are processed in parallel, in tasks of at least
+// this many rows
+constexpr int MinRowsPerTask = 64;
+
+// Call process(begin, end) for ranges of rows covering [0, nRows), split
+// across the threads of the pool
+template<typename F>
+void forEachRowRange(int nRows, celestia::util::ThreadPool* pool, const F& process)
+{
+    if (pool == nullptr || pool->threadCount() == 0 || nRows < 2 * MinRowsPerTask)
+    {
+        process(0, nRows);
+        return;
+    }
+
+    int nTasks = static_cast<int>(pool->threadCount()) * 4;
+    int taskRows = max((nRows + nTasks - 1) / nTasks, MinRowsPerTask);
+    std::vector<std::future<void>> tasks;
+    for (int begin = 0; begin < nRows; begin += taskRows)
+    {
+        int end = min(begin + taskRows, nRows);
+        tasks.push_back(pool->submit([&process, begin, end]() { process(begin, end); }));
+    }
+    for (auto& task : tasks)
+        task.get();
+}
+
+// Compute a row of a normal map from two rows of heights; the normal at
+// column j is computed from the heights h0[j], h0[j - 1] and h1[j].
+void computeNormalRow(const float* h0, const float* h1, int width, float scale, uint8_t* normals)
+{
+    for (int j = 0; j < width; j++)
+    {
+        float dx = (h0[j - 1] - h0[j]) * (1.0f / 255.0f) * scale;
+        float dy = (h1[j] - h0[j]) * (1.0f / 255.0f) * scale;
+
+        float mag = std::sqrt(dx * dx + dy * dy + 1.0f);
+        float rmag = 1.0f / mag;
+
+        normals[j * 4]     = (uint8_t) (128 + 127 * dx * rmag);
+        normals[j * 4 + 1] = (uint8_t) (128 + 127 * dy * rmag);
+        normals[j * 4 + 2] = (uint8_t) (128 + 127 * rmag);
+        normals[j * 4 + 3] = 255;
+    }
+}
+
+// Separable filter for halving the size of an image: destination texel x
+// is the weighted sum of the source texels 2x + firstTap + k.
+struct DownsampleFilter
+{
+    int firstTap;
+    std::vector<float> weights;
+};
+
+// Modified Bessel function of the first kind of order zero
+double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++)
+    {
+        term *= (x * 0.5 / k) * (x * 0.5 / k);
+        sum += term;
+    }
+    return sum;
+}
+
+DownsampleFilter makeDownsampleFilter(Image::MipmapFilter filter)
+{
+    if (filter == Image::MipmapFilter::Box)
+        return { 0, { 0.5f, 0.5f } };
+
+    // Kaiser windowed sinc covering three source texels on either side
+    // of the destination texel center
+    constexpr int radius = 3;
+    constexpr double alpha = 4.0;
+    constexpr double pi = 3.14159265358979323846;
+
+    DownsampleFilter result{ 1 - radius, {} };
+    double sum = 0.0;
+    std::vector<double> weights;
+    for (int k = 0; k < 2 * radius; k++)
+    {
+        // Distance from the center in source texels
+        double d = k - radius + 0.5;
+        double x = pi * d * 0.5;
+        double sinc = std::sin(x) / x;
+        double window = besselI0(alpha * std::sqrt(1.0 - (d / radius) * (d / radius))) / besselI0(alpha);
+        weights.push_back(sinc * window);
+        sum += sinc * window;
+    }
+    for (double w : weights)
+        result.weights.push_back(static_cast<float>(w / sum));
+    return result;
+}
+
+float srgbToLinear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float linearToSrgb(float c)
+{
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// Conversion of the 8 bit channels of a texel to linear values in [0, 1]
+// and back. Color channels of sRGB images are decoded before filtering;
+// alpha is always linear.
+class ChannelCodec
+{
+ public:
+    ChannelCodec(PixelFormat format, int components, bool sRGB)
+    {
+        static const std::array<float, 256> linearDecode = []()
+        {
+            std::array<float, 256> table;
+            for (int i = 0; i < 256; i++)
+                table[i] = i / 255.0f;
+            return table;
+        }();
+        static const std::array<float, 256> srgbDecode = []()
+        {
+            std::array<float, 256> table;
+            for (int i = 0; i < 256; i++)
+                table[i] = srgbToLinear(i / 255.0f);
+            return table;
+        }();
+
+        int colorChannels = 0;
+        if (sRGB)
+        {
+            switch (format)
+            {
+            case PixelFormat::RGB:
+            case PixelFormat::BGR:
+            case PixelFormat::RGBA:
+            case PixelFormat::BGRA:
+                colorChannels = 3;
+                break;
+            case PixelFormat::LUMINANCE:
+            case PixelFormat::LUM_ALPHA:
+                colorChannels = 1;
+                break;
+            default:
+                break;
+            }
+        }
+
+        for (int c = 0; c < components; c++)
+        {
+            srgb[c] = c < colorChannels;
+            decode[c] = srgb[c] ? srgbDecode.data() : linearDecode.data();
+        }
+    }
+
+    float toLinear(int channel, uint8_t value) const
+    {
+        return decode[channel][value];
+    }
+
+    uint8_t fromLinear(int channel, float value) const
+    {
+        // Sharpening filters overshoot
+        value = std::clamp(value, 0.0f, 1.0f);
+        if (!srgb[channel])
+            return static_cast<uint8_t>(value * 255.0f + 0.5f);
+
+        static const std::vector<uint8_t> srgbEncode = []()
+        {
+            std::vector<uint8_t> table(SrgbEncodeSize);
+            for (int i = 0; i < SrgbEncodeSize; i++)
+                table[i] = static_cast<uint8_t>(linearToSrgb(static_cast<float>(i) / (SrgbEncodeSize - 1)) * 255.0f + 0.5f);
+            return table;
+        }();
+        return srgbEncode[static_cast<int>(value * (SrgbEncodeSize - 1) + 0.5f)];
+    }
+
+ private:
+    static constexpr int SrgbEncodeSize = 16384;
+
+    std::array<const float*, 4> decode{};
+    std::array<bool, 4> srgb{};
+};
+
+struct MipLevel
+{
+    uint8_t* pixels;
+    int width;
+    int height;
+    int pitch;
+};
+
+int sourceIndex(int i, int size, bool wrap)
+{
+    if (wrap)
+        return ((i % size) + size) % size;
+    return std::clamp(i, 0, size - 1);
+}
+
+// Compute the destination rows [begin, end) of a mip level from the next
+// larger level. Source rows are filtered horizontally into a ring of
+// buffers, so that each of them is only filtered once.
+void downsampleRows(const MipLevel& src, const MipLevel& dst,
+                    int components, const DownsampleFilter& filter,
+                    const ChannelCodec& codec, bool wrap,
+                    int begin, int end)
+{
+    int nTaps = static_cast<int>(filter.weights.size());
+    int dstRowSize = dst.width * components;
+
+    std::vector<int> columns(dst.width * nTaps);
+    for (int x = 0; x < dst.width; x++)
+    {
+        for (int k = 0; k < nTaps; k++)
+            columns[x * nTaps + k] = sourceIndex(2 * x + filter.firstTap + k, src.width, wrap) * components;
+    }
+
+    std::vector<float> decoded(src.width * components);
+    std::vector<float> rows(nTaps * dstRowSize);
+    std::vector<int> rowTags(nTaps, -nTaps - 1);
+    std::vector<float> sum(dstRowSize);
+
+    for (int y = begin; y < end; y++)
+    {
+        std::fill(sum.begin(), sum.end(), 0.0f);
+        for (int k = 0; k < nTaps; k++)
+        {
+            int u = 2 * y + filter.firstTap + k;
+            int slot = ((u % nTaps) + nTaps) % nTaps;
+            float* row = rows.data() + slot * dstRowSize;
+            if (rowTags[slot] != u)
+            {
+                const uint8_t* srcRow = src.pixels + sourceIndex(u, src.height, wrap) * src.pitch;
+                for (int x = 0; x < src.width; x++)
+                {
+                    for (int c = 0; c < components; c++)
+                        decoded[x * components + c] = codec.toLinear(c, srcRow[x * components + c]);
+                }
+
+                for (int x = 0; x < dst.width; x++)
+                {
+                    for (int c = 0; c < components; c++)
+                    {
+                        float value = 0.0f;
+                        for (int t = 0; t < nTaps; t++)
+                            value += filter.weights[t] * decoded[columns[x * nTaps + t] + c];
+                        row[x * components + c] = value;
+                    }
+                }
+                rowTags[slot] = u;
+            }
+
+            float weight = filter.weights[k];
+            for (int i = 0; i < dstRowSize; i++)
+                sum[i] += weight * row[i];
+        }
+
+        uint8_t* dstRow = dst.pixels + y * dst.pitch;
+        for (int x = 0; x < dst.width; x++)
+        {
+            for (int c = 0; c < components; c++)
+                dstRow[x * components + c] = codec.fromLinear(c, sum[x * components + c]);
+        }
+    }
+}
 } // anonymous namespace
 
 Image::Image(PixelFormat fmt, int w, int h, int mip) :
@@ -215,7 +488,7 @@ bool Image::hasAlpha() const
  * is the one only one used when generating normals.  This produces the
  * expected results for grayscale values in RGB images.
  */
-Image* Image::computeNormalMap(float scale, bool wrap) const
+Image* Image::computeNormalMap(float scale, bool wrap, celestia::util::ThreadPool* pool) const
 {
     // Can't do anything with compressed input; there are probably some other
     // formats that should be rejected as well . . .
@@ -227,15 +500,20 @@ Image* Image::computeNormalMap(float scale, bool wrap) const
     uint8_t* nmPixels = normalMap->getPixels();
     int nmPitch = normalMap->getPitch();
 
-    // Compute normals using differences between adjacent texels.
-    for (int i = 0; i < height; i++)
+    // Compute normals using differences between adjacent texels: the height
+    // to the left and the one above. Along the edges of a non-wrapping map,
+    // the differences of the next row or column are used instead.
+    forEachRowRange(height, pool, [&](int begin, int end)
     {
-        for (int j = 0; j < width; j++)
+        // The heights are copied to rows with an extra leading element
+        // holding the left neighbor of the first column, so that the loop
+        // over the columns has no special cases.
+        std::vector<float> h0(width + 1);
+        std::vector<float> h1(width + 1);
+        for (int i = begin; i < end; i++)
         {
             int i0 = i;
-            int j0 = j;
             int i1 = i - 1;
-            int j1 = j - 1;
             if (i1 < 0)
             {
                 if (wrap)
@@ -244,42 +522,74 @@ Image* Image::computeNormalMap(float scale, bool wrap) const
                 }
                 else
                 {
-                    i0++;
+                    i0 = min(i0 + 1, height - 1);
                     i1++;
                 }
             }
-            if (j1 < 0)
+
+            const uint8_t* row0 = pixels.get() + i0 * pitch;
+            const uint8_t* row1 = pixels.get() + i1 * pitch;
+            for (int j = 0; j < width; j++)
             {
-                if (wrap)
-                {
-                    j1 = width - 1;
-                }
-                else
-                {
-                    j0++;
-                    j1++;
-                }
+                h0[j + 1] = row0[j * components];
+                h1[j + 1] = row1[j * components];
+            }
+
+            uint8_t* nmRow = nmPixels + i * nmPitch;
+            if (wrap)
+            {
+                h0[0] = h0[width];
+                computeNormalRow(h0.data() + 1, h1.data() + 1, width, scale, nmRow);
+            }
+            else
+            {
+                // The first column uses the differences of the second one
+                h0[0] = h0[1];
+                if (width > 1)
+                    computeNormalRow(h0.data() + 1, h1.data() + 1, width, scale, nmRow);
+                computeNormalRow(h0.data() + min(2, width), h1.data() + min(2, width), 1, scale, nmRow);
             }
+        }
+    });
+
+    return normalMap;
+}
 
-            auto h00 = (int) pixels[i0 * pitch + j0 * components];
-            auto h10 = (int) pixels[i0 * pitch + j1 * components];
-            auto h01 = (int) pixels[i1 * pitch + j0 * components];
+/**
+ * Build a complete chain of mipmaps from the base level of an uncompressed
+ * image. Each level is filtered from the next larger one, in linear space
+ * for the color channels of sRGB images. Returns nullptr for compressed
+ * images.
+ */
+Image* Image::buildMipmaps(MipmapFilter filter, bool sRGB, bool wrap, celestia::util::ThreadPool* pool) const
+{
+    if (isCompressed())
+        return nullptr;
 
-            float dx = (float) (h10 - h00) * (1.0f / 255.0f) * scale;
-            float dy = (float) (h01 - h00) * (1.0f / 255.0f) * scale;
+    int levelCount = 1;
+    while ((max(width, height) >> levelCount) != 0)
+        levelCount++;
 
-            auto mag = (float) sqrt(dx * dx + dy * dy + 1.0f);
-            float rmag = 1.0f / mag;
+    auto* mipmaps = new Image(format, width, height, levelCount);
+    std::memcpy(mipmaps->getPixels(), pixels.get(), calcMipLevelSize(format, width, height, 0));
 
-            int n = i * nmPitch + j * 4;
-            nmPixels[n]     = (uint8_t) (128 + 127 * dx * rmag);
-            nmPixels[n + 1] = (uint8_t) (128 + 127 * dy * rmag);
-            nmPixels[n + 2] = (uint8_t) (128 + 127 * rmag);
-            nmPixels[n + 3] = 255;
-        }
+    DownsampleFilter downsampleFilter = makeDownsampleFilter(filter);
+    ChannelCodec codec(format, components, sRGB);
+    for (int mip = 1; mip < levelCount; mip++)
+    {
+        MipLevel src{ mipmaps->getMipLevel(mip - 1),
+                      max(width >> (mip - 1), 1), max(height >> (mip - 1), 1), 0 };
+        src.pitch = pad(src.width * components);
+        MipLevel dst{ mipmaps->getMipLevel(mip), max(width >> mip, 1), max(height >> mip, 1), 0 };
+        dst.pitch = pad(dst.width * components);
+
+        forEachRowRange(dst.height, pool, [&](int begin, int end)
+        {
+            downsampleRows(src, dst, components, downsampleFilter, codec, wrap, begin, end);
+        });
     }
 
-    return normalMap;
+    return mipmaps;
 }
 
 Image* LoadImageFromFile(const fs::path& filename)
@@ -316,3 +626,11 @@ Image* LoadImageFromFile(const fs::path& filename)
 
     return img;
 }
+
+celestia::util::ThreadPool* GetImageThreadPool()
+{
+    static celestia::util::ThreadPool pool(celestia::util::ThreadPool::defaultThreadCount() > 1
+                                           ? celestia::util::ThreadPool::defaultThreadCount()
+                                           : 0);
+    return &pool;
+}
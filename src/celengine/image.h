@@ -14,6 +14,11 @@
 #include <celcompat/filesystem.h>
 #include <celengine/pixelformat.h>
 
+namespace celestia::util
+{
+class ThreadPool;
+}
+
 // The image class supports multiple GL formats, including compressed ones.
 // Mipmaps may be stored within an image as well.  The mipmaps are stored in
 // one contiguous block of memory (i.e. there's not an instance of Image per
@@ -47,7 +52,17 @@ class Image
     bool isCompressed() const;
     bool hasAlpha() const;
 
-    Image* computeNormalMap(float scale, bool wrap) const;
+    Image* computeNormalMap(float scale, bool wrap,
+                            celestia::util::ThreadPool* pool = nullptr) const;
+
+    enum class MipmapFilter
+    {
+        Box,
+        Kaiser,
+    };
+
+    Image* buildMipmaps(MipmapFilter filter, bool sRGB, bool wrap,
+                        celestia::util::ThreadPool* pool = nullptr) const;
 
     enum
     {
@@ -67,3 +82,7 @@ class Image
 };
 
 Image* LoadImageFromFile(const fs::path& filename);
+
+// Worker threads for processing large images, separate from the texture
+// loading threads which wait for them
+celestia::util::ThreadPool* GetImageThreadPool();
@@ -208,6 +208,7 @@ void LODSphereMesh::render(unsigned int attributes,
             ((float) tex[i]->getWidth() / 2.0f);
         double l = log(pixelsPerTexel) / log(2.0);
 
+        tex[i]->setDesiredLOD((float) l);
         ri.texLOD[i] = max(min(tex[i]->getLODCount() - 1, (int) l), 0);
         if (tex[i]->getUTileCount(ri.texLOD[i]) > minSplit)
             minSplit = tex[i]->getUTileCount(ri.texLOD[i]);
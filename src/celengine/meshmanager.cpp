@@ -9,11 +9,16 @@
 // of the License, or (at your option) any later version.
 
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
 #include <utility>
 #include <vector>
 
@@ -26,9 +31,12 @@
 #include <celmodel/mesh.h>
 #include <celmodel/model.h>
 #include <celmodel/modelfile.h>
+#include <celutil/binaryread.h>
+#include <celutil/binarywrite.h>
 #include <celutil/filetype.h>
 #include <celutil/gettext.h>
 #include <celutil/logger.h>
+#include <celutil/mappedfile.h>
 #include <celutil/tokenizer.h>
 #include "meshmanager.h"
 #include "modelgeometry.h"
@@ -36,8 +44,11 @@
 #include "spheremesh.h"
 #include "texmanager.h"
 
+using namespace std::string_view_literals;
 using celestia::util::GetLogger;
 
+namespace celutil = celestia::util;
+
 namespace
 {
 
@@ -352,9 +363,156 @@ Convert3DSModel(const M3DScene& scene, const fs::path& texPath)
 
 constexpr const char UniqueSuffixChar = '!';
 
+constexpr inline std::string_view MODELCACHE_MAGIC = "CELMODLC"sv;
+constexpr inline std::uint16_t MODELCACHE_VERSION  = 0x0200;
+
+fs::path modelCacheDirectory;
+
+
+// Models converted from 3DS files or parsed from ASCII CMOD files are
+// cached; binary CMOD files load about as fast as the cache itself.
+bool
+IsCacheableModel(const fs::path& filename, ContentType fileType)
+{
+    if (fileType == Content_3DStudio)
+        return true;
+    if (fileType != Content_CelestiaModel)
+        return false;
+
+    constexpr std::string_view asciiHeader = "#celmodel__ascii"sv;
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    char header[asciiHeader.size()];
+    return in.read(header, sizeof(header)).good()
+        && std::string_view(header, sizeof(header)) == asciiHeader;
+}
+
+
+/*! A cache file holds a header identifying the source file and the model
+ *  options, followed by the processed model in binary CMOD format. The
+ *  size and modification time of the source are kept in the header, so
+ *  that a changed source replaces its stale cache file.
+ */
+struct ModelCacheEntry
+{
+    fs::path cacheFile;
+    std::string key;
+    std::uint64_t sourceSize{ 0 };
+    std::int64_t sourceTime{ 0 };
+};
+
+
+bool
+LoadCachedModelHeader(std::istream& in, const ModelCacheEntry& entry)
+{
+    char magic[MODELCACHE_MAGIC.size()];
+    if (!in.read(magic, sizeof(magic)).good()
+        || std::string_view(magic, sizeof(magic)) != MODELCACHE_MAGIC)
+    {
+        return false;
+    }
+
+    std::uint16_t version;
+    std::uint32_t keyLength;
+    if (!celutil::readLE<std::uint16_t>(in, version) || version != MODELCACHE_VERSION
+        || !celutil::readLE<std::uint32_t>(in, keyLength) || keyLength != entry.key.size())
+    {
+        return false;
+    }
+
+    std::string key(keyLength, '\0');
+    if (!in.read(key.data(), keyLength).good() || key != entry.key)
+        return false;
+
+    // The source size and time are only compared with values from the
+    // same machine, so they are stored in native byte order.
+    std::uint64_t sourceSize;
+    std::int64_t sourceTime;
+    return celutil::readNative<std::uint64_t>(in, sourceSize) && sourceSize == entry.sourceSize
+        && celutil::readNative<std::int64_t>(in, sourceTime) && sourceTime == entry.sourceTime;
+}
+
+
+std::unique_ptr<cmod::Model>
+LoadCachedModel(const ModelCacheEntry& entry, const fs::path& texPath)
+{
+    std::ifstream in(entry.cacheFile, std::ios::in | std::ios::binary);
+    if (!in.good() || !LoadCachedModelHeader(in, entry))
+        return nullptr;
+
+    return cmod::LoadModel(
+        in,
+        [&](const fs::path& name)
+        {
+            return GetTextureManager()->getHandle(TextureInfo(name, texPath, TextureInfo::WrapTexture));
+        });
+}
+
+
+void
+SaveCachedModel(const ModelCacheEntry& entry, const cmod::Model& model)
+{
+    std::error_code ec;
+    fs::create_directories(entry.cacheFile.parent_path(), ec);
+    if (ec)
+    {
+        GetLogger()->warn("Failed to create directory for model cache {}\n", entry.cacheFile);
+        return;
+    }
+
+    // Write to a temporary file first so that an interrupted write never
+    // leaves a truncated cache behind.
+    fs::path tmpPath = entry.cacheFile;
+    tmpPath += ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.good())
+        {
+            GetLogger()->warn("Failed to write model cache {}\n", entry.cacheFile);
+            return;
+        }
+
+        out.write(MODELCACHE_MAGIC.data(), MODELCACHE_MAGIC.size());
+        celutil::writeLE<std::uint16_t>(out, MODELCACHE_VERSION);
+        celutil::writeLE<std::uint32_t>(out, static_cast<std::uint32_t>(entry.key.size()));
+        out.write(entry.key.data(), entry.key.size());
+        celutil::writeNative<std::uint64_t>(out, entry.sourceSize);
+        celutil::writeNative<std::int64_t>(out, entry.sourceTime);
+
+        bool saved = cmod::SaveModelAlignedBinary(
+            &model, out,
+            [](ResourceHandle handle)
+            {
+                const TextureInfo* info = GetTextureManager()->getResourceInfo(handle);
+                return info == nullptr ? fs::path() : info->source;
+            });
+
+        if (!saved || !out.good())
+        {
+            out.close();
+            fs::remove(tmpPath, ec);
+            GetLogger()->warn("Failed to write model cache {}\n", entry.cacheFile);
+            return;
+        }
+    }
+
+    fs::rename(tmpPath, entry.cacheFile, ec);
+    if (ec)
+    {
+        fs::remove(tmpPath, ec);
+        GetLogger()->warn("Failed to write model cache {}\n", entry.cacheFile);
+    }
+}
+
 } // end unnamed namespace
 
 
+void
+SetModelCacheDirectory(const fs::path& dir)
+{
+    modelCacheDirectory = dir;
+}
+
+
 GeometryManager*
 GetGeometryManager()
 {
@@ -399,15 +557,41 @@ GeometryInfo::load(const fs::path& resolvedFilename)
     std::unique_ptr<cmod::Model> model = nullptr;
     ContentType fileType = DetermineFileType(filename);
 
+    // Textures of 3DS models are only looked up in the add-on directory
+    // when the model itself was found there.
+    fs::path texPath = fileType != Content_3DStudio || resolvedToPath ? path : fs::path();
+
+    ModelCacheEntry cacheEntry;
+    if (!modelCacheDirectory.empty() && IsCacheableModel(filename, fileType))
+    {
+        std::error_code ec;
+        cacheEntry.sourceSize = fs::file_size(filename, ec);
+        if (!ec)
+            cacheEntry.sourceTime = fs::last_write_time(filename, ec).time_since_epoch().count();
+        if (!ec)
+        {
+            cacheEntry.key = fmt::format("{}\n{}\n{},{},{},{},{}", filename.string(), texPath.string(),
+                                         center.x(), center.y(), center.z(),
+                                         scale, static_cast<int>(isNormalized));
+            cacheEntry.cacheFile = modelCacheDirectory / fmt::format("{:x}.cmod", std::hash<std::string>()(cacheEntry.key));
+            model = LoadCachedModel(cacheEntry, texPath);
+        }
+
+        // The cached model has already been conditioned for rendering
+        if (model != nullptr)
+        {
+            GetLogger()->debug("Loaded model {} from cache {}\n", filename, cacheEntry.cacheFile);
+            model->determineOpacity();
+            return new ModelGeometry(std::move(model));
+        }
+    }
+
     if (fileType == Content_3DStudio)
     {
         std::unique_ptr<M3DScene> scene = Read3DSFile(filename);
         if (scene != nullptr)
         {
-            if (resolvedToPath)
-                model = Convert3DSModel(*scene, path);
-            else
-                model = Convert3DSModel(*scene, "");
+            model = Convert3DSModel(*scene, texPath);
 
             if (isNormalized)
                 model->normalize(center);
@@ -417,22 +601,28 @@ GeometryInfo::load(const fs::path& resolvedFilename)
     }
     else if (fileType == Content_CelestiaModel)
     {
-        std::ifstream in(filename, std::ios::binary);
-        if (in.good())
+        auto getHandle = [&](const fs::path& name)
         {
-            model = cmod::LoadModel(
-                in,
-                [&](const fs::path& name)
-                {
-                    return GetTextureManager()->getHandle(TextureInfo(name, path, TextureInfo::WrapTexture));
-                });
-            if (model != nullptr)
-            {
-                if (isNormalized)
-                    model->normalize(center);
-                else
-                    model->transform(center, scale);
-            }
+            return GetTextureManager()->getHandle(TextureInfo(name, texPath, TextureInfo::WrapTexture));
+        };
+
+        // Read the model straight from a mapping of the file, falling back
+        // to stream I/O if it can't be mapped
+        if (celutil::MappedFile file; file.open(filename))
+        {
+            model = cmod::LoadModel(file.data(), file.size(), getHandle);
+        }
+        else if (std::ifstream in(filename, std::ios::binary); in.good())
+        {
+            model = cmod::LoadModel(in, getHandle);
+        }
+
+        if (model != nullptr)
+        {
+            if (isNormalized)
+                model->normalize(center);
+            else
+                model->transform(center, scale);
         }
     }
     else if (fileType == Content_CelestiaMesh)
@@ -473,6 +663,9 @@ GeometryInfo::load(const fs::path& resolvedFilename)
                         originalMaterialCount,
                         model->getMaterialCount());
 
+        if (!cacheEntry.cacheFile.empty())
+            SaveCachedModel(cacheEntry, *model);
+
         return new ModelGeometry(std::move(model));
     }
     else
@@ -481,3 +674,10 @@ GeometryInfo::load(const fs::path& resolvedFilename)
         return nullptr;
     }
 }
+
+
+std::size_t
+GeometryInfo::getMemoryUsage() const
+{
+    return resource == nullptr ? 0 : resource->getMemoryUsage();
+}
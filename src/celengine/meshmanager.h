@@ -51,6 +51,7 @@ class GeometryInfo : public ResourceInfo<Geometry>
 
     virtual fs::path resolve(const fs::path&);
     virtual Geometry* load(const fs::path&);
+    std::size_t getMemoryUsage() const override;
 };
 
 inline bool operator<(const GeometryInfo& g0, const GeometryInfo& g1)
@@ -74,3 +75,8 @@ inline bool operator<(const GeometryInfo& g0, const GeometryInfo& g1)
 typedef ResourceManager<GeometryInfo> GeometryManager;
 
 extern GeometryManager* GetGeometryManager();
+
+// Set the directory where models converted from 3DS and ASCII CMOD files
+// are cached, so that later loads skip the conversion. An empty path
+// disables the cache.
+extern void SetModelCacheDirectory(const fs::path& dir);
@@ -8,6 +8,7 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <cstddef>
 #include <vector>
 #include <utility>
 
@@ -191,3 +192,21 @@ ModelGeometry::loadTextures()
     }
 #endif
 }
+
+
+// The size of the vertex and index data of the model
+std::size_t
+ModelGeometry::getMemoryUsage() const
+{
+    std::size_t size = 0;
+    for (unsigned int i = 0; i < m_model->getMeshCount(); ++i)
+    {
+        const cmod::Mesh* mesh = m_model->getMesh(i);
+        size += static_cast<std::size_t>(mesh->getVertexCount()) *
+                mesh->getVertexStrideWords() * sizeof(cmod::VWord);
+        for (unsigned int j = 0; j < mesh->getGroupCount(); ++j)
+            size += mesh->getGroup(j)->indices.size() * sizeof(cmod::Index32);
+    }
+
+    return size;
+}
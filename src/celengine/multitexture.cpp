@@ -90,6 +90,21 @@ Texture* MultiResTexture::find(unsigned int resolution)
         break;
     }
 
+    // If the preferred resolution is still being loaded in the background,
+    // stand in with another resolution which has already been loaded, if
+    // any; the caller renders without the texture otherwise.
+    const TextureInfo* info = texMan->getResourceInfo(tex[resolution]);
+    if (info != nullptr && info->state == ResourceLoading)
+    {
+        for (unsigned int fallback : { secondChoice, lastResort })
+        {
+            info = texMan->getResourceInfo(tex[fallback]);
+            if (info != nullptr && info->state == ResourceLoaded)
+                return info->resource;
+        }
+        return nullptr;
+    }
+
     tex[resolution] = tex[secondChoice];
     res = texMan->find(tex[resolution]);
     if (res != nullptr)
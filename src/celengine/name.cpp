@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <utility>
+
 #ifdef DEBUG
 #include <celutil/logger.h>
 #endif
@@ -29,6 +32,9 @@ void NameDatabase::add(const AstroCatalog::IndexNumber catalogNumber, const std:
         if (lname != fname)
             localizedNameIndex[lname] = catalogNumber;
         numberIndex.insert(NumberIndex::value_type(catalogNumber, fname));
+
+        std::scoped_lock lock(completionMutex);
+        completionIndexValid = false;
     }
 }
 void NameDatabase::erase(const AstroCatalog::IndexNumber catalogNumber)
@@ -103,23 +109,80 @@ NameDatabase::NumberIndex::const_iterator NameDatabase::getFinalNameIter() const
 
 std::vector<std::string> NameDatabase::getCompletion(const std::string& name, bool i18n) const
 {
-    std::string name2 = ReplaceGreekLetter(name);
+    std::string query = ReplaceGreekLetter(name);
+    std::string prefix;
+    UTF8FoldCase(query, prefix);
 
-    std::vector<std::string> completion;
-    const int name_length = UTF8Length(name2);
-
-    for (const auto &[n, _] : nameIndex)
+    std::scoped_lock lock(completionMutex);
+    if (!completionIndexValid)
     {
-        if (!UTF8StringCompare(n, name2, name_length, true))
-            completion.push_back(n);
+        buildCompletionIndex(nameIndex, completionIndex);
+        buildCompletionIndex(localizedNameIndex, localizedCompletionIndex);
+        completionIndexValid = true;
     }
+
+    std::vector<const std::string*> matches;
+    findCompletion(completionIndex, prefix, matches);
     if (i18n)
+        findCompletion(localizedCompletionIndex, prefix, matches);
+
+    // Rank the names which start with the query as typed first, then the
+    // shorter names, which are the closer matches; names of the same rank
+    // stay in case folded order.
+    auto rank = [&query](const std::string* n)
     {
-        for (const auto &[n, _] : localizedNameIndex)
-        {
-            if (!UTF8StringCompare(n, name2, name_length, true))
-                completion.push_back(n);
-        }
-    }
+        return std::make_pair(n->compare(0, query.size(), query) != 0, n->size());
+    };
+    std::stable_sort(matches.begin(), matches.end(),
+                     [&rank](const std::string* a, const std::string* b) { return rank(a) < rank(b); });
+
+    std::vector<std::string> completion;
+    completion.reserve(matches.size());
+    for (const std::string* n : matches)
+        completion.push_back(*n);
     return completion;
 }
+
+void NameDatabase::buildCompletionIndex(const NameIndex& names, CompletionIndex& index) const
+{
+    // The names are folded once for sorting, only the pointers to the map
+    // keys are kept.
+    std::vector<std::pair<std::string, const std::string*>> folded;
+    folded.reserve(names.size());
+    for (const auto &[n, _] : names)
+    {
+        UTF8FoldCase(n, folded.emplace_back(std::string(), &n).first);
+    }
+
+    std::sort(folded.begin(), folded.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first || (a.first == b.first && *a.second < *b.second); });
+
+    index.clear();
+    index.shrink_to_fit();
+    index.reserve(folded.size());
+    for (const auto& entry : folded)
+        index.push_back(entry.second);
+}
+
+// Append the names of the index which start with the case folded prefix.
+void NameDatabase::findCompletion(const CompletionIndex& index,
+                                  const std::string& prefix,
+                                  std::vector<const std::string*>& completion)
+{
+    // Only the first prefix.size() bytes of a name's folded form are
+    // compared, which splits the index into names before, starting with
+    // and after the prefix.
+    std::string folded;
+    auto compare = [&prefix, &folded](const std::string* n)
+    {
+        folded.clear();
+        UTF8FoldCase(*n, folded, prefix.size());
+        return folded.compare(0, prefix.size(), prefix);
+    };
+
+    auto first = std::partition_point(index.begin(), index.end(),
+                                      [&compare](const std::string* n) { return compare(n) < 0; });
+    auto last = std::partition_point(first, index.end(),
+                                     [&compare](const std::string* n) { return compare(n) == 0; });
+    completion.insert(completion.end(), first, last);
+}
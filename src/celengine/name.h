@@ -14,7 +14,9 @@
 
 #include <cstdint>
 #include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <celengine/astroobj.h>
 #include <celutil/stringutils.h>
@@ -28,7 +30,7 @@ class NameDatabase
     using NumberIndex = std::multimap<AstroCatalog::IndexNumber, std::string>;
 
  public:
-    NameDatabase() {};
+    NameDatabase() = default;
 
 
     std::uint32_t getNameCount() const;
@@ -44,11 +46,26 @@ class NameDatabase
     NumberIndex::const_iterator getFirstNameIter(const AstroCatalog::IndexNumber catalogNumber) const;
     NumberIndex::const_iterator getFinalNameIter() const;
 
+    // Names starting with name, ignoring case, best matches first
     std::vector<std::string> getCompletion(const std::string& name, bool i18n) const;
 
  protected:
     NameIndex   nameIndex;
     NameIndex   localizedNameIndex;
     NumberIndex numberIndex;
+
+ private:
+    using CompletionIndex = std::vector<const std::string*>;
+
+    void buildCompletionIndex(const NameIndex&, CompletionIndex&) const;
+    static void findCompletion(const CompletionIndex&, const std::string&, std::vector<const std::string*>&);
+
+    // The names of nameIndex and localizedNameIndex sorted by their case
+    // folded form, so that the names starting with a prefix are adjacent.
+    // They're built by the first completion after names were added.
+    mutable CompletionIndex completionIndex;
+    mutable CompletionIndex localizedCompletionIndex;
+    mutable bool completionIndexValid{ false };
+    mutable std::mutex completionMutex;
 };
 
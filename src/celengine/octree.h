@@ -13,10 +13,15 @@
 #ifndef _CELENGINE_OCTREE_H_
 #define _CELENGINE_OCTREE_H_
 
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <vector>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 #include <celengine/observer.h>
-#include <vector>
+#include <celutil/threadpool.h>
 
 // The DynamicOctree and StaticOctree template arguments are:
 // OBJ:  object hanging from the node,
@@ -42,6 +47,35 @@ template <class OBJ, class PREC> class OctreeProcessor
 };
 
 
+// Processor which records the objects passed to it, so that they can be
+// handed to another processor later, in the same order. The objects must
+// stay in place until then.
+template <class OBJ, class PREC> class OctreeCollector : public OctreeProcessor<OBJ, PREC>
+{
+ public:
+    void process(const OBJ& obj, PREC distance, float appMag) override
+    {
+        objects.push_back({ &obj, distance, appMag });
+    }
+
+    void replay(OctreeProcessor<OBJ, PREC>& processor) const
+    {
+        for (const auto& entry : objects)
+            processor.process(*entry.obj, entry.distance, entry.appMag);
+    }
+
+ private:
+    struct Entry
+    {
+        const OBJ* obj;
+        PREC       distance;
+        float      appMag;
+    };
+
+    std::vector<Entry> objects;
+};
+
+
 
 struct OctreeLevelStatistics
 {
@@ -51,6 +85,26 @@ struct OctreeLevelStatistics
 };
 
 
+// Flattened representation of a StaticOctree node, used to save and restore
+// prebuilt octrees. Nodes are listed in depth first order, which is also the
+// order of the spatially sorted object array: a node with children is
+// immediately followed by the subtrees of its eight children.
+template <class PREC> struct OctreeNodeRecord
+{
+    Eigen::Matrix<PREC, 3, 1> cellCenterPos;
+    float                     exclusionFactor;
+    unsigned int              firstObject;
+    unsigned int              nObjects;
+    bool                      hasChildren;
+};
+
+
+// Copy of the object properties used for culling, laid out for testing
+// several objects at once. Only defined for the object types whose
+// StaticOctree specialization makes use of it.
+template <class OBJ, class PREC> struct OctreeCullingTable;
+
+
 template <class OBJ, class PREC> class StaticOctree;
 template <class OBJ, class PREC> class DynamicOctree
 {
@@ -71,7 +125,9 @@ private:
     ~DynamicOctree();
 
     void insertObject  (const OBJ&, const PREC);
-    void rebuildAndSort(StaticOctree<OBJ, PREC>*&, OBJ*&);
+    // If sources is not null, the address of each inserted object is
+    // appended to it in sorted order.
+    void rebuildAndSort(StaticOctree<OBJ, PREC>*&, OBJ*&, std::vector<const OBJ*>* sources = nullptr);
 
  private:
    static unsigned int SPLIT_THRESHOLD;
@@ -137,6 +193,37 @@ template <class OBJ, class PREC> class StaticOctree
                                PREC                              scale,
                                OctreeProcStats * = nullptr) const;
 
+    // Same as above, but the objects of each node are first filtered using
+    // table, which must have been built from the objects of this octree.
+    void processVisibleObjects(OctreeProcessor<OBJ, PREC>&       processor,
+                               const OctreeCullingTable<OBJ, PREC>& table,
+                               const PointType&                  obsPosition,
+                               const Eigen::Hyperplane<PREC, 3>* frustumPlanes,
+                               float                             limitingFactor,
+                               PREC                              scale,
+                               OctreeProcStats * = nullptr) const;
+
+    // Parallel versions of the above: the subtrees below the top levels of
+    // the octree are traversed by the threads of pool, and the objects they
+    // find are passed to processor on the calling thread afterwards, in
+    // the same order as by the sequential traversal.
+    void processVisibleObjects(OctreeProcessor<OBJ, PREC>&       processor,
+                               const PointType&                  obsPosition,
+                               const Eigen::Hyperplane<PREC, 3>* frustumPlanes,
+                               float                             limitingFactor,
+                               PREC                              scale,
+                               celestia::util::ThreadPool&       pool,
+                               OctreeProcStats * = nullptr) const;
+
+    void processVisibleObjects(OctreeProcessor<OBJ, PREC>&       processor,
+                               const OctreeCullingTable<OBJ, PREC>& table,
+                               const PointType&                  obsPosition,
+                               const Eigen::Hyperplane<PREC, 3>* frustumPlanes,
+                               float                             limitingFactor,
+                               PREC                              scale,
+                               celestia::util::ThreadPool&       pool,
+                               OctreeProcStats * = nullptr) const;
+
     void processCloseObjects(OctreeProcessor<OBJ, PREC>&        processor,
                              const PointType&                   obsPosition,
                              PREC                               boundingRadius,
@@ -147,9 +234,74 @@ template <class OBJ, class PREC> class StaticOctree
 
     void computeStatistics(std::vector<OctreeLevelStatistics>& stats, unsigned int level = 0);
 
+    // Append this node and its descendants to nodes in depth first order;
+    // object ranges are stored as offsets from firstObject.
+    void flatten(std::vector<OctreeNodeRecord<PREC>>& nodes, const OBJ* firstObject) const;
+
+    // Rebuild an octree from records produced by flatten(), with the object
+    // ranges referring to the array objects of nObjects entries. Returns
+    // nullptr if the records do not describe a consistent tree.
+    static StaticOctree* unflatten(const std::vector<OctreeNodeRecord<PREC>>& nodes,
+                                   OBJ* objects,
+                                   unsigned int nObjects);
+
  private:
+    static StaticOctree* unflatten(const std::vector<OctreeNodeRecord<PREC>>& nodes,
+                                   std::size_t& nodeIndex,
+                                   OBJ* objects,
+                                   unsigned int& nextObject,
+                                   unsigned int nObjects);
+
+    // Pass the potentially visible objects of this node, but not of its
+    // children, to processor. Returns false if none of the objects in the
+    // child nodes can be visible. Implemented as specializations.
+    bool processVisibleNode(OctreeProcessor<OBJ, PREC>&       processor,
+                            const PointType&                  obsPosition,
+                            const Eigen::Hyperplane<PREC, 3>* frustumPlanes,
+                            float                             limitingFactor,
+                            PREC                              scale,
+                            OctreeProcStats                   *stats) const;
+
+    bool processVisibleNode(OctreeProcessor<OBJ, PREC>&       processor,
+                            const OctreeCullingTable<OBJ, PREC>& table,
+                            const PointType&                  obsPosition,
+                            const Eigen::Hyperplane<PREC, 3>* frustumPlanes,
+                            float                             limitingFactor,
+                            PREC                              scale,
+                            OctreeProcStats                   *stats) const;
+
+    // Depth first traversal calling processNode(node, processor, scale,
+    // stats) for each node, which returns whether to visit the children.
+    template <class NodeFunc>
+    void processVisibleTree(OctreeProcessor<OBJ, PREC>& processor,
+                            const NodeFunc&             processNode,
+                            PREC                        scale,
+                            OctreeProcStats             *stats) const;
+
+    template <class NodeFunc>
+    void processVisibleTree(OctreeProcessor<OBJ, PREC>& processor,
+                            const NodeFunc&             processNode,
+                            PREC                        scale,
+                            celestia::util::ThreadPool& pool,
+                            OctreeProcStats             *stats) const;
+
+    struct TraversalSegment;
+
+    template <class NodeFunc>
+    void splitVisibleTree(const NodeFunc&              processNode,
+                          PREC                         scale,
+                          unsigned int                 depth,
+                          celestia::util::ThreadPool&  pool,
+                          std::deque<TraversalSegment>& segments,
+                          std::vector<std::future<void>>& tasks) const;
+
     static const PREC SQRT3;
 
+    // Depth of the nodes whose subtrees are traversed as separate tasks by
+    // the parallel traversal; the nodes above them are handled by the
+    // calling thread.
+    static constexpr unsigned int PARALLEL_SPLIT_DEPTH = 2;
+
  private:
     StaticOctree** _children;
     Eigen::Matrix<PREC, 3, 1>   cellCenterPos;
@@ -304,7 +456,7 @@ inline void DynamicOctree<OBJ, PREC>::sortIntoChildNodes()
 
 
 template <class OBJ, class PREC>
-inline void DynamicOctree<OBJ, PREC>::rebuildAndSort(StaticOctree<OBJ, PREC>*& _staticNode, OBJ*& _sortedObjects)
+inline void DynamicOctree<OBJ, PREC>::rebuildAndSort(StaticOctree<OBJ, PREC>*& _staticNode, OBJ*& _sortedObjects, std::vector<const OBJ*>* sources)
 {
     OBJ* _firstObject = _sortedObjects;
 
@@ -312,6 +464,8 @@ inline void DynamicOctree<OBJ, PREC>::rebuildAndSort(StaticOctree<OBJ, PREC>*& _
         for (typename ObjectList::const_iterator iter = _objects->begin(); iter != _objects->end(); ++iter)
         {
             *_sortedObjects++ = **iter;
+            if (sources != nullptr)
+                sources->push_back(*iter);
         }
 
     unsigned int nObjects  = (unsigned int) (_sortedObjects - _firstObject);
@@ -322,7 +476,7 @@ inline void DynamicOctree<OBJ, PREC>::rebuildAndSort(StaticOctree<OBJ, PREC>*& _
         _staticNode->_children    = new StaticOctree<OBJ, PREC>*[8];
 
         for (int i=0; i<8; ++i)
-            _children[i]->rebuildAndSort(_staticNode->_children[i], _sortedObjects);
+            _children[i]->rebuildAndSort(_staticNode->_children[i], _sortedObjects, sources);
     }
 }
 
@@ -384,6 +538,216 @@ inline int StaticOctree<OBJ, PREC>::countObjects() const
 }
 
 
+template <class OBJ, class PREC>
+void StaticOctree<OBJ, PREC>::processVisibleObjects(OctreeProcessor<OBJ, PREC>&       processor,
+                                                    const PointType&                  obsPosition,
+                                                    const Eigen::Hyperplane<PREC, 3>* frustumPlanes,
+                                                    float                             limitingFactor,
+                                                    PREC                              scale,
+                                                    OctreeProcStats                   *stats) const
+{
+    processVisibleTree(processor,
+                       [&](const StaticOctree& node, OctreeProcessor<OBJ, PREC>& nodeProcessor,
+                           PREC nodeScale, OctreeProcStats* nodeStats)
+                       {
+                           return node.processVisibleNode(nodeProcessor, obsPosition, frustumPlanes,
+                                                          limitingFactor, nodeScale, nodeStats);
+                       },
+                       scale,
+                       stats);
+}
+
+
+template <class OBJ, class PREC>
+void StaticOctree<OBJ, PREC>::processVisibleObjects(OctreeProcessor<OBJ, PREC>&          processor,
+                                                    const OctreeCullingTable<OBJ, PREC>& table,
+                                                    const PointType&                     obsPosition,
+                                                    const Eigen::Hyperplane<PREC, 3>*    frustumPlanes,
+                                                    float                                limitingFactor,
+                                                    PREC                                 scale,
+                                                    OctreeProcStats                      *stats) const
+{
+    processVisibleTree(processor,
+                       [&](const StaticOctree& node, OctreeProcessor<OBJ, PREC>& nodeProcessor,
+                           PREC nodeScale, OctreeProcStats* nodeStats)
+                       {
+                           return node.processVisibleNode(nodeProcessor, table, obsPosition, frustumPlanes,
+                                                          limitingFactor, nodeScale, nodeStats);
+                       },
+                       scale,
+                       stats);
+}
+
+
+template <class OBJ, class PREC>
+void StaticOctree<OBJ, PREC>::processVisibleObjects(OctreeProcessor<OBJ, PREC>&       processor,
+                                                    const PointType&                  obsPosition,
+                                                    const Eigen::Hyperplane<PREC, 3>* frustumPlanes,
+                                                    float                             limitingFactor,
+                                                    PREC                              scale,
+                                                    celestia::util::ThreadPool&       pool,
+                                                    OctreeProcStats                   *stats) const
+{
+    processVisibleTree(processor,
+                       [&](const StaticOctree& node, OctreeProcessor<OBJ, PREC>& nodeProcessor,
+                           PREC nodeScale, OctreeProcStats* nodeStats)
+                       {
+                           return node.processVisibleNode(nodeProcessor, obsPosition, frustumPlanes,
+                                                          limitingFactor, nodeScale, nodeStats);
+                       },
+                       scale,
+                       pool,
+                       stats);
+}
+
+
+template <class OBJ, class PREC>
+void StaticOctree<OBJ, PREC>::processVisibleObjects(OctreeProcessor<OBJ, PREC>&          processor,
+                                                    const OctreeCullingTable<OBJ, PREC>& table,
+                                                    const PointType&                     obsPosition,
+                                                    const Eigen::Hyperplane<PREC, 3>*    frustumPlanes,
+                                                    float                                limitingFactor,
+                                                    PREC                                 scale,
+                                                    celestia::util::ThreadPool&          pool,
+                                                    OctreeProcStats                      *stats) const
+{
+    processVisibleTree(processor,
+                       [&](const StaticOctree& node, OctreeProcessor<OBJ, PREC>& nodeProcessor,
+                           PREC nodeScale, OctreeProcStats* nodeStats)
+                       {
+                           return node.processVisibleNode(nodeProcessor, table, obsPosition, frustumPlanes,
+                                                          limitingFactor, nodeScale, nodeStats);
+                       },
+                       scale,
+                       pool,
+                       stats);
+}
+
+
+template <class OBJ, class PREC>
+template <class NodeFunc>
+void StaticOctree<OBJ, PREC>::processVisibleTree(OctreeProcessor<OBJ, PREC>& processor,
+                                                 const NodeFunc&             processNode,
+                                                 PREC                        scale,
+                                                 OctreeProcStats             *stats) const
+{
+#ifdef OCTREE_DEBUG
+    size_t h;
+    if (stats != nullptr)
+        h = stats->height + 1;
+#endif
+    if (!processNode(*this, processor, scale, stats))
+        return;
+
+    // Recurse into the child nodes
+    if (_children != nullptr)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            _children[i]->processVisibleTree(processor, processNode, scale * (PREC) 0.5, stats);
+#ifdef OCTREE_DEBUG
+            if (stats != nullptr && stats->height > h)
+                h = stats->height;
+#endif
+        }
+#ifdef OCTREE_DEBUG
+        if (stats != nullptr)
+            stats->height = h;
+#endif
+    }
+}
+
+
+// Objects found in a part of the octree by the parallel traversal. A
+// segment either holds the objects of consecutive nodes processed by the
+// calling thread, or those of a subtree processed as a separate task.
+template <class OBJ, class PREC>
+struct StaticOctree<OBJ, PREC>::TraversalSegment
+{
+    OctreeCollector<OBJ, PREC> objects;
+    OctreeProcStats            stats;
+    bool                       subtree{ false };
+};
+
+
+template <class OBJ, class PREC>
+template <class NodeFunc>
+void StaticOctree<OBJ, PREC>::processVisibleTree(OctreeProcessor<OBJ, PREC>& processor,
+                                                 const NodeFunc&             processNode,
+                                                 PREC                        scale,
+                                                 celestia::util::ThreadPool& pool,
+                                                 OctreeProcStats             *stats) const
+{
+    // Without worker threads the tasks would run one after the other
+    // anyway; skip collecting the objects.
+    if (pool.threadCount() == 0)
+    {
+        processVisibleTree(processor, processNode, scale, stats);
+        return;
+    }
+
+    // Segments are only ever appended, so a deque keeps the ones referred
+    // to by running tasks in place.
+    std::deque<TraversalSegment> segments;
+    std::vector<std::future<void>> tasks;
+    splitVisibleTree(processNode, scale, 0, pool, segments, tasks);
+
+    for (auto& task : tasks)
+        task.get();
+
+    for (const auto& segment : segments)
+    {
+        segment.objects.replay(processor);
+        if (stats != nullptr)
+        {
+            stats->nodes += segment.stats.nodes;
+            stats->objects += segment.stats.objects;
+            stats->height = std::max(stats->height,
+                                     segment.stats.height + (segment.subtree ? PARALLEL_SPLIT_DEPTH : 0));
+        }
+    }
+}
+
+
+template <class OBJ, class PREC>
+template <class NodeFunc>
+void StaticOctree<OBJ, PREC>::splitVisibleTree(const NodeFunc&                 processNode,
+                                               PREC                            scale,
+                                               unsigned int                    depth,
+                                               celestia::util::ThreadPool&     pool,
+                                               std::deque<TraversalSegment>&   segments,
+                                               std::vector<std::future<void>>& tasks) const
+{
+    if (segments.empty() || segments.back().subtree)
+        segments.emplace_back();
+
+    TraversalSegment& segment = segments.back();
+    if (!processNode(*this, segment.objects, scale, &segment.stats))
+        return;
+
+    if (_children == nullptr)
+        return;
+
+    PREC childScale = scale * (PREC) 0.5;
+    for (int i = 0; i < 8; ++i)
+    {
+        const StaticOctree* child = _children[i];
+        if (depth + 1 < PARALLEL_SPLIT_DEPTH)
+        {
+            child->splitVisibleTree(processNode, childScale, depth + 1, pool, segments, tasks);
+            continue;
+        }
+
+        TraversalSegment& subtree = segments.emplace_back();
+        subtree.subtree = true;
+        tasks.push_back(pool.submit([child, &processNode, childScale, &subtree]()
+        {
+            child->processVisibleTree(subtree.objects, processNode, childScale, &subtree.stats);
+        }));
+    }
+}
+
+
 template <class OBJ, class PREC>
 void StaticOctree<OBJ, PREC>::computeStatistics(std::vector<OctreeLevelStatistics>& stats, unsigned int level)
 {
@@ -411,4 +775,83 @@ void StaticOctree<OBJ, PREC>::computeStatistics(std::vector<OctreeLevelStatistic
 }
 
 
+template <class OBJ, class PREC>
+void StaticOctree<OBJ, PREC>::flatten(std::vector<OctreeNodeRecord<PREC>>& nodes, const OBJ* firstObject) const
+{
+    OctreeNodeRecord<PREC> node;
+    node.cellCenterPos   = cellCenterPos;
+    node.exclusionFactor = exclusionFactor;
+    node.firstObject     = (unsigned int) (_firstObject - firstObject);
+    node.nObjects        = nObjects;
+    node.hasChildren     = _children != nullptr;
+    nodes.push_back(node);
+
+    if (_children != nullptr)
+    {
+        for (int i = 0; i < 8; ++i)
+            _children[i]->flatten(nodes, firstObject);
+    }
+}
+
+
+template <class OBJ, class PREC>
+StaticOctree<OBJ, PREC>* StaticOctree<OBJ, PREC>::unflatten(const std::vector<OctreeNodeRecord<PREC>>& nodes,
+                                                            OBJ* objects,
+                                                            unsigned int nObjects)
+{
+    std::size_t nodeIndex = 0;
+    unsigned int nextObject = 0;
+    StaticOctree* root = unflatten(nodes, nodeIndex, objects, nextObject, nObjects);
+
+    // Every record and every object must be accounted for exactly once
+    if (root != nullptr && (nodeIndex != nodes.size() || nextObject != nObjects))
+    {
+        delete root;
+        return nullptr;
+    }
+
+    return root;
+}
+
+
+template <class OBJ, class PREC>
+StaticOctree<OBJ, PREC>* StaticOctree<OBJ, PREC>::unflatten(const std::vector<OctreeNodeRecord<PREC>>& nodes,
+                                                            std::size_t& nodeIndex,
+                                                            OBJ* objects,
+                                                            unsigned int& nextObject,
+                                                            unsigned int nObjects)
+{
+    if (nodeIndex >= nodes.size())
+        return nullptr;
+
+    const OctreeNodeRecord<PREC>& node = nodes[nodeIndex++];
+
+    // Objects are sorted in depth first order, so each node's range must
+    // start where the previous node's range ended.
+    if (node.firstObject != nextObject || node.nObjects > nObjects - nextObject)
+        return nullptr;
+    nextObject += node.nObjects;
+
+    auto* staticNode = new StaticOctree(node.cellCenterPos,
+                                        node.exclusionFactor,
+                                        objects + node.firstObject,
+                                        node.nObjects);
+    if (node.hasChildren)
+    {
+        staticNode->_children = new StaticOctree*[8]();
+        for (int i = 0; i < 8; ++i)
+        {
+            staticNode->_children[i] = unflatten(nodes, nodeIndex, objects, nextObject, nObjects);
+            if (staticNode->_children[i] == nullptr)
+            {
+                delete staticNode;
+                return nullptr;
+            }
+        }
+    }
+
+    return staticNode;
+}
+
+
 #endif // _OCTREE_H_
@@ -0,0 +1,260 @@
+// octreecache.cpp
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// Persistent cache of prebuilt octrees.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <cstddef>
+#include <fstream>
+#include <string_view>
+#include <system_error>
+
+#include <celutil/binarywrite.h>
+#include <celutil/bytes.h>
+#include <celutil/logger.h>
+#include <celutil/mappedfile.h>
+#include "octreecache.h"
+
+using namespace std::string_view_literals;
+using celestia::util::GetLogger;
+
+namespace celutil = celestia::util;
+
+namespace
+{
+constexpr inline std::string_view OCTREECACHE_MAGIC = "CELOCTRE"sv;
+constexpr inline std::uint16_t OCTREECACHE_VERSION  = 0x0100;
+
+constexpr inline std::uint32_t NODE_HAS_CHILDREN = 1;
+
+#pragma pack(push, 1)
+// octree cache header structure
+struct OctreeCacheHeader
+{
+    OctreeCacheHeader() = delete;
+    char magic[8];
+    std::uint16_t version;
+    std::uint16_t precision;
+    std::uint64_t key;
+    std::uint32_t nObjects;
+    std::uint32_t nNodes;
+};
+
+static_assert(std::is_standard_layout_v<OctreeCacheHeader>);
+#pragma pack(pop)
+
+template<class PREC>
+constexpr std::size_t nodeRecordSize()
+{
+    return 3 * sizeof(PREC) + sizeof(float) + 3 * sizeof(std::uint32_t);
+}
+
+template<typename T>
+T readValue(const char*& ptr)
+{
+    T value;
+    std::memcpy(&value, ptr, sizeof(T));
+    ptr += sizeof(T);
+    return value;
+}
+
+std::uint32_t readUint32(const char*& ptr)
+{
+    auto value = readValue<std::uint32_t>(ptr);
+    LE_TO_CPU_INT32(value, value);
+    return value;
+}
+
+float readFloat(const char*& ptr)
+{
+    auto value = readValue<float>(ptr);
+    LE_TO_CPU_FLOAT(value, value);
+    return value;
+}
+
+template<class PREC>
+PREC readPrec(const char*& ptr)
+{
+    if constexpr (std::is_same_v<PREC, float>)
+    {
+        return readFloat(ptr);
+    }
+    else
+    {
+        auto value = readValue<PREC>(ptr);
+        LE_TO_CPU_DOUBLE(value, value);
+        return value;
+    }
+}
+} // end unnamed namespace
+
+
+template<class PREC>
+bool LoadOctreeCache(const fs::path& path,
+                     std::uint64_t key,
+                     std::uint32_t nObjects,
+                     std::vector<std::uint32_t>& order,
+                     std::vector<OctreeNodeRecord<PREC>>& nodes)
+{
+    celutil::MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(OctreeCacheHeader))
+        return false;
+
+    const char* ptr = file.data();
+    if (std::string_view(ptr + offsetof(OctreeCacheHeader, magic), OCTREECACHE_MAGIC.size()) != OCTREECACHE_MAGIC)
+        return false;
+
+    std::uint16_t version;
+    std::memcpy(&version, ptr + offsetof(OctreeCacheHeader, version), sizeof(version));
+    LE_TO_CPU_INT16(version, version);
+    std::uint16_t precision;
+    std::memcpy(&precision, ptr + offsetof(OctreeCacheHeader, precision), sizeof(precision));
+    LE_TO_CPU_INT16(precision, precision);
+    if (version != OCTREECACHE_VERSION || precision != sizeof(PREC))
+        return false;
+
+    // The key is only ever compared with keys computed on the same machine,
+    // so it is stored in native byte order.
+    std::uint64_t fileKey;
+    std::memcpy(&fileKey, ptr + offsetof(OctreeCacheHeader, key), sizeof(fileKey));
+
+    std::uint32_t fileObjects;
+    std::memcpy(&fileObjects, ptr + offsetof(OctreeCacheHeader, nObjects), sizeof(fileObjects));
+    LE_TO_CPU_INT32(fileObjects, fileObjects);
+    std::uint32_t nNodes;
+    std::memcpy(&nNodes, ptr + offsetof(OctreeCacheHeader, nNodes), sizeof(nNodes));
+    LE_TO_CPU_INT32(nNodes, nNodes);
+
+    if (fileKey != key || fileObjects != nObjects)
+        return false;
+
+    std::uint64_t expectedSize = sizeof(OctreeCacheHeader)
+                               + std::uint64_t(nObjects) * sizeof(std::uint32_t)
+                               + std::uint64_t(nNodes) * nodeRecordSize<PREC>();
+    if (file.size() != expectedSize)
+    {
+        GetLogger()->warn("Ignoring octree cache {} with bad size\n", path);
+        return false;
+    }
+
+    ptr += sizeof(OctreeCacheHeader);
+
+    // The order must be a permutation of the loaded objects
+    std::vector<bool> seen(nObjects, false);
+    order.resize(nObjects);
+    for (std::uint32_t i = 0; i < nObjects; ++i)
+    {
+        std::uint32_t index = readUint32(ptr);
+        if (index >= nObjects || seen[index])
+        {
+            GetLogger()->warn("Ignoring octree cache {} with bad object order\n", path);
+            return false;
+        }
+        seen[index] = true;
+        order[i] = index;
+    }
+
+    nodes.clear();
+    nodes.reserve(nNodes);
+    for (std::uint32_t i = 0; i < nNodes; ++i)
+    {
+        OctreeNodeRecord<PREC>& node = nodes.emplace_back();
+        PREC x = readPrec<PREC>(ptr);
+        PREC y = readPrec<PREC>(ptr);
+        PREC z = readPrec<PREC>(ptr);
+        node.cellCenterPos = Eigen::Matrix<PREC, 3, 1>(x, y, z);
+        node.exclusionFactor = readFloat(ptr);
+        node.firstObject = readUint32(ptr);
+        node.nObjects = readUint32(ptr);
+        node.hasChildren = (readUint32(ptr) & NODE_HAS_CHILDREN) != 0;
+    }
+
+    return true;
+}
+
+
+template<class PREC>
+bool SaveOctreeCache(const fs::path& path,
+                     std::uint64_t key,
+                     const std::vector<std::uint32_t>& order,
+                     const std::vector<OctreeNodeRecord<PREC>>& nodes)
+{
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    if (ec)
+    {
+        GetLogger()->warn("Failed to create directory for octree cache {}\n", path);
+        return false;
+    }
+
+    // Write to a temporary file first so that an interrupted write never
+    // leaves a truncated cache behind.
+    fs::path tmpPath = path;
+    tmpPath += ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.good())
+        {
+            GetLogger()->warn("Failed to write octree cache {}\n", path);
+            return false;
+        }
+
+        out.write(OCTREECACHE_MAGIC.data(), OCTREECACHE_MAGIC.size());
+        celutil::writeLE<std::uint16_t>(out, OCTREECACHE_VERSION);
+        celutil::writeLE<std::uint16_t>(out, static_cast<std::uint16_t>(sizeof(PREC)));
+        celutil::writeNative<std::uint64_t>(out, key);
+        celutil::writeLE<std::uint32_t>(out, static_cast<std::uint32_t>(order.size()));
+        celutil::writeLE<std::uint32_t>(out, static_cast<std::uint32_t>(nodes.size()));
+
+        for (std::uint32_t index : order)
+            celutil::writeLE<std::uint32_t>(out, index);
+
+        for (const auto& node : nodes)
+        {
+            celutil::writeLE<PREC>(out, node.cellCenterPos.x());
+            celutil::writeLE<PREC>(out, node.cellCenterPos.y());
+            celutil::writeLE<PREC>(out, node.cellCenterPos.z());
+            celutil::writeLE<float>(out, node.exclusionFactor);
+            celutil::writeLE<std::uint32_t>(out, node.firstObject);
+            celutil::writeLE<std::uint32_t>(out, node.nObjects);
+            celutil::writeLE<std::uint32_t>(out, node.hasChildren ? NODE_HAS_CHILDREN : 0);
+        }
+
+        if (!out.good())
+        {
+            out.close();
+            fs::remove(tmpPath, ec);
+            GetLogger()->warn("Failed to write octree cache {}\n", path);
+            return false;
+        }
+    }
+
+    fs::rename(tmpPath, path, ec);
+    if (ec)
+    {
+        fs::remove(tmpPath, ec);
+        GetLogger()->warn("Failed to write octree cache {}\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+
+template bool LoadOctreeCache<float>(const fs::path&, std::uint64_t, std::uint32_t,
+                                     std::vector<std::uint32_t>&,
+                                     std::vector<OctreeNodeRecord<float>>&);
+template bool LoadOctreeCache<double>(const fs::path&, std::uint64_t, std::uint32_t,
+                                      std::vector<std::uint32_t>&,
+                                      std::vector<OctreeNodeRecord<double>>&);
+template bool SaveOctreeCache<float>(const fs::path&, std::uint64_t,
+                                     const std::vector<std::uint32_t>&,
+                                     const std::vector<OctreeNodeRecord<float>>&);
+template bool SaveOctreeCache<double>(const fs::path&, std::uint64_t,
+                                      const std::vector<std::uint32_t>&,
+                                      const std::vector<OctreeNodeRecord<double>>&);
@@ -0,0 +1,58 @@
+// octreecache.h
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// Persistent cache of prebuilt octrees.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include <celcompat/filesystem.h>
+#include <celengine/octree.h>
+
+// Hash of all the object properties which determine the shape of an
+// octree, in the order the objects are inserted. A cached octree is only
+// reused when the key of the freshly loaded catalogs matches.
+class OctreeCacheKey
+{
+ public:
+    template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+    void add(T value)
+    {
+        static_assert(sizeof(T) <= sizeof(std::uint64_t));
+        std::uint64_t bits = 0;
+        std::memcpy(&bits, &value, sizeof(T));
+        hash = (hash ^ bits) * UINT64_C(0x100000001b3);
+        hash ^= hash >> 29;
+    }
+
+    std::uint64_t value() const { return hash; }
+
+ private:
+    std::uint64_t hash{ UINT64_C(0xcbf29ce484222325) };
+};
+
+// A cache file stores the permutation of the objects into octree order
+// (order[i] is the load order index of the i-th sorted object) and the
+// flattened octree nodes.
+template<class PREC>
+bool LoadOctreeCache(const fs::path& path,
+                     std::uint64_t key,
+                     std::uint32_t nObjects,
+                     std::vector<std::uint32_t>& order,
+                     std::vector<OctreeNodeRecord<PREC>>& nodes);
+
+template<class PREC>
+bool SaveOctreeCache(const fs::path& path,
+                     std::uint64_t key,
+                     const std::vector<std::uint32_t>& order,
+                     const std::vector<OctreeNodeRecord<PREC>>& nodes);
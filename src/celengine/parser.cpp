@@ -7,6 +7,7 @@
 // modify it under the terms of the GNU General Public License
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
+#include <istream>
 #include <map>
 #include <string_view>
 #include <utility>
@@ -124,6 +125,13 @@ Parser::Parser(Tokenizer* _tokenizer) :
 }
 
 
+Parser::Parser(Tokenizer* _tokenizer, ParsedCatalog* _catalog) :
+    tokenizer(_tokenizer),
+    catalog(_catalog)
+{
+}
+
+
 std::unique_ptr<ValueArray> Parser::readArray()
 {
     Tokenizer::TokenType tok = tokenizer->nextToken();
@@ -229,6 +237,16 @@ Value Parser::readValue()
         }
 
     case Tokenizer::TokenBeginGroup:
+        if (catalog != nullptr)
+        {
+            if (auto index = tokenizer->getParsedGroupIndex(); index.has_value())
+            {
+                // Consume the end of the group, as readHash() would have
+                tokenizer->nextToken();
+                return std::move(catalog->groups[*index]);
+            }
+        }
+
         tokenizer->pushBack();
         {
             std::unique_ptr<Hash> hash = readHash();
@@ -243,3 +261,43 @@ Value Parser::readValue()
         return Value();
     }
 }
+
+
+/****** ParsedCatalog method implementation ******/
+
+ParsedCatalog ParsedCatalog::read(std::istream& in)
+{
+    ParsedCatalog catalog;
+    Tokenizer tokenizer(&in);
+    Parser parser(&tokenizer);
+
+    for (;;)
+    {
+        Tokenizer::TokenType tok = tokenizer.nextToken();
+        if (tok != Tokenizer::TokenBeginGroup)
+        {
+            catalog.tokens.append(tokenizer);
+            if (tok == Tokenizer::TokenEnd || tok == Tokenizer::TokenError)
+                break;
+            continue;
+        }
+
+        int beginLine = tokenizer.getLineNumber();
+        tokenizer.pushBack();
+        Value value = parser.readValue();
+        bool isValid = !value.isNull();
+
+        catalog.tokens.appendParsedGroup(beginLine, tokenizer.getLineNumber(), catalog.groups.size());
+        catalog.groups.push_back(std::move(value));
+
+        // Loaders stop at an invalid definition, and the tokenizer is left
+        // somewhere inside the group, so there is nothing more to record.
+        if (!isValid)
+        {
+            catalog.tokens.appendError(tokenizer.getLineNumber());
+            break;
+        }
+    }
+
+    return catalog;
+}
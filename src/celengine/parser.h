@@ -10,23 +10,48 @@
 
 #pragma once
 
+#include <iosfwd>
 #include <memory>
+#include <vector>
 
+#include <celutil/tokenizer.h>
 #include "hash.h"
 #include "value.h"
 
-class Tokenizer;
 class Value;
 
+/**
+ * A catalog file (stc, dsc, ssc) read ahead of loading it: the top level
+ * tokens are recorded and each top level group is parsed into a Value.
+ * Reading does not depend on any database, so several catalogs can be
+ * read concurrently and then loaded in order.
+ */
+class ParsedCatalog
+{
+ public:
+    static ParsedCatalog read(std::istream&);
+
+    const TokenList* getTokens() const { return &tokens; }
+
+ private:
+    TokenList tokens;
+    std::vector<Value> groups;
+
+    friend class Parser;
+};
+
 class Parser
 {
  public:
     Parser(Tokenizer*);
+    // Parse tokens replayed from catalog, taking its parsed groups
+    Parser(Tokenizer*, ParsedCatalog* catalog);
 
     Value readValue();
 
  private:
     Tokenizer* tokenizer;
+    ParsedCatalog* catalog{ nullptr };
 
     std::unique_ptr<ValueArray> readArray();
     std::unique_ptr<Hash> readHash();
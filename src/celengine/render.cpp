@@ -47,6 +47,7 @@
 #include "pointstarvertexbuffer.h"
 #include "pointstarrenderer.h"
 #include "orbitsampler.h"
+#include "solarsysstate.h"
 #include "asterismrenderer.h"
 #include "boundariesrenderer.h"
 #include "rendcontext.h"
@@ -61,13 +62,16 @@
 #include <celrender/linerenderer.h>
 #include <celrender/vertexobject.h>
 #include <celutil/logger.h>
+#include <celutil/threadpool.h>
 #include <celutil/utf8.h>
 #include <celutil/timer.h>
 #include <celttf/truetypefont.h>
 #include "glsupport.h"
 #include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <cassert>
+#include <future>
 #include <sstream>
 #include <iomanip>
 #include <numeric>
@@ -150,8 +154,9 @@ static const int MaxSkyRings = 32;
 static const int MaxSkySlices = 180;
 static const int MinSkySlices = 30;
 
-// Size at which the orbit cache will be flushed of old orbit paths
-static const unsigned int OrbitCacheCullThreshold = 200;
+// Memory used by the orbit path samples above which the cache will be
+// flushed of old orbit paths
+static const std::size_t OrbitCacheMemoryBudget = 32 * 1024 * 1024;
 // Age in frames at which unused orbit paths may be eliminated from the cache
 static const uint32_t OrbitCacheRetireAge = 16;
 
@@ -310,7 +315,10 @@ Renderer::DetailOptions::DetailOptions() :
     eclipseTextureSize(128),
     orbitWindowEnd(0.5),
     orbitPeriodsShown(1.0),
-    linearFadeFraction(0.0)
+    linearFadeFraction(0.0),
+    octreeTraversalThreads(0),
+    orbitSamplingThreads(0),
+    bodyStateThreads(0)
 {
 }
 
@@ -540,6 +548,21 @@ bool Renderer::init(int winWidth, int winHeight, DetailOptions& _detailOptions)
 {
     detailOptions = _detailOptions;
 
+    if (detailOptions.octreeTraversalThreads > 1)
+        m_octreeTraversalPool = std::make_unique<celestia::util::ThreadPool>(detailOptions.octreeTraversalThreads);
+    else
+        m_octreeTraversalPool = nullptr;
+
+    if (detailOptions.orbitSamplingThreads > 1)
+        m_orbitSamplingPool = std::make_unique<celestia::util::ThreadPool>(detailOptions.orbitSamplingThreads);
+    else
+        m_orbitSamplingPool = nullptr;
+
+    if (detailOptions.bodyStateThreads > 1)
+        m_bodyStatePool = std::make_unique<celestia::util::ThreadPool>(detailOptions.bodyStateThreads);
+    else
+        m_bodyStatePool = nullptr;
+
     m_atmosphereRenderer->initGL();
     m_cometRenderer->initGL();
 
@@ -998,6 +1021,116 @@ Vector4f renderOrbitColor(const Body *body, bool selected, float opacity)
     return Vector4f(orbitColor.red(), orbitColor.green(), orbitColor.blue(), opacity * orbitColor.alpha());
 }
 
+struct Renderer::PendingOrbitSamples
+{
+    std::future<OrbitSampler> samples;
+    bool backward;
+    double windowStart;
+    double windowEnd;
+};
+
+
+// Sample the orbit over [ startTime, endTime ] and add the samples to the
+// cached path, which is trimmed to [ windowStart, windowEnd ]. Orbits that
+// can be sampled concurrently are sampled on the worker threads, if there
+// are any.
+void Renderer::sampleOrbit(const celestia::ephem::Orbit* orbit,
+                           CachedOrbit& cachedOrbit,
+                           double startTime, double endTime,
+                           bool backward,
+                           double windowStart, double windowEnd)
+{
+    if (m_orbitSamplingPool == nullptr || !orbit->isThreadSafe())
+    {
+        OrbitSampler sampler;
+        orbit->sample(startTime, endTime, sampler);
+        addOrbitSamples(cachedOrbit, sampler, backward, windowStart, windowEnd);
+        return;
+    }
+
+    cachedOrbit.pending = std::make_unique<PendingOrbitSamples>();
+    cachedOrbit.pending->samples = m_orbitSamplingPool->submit([orbit, startTime, endTime]()
+    {
+        OrbitSampler sampler;
+        orbit->sample(startTime, endTime, sampler);
+        return sampler;
+    });
+    cachedOrbit.pending->backward = backward;
+    cachedOrbit.pending->windowStart = windowStart;
+    cachedOrbit.pending->windowEnd = windowEnd;
+}
+
+
+void Renderer::addOrbitSamples(CachedOrbit& cachedOrbit,
+                               OrbitSampler& sampler,
+                               bool backward,
+                               double windowStart, double windowEnd)
+{
+    CurvePlot* plot = cachedOrbit.plot.get();
+    if (backward)
+    {
+        // Remove samples at the end of the time window
+        plot->removeSamplesAfter(windowEnd);
+
+        // Trim the first sample (because it will be duplicated when we sample the orbit.)
+        plot->removeSamplesBefore(plot->startTime() * (1.0 + 1.0e-15));
+
+        sampler.insertBackward(plot);
+    }
+    else
+    {
+        // Remove samples at the beginning of the time window
+        plot->removeSamplesBefore(windowStart);
+
+        // Trim the last sample (because it will be duplicated when we sample the orbit.)
+        plot->removeSamplesAfter(plot->endTime() * (1.0 - 1.0e-15));
+
+        sampler.insertForward(plot);
+    }
+#if DEBUG_ORBIT_CACHE
+    clog << "new sample count: " << plot->sampleCount() << endl;
+#endif
+
+    std::size_t memoryUsage = plot->sampleCount() * sizeof(CurvePlotSample);
+    orbitCacheMemoryUsage = orbitCacheMemoryUsage - cachedOrbit.memoryUsage + memoryUsage;
+    cachedOrbit.memoryUsage = memoryUsage;
+}
+
+
+void Renderer::cullOrbitCache()
+{
+    // Check for old orbits at most once per frame
+    if (orbitCacheMemoryUsage <= OrbitCacheMemoryBudget || lastOrbitCacheFlush == frameCount)
+        return;
+    lastOrbitCacheFlush = frameCount;
+
+    // Remove the least recently used orbit paths until the cache fits
+    // within its budget. Paths still being sampled are kept, as the
+    // worker thread uses their orbit.
+    std::vector<std::pair<uint32_t, const celestia::ephem::Orbit*>> retired;
+    for (const auto& [orbit, cachedOrbit] : orbitCache)
+    {
+        if (cachedOrbit.pending != nullptr &&
+            cachedOrbit.pending->samples.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            continue;
+
+        if (frameCount - cachedOrbit.plot->lastUsed() > OrbitCacheRetireAge)
+            retired.emplace_back(cachedOrbit.plot->lastUsed(), orbit);
+    }
+    std::sort(retired.begin(), retired.end());
+
+    for (const auto& [lastUsed, orbit] : retired)
+    {
+        if (orbitCacheMemoryUsage <= OrbitCacheMemoryBudget)
+            break;
+
+        auto iter = orbitCache.find(orbit);
+        orbitCacheMemoryUsage -= iter->second.memoryUsage;
+        orbitCache.erase(iter);
+    }
+}
+
+
 void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
                            double t,
                            const Quaterniond& cameraOrientation,
@@ -1011,16 +1144,10 @@ void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
 
     const auto* orbit = body != nullptr ? body->getOrbit(t) : orbitPath.star->getOrbit();
 
-    CurvePlot* cachedOrbit = nullptr;
     OrbitCache::iterator cached = orbitCache.find(orbit);
-    if (cached != orbitCache.end())
-    {
-        cachedOrbit = cached->second;
-        cachedOrbit->setLastUsed(frameCount);
-    }
 
     // If it's not in the cache already
-    if (cachedOrbit == nullptr)
+    if (cached == orbitCache.end())
     {
         double startTime = t;
 #if 0
@@ -1061,35 +1188,29 @@ void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
             startTime = t - orbit->getPeriod();
         }
 
-        cachedOrbit = new CurvePlot(*this);
-        cachedOrbit->setLastUsed(frameCount);
+        // If the orbit cache is full, first try and eliminate some old orbits
+        cullOrbitCache();
 
-        OrbitSampler sampler;
-        orbit->sample(startTime,
-                      startTime + orbit->getPeriod(),
-                      sampler);
-        sampler.insertForward(cachedOrbit);
+        cached = orbitCache.emplace(orbit, CachedOrbit()).first;
+        cached->second.plot = std::make_unique<CurvePlot>(*this);
 
-        // If the orbit cache is full, first try and eliminate some old orbits
-        if (orbitCache.size() > OrbitCacheCullThreshold)
-        {
-            // Check for old orbits at most once per frame
-            if (lastOrbitCacheFlush != frameCount)
-            {
-                for (auto iter = orbitCache.begin(); iter != orbitCache.end();)
-                {
-                    // Tricky code to eliminate a node in the orbit cache without screwing
-                    // up the iterator. Should work in all STL implementations.
-                    if (frameCount - iter->second->lastUsed() > OrbitCacheRetireAge)
-                        orbitCache.erase(iter++);
-                    else
-                        ++iter;
-                }
-                lastOrbitCacheFlush = frameCount;
-            }
-        }
+        double endTime = startTime + orbit->getPeriod();
+        sampleOrbit(orbit, cached->second, startTime, endTime, false, startTime, endTime);
+    }
 
-        orbitCache[orbit] = cachedOrbit;
+    CachedOrbit& cachedEntry = cached->second;
+    CurvePlot* cachedOrbit = cachedEntry.plot.get();
+    cachedOrbit->setLastUsed(frameCount);
+
+    // Samples computed on a worker thread are added once they're ready;
+    // until then the path is drawn from the samples already in the cache,
+    // or not at all.
+    if (cachedEntry.pending != nullptr &&
+        cachedEntry.pending->samples.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        std::unique_ptr<PendingOrbitSamples> pending = std::move(cachedEntry.pending);
+        OrbitSampler sampler = pending->samples.get();
+        addOrbitSamples(cachedEntry, sampler, pending->backward, pending->windowStart, pending->windowEnd);
     }
 
     if (cachedOrbit->empty())
@@ -1122,7 +1243,8 @@ void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
     // 'Periodic' orbits are generally not strictly periodic because of perturbations
     // from other bodies. Here we update the trajectory samples to make sure that the
     // orbit covers a time range centered at the current time and covering a full revolution.
-    if (orbit->isPeriodic())
+    // The samples are only updated when none are pending, so that they're added in order.
+    if (orbit->isPeriodic() && cachedEntry.pending == nullptr)
     {
         double period = orbit->getPeriod();
         double endTime = t + period * OrbitWindowEnd;
@@ -1135,35 +1257,15 @@ void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
 
         if (startTime < currentWindowStart)
         {
-            // Remove samples at the end of the time window
-            cachedOrbit->removeSamplesAfter(newWindowEnd);
-
-            // Trim the first sample (because it will be duplicated when we sample the orbit.)
-            cachedOrbit->removeSamplesBefore(cachedOrbit->startTime() * (1.0 + 1.0e-15));
-
-            // Add the new samples
-            OrbitSampler sampler;
-            orbit->sample(newWindowStart, min(currentWindowStart, newWindowEnd), sampler);
-            sampler.insertBackward(cachedOrbit);
-#if DEBUG_ORBIT_CACHE
-            clog << "new sample count: " << cachedOrbit->sampleCount() << endl;
-#endif
+            sampleOrbit(orbit, cachedEntry,
+                        newWindowStart, min(currentWindowStart, newWindowEnd), true,
+                        newWindowStart, newWindowEnd);
         }
         else if (endTime > currentWindowEnd)
         {
-            // Remove samples at the beginning of the time window
-            cachedOrbit->removeSamplesBefore(newWindowStart);
-
-            // Trim the last sample (because it will be duplicated when we sample the orbit.)
-            cachedOrbit->removeSamplesAfter(cachedOrbit->endTime() * (1.0 - 1.0e-15));
-
-            // Add the new samples
-            OrbitSampler sampler;
-            orbit->sample(max(currentWindowEnd, newWindowStart), newWindowEnd, sampler);
-            sampler.insertForward(cachedOrbit);
-#if DEBUG_ORBIT_CACHE
-            clog << "new sample count: " << cachedOrbit->sampleCount() << endl;
-#endif
+            sampleOrbit(orbit, cachedEntry,
+                        max(currentWindowEnd, newWindowStart), newWindowEnd, false,
+                        newWindowStart, newWindowEnd);
         }
     }
 
@@ -3265,8 +3367,8 @@ void Renderer::addRenderListEntries(RenderListEntry& rle,
 void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
                                 const Frustum& viewFrustum,
                                 const Vector3d& viewPlaneNormal,
-                                const Vector3d& frameCenter,
-                                const FrameTree* tree,
+                                const SolarSystemState& systemState,
+                                std::uint32_t parent,
                                 const Observer& observer,
                                 double now)
 {
@@ -3277,24 +3379,40 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
     double invCosViewAngle = 1.0 / cosViewConeAngle;
     double sinViewAngle = sqrt(1.0 - square(cosViewConeAngle));
 
-    unsigned int nChildren = tree != nullptr ? tree->childCount() : 0;
-    for (unsigned int i = 0; i < nChildren; i++)
+    // Groups of bodies are skipped when their bounds, grown by the reach of
+    // reflected light, are neither in the view cone nor in the frustum.
+    auto isGroupVisible = [&](const SolarSystemState::BoundingNode& node)
     {
-        auto phase = tree->getChild(i);
+        Vector3d pos_v = node.center - astrocentricObserverPos;
+        double radius = node.radius + node.illuminatorRadius * PLANETSHINE_DISTANCE_LIMIT_FACTOR;
+        double distSq = pos_v.squaredNorm();
+        if (distSq <= radius * radius)
+            return true;
 
-        // No need to do anything if the phase isn't active now
-        if (!phase->includes(now))
-            continue;
+        double dist_vn = viewPlaneNormal.dot(pos_v);
+        if (dist_vn > -radius)
+        {
+            double maxPerpDist = (radius + dist_vn * sinViewAngle) * invCosViewAngle;
+            double perpDistSq = distSq - dist_vn * dist_vn;
+            if (maxPerpDist > 0.0 && perpDistSq < maxPerpDist * maxPerpDist)
+                return true;
+        }
+
+        return viewFrustum.testSphere(pos_v, radius) != Frustum::Outside;
+    };
 
-        Body* body = phase->body();
+    // The bodies orbiting one center; the state only holds the bodies
+    // whose phases are active now.
+    systemState.forEachChild(parent, isGroupVisible, [&](std::uint32_t i)
+    {
+        const SolarSystemState::BodyState& state = systemState[i];
+        Body* body = state.body;
 
         // pos_s: sun-relative position of object
         // pos_v: viewer-relative position of object
 
         // Get the position of the body relative to the sun.
-        Vector3d p = phase->orbit()->positionAtTime(now);
-        auto frame = phase->orbitFrame();
-        Vector3d pos_s = frameCenter + frame->getOrientation(now).conjugate() * p;
+        const Vector3d& pos_s = state.position;
 
         // We now have the positions of the observer and the planet relative
         // to the sun.  From these, compute the position of the body
@@ -3478,41 +3596,39 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
                 buildRenderLists(astrocentricObserverPos,
                                  viewFrustum,
                                  viewPlaneNormal,
-                                 pos_s,
-                                 subtree,
+                                 systemState,
+                                 i,
                                  observer,
                                  now);
             }
         } // end subtree traverse
-    }
+    });
 }
 
 
 void Renderer::buildOrbitLists(const Vector3d& astrocentricObserverPos,
                                const Quaterniond& observerOrientation,
                                const Frustum& viewFrustum,
-                               const FrameTree* tree,
+                               const SolarSystemState& systemState,
+                               std::uint32_t parent,
                                double now)
 {
     Matrix3d viewMat = observerOrientation.toRotationMatrix();
     Vector3d viewMatZ = viewMat.row(2);
 
-    unsigned int nChildren = tree != nullptr ? tree->childCount() : 0;
-    for (unsigned int i = 0; i < nChildren; i++)
+    // Orbits may be visible when the bodies aren't, so the bounds of the
+    // bodies can't be used to skip any.
+    auto allGroups = [](const SolarSystemState::BoundingNode&) { return true; };
+    systemState.forEachChild(parent, allGroups, [&](std::uint32_t i)
     {
-        auto phase = tree->getChild(i);
-
-        // No need to do anything if the phase isn't active now
-        if (!phase->includes(now))
-            continue;
-
-        Body* body = phase->body();
+        const SolarSystemState::BodyState& state = systemState[i];
+        Body* body = state.body;
 
         // pos_s: sun-relative position of object
         // pos_v: viewer-relative position of object
 
         // Get the position of the body relative to the sun.
-        Vector3d pos_s = body->getAstrocentricPosition(now);
+        const Vector3d& pos_s = state.position;
 
         // We now have the positions of the observer and the planet relative
         // to the sun.  From these, compute the position of the body
@@ -3527,19 +3643,15 @@ void Renderer::buildOrbitLists(const Vector3d& astrocentricObserverPos,
              orbitVis == Body::AlwaysVisible ||
              (orbitVis == Body::UseClassVisibility && (body->getOrbitClassification() & orbitMask) != 0)))
         {
-            Vector3d orbitOrigin = Vector3d::Zero();
-            Selection centerObject = phase->orbitFrame()->getCenter();
-            if (centerObject.body() != nullptr)
-            {
-                orbitOrigin = centerObject.body()->getAstrocentricPosition(now);
-            }
+            // Orbits are centered on the body at the center of the orbit frame
+            Vector3d orbitOrigin = systemState.getFramePosition(state);
 
             // Calculate the origin of the orbit relative to the observer
             Vector3d relOrigin = orbitOrigin - astrocentricObserverPos;
 
             // Compute the size of the orbit in pixels
             double originDistance = pos_v.norm();
-            double boundingRadius = body->getOrbit(now)->getBoundingRadius();
+            double boundingRadius = state.phase->orbit()->getBoundingRadius();
             auto orbitRadiusInPixels = (float) (boundingRadius / (originDistance * pixelSize));
 
             if (orbitRadiusInPixels > minOrbitSize)
@@ -3586,12 +3698,13 @@ void Renderer::buildOrbitLists(const Vector3d& astrocentricObserverPos,
                     buildOrbitLists(astrocentricObserverPos,
                                     observerOrientation,
                                     viewFrustum,
-                                    subtree,
+                                    systemState,
+                                    i,
                                     now);
                 }
             }
         } // end subtree traverse
-    }
+    });
 }
 
 
@@ -3850,10 +3963,11 @@ void Renderer::renderPointStars(const StarDatabase& starDB,
                             getAspectRatio(),
                             faintestMagNight,
 #ifdef OCTREE_DEBUG
-                            &m_starProcStats);
+                            &m_starProcStats,
 #else
-                            nullptr);
+                            nullptr,
 #endif
+                            m_octreeTraversalPool.get());
 
     starRenderer.starVertexBuffer->finish();
     starRenderer.glareVertexBuffer->finish();
@@ -3918,10 +4032,11 @@ void Renderer::renderDeepSkyObjects(const Universe& universe,
                            getAspectRatio(),
                            2 * faintestMagNight,
 #ifdef OCTREE_DEBUG
-                           &m_dsoProcStats);
+                           &m_dsoProcStats,
 #else
-                            nullptr);
+                           nullptr,
 #endif
+                           m_octreeTraversalPool.get());
 
     // clog << "DSOs processed: " << dsoRenderer.dsosProcessed << endl;
 }
@@ -4405,7 +4520,16 @@ void Renderer::loadTextures(Body* body)
 
 void Renderer::invalidateOrbitCache()
 {
+    // Wait for the paths being sampled, whose orbits may be about to be
+    // destroyed
+    for (auto& [orbit, cachedOrbit] : orbitCache)
+    {
+        if (cachedOrbit.pending != nullptr)
+            cachedOrbit.pending->samples.wait();
+    }
+
     orbitCache.clear();
+    orbitCacheMemoryUsage = 0;
 }
 
 
@@ -5080,14 +5204,17 @@ Renderer::buildNearSystemsLists(const Universe &universe,
         // Compute the position of the observer in astrocentric coordinates
         Vector3d astrocentricObserverPos = astrocentricPosition(observerPos, *sun, now);
 
+        // Evaluate the positions of all the bodies once for all the lists
+        const SolarSystemState& systemState = solarSystem->updateState(now, m_bodyStatePool.get());
+
         // Build render lists for bodies and orbits paths
         buildRenderLists(astrocentricObserverPos, xfrustum,
                          observerOrient.conjugate() * -Vector3d::UnitZ(),
-                         Vector3d::Zero(), solarSysTree, observer, now);
+                         systemState, SolarSystemState::NoParent, observer, now);
         if ((renderFlags & ShowOrbits) != 0)
         {
             buildOrbitLists(astrocentricObserverPos, observerOrient,
-                            xfrustum, solarSysTree, now);
+                            xfrustum, systemState, SolarSystemState::NoParent, now);
         }
     }
 
@@ -10,9 +10,12 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <list>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <Eigen/Core>
@@ -28,7 +31,9 @@
 class RendererWatcher;
 class FrameTree;
 class ReferenceMark;
+class SolarSystemState;
 class CurvePlot;
+class OrbitSampler;
 class PointStarVertexBuffer;
 class AsterismRenderer;
 class BoundariesRenderer;
@@ -40,6 +45,10 @@ class FramebufferObject;
 namespace celestia
 {
 class Rect;
+namespace util
+{
+class ThreadPool;
+}
 namespace render
 {
 class AtmosphereRenderer;
@@ -128,6 +137,15 @@ class Renderer
         double orbitWindowEnd;
         double orbitPeriodsShown;
         double linearFadeFraction;
+        // Number of threads used to traverse the star and DSO octrees;
+        // 0 or 1 for a traversal on the render thread only.
+        unsigned int octreeTraversalThreads;
+        // Number of threads used to sample orbit paths; 0 or 1 to sample
+        // them on the render thread.
+        unsigned int orbitSamplingThreads;
+        // Number of threads used to compute the positions of solar system
+        // bodies; 0 or 1 to compute them on the render thread.
+        unsigned int bodyStateThreads;
     };
 
     enum class ProjectionMode
@@ -517,14 +535,15 @@ class Renderer
     void buildRenderLists(const Eigen::Vector3d& astrocentricObserverPos,
                           const celmath::Frustum& viewFrustum,
                           const Eigen::Vector3d& viewPlaneNormal,
-                          const Eigen::Vector3d& frameCenter,
-                          const FrameTree* tree,
+                          const SolarSystemState& systemState,
+                          std::uint32_t parent,
                           const Observer& observer,
                           double now);
     void buildOrbitLists(const Eigen::Vector3d& astrocentricObserverPos,
                          const Eigen::Quaterniond& observerOrientation,
                          const celmath::Frustum& viewFrustum,
-                         const FrameTree* tree,
+                         const SolarSystemState& systemState,
+                         std::uint32_t parent,
                          double now);
     void buildLabelLists(const celmath::Frustum& viewFrustum,
                          double now);
@@ -744,8 +763,32 @@ class Renderer
 
     std::array<int, 4> m_viewport { 0, 0, 0, 0 };
 
-    typedef std::map<const celestia::ephem::Orbit*, CurvePlot*> OrbitCache;
+    // Samples of an orbit path computed on a worker thread, and the time
+    // window of the path they belong to
+    struct PendingOrbitSamples;
+
+    struct CachedOrbit
+    {
+        std::unique_ptr<CurvePlot> plot;
+        std::unique_ptr<PendingOrbitSamples> pending;
+        std::size_t memoryUsage{ 0 };
+    };
+
+    void sampleOrbit(const celestia::ephem::Orbit* orbit,
+                     CachedOrbit& cachedOrbit,
+                     double startTime, double endTime,
+                     bool backward,
+                     double windowStart, double windowEnd);
+    void addOrbitSamples(CachedOrbit& cachedOrbit,
+                         OrbitSampler& sampler,
+                         bool backward,
+                         double windowStart, double windowEnd);
+    void cullOrbitCache();
+
+    typedef std::unordered_map<const celestia::ephem::Orbit*, CachedOrbit> OrbitCache;
     OrbitCache orbitCache;
+    // Memory used by the samples of the cached orbit paths, in bytes
+    std::size_t orbitCacheMemoryUsage{ 0 };
     uint32_t lastOrbitCacheFlush;
 
     float minOrbitSize;
@@ -773,6 +816,15 @@ class Renderer
     unsigned m_shadowMapSize { 0 };
     std::unique_ptr<FramebufferObject> m_shadowFBO;
 
+    // Worker threads for the star and DSO octree traversals, if enabled
+    std::unique_ptr<celestia::util::ThreadPool> m_octreeTraversalPool;
+
+    // Worker threads for sampling orbit paths, if enabled
+    std::unique_ptr<celestia::util::ThreadPool> m_orbitSamplingPool;
+
+    // Worker threads for computing body positions, if enabled
+    std::unique_ptr<celestia::util::ThreadPool> m_bodyStatePool;
+
     std::array<celestia::render::VertexObject*, static_cast<size_t>(VOType::Count)> m_VertexObjects;
 
     // Saturation magnitude used to calculate a point star size
@@ -36,6 +36,7 @@
 #include "parseobject.h"
 #include "parser.h"
 #include "solarsys.h"
+#include "solarsysstate.h"
 #include "surface.h"
 #include "texmanager.h"
 #include "universe.h"
@@ -1087,8 +1088,16 @@ bool LoadSolarSystemObjects(std::istream& in,
                             Universe& universe,
                             const fs::path& directory)
 {
-    Tokenizer tokenizer(&in);
-    Parser parser(&tokenizer);
+    ParsedCatalog catalog = ParsedCatalog::read(in);
+    return LoadSolarSystemObjects(catalog, universe, directory);
+}
+
+bool LoadSolarSystemObjects(ParsedCatalog& catalog,
+                            Universe& universe,
+                            const fs::path& directory)
+{
+    Tokenizer tokenizer(catalog.getTokens());
+    Parser parser(&tokenizer, &catalog);
 
 #ifdef ENABLE_NLS
     std::string s = directory.string();
@@ -1306,6 +1315,8 @@ SolarSystem::SolarSystem(Star* _star) :
 {
     planets = new PlanetarySystem(star);
     frameTree = new FrameTree(star);
+    state = std::make_unique<SolarSystemState>();
+    pickState = std::make_unique<SolarSystemState>();
 }
 
 SolarSystem::~SolarSystem()
@@ -1337,3 +1348,20 @@ FrameTree* SolarSystem::getFrameTree() const
 {
     return frameTree;
 }
+
+const SolarSystemState& SolarSystem::getState() const
+{
+    return *state;
+}
+
+const SolarSystemState& SolarSystem::updateState(double tdb, celestia::util::ThreadPool* pool)
+{
+    state->update(*frameTree, tdb, pool);
+    return *state;
+}
+
+const SolarSystemState& SolarSystem::updatePickState(double tdb)
+{
+    pickState->update(*frameTree, tdb);
+    return *pickState;
+}
@@ -11,6 +11,7 @@
 
 #include <cstdint>
 #include <map>
+#include <memory>
 
 #include <Eigen/Core>
 
@@ -18,10 +19,17 @@
 
 
 class FrameTree;
+class ParsedCatalog;
 class PlanetarySystem;
+class SolarSystemState;
 class Star;
 class Universe;
 
+namespace celestia::util
+{
+class ThreadPool;
+}
+
 class SolarSystem
 {
  public:
@@ -33,10 +41,21 @@ class SolarSystem
     PlanetarySystem* getPlanets() const;
     FrameTree* getFrameTree() const;
 
+    // Positions of the bodies at the last update. They are kept from one
+    // update to the next so that the bounding hierarchies can be refitted.
+    const SolarSystemState& getState() const;
+    const SolarSystemState& updateState(double tdb, celestia::util::ThreadPool* pool = nullptr);
+
+    // Positions evaluated for picking, kept apart from the ones used for
+    // rendering so that picking doesn't change them in the middle of a frame
+    const SolarSystemState& updatePickState(double tdb);
+
  private:
     Star* star;
     PlanetarySystem* planets;
     FrameTree* frameTree;
+    std::unique_ptr<SolarSystemState> state;
+    std::unique_ptr<SolarSystemState> pickState;
 };
 
 using SolarSystemCatalog = std::map<std::uint32_t, SolarSystem*>;
@@ -44,3 +63,6 @@ using SolarSystemCatalog = std::map<std::uint32_t, SolarSystem*>;
 bool LoadSolarSystemObjects(std::istream& in,
                             Universe& universe,
                             const fs::path& dir = fs::path());
+bool LoadSolarSystemObjects(ParsedCatalog& catalog,
+                            Universe& universe,
+                            const fs::path& dir = fs::path());
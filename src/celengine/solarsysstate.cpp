@@ -0,0 +1,320 @@
+// solarsysstate.cpp
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// Positions of all the bodies of a solar system at one instant.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "solarsysstate.h"
+
+#include <algorithm>
+#include <future>
+
+#include <Eigen/Geometry>
+
+#include <celephem/orbit.h>
+#include <celutil/threadpool.h>
+#include "body.h"
+#include "frametree.h"
+#include "timelinephase.h"
+
+namespace
+{
+
+// Systems smaller than this are evaluated on the calling thread, as the
+// orbits are computed faster than tasks are handed to the workers.
+constexpr std::size_t MinParallelBodies = 1024;
+constexpr std::size_t MinBodiesPerTask = 256;
+
+// Bodies orbiting one center are sorted into a hierarchy when there are at
+// least this many of them; fewer are visited faster one by one.
+constexpr std::uint32_t MinHierarchyBodies = 256;
+constexpr std::uint32_t MaxLeafBodies = 8;
+
+// A hierarchy is rebuilt when its leaves have grown by this factor since
+// it was last built.
+constexpr double MaxHierarchyGrowth = 2.0;
+
+struct Sphere
+{
+    Eigen::Vector3d center;
+    double radius;
+};
+
+// The smallest sphere containing two spheres
+Sphere
+mergeSpheres(const Sphere& a, const Sphere& b)
+{
+    Eigen::Vector3d offset = b.center - a.center;
+    double distance = offset.norm();
+    if (distance + b.radius <= a.radius)
+        return a;
+    if (distance + a.radius <= b.radius)
+        return b;
+
+    double radius = 0.5 * (distance + a.radius + b.radius);
+    return { a.center + offset * ((radius - a.radius) / distance), radius };
+}
+
+} // end unnamed namespace
+
+
+void
+SolarSystemState::update(const FrameTree& tree, double tdb, celestia::util::ThreadPool* pool)
+{
+    time = tdb;
+    bodies.clear();
+
+    // The number of bodies orbiting the star is a good enough estimate of
+    // the size of the system to decide whether it's worth using the pool.
+    bool parallel = pool != nullptr && pool->threadCount() > 0 && tree.childCount() >= MinParallelBodies;
+    addSubtree(tree, NoParent, parallel);
+    if (parallel)
+        computeParallel(*pool);
+
+    updateHierarchies();
+}
+
+
+void
+SolarSystemState::computeParallel(celestia::util::ThreadPool& pool)
+{
+    // Positions within the orbit frames don't depend on each other, so they
+    // can be computed in any order. Orbits which aren't thread safe were
+    // already computed while the bodies were collected.
+    std::size_t nBodies = bodies.size();
+    std::size_t nTasks = static_cast<std::size_t>(pool.threadCount()) * 4;
+    std::size_t taskSize = std::max((nBodies + nTasks - 1) / nTasks, MinBodiesPerTask);
+
+    std::vector<std::future<void>> tasks;
+    for (std::size_t begin = 0; begin < nBodies; begin += taskSize)
+    {
+        std::size_t end = std::min(begin + taskSize, nBodies);
+        tasks.push_back(pool.submit([this, begin, end]() { computeOrbitPositions(begin, end); }));
+    }
+    for (auto& task : tasks)
+        task.get();
+
+    // Convert to astrocentric positions; centers come before the bodies
+    // orbiting them.
+    for (BodyState& state : bodies)
+        state.position = toAstrocentric(state, state.position);
+}
+
+
+/*! Collect the bodies of a frame tree which exist now. Unless deferred,
+ *  their astrocentric positions are computed at once, which is faster than
+ *  going over the bodies again; otherwise only the positions in the orbit
+ *  frames of the orbits which aren't thread safe are.
+ */
+void
+SolarSystemState::addSubtree(const FrameTree& tree, std::uint32_t parent, bool deferred)
+{
+    for (unsigned int i = 0; i < tree.childCount(); i++)
+    {
+        const TimelinePhase* phase = tree.getChild(i).get();
+
+        // Bodies (and their satellites) which don't exist now are skipped
+        if (!phase->includes(time))
+            continue;
+
+        auto index = static_cast<std::uint32_t>(bodies.size());
+        Body* body = phase->body();
+        BodyState& state = bodies.emplace_back();
+        state.body = body;
+        state.phase = phase;
+        state.parent = parent;
+        state.hierarchy = NoHierarchy;
+
+        // The bounds are needed for the hierarchies, and are cheaper to
+        // look up now that the body was just accessed.
+        const FrameTree* subtree = body->getFrameTree();
+        state.boundingRadius = body->getCullingRadius();
+        state.illuminatorRadius = body->isSecondaryIlluminator() ? body->getRadius() : 0.0f;
+        if (subtree != nullptr)
+        {
+            state.boundingRadius = std::max(state.boundingRadius, static_cast<float>(subtree->boundingSphereRadius()));
+            if (subtree->containsSecondaryIlluminators())
+                state.illuminatorRadius = std::max(state.illuminatorRadius, static_cast<float>(subtree->maxChildRadius()));
+        }
+
+        const celestia::ephem::Orbit* orbit = phase->orbit();
+        if (!deferred)
+            state.position = toAstrocentric(state, orbit->positionAtTime(time));
+        else if (!orbit->isThreadSafe())
+            state.position = orbit->positionAtTime(time);
+
+        if (subtree != nullptr)
+            addSubtree(*subtree, index, deferred);
+
+        bodies[index].subtreeEnd = static_cast<std::uint32_t>(bodies.size());
+    }
+}
+
+
+// Compute the positions of the bodies in [begin, end) with thread safe
+// orbits in their orbit frames.
+void
+SolarSystemState::computeOrbitPositions(std::size_t begin, std::size_t end)
+{
+    for (std::size_t i = begin; i < end; i++)
+    {
+        const celestia::ephem::Orbit* orbit = bodies[i].phase->orbit();
+        if (orbit->isThreadSafe())
+            bodies[i].position = orbit->positionAtTime(time);
+    }
+}
+
+
+Eigen::Vector3d
+SolarSystemState::toAstrocentric(const BodyState& state, const Eigen::Vector3d& orbitPosition) const
+{
+    const auto& frame = state.phase->orbitFrame();
+    return getFramePosition(state) + frame->getOrientation(time).conjugate() * orbitPosition;
+}
+
+
+// Sort the bodies orbiting each center with enough of them into a
+// hierarchy. The hierarchies of the previous update are refitted when the
+// center still has the same number of bodies around it.
+void
+SolarSystemState::updateHierarchies()
+{
+    std::vector<BoundingHierarchy> previous;
+    previous.swap(hierarchies);
+    rootHierarchy = NoHierarchy;
+
+    std::vector<std::uint32_t> children;
+    for (std::size_t center = 0; center <= bodies.size(); center++)
+    {
+        // The star's bodies are checked first, then each body's
+        std::uint32_t parent = center == 0 ? NoParent : static_cast<std::uint32_t>(center - 1);
+        std::size_t begin = parent == NoParent ? 0 : parent + 1;
+        std::size_t end = parent == NoParent ? bodies.size() : bodies[parent].subtreeEnd;
+        if (end - begin < MinHierarchyBodies)
+            continue;
+
+        children.clear();
+        for (std::size_t i = begin; i < end; i = bodies[i].subtreeEnd)
+            children.push_back(static_cast<std::uint32_t>(i));
+        if (children.size() < MinHierarchyBodies)
+            continue;
+
+        const Body* centerBody = parent == NoParent ? nullptr : bodies[parent].body;
+        auto match = std::find_if(previous.begin(), previous.end(),
+                                  [centerBody](const BoundingHierarchy& h) { return h.center == centerBody; });
+
+        BoundingHierarchy& hierarchy = hierarchies.emplace_back();
+        bool rebuild = true;
+        if (match != previous.end() && match->order.size() == children.size())
+        {
+            hierarchy = std::move(*match);
+            for (std::size_t i = 0; i < hierarchy.order.size(); i++)
+                hierarchy.items[i] = children[hierarchy.order[i]];
+            rebuild = refit(hierarchy) > MaxHierarchyGrowth * hierarchy.builtSize;
+        }
+
+        if (rebuild)
+        {
+            hierarchy.center = centerBody;
+            hierarchy.nodes.clear();
+            hierarchy.order.resize(children.size());
+            hierarchy.items = children;
+            for (std::uint32_t i = 0; i < hierarchy.order.size(); i++)
+                hierarchy.order[i] = i;
+
+            buildNode(hierarchy, 0, static_cast<std::uint32_t>(children.size()));
+            for (std::size_t i = 0; i < hierarchy.order.size(); i++)
+                hierarchy.items[i] = children[hierarchy.order[i]];
+            hierarchy.builtSize = refit(hierarchy);
+        }
+
+        auto index = static_cast<std::uint32_t>(hierarchies.size() - 1);
+        if (parent == NoParent)
+            rootHierarchy = index;
+        else
+            bodies[parent].hierarchy = index;
+    }
+}
+
+
+// Add the nodes for the bodies in [first, first + count) of the hierarchy
+// order, splitting them at the median along the longest axis of their
+// bounding box. Only the structure is built, refit() computes the bounds.
+void
+SolarSystemState::buildNode(BoundingHierarchy& hierarchy, std::uint32_t first, std::uint32_t count)
+{
+    auto nodeIndex = static_cast<std::uint32_t>(hierarchy.nodes.size());
+    hierarchy.nodes.push_back({ Eigen::Vector3d::Zero(), 0.0, 0.0, first, count });
+    if (count <= MaxLeafBodies)
+        return;
+
+    // Until the hierarchy is built, items holds the children of the center
+    // in frame tree order, which maps the order to the bodies.
+    auto position = [this, &hierarchy](std::uint32_t i) -> const Eigen::Vector3d&
+    {
+        return bodies[hierarchy.items[i]].position;
+    };
+
+    Eigen::AlignedBox3d box;
+    for (std::uint32_t i = first; i < first + count; i++)
+        box.extend(position(hierarchy.order[i]));
+    int axis;
+    box.sizes().maxCoeff(&axis);
+
+    auto begin = hierarchy.order.begin() + first;
+    std::uint32_t half = count / 2;
+    std::nth_element(begin, begin + half, begin + count,
+                     [&position, axis](std::uint32_t a, std::uint32_t b) { return position(a)[axis] < position(b)[axis]; });
+
+    buildNode(hierarchy, first, half);
+    hierarchy.nodes[nodeIndex].first = static_cast<std::uint32_t>(hierarchy.nodes.size());
+    hierarchy.nodes[nodeIndex].count = 0;
+    buildNode(hierarchy, first + half, count - half);
+}
+
+
+// Recompute the bounds from the current positions, and return the sum of
+// the leaf radii as a measure of how tight they are.
+double
+SolarSystemState::refit(BoundingHierarchy& hierarchy) const
+{
+    double leafSize = 0.0;
+
+    // Children follow their parents, so walking backwards visits them first
+    for (std::size_t n = hierarchy.nodes.size(); n-- > 0;)
+    {
+        BoundingNode* node = &hierarchy.nodes[n];
+        if (node->count == 0)
+        {
+            const BoundingNode& left = hierarchy.nodes[n + 1];
+            const BoundingNode& right = hierarchy.nodes[node->first];
+            Sphere sphere = mergeSpheres({ left.center, left.radius }, { right.center, right.radius });
+            node->center = sphere.center;
+            node->radius = sphere.radius;
+            node->illuminatorRadius = std::max(left.illuminatorRadius, right.illuminatorRadius);
+            continue;
+        }
+
+        Eigen::AlignedBox3d box;
+        for (std::uint32_t i = node->first; i < node->first + node->count; i++)
+            box.extend(bodies[hierarchy.items[i]].position);
+
+        node->center = box.center();
+        node->radius = 0.0;
+        node->illuminatorRadius = 0.0;
+        for (std::uint32_t i = node->first; i < node->first + node->count; i++)
+        {
+            const BodyState& state = bodies[hierarchy.items[i]];
+            node->radius = std::max(node->radius, (state.position - node->center).norm() + state.boundingRadius);
+            node->illuminatorRadius = std::max(node->illuminatorRadius, static_cast<double>(state.illuminatorRadius));
+        }
+        leafSize += node->radius;
+    }
+
+    return leafSize;
+}
@@ -0,0 +1,181 @@
+// solarsysstate.h
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// Positions of all the bodies of a solar system at one instant.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+
+class Body;
+class FrameTree;
+class TimelinePhase;
+
+namespace celestia::util
+{
+class ThreadPool;
+}
+
+/*! The astrocentric positions of all the bodies in a frame tree which
+ *  exist at one instant. They are evaluated once per time step, so that
+ *  building the render lists and orbit paths or picking don't each walk
+ *  the frame tree and compute the same orbits again.
+ *
+ *  Bodies are stored depth first: each body is followed by the bodies of
+ *  its own frame subtree, which end at subtreeEnd. The bodies orbiting
+ *  one center are found by starting at the first and stepping from
+ *  subtreeEnd to subtreeEnd.
+ *
+ *  When many bodies orbit one center, as with the asteroids of minor body
+ *  catalogs, they are also sorted into a bounding volume hierarchy so that
+ *  culling and picking can skip whole groups of them. The hierarchy is
+ *  refitted to the new positions on each update and only rebuilt when the
+ *  bodies have moved so much that the bounds got loose.
+ */
+class SolarSystemState
+{
+ public:
+    static constexpr std::uint32_t NoParent = UINT32_MAX;
+    static constexpr std::uint32_t NoHierarchy = UINT32_MAX;
+
+    struct BodyState
+    {
+        Body* body;
+        const TimelinePhase* phase;
+        Eigen::Vector3d position;
+        // Index of the body at the center of the orbit frame, or NoParent
+        // for the star
+        std::uint32_t parent;
+        std::uint32_t subtreeEnd;
+        // Index of the hierarchy of the bodies orbiting this one, or
+        // NoHierarchy if they are few enough to be visited one by one
+        std::uint32_t hierarchy;
+        // Radius of a sphere containing the body, its satellites and
+        // anything else drawn around it, and the radius of the largest
+        // secondary illuminator among them
+        float boundingRadius;
+        float illuminatorRadius;
+    };
+
+    /*! The bounds of a group of bodies orbiting the same center. The
+     *  sphere contains the bodies and the bounding spheres of their
+     *  satellites; illuminatorRadius is the radius of the largest secondary
+     *  illuminator among them, so that the reach of reflected light can be
+     *  added to the bounds.
+     */
+    struct BoundingNode
+    {
+        Eigen::Vector3d center;
+        double radius;
+        double illuminatorRadius;
+        // Leaves: index of the first item; inner nodes: index of the
+        // second child, the first one directly follows its parent
+        std::uint32_t first;
+        // Number of items of leaves, 0 for inner nodes
+        std::uint32_t count;
+    };
+
+    /*! Evaluate the positions at time tdb. With a thread pool, orbits
+     *  which are thread safe are evaluated on its threads when there are
+     *  enough bodies for it to pay off.
+     */
+    void update(const FrameTree& tree, double tdb, celestia::util::ThreadPool* pool = nullptr);
+
+    double getTime() const { return time; }
+    std::size_t size() const { return bodies.size(); }
+    const BodyState& operator[](std::size_t i) const { return bodies[i]; }
+
+    // Astrocentric position of the center of a body's orbit frame
+    Eigen::Vector3d getFramePosition(const BodyState& state) const
+    {
+        return state.parent == NoParent ? Eigen::Vector3d::Zero() : bodies[state.parent].position;
+    }
+
+    /*! Call f(i) with the index of each body orbiting the body at index
+     *  parent, or the star for NoParent. When the bodies are sorted into a
+     *  hierarchy, only the groups whose bounds pass test(node) are visited,
+     *  in no particular order; otherwise all of them are visited in frame
+     *  tree order without testing.
+     */
+    template<typename T, typename F>
+    void forEachChild(std::uint32_t parent, T test, F f) const;
+
+ private:
+    struct BoundingHierarchy
+    {
+        // Body at the center, nullptr for the star
+        const Body* center;
+        std::vector<BoundingNode> nodes;
+        // The bodies in leaf order, as positions among the children of
+        // the center, and as indices of the bodies in the current state
+        std::vector<std::uint32_t> order;
+        std::vector<std::uint32_t> items;
+        // Sum of the leaf radii right after the last rebuild
+        double builtSize;
+    };
+
+    void addSubtree(const FrameTree& tree, std::uint32_t parent, bool deferred);
+    void computeParallel(celestia::util::ThreadPool& pool);
+    void computeOrbitPositions(std::size_t begin, std::size_t end);
+    Eigen::Vector3d toAstrocentric(const BodyState& state, const Eigen::Vector3d& orbitPosition) const;
+
+    void updateHierarchies();
+    void buildNode(BoundingHierarchy& hierarchy, std::uint32_t first, std::uint32_t count);
+    double refit(BoundingHierarchy& hierarchy) const;
+
+    std::vector<BodyState> bodies;
+    std::vector<BoundingHierarchy> hierarchies;
+    std::uint32_t rootHierarchy{ NoHierarchy };
+    double time{ 0.0 };
+};
+
+
+template<typename T, typename F>
+void
+SolarSystemState::forEachChild(std::uint32_t parent, T test, F f) const
+{
+    std::uint32_t hierarchyIndex = parent == NoParent ? rootHierarchy : bodies[parent].hierarchy;
+    if (hierarchyIndex == NoHierarchy)
+    {
+        std::size_t begin = parent == NoParent ? 0 : parent + 1;
+        std::size_t end = parent == NoParent ? bodies.size() : bodies[parent].subtreeEnd;
+        for (std::size_t i = begin; i < end; i = bodies[i].subtreeEnd)
+            f(static_cast<std::uint32_t>(i));
+        return;
+    }
+
+    // The hierarchy is split at the median, so its depth is at most the
+    // log2 of the number of bodies.
+    const BoundingHierarchy& hierarchy = hierarchies[hierarchyIndex];
+    std::uint32_t stack[64];
+    std::size_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const BoundingNode& node = hierarchy.nodes[stack[--stackSize]];
+        if (!test(node))
+            continue;
+
+        if (node.count == 0)
+        {
+            std::uint32_t nodeIndex = static_cast<std::uint32_t>(&node - hierarchy.nodes.data());
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+        else
+        {
+            for (std::uint32_t i = node.first; i < node.first + node.count; i++)
+                f(hierarchy.items[i]);
+        }
+    }
+}
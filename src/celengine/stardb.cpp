@@ -13,22 +13,32 @@
 #include <cassert>
 #include <cmath>
 #include <cstddef>
+#include <cstring>
+#include <fstream>
 #include <istream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <ostream>
 #include <set>
 #include <string_view>
 #include <system_error>
 #include <type_traits>
+#include <utility>
 
 #include <fmt/format.h>
 
 #include <celcompat/charconv.h>
 #include <celutil/bytes.h>
+#include <celutil/binarywrite.h>
 #include <celutil/gettext.h>
 #include <celutil/logger.h>
+#include <celutil/mappedfile.h>
 #include <celutil/timer.h>
 #include <celutil/tokenizer.h>
 #include <celutil/stringutils.h>
 #include "meshmanager.h"
+#include "octreecache.h"
 #include "parser.h"
 #include "stardb.h"
 #include "starname.h"
@@ -65,6 +75,14 @@ constexpr inline float STAR_OCTREE_MAGNITUDE   = 6.0f;
 constexpr inline std::string_view STARSDAT_MAGIC   = "CELSTARS"sv;
 constexpr inline std::string_view CROSSINDEX_MAGIC = "CELINDEX"sv;
 
+constexpr inline std::uint16_t STARSDAT_VERSION        = 0x0100;
+// Version 2 star databases store the star records in octree order, followed
+// by the octree node table and an index of the records sorted by catalog
+// number, so the file can be used without rebuilding the octree.
+constexpr inline std::uint16_t STARSDAT_OCTREE_VERSION = 0x0200;
+
+constexpr inline std::uint32_t STARSDAT_NODE_HAS_CHILDREN = 1;
+
 constexpr inline AstroCatalog::IndexNumber TYC3_MULTIPLIER = 1000000000u;
 constexpr inline AstroCatalog::IndexNumber TYC2_MULTIPLIER = 10000u;
 constexpr inline AstroCatalog::IndexNumber TYC123_MIN = 1u;
@@ -105,6 +123,30 @@ struct StarsDatRecord
 
 static_assert(std::is_standard_layout_v<StarsDatRecord>);
 
+// additional header of octree ordered stars.dat files
+struct StarsDatOctreeHeader
+{
+    StarsDatOctreeHeader() = delete;
+    std::uint32_t nodeCount;
+};
+
+static_assert(std::is_standard_layout_v<StarsDatOctreeHeader>);
+
+// octree ordered stars.dat node record structure
+struct StarsDatNodeRecord
+{
+    StarsDatNodeRecord() = delete;
+    float x;
+    float y;
+    float z;
+    float exclusionFactor;
+    std::uint32_t firstStar;
+    std::uint32_t nStars;
+    std::uint32_t flags;
+};
+
+static_assert(std::is_standard_layout_v<StarsDatNodeRecord>);
+
 // cross-index header structure
 struct CrossIndexHeader
 {
@@ -127,6 +169,79 @@ static_assert(std::is_standard_layout_v<CrossIndexRecord>);
 
 #pragma pack(pop)
 
+bool parseStarsDatHeader(const char* header,
+                         std::uint16_t& version,
+                         std::uint32_t& nStarsInFile)
+{
+    // Verify the magic string
+    if (std::string_view(header + offsetof(StarsDatHeader, magic), STARSDAT_MAGIC.size()) != STARSDAT_MAGIC) { return false; }
+
+    std::memcpy(&version, header + offsetof(StarsDatHeader, version), sizeof(version));
+    LE_TO_CPU_INT16(version, version);
+
+    std::memcpy(&nStarsInFile, header + offsetof(StarsDatHeader, counter), sizeof(nStarsInFile));
+    LE_TO_CPU_INT32(nStarsInFile, nStarsInFile);
+
+    return true;
+}
+
+
+AstroCatalog::IndexNumber getRecordCatalogNumber(const char* ptr)
+{
+    AstroCatalog::IndexNumber catNo;
+    std::memcpy(&catNo, ptr + offsetof(StarsDatRecord, catNo), sizeof(catNo));
+    LE_TO_CPU_INT32(catNo, catNo);
+    return catNo;
+}
+
+
+bool decodeStarRecord(const char* ptr, Star& star)
+{
+    float x;
+    std::memcpy(&x, ptr + offsetof(StarsDatRecord, x), sizeof(x));
+    LE_TO_CPU_FLOAT(x, x);
+
+    float y;
+    std::memcpy(&y, ptr + offsetof(StarsDatRecord, y), sizeof(y));
+    LE_TO_CPU_FLOAT(y, y);
+
+    float z;
+    std::memcpy(&z, ptr + offsetof(StarsDatRecord, z), sizeof(z));
+    LE_TO_CPU_FLOAT(z, z);
+
+    std::int16_t absMag;
+    std::memcpy(&absMag, ptr + offsetof(StarsDatRecord, absMag), sizeof(absMag));
+    LE_TO_CPU_INT16(absMag, absMag);
+
+    std::uint16_t spectralType;
+    std::memcpy(&spectralType, ptr + offsetof(StarsDatRecord, spectralType), sizeof(spectralType));
+    LE_TO_CPU_INT16(spectralType, spectralType);
+
+    StarDetails* details = nullptr;
+    StellarClass sc;
+    if (sc.unpackV1(spectralType))
+        details = StarDetails::GetStarDetails(sc);
+
+    if (details == nullptr)
+        return false;
+
+    star.setPosition(x, y, z);
+    star.setAbsoluteMagnitude(static_cast<float>(absMag) / 256.0f);
+    star.setDetails(details);
+    star.setIndex(getRecordCatalogNumber(ptr));
+    return true;
+}
+
+
+DynamicStarOctree* createDynamicStarOctree()
+{
+    float absMag = astro::appToAbsMag(STAR_OCTREE_MAGNITUDE,
+                                      STAR_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
+    return new DynamicStarOctree(Eigen::Vector3f(1000.0f, 1000.0f, 1000.0f),
+                                 absMag);
+}
+
+
 bool parseSimpleCatalogNumber(std::string_view name,
                               std::string_view prefix,
                               AstroCatalog::IndexNumber& catalogNumber)
@@ -269,12 +384,6 @@ void stcError(const Tokenizer& tok,
 } // end unnamed namespace
 
 
-bool StarDatabase::CrossIndexEntry::operator<(const StarDatabase::CrossIndexEntry& e) const
-{
-    return catalogNumber < e.catalogNumber;
-}
-
-
 StarDatabase::StarDatabase()
 {
     crossIndexes.resize(MaxCatalog);
@@ -284,27 +393,31 @@ StarDatabase::StarDatabase()
 StarDatabase::~StarDatabase()
 {
     delete [] stars;
-    delete [] catalogNumberIndex;
-
-    for (const auto index : crossIndexes)
-        delete index;
 }
 
 
 Star* StarDatabase::find(AstroCatalog::IndexNumber catalogNumber) const
 {
-    Star refStar;
-    refStar.setIndex(catalogNumber);
+    const std::uint32_t* index = catalogNumberIndex.find(catalogNumber);
+    return index == nullptr ? nullptr : stars + *index;
+}
 
-    Star** star = std::lower_bound(catalogNumberIndex,
-                                   catalogNumberIndex + nStars,
-                                   catalogNumber,
-                                   [](const Star* star, AstroCatalog::IndexNumber catNum) { return star->getIndex() < catNum; });
 
-    if (star != catalogNumberIndex + nStars && (*star)->getIndex() == catalogNumber)
-        return *star;
-    else
-        return nullptr;
+void StarDatabase::find(celestia::util::array_view<AstroCatalog::IndexNumber> catalogNumbers, Star** result) const
+{
+    // Star indices are looked up in chunks, so that the hash index lookups
+    // of a chunk overlap without a temporary array for all the numbers.
+    constexpr std::size_t ChunkSize = 256;
+    std::array<std::uint32_t, ChunkSize> indices;
+
+    for (std::size_t first = 0; first < catalogNumbers.size(); first += ChunkSize)
+    {
+        std::size_t count = std::min(ChunkSize, catalogNumbers.size() - first);
+        catalogNumberIndex.find(celestia::util::array_view<AstroCatalog::IndexNumber>(catalogNumbers.data() + first, count),
+                                indices.data(), UINT32_MAX);
+        for (std::size_t i = 0; i < count; ++i)
+            result[first + i] = indices[i] == UINT32_MAX ? nullptr : stars + indices[i];
+    }
 }
 
 
@@ -365,18 +478,8 @@ AstroCatalog::IndexNumber StarDatabase::crossIndex(const Catalog catalog, const
     if (static_cast<std::size_t>(catalog) >= crossIndexes.size())
         return AstroCatalog::InvalidIndex;
 
-    CrossIndex* xindex = crossIndexes[catalog];
-    if (xindex == nullptr)
-        return AstroCatalog::InvalidIndex;
-
-    // A simple linear search.  We could store cross indices sorted by
-    // both catalog numbers and trade memory for speed
-    auto iter = std::find_if(xindex->begin(), xindex->end(),
-                             [celCatalogNumber](CrossIndexEntry& o){ return celCatalogNumber == o.celCatalogNumber; });
-    if (iter != xindex->end())
-        return iter->catalogNumber;
-
-    return AstroCatalog::InvalidIndex;
+    const AstroCatalog::IndexNumber* catalogNumber = crossIndexes[catalog].catalogNumbers.find(celCatalogNumber);
+    return catalogNumber == nullptr ? AstroCatalog::InvalidIndex : *catalogNumber;
 }
 
 
@@ -387,19 +490,8 @@ AstroCatalog::IndexNumber StarDatabase::searchCrossIndexForCatalogNumber(const C
     if (static_cast<unsigned int>(catalog) >= crossIndexes.size())
         return AstroCatalog::InvalidIndex;
 
-    CrossIndex* xindex = crossIndexes[catalog];
-    if (xindex == nullptr)
-        return AstroCatalog::InvalidIndex;
-
-    CrossIndexEntry xindexEnt;
-    xindexEnt.catalogNumber = number;
-
-    CrossIndex::iterator iter = lower_bound(xindex->begin(), xindex->end(),
-                                            xindexEnt);
-    if (iter == xindex->end() || iter->catalogNumber != number)
-        return AstroCatalog::InvalidIndex;
-    else
-        return iter->celCatalogNumber;
+    const AstroCatalog::IndexNumber* celCatalogNumber = crossIndexes[catalog].celCatalogNumbers.find(number);
+    return celCatalogNumber == nullptr ? AstroCatalog::InvalidIndex : *celCatalogNumber;
 }
 
 
@@ -413,6 +505,24 @@ Star* StarDatabase::searchCrossIndex(const Catalog catalog, const AstroCatalog::
 }
 
 
+void StarDatabase::searchCrossIndex(const Catalog catalog,
+                                    celestia::util::array_view<AstroCatalog::IndexNumber> numbers,
+                                    Star** result) const
+{
+    if (static_cast<unsigned int>(catalog) >= crossIndexes.size())
+    {
+        std::fill(result, result + numbers.size(), nullptr);
+        return;
+    }
+
+    // InvalidIndex is never in the catalog number index, so numbers
+    // missing from the cross index end up as nullptr.
+    std::vector<AstroCatalog::IndexNumber> celCatalogNumbers(numbers.size());
+    crossIndexes[catalog].celCatalogNumbers.find(numbers, celCatalogNumbers.data(), AstroCatalog::InvalidIndex);
+    find(celCatalogNumbers, result);
+}
+
+
 std::vector<std::string> StarDatabase::getCompletion(const std::string& name, bool i18n) const
 {
     std::vector<std::string> completion;
@@ -543,7 +653,8 @@ void StarDatabase::findVisibleStars(StarHandler& starHandler,
                                     float fovY,
                                     float aspectRatio,
                                     float limitingMag,
-                                    OctreeProcStats *stats) const
+                                    OctreeProcStats *stats,
+                                    celestia::util::ThreadPool* pool) const
 {
     // Compute the bounding planes of an infinite view frustum
     Eigen::Hyperplane<float, 3> frustumPlanes[5];
@@ -562,7 +673,21 @@ void StarDatabase::findVisibleStars(StarHandler& starHandler,
         frustumPlanes[i] = Eigen::Hyperplane<float, 3>(planeNormals[i], position);
     }
 
+    if (pool != nullptr)
+    {
+        octreeRoot->processVisibleObjects(starHandler,
+                                          cullingTable,
+                                          position,
+                                          frustumPlanes,
+                                          limitingMag,
+                                          STAR_OCTREE_ROOT_SIZE,
+                                          *pool,
+                                          stats);
+        return;
+    }
+
     octreeRoot->processVisibleObjects(starHandler,
+                                      cullingTable,
                                       position,
                                       frustumPlanes,
                                       limitingMag,
@@ -582,6 +707,33 @@ void StarDatabase::findCloseStars(StarHandler& starHandler,
 }
 
 
+std::unique_ptr<CompactStarStore>
+StarDatabase::createCompactStore(float positionTolerance) const
+{
+    if (octreeRoot == nullptr)
+        return nullptr;
+
+    std::vector<OctreeNodeRecord<float>> nodes;
+    octreeRoot->flatten(nodes, stars);
+    return CompactStarStore::create(nodes,
+                                    STAR_OCTREE_ROOT_SIZE,
+                                    nStars,
+                                    [this](std::uint32_t i)
+                                    {
+                                        const Star& star = stars[i];
+                                        return CompactStarStore::StarRecord
+                                        {
+                                            star.getIndex(),
+                                            star.getPosition(),
+                                            star.getAbsoluteMagnitude(),
+                                            star.getExtinction(),
+                                            star.getDetails(),
+                                        };
+                                    },
+                                    positionTolerance);
+}
+
+
 StarNameDatabase* StarDatabase::getNameDatabase() const
 {
     return namesDB;
@@ -594,6 +746,12 @@ void StarDatabase::setNameDatabase(StarNameDatabase* _namesDB)
 }
 
 
+void StarDatabase::setOctreeCacheFile(const fs::path& path)
+{
+    octreeCacheFile = path;
+}
+
+
 bool StarDatabase::loadCrossIndex(const Catalog catalog, std::istream& in)
 {
     Timer timer{};
@@ -601,8 +759,7 @@ bool StarDatabase::loadCrossIndex(const Catalog catalog, std::istream& in)
     if (static_cast<unsigned int>(catalog) >= crossIndexes.size())
         return false;
 
-    if (crossIndexes[catalog] != nullptr)
-        delete crossIndexes[catalog];
+    crossIndexes[catalog] = CrossIndex();
 
     // Verify that the star database file has a correct header
     {
@@ -627,7 +784,7 @@ bool StarDatabase::loadCrossIndex(const Catalog catalog, std::istream& in)
         }
     }
 
-    CrossIndex* xindex = new CrossIndex();
+    CrossIndex xindex;
 
     constexpr std::uint32_t BUFFER_RECORDS = UINT32_C(4096) / sizeof(CrossIndexRecord);
     std::vector<char> buffer(sizeof(CrossIndexRecord) * BUFFER_RECORDS);
@@ -639,7 +796,6 @@ bool StarDatabase::loadCrossIndex(const Catalog catalog, std::istream& in)
         if (in.bad())
         {
             GetLogger()->error(_("Loading cross index failed\n"));
-            delete xindex;
             return false;
         }
         if (in.eof())
@@ -650,35 +806,39 @@ bool StarDatabase::loadCrossIndex(const Catalog catalog, std::istream& in)
             if (bytesRead % sizeof(CrossIndexRecord) != 0)
             {
                 GetLogger()->error(_("Loading cross index failed - unexpected EOF\n"));
-                delete xindex;
                 return false;
             }
 
             hasMoreRecords = false;
         }
 
-        xindex->reserve(xindex->size() + remainingRecords);
-
         const char* ptr = buffer.data();
         while (remainingRecords-- > 0)
         {
-            CrossIndexEntry ent;
-            std::memcpy(&ent.catalogNumber, ptr + offsetof(CrossIndexRecord, catalogNumber), sizeof(ent.catalogNumber));
-            LE_TO_CPU_INT32(ent.catalogNumber, ent.catalogNumber);
-
-            std::memcpy(&ent.celCatalogNumber, ptr + offsetof(CrossIndexRecord, celCatalogNumber), sizeof(ent.celCatalogNumber));
-            LE_TO_CPU_INT32(ent.celCatalogNumber, ent.celCatalogNumber);
+            AstroCatalog::IndexNumber catalogNumber;
+            std::memcpy(&catalogNumber, ptr + offsetof(CrossIndexRecord, catalogNumber), sizeof(catalogNumber));
+            LE_TO_CPU_INT32(catalogNumber, catalogNumber);
+
+            AstroCatalog::IndexNumber celCatalogNumber;
+            std::memcpy(&celCatalogNumber, ptr + offsetof(CrossIndexRecord, celCatalogNumber), sizeof(celCatalogNumber));
+            LE_TO_CPU_INT32(celCatalogNumber, celCatalogNumber);
+
+            // The first entry for a catalog number wins; a star listed
+            // under several numbers maps back to the lowest one.
+            xindex.celCatalogNumbers.insert(catalogNumber, celCatalogNumber);
+            if (!xindex.catalogNumbers.insert(celCatalogNumber, catalogNumber)
+                && catalogNumber < *xindex.catalogNumbers.find(celCatalogNumber))
+            {
+                xindex.catalogNumbers.insertOrAssign(celCatalogNumber, catalogNumber);
+            }
 
-            xindex->push_back(ent);
             ptr += sizeof(CrossIndexRecord);
         }
     }
 
     GetLogger()->debug("Loaded xindex in {} ms\n", timer.getTime());
 
-    sort(xindex->begin(), xindex->end());
-
-    crossIndexes[catalog] = xindex;
+    crossIndexes[catalog] = std::move(xindex);
 
     return true;
 }
@@ -688,122 +848,369 @@ bool StarDatabase::loadBinary(std::istream& in)
 {
     Timer timer{};
     std::uint32_t nStarsInFile = 0;
+    std::uint16_t version = 0;
     {
         std::array<char, sizeof(StarsDatHeader)> header;
         if (!in.read(header.data(), header.size()).good()) { return false; }
+        if (!parseStarsDatHeader(header.data(), version, nStarsInFile)) { return false; }
+    }
 
-        // Verify the magic string
-        if (std::string_view(header.data() + offsetof(StarsDatHeader, magic), STARSDAT_MAGIC.size()) != STARSDAT_MAGIC) { return false; }
+    if (version == STARSDAT_OCTREE_VERSION)
+    {
+        std::vector<char> data(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>{});
+        if (in.bad() || !loadOctreeBinary(data.data(), data.size(), nStarsInFile))
+            return false;
+    }
+    else if (version == STARSDAT_VERSION)
+    {
+        constexpr std::uint32_t BUFFER_RECORDS = UINT32_C(4096) / sizeof(StarsDatRecord);
+        std::vector<char> buffer(sizeof(StarsDatRecord) * BUFFER_RECORDS);
+        std::uint32_t nStarsRemaining = nStarsInFile;
+        while (nStarsRemaining > 0)
+        {
+            std::uint32_t recordsToRead = std::min(BUFFER_RECORDS, nStarsRemaining);
+            if (!in.read(buffer.data(), sizeof(StarsDatRecord) * recordsToRead).good()) { return false; }
+            if (!addBinaryRecords(buffer.data(), recordsToRead)) { return false; }
 
-        // Verify the version
-        std::uint16_t version;
-        std::memcpy(&version, header.data() + offsetof(StarsDatHeader, version), sizeof(version));
-        LE_TO_CPU_INT16(version, version);
-        if (version != 0x0100) { return false; }
+            nStarsRemaining -= recordsToRead;
+        }
 
-        // Read the star count
-        std::memcpy(&nStarsInFile, header.data() + offsetof(StarsDatHeader, counter), sizeof(nStarsInFile));
-        LE_TO_CPU_INT32(nStarsInFile, nStarsInFile);
-    }
+        if (in.bad())
+            return false;
 
-    constexpr std::uint32_t BUFFER_RECORDS = UINT32_C(4096) / sizeof(StarsDatRecord);
-    std::vector<char> buffer(sizeof(StarsDatRecord) * BUFFER_RECORDS);
-    std::uint32_t nStarsRemaining = nStarsInFile;
-    while (nStarsRemaining > 0)
+        buildBinFileIndex();
+    }
+    else
     {
-        std::uint32_t recordsToRead = std::min(BUFFER_RECORDS, nStarsRemaining);
-        if (!in.read(buffer.data(), sizeof(StarsDatRecord) * recordsToRead).good()) { return false; }
+        return false;
+    }
 
-        const char* ptr = buffer.data();
-        for (std::uint32_t i = 0; i < recordsToRead; ++i)
+    auto loadTime = timer.getTime();
+
+    GetLogger()->debug("StarDatabase::read: nStars = {}, time = {} ms\n", nStarsInFile, loadTime);
+    GetLogger()->info(_("{} stars in binary database\n"), nStars);
+
+    return true;
+}
+
+
+/*! Load a binary star database by mapping it into memory; this avoids
+ *  copying the file through stream buffers, and for octree ordered files
+ *  only the pages actually touched while decoding are read. Falls back to
+ *  stream I/O if the file can't be mapped.
+ */
+bool StarDatabase::loadBinary(const fs::path& path)
+{
+    celutil::MappedFile file;
+    if (!file.open(path))
+    {
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        if (!in.good())
         {
-            AstroCatalog::IndexNumber catNo;
-            std::memcpy(&catNo, ptr + offsetof(StarsDatRecord, catNo), sizeof(catNo));
-            LE_TO_CPU_INT32(catNo, catNo);
+            GetLogger()->error(_("Error opening {}\n"), path);
+            return false;
+        }
 
-            float x;
-            std::memcpy(&x, ptr + offsetof(StarsDatRecord, x), sizeof(x));
-            LE_TO_CPU_FLOAT(x, x);
+        return loadBinary(in);
+    }
 
-            float y;
-            std::memcpy(&y, ptr + offsetof(StarsDatRecord, y), sizeof(y));
-            LE_TO_CPU_FLOAT(y, y);
+    Timer timer{};
+    if (file.size() < sizeof(StarsDatHeader)) { return false; }
 
-            float z;
-            std::memcpy(&z, ptr + offsetof(StarsDatRecord, z), sizeof(z));
-            LE_TO_CPU_FLOAT(z, z);
+    std::uint32_t nStarsInFile = 0;
+    std::uint16_t version = 0;
+    if (!parseStarsDatHeader(file.data(), version, nStarsInFile)) { return false; }
 
-            std::int16_t absMag;
-            std::memcpy(&absMag, ptr + offsetof(StarsDatRecord, absMag), sizeof(absMag));
-            LE_TO_CPU_INT16(absMag, absMag);
+    const char* data = file.data() + sizeof(StarsDatHeader);
+    std::size_t size = file.size() - sizeof(StarsDatHeader);
+    if (version == STARSDAT_OCTREE_VERSION)
+    {
+        if (!loadOctreeBinary(data, size, nStarsInFile))
+            return false;
+    }
+    else if (version == STARSDAT_VERSION)
+    {
+        if (size / sizeof(StarsDatRecord) < nStarsInFile) { return false; }
+        if (!addBinaryRecords(data, nStarsInFile)) { return false; }
 
-            std::uint16_t spectralType;
-            std::memcpy(&spectralType, ptr + offsetof(StarsDatRecord, spectralType), sizeof(spectralType));
-            LE_TO_CPU_INT16(spectralType, spectralType);
+        buildBinFileIndex();
+    }
+    else
+    {
+        return false;
+    }
 
-            Star star;
-            star.setPosition(x, y, z);
-            star.setAbsoluteMagnitude(static_cast<float>(absMag) / 256.0f);
+    auto loadTime = timer.getTime();
 
-            StarDetails* details = nullptr;
-            StellarClass sc;
-            if (sc.unpackV1(spectralType))
-                details = StarDetails::GetStarDetails(sc);
+    GetLogger()->debug("StarDatabase::read: nStars = {}, time = {} ms\n", nStarsInFile, loadTime);
+    GetLogger()->info(_("{} stars in binary database\n"), nStars);
 
-            if (details == nullptr)
-            {
-                GetLogger()->error(_("Bad spectral type in star database, star #{}\n"), nStars);
-                return false;
-            }
+    return true;
+}
 
-            star.setDetails(details);
-            star.setIndex(catNo);
-            unsortedStars.add(star);
 
-            ptr += sizeof(StarsDatRecord);
-            nStars++;
+bool StarDatabase::addBinaryRecords(const char* ptr, std::uint32_t nRecords)
+{
+    for (std::uint32_t i = 0; i < nRecords; ++i)
+    {
+        Star star;
+        if (!decodeStarRecord(ptr, star))
+        {
+            GetLogger()->error(_("Bad spectral type in star database, star #{}\n"), nStars);
+            return false;
         }
 
-        nStarsRemaining -= recordsToRead;
+        unsortedStars.add(star);
+
+        ptr += sizeof(StarsDatRecord);
+        nStars++;
+    }
+
+    return true;
+}
+
+
+// Create the temporary list of stars sorted by catalog number; this
+// will be used to lookup stars during file loading. After loading is
+// complete, the stars are sorted into an octree and this list gets
+// replaced.
+void StarDatabase::buildBinFileIndex()
+{
+    if (unsortedStars.size() == 0)
+        return;
+
+    binFileStarCount = unsortedStars.size();
+    binFileCatalogNumberIndex = new Star*[binFileStarCount];
+    for (unsigned int i = 0; i < binFileStarCount; i++)
+    {
+        binFileCatalogNumberIndex[i] = &unsortedStars[i];
     }
+    std::sort(binFileCatalogNumberIndex, binFileCatalogNumberIndex + binFileStarCount,
+              [](const Star* star0, const Star* star1) { return star0->getIndex() < star1->getIndex(); });
+}
+
 
-    if (in.bad())
+/*! Load the body of an octree ordered star database; data points just past
+ *  the common stars.dat header. The stars, octree and catalog number index
+ *  are used directly as the final database unless stc files add or modify
+ *  stars, in which case finish() sorts everything again.
+ */
+bool StarDatabase::loadOctreeBinary(const char* data, std::size_t size, std::uint32_t nStarsInFile)
+{
+    // The prebuilt octree can only describe a database with no other stars
+    if (nStars != 0 || octreeRoot != nullptr)
+    {
+        GetLogger()->error(_("Octree ordered star database must be loaded first\n"));
         return false;
+    }
 
-    auto loadTime = timer.getTime();
+    if (size < sizeof(StarsDatOctreeHeader)) { return false; }
 
-    GetLogger()->debug("StarDatabase::read: nStars = {}, time = {} ms\n", nStarsInFile, loadTime);
-    GetLogger()->info(_("{} stars in binary database\n"), nStars);
+    std::uint32_t nodeCount;
+    std::memcpy(&nodeCount, data + offsetof(StarsDatOctreeHeader, nodeCount), sizeof(nodeCount));
+    LE_TO_CPU_INT32(nodeCount, nodeCount);
+
+    std::uint64_t expectedSize = sizeof(StarsDatOctreeHeader)
+                               + std::uint64_t(nStarsInFile) * sizeof(StarsDatRecord)
+                               + std::uint64_t(nodeCount) * sizeof(StarsDatNodeRecord)
+                               + std::uint64_t(nStarsInFile) * sizeof(std::uint32_t);
+    if (size < expectedSize)
+    {
+        GetLogger()->error(_("Star database is truncated\n"));
+        return false;
+    }
 
-    // Create the temporary list of stars sorted by catalog number; this
-    // will be used to lookup stars during file loading. After loading is
-    // complete, the stars are sorted into an octree and this list gets
-    // replaced.
-    if (unsortedStars.size() > 0)
+    const char* ptr = data + sizeof(StarsDatOctreeHeader);
+
+    auto sortedStars = std::make_unique<Star[]>(nStarsInFile);
+    for (std::uint32_t i = 0; i < nStarsInFile; ++i)
+    {
+        if (!decodeStarRecord(ptr, sortedStars[i]))
+        {
+            GetLogger()->error(_("Bad spectral type in star database, star #{}\n"), i);
+            return false;
+        }
+        ptr += sizeof(StarsDatRecord);
+    }
+
+    std::vector<OctreeNodeRecord<float>> nodes;
+    nodes.reserve(nodeCount);
+    for (std::uint32_t i = 0; i < nodeCount; ++i)
+    {
+        OctreeNodeRecord<float>& node = nodes.emplace_back();
+
+        float x;
+        std::memcpy(&x, ptr + offsetof(StarsDatNodeRecord, x), sizeof(x));
+        LE_TO_CPU_FLOAT(x, x);
+
+        float y;
+        std::memcpy(&y, ptr + offsetof(StarsDatNodeRecord, y), sizeof(y));
+        LE_TO_CPU_FLOAT(y, y);
+
+        float z;
+        std::memcpy(&z, ptr + offsetof(StarsDatNodeRecord, z), sizeof(z));
+        LE_TO_CPU_FLOAT(z, z);
+
+        node.cellCenterPos = Eigen::Vector3f(x, y, z);
+
+        std::memcpy(&node.exclusionFactor, ptr + offsetof(StarsDatNodeRecord, exclusionFactor), sizeof(node.exclusionFactor));
+        LE_TO_CPU_FLOAT(node.exclusionFactor, node.exclusionFactor);
+
+        std::memcpy(&node.firstObject, ptr + offsetof(StarsDatNodeRecord, firstStar), sizeof(node.firstObject));
+        LE_TO_CPU_INT32(node.firstObject, node.firstObject);
+
+        std::memcpy(&node.nObjects, ptr + offsetof(StarsDatNodeRecord, nStars), sizeof(node.nObjects));
+        LE_TO_CPU_INT32(node.nObjects, node.nObjects);
+
+        std::uint32_t flags;
+        std::memcpy(&flags, ptr + offsetof(StarsDatNodeRecord, flags), sizeof(flags));
+        LE_TO_CPU_INT32(flags, flags);
+        node.hasChildren = (flags & STARSDAT_NODE_HAS_CHILDREN) != 0;
+
+        ptr += sizeof(StarsDatNodeRecord);
+    }
+
+    std::unique_ptr<StarOctree> root{ StarOctree::unflatten(nodes, sortedStars.get(), nStarsInFile) };
+    if (root == nullptr)
+    {
+        GetLogger()->error(_("Bad octree in star database\n"));
+        return false;
+    }
+
+    auto index = std::make_unique<Star*[]>(nStarsInFile);
+    for (std::uint32_t i = 0; i < nStarsInFile; ++i)
     {
-        binFileStarCount = unsortedStars.size();
-        binFileCatalogNumberIndex = new Star*[binFileStarCount];
-        for (unsigned int i = 0; i < binFileStarCount; i++)
+        std::uint32_t starIndex;
+        std::memcpy(&starIndex, ptr, sizeof(starIndex));
+        LE_TO_CPU_INT32(starIndex, starIndex);
+
+        if (starIndex >= nStarsInFile ||
+            (i > 0 && sortedStars[starIndex].getIndex() < index[i - 1]->getIndex()))
         {
-            binFileCatalogNumberIndex[i] = &unsortedStars[i];
+            GetLogger()->error(_("Bad catalog number index in star database\n"));
+            return false;
         }
-        std::sort(binFileCatalogNumberIndex, binFileCatalogNumberIndex + binFileStarCount,
-                  [](const Star* star0, const Star* star1) { return star0->getIndex() < star1->getIndex(); });
+
+        index[i] = &sortedStars[starIndex];
+        ptr += sizeof(std::uint32_t);
     }
 
+    stars = sortedStars.release();
+    octreeRoot = root.release();
+    binFileCatalogNumberIndex = index.release();
+    binFileStarCount = nStarsInFile;
+    nStars = nStarsInFile;
+
     return true;
 }
 
 
+/*! Convert a version 1 binary star database into the octree ordered layout,
+ *  so that loading it doesn't require sorting the stars into an octree.
+ *  Record contents are copied verbatim; only their order changes.
+ */
+bool StarDatabase::writeOctreeBinary(std::istream& in, std::ostream& out)
+{
+    std::uint32_t nStarsInFile = 0;
+    {
+        std::array<char, sizeof(StarsDatHeader)> header;
+        if (!in.read(header.data(), header.size()).good()) { return false; }
+
+        std::uint16_t version;
+        if (!parseStarsDatHeader(header.data(), version, nStarsInFile) || version != STARSDAT_VERSION) { return false; }
+    }
+
+    std::vector<char> records(std::size_t(nStarsInFile) * sizeof(StarsDatRecord));
+    if (!in.read(records.data(), records.size()).good()) { return false; }
+
+    // Use the position of each record in the file as the star index, so
+    // that the records can be written out in octree order afterwards.
+    std::vector<Star> unsorted(nStarsInFile);
+    for (std::uint32_t i = 0; i < nStarsInFile; ++i)
+    {
+        if (!decodeStarRecord(records.data() + std::size_t(i) * sizeof(StarsDatRecord), unsorted[i]))
+        {
+            GetLogger()->error(_("Bad spectral type in star database, star #{}\n"), i);
+            return false;
+        }
+        unsorted[i].setIndex(i);
+    }
+
+    std::unique_ptr<DynamicStarOctree> root{ createDynamicStarOctree() };
+    for (const Star& star : unsorted)
+        root->insertObject(star, STAR_OCTREE_ROOT_SIZE);
+
+    auto sortedStars = std::make_unique<Star[]>(nStarsInFile);
+    Star* firstStar = sortedStars.get();
+    StarOctree* octree = nullptr;
+    root->rebuildAndSort(octree, firstStar);
+    root.reset();
+    unsorted.clear();
+
+    std::vector<OctreeNodeRecord<float>> nodes;
+    octree->flatten(nodes, sortedStars.get());
+    delete octree;
+
+    auto recordAt = [&](std::uint32_t i)
+    {
+        return records.data() + std::size_t(sortedStars[i].getIndex()) * sizeof(StarsDatRecord);
+    };
+
+    // Positions of the sorted records, ordered by catalog number
+    std::vector<std::uint32_t> catalogIndex(nStarsInFile);
+    std::iota(catalogIndex.begin(), catalogIndex.end(), UINT32_C(0));
+    std::stable_sort(catalogIndex.begin(), catalogIndex.end(),
+                     [&](std::uint32_t i0, std::uint32_t i1)
+                     {
+                         return getRecordCatalogNumber(recordAt(i0)) < getRecordCatalogNumber(recordAt(i1));
+                     });
+
+    out.write(STARSDAT_MAGIC.data(), STARSDAT_MAGIC.size());
+    celutil::writeLE<std::uint16_t>(out, STARSDAT_OCTREE_VERSION);
+    celutil::writeLE<std::uint32_t>(out, nStarsInFile);
+    celutil::writeLE<std::uint32_t>(out, static_cast<std::uint32_t>(nodes.size()));
+
+    for (std::uint32_t i = 0; i < nStarsInFile; ++i)
+        out.write(recordAt(i), sizeof(StarsDatRecord));
+
+    for (const auto& node : nodes)
+    {
+        celutil::writeLE<float>(out, node.cellCenterPos.x());
+        celutil::writeLE<float>(out, node.cellCenterPos.y());
+        celutil::writeLE<float>(out, node.cellCenterPos.z());
+        celutil::writeLE<float>(out, node.exclusionFactor);
+        celutil::writeLE<std::uint32_t>(out, node.firstObject);
+        celutil::writeLE<std::uint32_t>(out, node.nObjects);
+        celutil::writeLE<std::uint32_t>(out, node.hasChildren ? STARSDAT_NODE_HAS_CHILDREN : 0);
+    }
+
+    for (std::uint32_t i : catalogIndex)
+        celutil::writeLE<std::uint32_t>(out, i);
+
+    return out.good();
+}
+
+
 void StarDatabase::finish()
 {
     GetLogger()->info(_("Total star count: {}\n"), nStars);
 
-    buildOctree();
+    if (octreeRoot != nullptr && unsortedStars.size() == 0 && !starsModifiedWhileLoading)
+    {
+        // The binary database was stored in octree order and no stc file
+        // changed it, so its octree is final.
+        GetLogger()->debug("Using prebuilt star octree\n");
+    }
+    else
+    {
+        buildOctree();
+    }
+
     buildIndexes();
 
     // Delete the temporary indices used only during loading
     delete[] binFileCatalogNumberIndex;
+    binFileCatalogNumberIndex = nullptr;
     stcFileCatalogNumberIndex.clear();
 
     // Resolve all barycenters; this can't be done before star sorting. There's
@@ -825,6 +1232,8 @@ void StarDatabase::finish()
     }
 
     barycenters.clear();
+
+    cullingTable.build(stars, nStars);
 }
 
 
@@ -1247,8 +1656,15 @@ bool StarDatabase::createStar(Star* star,
  */
 bool StarDatabase::load(std::istream& in, const fs::path& resourcePath)
 {
-    Tokenizer tokenizer(&in);
-    Parser parser(&tokenizer);
+    ParsedCatalog catalog = ParsedCatalog::read(in);
+    return load(catalog, resourcePath);
+}
+
+
+bool StarDatabase::load(ParsedCatalog& catalog, const fs::path& resourcePath)
+{
+    Tokenizer tokenizer(catalog.getTokens());
+    Parser parser(&tokenizer, &catalog);
 
 #ifdef ENABLE_NLS
     std::string s = resourcePath.string();
@@ -1388,6 +1804,8 @@ bool StarDatabase::load(std::istream& in, const fs::path& resourcePath)
         }
 
         bool isNewStar = star == nullptr;
+        if (!isNewStar)
+            starsModifiedWhileLoading = true;
 
         tokenizer.pushBack();
 
@@ -1422,7 +1840,7 @@ bool StarDatabase::load(std::istream& in, const fs::path& resourcePath)
                 delete star;
 
                 // Add the new star to the temporary (load time) index.
-                stcFileCatalogNumberIndex[catalogNumber] = &unsortedStars[unsortedStars.size() - 1];
+                stcFileCatalogNumberIndex.insertOrAssign(catalogNumber, &unsortedStars[unsortedStars.size() - 1]);
             }
 
             if (namesDB != nullptr && !objName.empty())
@@ -1464,28 +1882,81 @@ bool StarDatabase::load(std::istream& in, const fs::path& resourcePath)
 
 void StarDatabase::buildOctree()
 {
-    // This should only be called once for the database
-    // ASSERT(octreeRoot == nullptr);
+    // Gather the stars in load order: stars from an octree ordered binary
+    // database come first, followed by the stars added by stc files. Keeping
+    // them in a single array lets the octree cache refer to each star by its
+    // position in the load order.
+    auto loadedStars = std::make_unique<Star[]>(nStars);
+    std::uint32_t nLoaded = 0;
+    if (octreeRoot != nullptr)
+    {
+        std::copy(stars, stars + binFileStarCount, loadedStars.get());
+        nLoaded = binFileStarCount;
+
+        delete octreeRoot;
+        octreeRoot = nullptr;
+    }
 
-    GetLogger()->debug("Sorting stars into octree . . .\n");
-    float absMag = astro::appToAbsMag(STAR_OCTREE_MAGNITUDE,
-                                      STAR_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
-    DynamicStarOctree* root = new DynamicStarOctree(Eigen::Vector3f(1000.0f, 1000.0f, 1000.0f),
-                                                    absMag);
     for (unsigned int i = 0; i < unsortedStars.size(); ++i)
+        loadedStars[nLoaded++] = unsortedStars[i];
+
+    assert(nLoaded == nStars);
+    unsortedStars.clear();
+    delete[] stars;
+
+    Star* sortedStars = new Star[nStars];
+
+    std::uint64_t cacheKey = 0;
+    if (!octreeCacheFile.empty())
     {
-        root->insertObject(unsortedStars[i], STAR_OCTREE_ROOT_SIZE);
+        cacheKey = computeOctreeCacheKey(loadedStars.get());
+
+        std::vector<std::uint32_t> order;
+        std::vector<OctreeNodeRecord<float>> nodes;
+        if (LoadOctreeCache(octreeCacheFile, cacheKey, nStars, order, nodes))
+        {
+            for (std::uint32_t i = 0; i < nStars; ++i)
+                sortedStars[i] = loadedStars[order[i]];
+
+            octreeRoot = StarOctree::unflatten(nodes, sortedStars, nStars);
+            if (octreeRoot != nullptr)
+                GetLogger()->debug("Loaded star octree from cache {}\n", octreeCacheFile);
+        }
     }
 
-    GetLogger()->debug("Spatially sorting stars for improved locality of reference . . .\n");
-    Star* sortedStars    = new Star[nStars];
-    Star* firstStar      = sortedStars;
-    root->rebuildAndSort(octreeRoot, firstStar);
+    if (octreeRoot == nullptr)
+    {
+        GetLogger()->debug("Sorting stars into octree . . .\n");
+        DynamicStarOctree* root = createDynamicStarOctree();
+        for (std::uint32_t i = 0; i < nStars; ++i)
+        {
+            root->insertObject(loadedStars[i], STAR_OCTREE_ROOT_SIZE);
+        }
+
+        GetLogger()->debug("Spatially sorting stars for improved locality of reference . . .\n");
+        Star* firstStar = sortedStars;
+        std::vector<const Star*> sources;
+        root->rebuildAndSort(octreeRoot, firstStar, octreeCacheFile.empty() ? nullptr : &sources);
+        delete root;
+
+        // ASSERT((int) (firstStar - sortedStars) == nStars);
+        GetLogger()->debug("{} stars total\nOctree has {} nodes and {} stars.\n",
+                           firstStar - sortedStars,
+                           1 + octreeRoot->countChildren(), octreeRoot->countObjects());
+
+        if (!octreeCacheFile.empty())
+        {
+            std::vector<std::uint32_t> order;
+            order.reserve(sources.size());
+            for (const Star* star : sources)
+                order.push_back(static_cast<std::uint32_t>(star - loadedStars.get()));
+
+            std::vector<OctreeNodeRecord<float>> nodes;
+            octreeRoot->flatten(nodes, sortedStars);
+            SaveOctreeCache(octreeCacheFile, cacheKey, order, nodes);
+        }
+    }
 
-    // ASSERT((int) (firstStar - sortedStars) == nStars);
-    GetLogger()->debug("{} stars total\nOctree has {} nodes and {} stars.\n",
-                       firstStar - sortedStars,
-                       1 + octreeRoot->countChildren(), octreeRoot->countObjects());
 #ifdef PROFILE_OCTREE
     vector<OctreeLevelStatistics> stats;
     octreeRoot->computeStatistics(stats);
@@ -1502,15 +1973,32 @@ void StarDatabase::buildOctree()
     }
 #endif
 
-    // Clean up . . .
-    //delete[] stars;
-    unsortedStars.clear();
-    delete root;
-
     stars = sortedStars;
 }
 
 
+std::uint64_t StarDatabase::computeOctreeCacheKey(const Star* loadedStars) const
+{
+    OctreeCacheKey key;
+    key.add(STAR_OCTREE_ROOT_SIZE);
+    key.add(STAR_OCTREE_MAGNITUDE);
+    key.add(nStars);
+    for (std::uint32_t i = 0; i < nStars; ++i)
+    {
+        const Star& star = loadedStars[i];
+        Eigen::Vector3f position = star.getPosition();
+        key.add(star.getIndex());
+        key.add(position.x());
+        key.add(position.y());
+        key.add(position.z());
+        key.add(star.getAbsoluteMagnitude());
+        key.add(star.getOrbitalRadius());
+    }
+
+    return key.value();
+}
+
+
 void StarDatabase::buildIndexes()
 {
     // This should only be called once for the database
@@ -1518,12 +2006,10 @@ void StarDatabase::buildIndexes()
 
     GetLogger()->info("Building catalog number indexes . . .\n");
 
-    catalogNumberIndex = new Star*[nStars];
-    for (int i = 0; i < nStars; ++i)
-        catalogNumberIndex[i] = &stars[i];
-
-    std::sort(catalogNumberIndex, catalogNumberIndex + nStars,
-              [](const Star* star0, const Star* star1) { return star0->getIndex() < star1->getIndex(); });
+    catalogNumberIndex.clear();
+    catalogNumberIndex.reserve(nStars);
+    for (std::uint32_t i = 0; i < nStars; ++i)
+        catalogNumberIndex.insert(stars[i].getIndex(), i);
 }
 
 
@@ -1532,11 +2018,11 @@ void StarDatabase::buildIndexes()
  *  after all stars have been loaded. During catalog loading, there are two
  *  separate indexes: one for the binary catalog and another index for stars
  *  loaded from stc files. They binary catalog index is a sorted array, while
- *  the stc catalog index is an STL map. Since the binary file can be quite
- *  large, we want to avoid creating a map with as many nodes as there are
- *  stars. Stc files should collectively contain many fewer stars, and stars
- *  in an stc file may reference each other (barycenters). Thus, a dynamic
- *  structure like a map is both practical and essential.
+ *  the stc catalog index is a hash index. Since the binary file can be quite
+ *  large, we want to avoid copying all of its stars into another structure.
+ *  Stc files should collectively contain many fewer stars, and stars in an
+ *  stc file may reference each other (barycenters). Thus, a dynamic
+ *  structure is both practical and essential.
  */
 Star* StarDatabase::findWhileLoading(AstroCatalog::IndexNumber catalogNumber) const
 {
@@ -1553,11 +2039,8 @@ Star* StarDatabase::findWhileLoading(AstroCatalog::IndexNumber catalogNumber) co
     }
 
     // Next check for stars loaded from an stc file
-    std::map<AstroCatalog::IndexNumber, Star*>::const_iterator iter = stcFileCatalogNumberIndex.find(catalogNumber);
-    if (iter != stcFileCatalogNumberIndex.end())
-    {
-        return iter->second;
-    }
+    if (Star* const* star = stcFileCatalogNumberIndex.find(catalogNumber); star != nullptr)
+        return *star;
 
     // Star not found
     return nullptr;
@@ -10,9 +10,10 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <iosfwd>
-#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -21,12 +22,16 @@
 
 #include <celcompat/filesystem.h>
 #include <celengine/parseobject.h>
+#include <celutil/array_view.h>
 #include <celutil/blockarray.h>
+#include <celutil/hashindex.h>
 #include "astroobj.h"
+#include "compactstarstore.h"
 #include "hash.h"
 #include "staroctree.h"
 
 
+class ParsedCatalog;
 class StarNameDatabase;
 
 
@@ -44,6 +49,9 @@ class StarDatabase
 
     Star* find(AstroCatalog::IndexNumber catalogNumber) const;
     Star* find(const std::string&, bool i18n) const;
+    // Look up many catalog numbers at once, storing nullptr for those
+    // without a star
+    void find(celestia::util::array_view<AstroCatalog::IndexNumber> catalogNumbers, Star** result) const;
     AstroCatalog::IndexNumber findCatalogNumberByName(const std::string&, bool i18n) const;
 
     std::vector<std::string> getCompletion(const std::string&, bool i18n) const;
@@ -54,20 +62,33 @@ class StarDatabase
                           float fovY,
                           float aspectRatio,
                           float limitingMag,
-                          OctreeProcStats * = nullptr) const;
+                          OctreeProcStats * = nullptr,
+                          celestia::util::ThreadPool* pool = nullptr) const;
 
     void findCloseStars(StarHandler& starHandler,
                         const Eigen::Vector3f& obsPosition,
                         float radius) const;
 
+    // Copy the stars into a compact store, in the same order and with the
+    // same octree, once the database is finished. Returns nullptr if the
+    // stars can't be stored compactly.
+    std::unique_ptr<CompactStarStore> createCompactStore(float positionTolerance = CompactStarStore::DefaultPositionTolerance) const;
+
     std::string getStarName(const Star&, bool i18n = false) const;
     std::string getStarNameList(const Star&, const unsigned int maxNames = MAX_STAR_NAMES) const;
 
     StarNameDatabase* getNameDatabase() const;
     void setNameDatabase(StarNameDatabase*);
 
+    // Reuse or save the sorted octree in this file when finishing loading
+    void setOctreeCacheFile(const fs::path&);
+
     bool load(std::istream&, const fs::path& resourcePath = fs::path());
+    bool load(ParsedCatalog&, const fs::path& resourcePath = fs::path());
     bool loadBinary(std::istream&);
+    bool loadBinary(const fs::path&);
+
+    static bool writeOctreeBinary(std::istream&, std::ostream&);
 
     enum Catalog
     {
@@ -81,19 +102,12 @@ class StarDatabase
     // a HIPPARCOS stars.
     static constexpr AstroCatalog::IndexNumber MAX_HIPPARCOS_NUMBER = 999999;
 
-    struct CrossIndexEntry
-    {
-        AstroCatalog::IndexNumber catalogNumber;
-        AstroCatalog::IndexNumber celCatalogNumber;
-
-        bool operator<(const CrossIndexEntry&) const;
-    };
-
-    using CrossIndex = std::vector<CrossIndexEntry>;
-
     bool loadCrossIndex(const Catalog, std::istream&);
     AstroCatalog::IndexNumber searchCrossIndexForCatalogNumber(const Catalog, const AstroCatalog::IndexNumber number) const;
     Star* searchCrossIndex(const Catalog, const AstroCatalog::IndexNumber number) const;
+    void searchCrossIndex(const Catalog,
+                          celestia::util::array_view<AstroCatalog::IndexNumber> numbers,
+                          Star** result) const;
     AstroCatalog::IndexNumber crossIndex(const Catalog, const AstroCatalog::IndexNumber number) const;
 
     void finish();
@@ -106,19 +120,36 @@ private:
                     const fs::path& path,
                     const bool isBarycenter);
 
+    bool addBinaryRecords(const char*, std::uint32_t);
+    void buildBinFileIndex();
+    bool loadOctreeBinary(const char*, std::size_t, std::uint32_t);
+
     void buildOctree();
     void buildIndexes();
+    std::uint64_t computeOctreeCacheKey(const Star*) const;
     Star* findWhileLoading(AstroCatalog::IndexNumber catalogNumber) const;
 
     std::uint32_t nStars{ 0 };
 
     Star*             stars{ nullptr };
     StarNameDatabase* namesDB{ nullptr };
-    Star**            catalogNumberIndex{ nullptr };
+    // Catalog number -> index of the star in stars
+    celestia::util::HashIndex<std::uint32_t> catalogNumberIndex;
     StarOctree*       octreeRoot{ nullptr };
+    StarCullingTable  cullingTable;
     AstroCatalog::IndexNumber nextAutoCatalogNumber{ 0xfffffffe };
 
-    std::vector<CrossIndex*> crossIndexes;
+    struct CrossIndex
+    {
+        // Catalog number -> Celestia catalog number
+        celestia::util::HashIndex<AstroCatalog::IndexNumber> celCatalogNumbers;
+        // Celestia catalog number -> lowest catalog number
+        celestia::util::HashIndex<AstroCatalog::IndexNumber> catalogNumbers;
+    };
+
+    std::vector<CrossIndex> crossIndexes;
+
+    fs::path octreeCacheFile;
 
     // These values are used by the star database loader; they are
     // not used after loading is complete.
@@ -127,7 +158,9 @@ private:
     Star** binFileCatalogNumberIndex{ nullptr };
     unsigned int binFileStarCount{ 0 };
     // Catalog number -> star mapping for stars loaded from stc files
-    std::map<AstroCatalog::IndexNumber, Star*> stcFileCatalogNumberIndex;
+    celestia::util::HashIndex<Star*> stcFileCatalogNumberIndex;
+    // Set when an stc file changes a star that has already been loaded
+    bool starsModifiedWhileLoading{ false };
 
     struct BarycenterUsage
     {
@@ -10,6 +10,11 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
 #include <celengine/staroctree.h>
 
 using namespace Eigen;
@@ -24,6 +29,16 @@ using namespace Eigen;
 // render stars with orbits that are closer than MAX_STAR_ORBIT_RADIUS.
 static const float MAX_STAR_ORBIT_RADIUS = 1.0f;
 
+// Stars in the culling table are tested in blocks of up to this size,
+// which don't straddle the groups of the table. The test of a block has no
+// branches and no dependencies between the stars, so the compiler is free
+// to vectorize it; without SIMD support it simply runs as a loop.
+static const unsigned int STAR_CULLING_BLOCK_SIZE = 16;
+
+// Relative slack allowed for in the culling table test, which doesn't
+// compute magnitudes the same way as the exact test.
+static const float STAR_CULLING_MARGIN = 1.0e-3f;
+
 
 // The octree node into which a star is placed is dependent on two properties:
 // its obsPosition and its luminosity--the fainter the star, the deeper the node
@@ -85,20 +100,16 @@ template<> DynamicStarOctree::ExclusionFactorDecayFunction*
 
 // total specialization of the StaticOctree template process*() methods for stars:
 template<>
-void StarOctree::processVisibleObjects(StarHandler&    processor,
-                                       const Vector3f& obsPosition,
-                                       const Hyperplane<float, 3>*   frustumPlanes,
-                                       float           limitingFactor,
-                                       float           scale,
-                                       OctreeProcStats *stats) const
+bool StarOctree::processVisibleNode(StarHandler&    processor,
+                                    const Vector3f& obsPosition,
+                                    const Hyperplane<float, 3>*   frustumPlanes,
+                                    float           limitingFactor,
+                                    float           scale,
+                                    OctreeProcStats *stats) const
 {
 #ifdef OCTREE_DEBUG
-    size_t h;
     if (stats != nullptr)
-    {
-        h = stats->height + 1;
         stats->nodes++;
-    }
 #endif
     // See if this node lies within the view frustum
 
@@ -109,7 +120,7 @@ void StarOctree::processVisibleObjects(StarHandler&    processor,
         const Hyperplane<float, 3>& plane = frustumPlanes[i];
         float r = scale * plane.normal().cwiseAbs().sum();
         if (plane.signedDistance(cellCenterPos) < -r)
-            return;
+            return false;
     }
 
     // Compute the distance to node; this is equal to the distance to
@@ -139,31 +150,243 @@ void StarOctree::processVisibleObjects(StarHandler&    processor,
 
     // See if any of the objects in child nodes are potentially included
     // that we need to recurse deeper.
-    if (minDistance <= 0 || astro::absToAppMag(exclusionFactor, minDistance) <= limitingFactor)
+    return minDistance <= 0 || astro::absToAppMag(exclusionFactor, minDistance) <= limitingFactor;
+}
+
+
+namespace
+{
+
+// Convert root brightnesses to the 16 bit format of the culling table: the
+// upper half of the float, rounded up.
+inline std::uint16_t
+packBrightness(float brightness)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &brightness, sizeof(bits));
+    if ((bits & 0xffffU) != 0 && (bits & 0x7f800000U) != 0x7f800000U)
+        bits += 0x10000U;
+    return static_cast<std::uint16_t>(bits >> 16);
+}
+
+inline float
+unpackBrightness(std::uint16_t packed)
+{
+    std::uint32_t bits = static_cast<std::uint32_t>(packed) << 16;
+    float brightness;
+    std::memcpy(&brightness, &bits, sizeof(brightness));
+    return brightness;
+}
+
+
+// Thresholds of the culling table test, which only depend on the limiting
+// magnitude
+struct CullingThresholds
+{
+    float limitingMag{ std::numeric_limits<float>::quiet_NaN() };
+    // Distance up to which a star of unit root brightness is within the
+    // magnitude limit
+    float distanceRatio{ 0.0f };
+};
+
+
+// The thresholds for limitingMag. They are the same for all the nodes of a
+// traversal, so the last ones computed by each thread are kept rather than
+// computing a power for every node.
+const CullingThresholds&
+getCullingThresholds(float limitingMag)
+{
+    thread_local CullingThresholds thresholds;
+    if (thresholds.limitingMag != limitingMag)
     {
-        // Recurse into the child nodes
-        if (_children != nullptr)
+        // A star of absolute magnitude M is within the limit up to a
+        // distance of 10^(0.2 * (limitingMag + 5 - M)) parsecs. The ratio
+        // is slightly increased so that no star passing the exact test is
+        // rejected by the table.
+        thresholds.limitingMag = limitingMag;
+        thresholds.distanceRatio = LY_PER_PARSEC<float> * std::pow(10.0f, 0.2f * (limitingMag + 5.0f))
+                                 * (1.0f + STAR_CULLING_MARGIN);
+    }
+    return thresholds;
+}
+
+
+// Conservative visibility test of the count consecutive stars of table
+// starting at first, which must belong to the same group. Sets candidate[i]
+// for each star which may pass the exact test of processVisibleObjects():
+// closer than either the distance at which it falls below the magnitude
+// limit or the star orbit radius. Distances are increased by the
+// quantization error and compared squared, so that there are no square
+// roots to compute.
+inline void
+cullStars(const StarCullingTable& table,
+          std::size_t first,
+          unsigned int count,
+          const Vector3f& obsPosition,
+          const CullingThresholds& thresholds,
+          bool* candidate)
+{
+    const StarCullingTable::Group& group = table.groups[first >> StarCullingTable::GroupShift];
+    const float originX = group.origin.x() - obsPosition.x();
+    const float originY = group.origin.y() - obsPosition.y();
+    const float originZ = group.origin.z() - obsPosition.z();
+    const float step = group.step;
+    const float error = group.error;
+    const float distanceRatio = thresholds.distanceRatio;
+    const float orbitRadius = MAX_STAR_ORBIT_RADIUS * (1.0f + STAR_CULLING_MARGIN);
+
+    const std::uint16_t* x = table.x.data() + first;
+    const std::uint16_t* y = table.y.data() + first;
+    const std::uint16_t* z = table.z.data() + first;
+    const std::uint16_t* rootBrightness = table.rootBrightness.data() + first;
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        float dx = originX + static_cast<float>(x[i]) * step;
+        float dy = originY + static_cast<float>(y[i]) * step;
+        float dz = originZ + static_cast<float>(z[i]) * step;
+        float distanceSquared = dx * dx + dy * dy + dz * dz;
+        float maxDistance = std::max(unpackBrightness(rootBrightness[i]) * distanceRatio, orbitRadius) + error;
+        candidate[i] = distanceSquared < maxDistance * maxDistance;
+    }
+}
+
+} // end unnamed namespace
+
+
+void StarCullingTable::build(const Star* stars, std::uint32_t nStars)
+{
+    constexpr std::uint32_t groupSize = 1U << GroupShift;
+    constexpr float maxStep = 65535.0f;
+
+    firstStar = stars;
+    groups.resize((nStars + groupSize - 1) / groupSize);
+    x.resize(nStars);
+    y.resize(nStars);
+    z.resize(nStars);
+    rootBrightness.resize(nStars);
+
+    for (std::uint32_t groupStart = 0; groupStart < nStars; groupStart += groupSize)
+    {
+        std::uint32_t groupEnd = std::min(groupStart + groupSize, nStars);
+        AlignedBox3f bounds;
+        for (std::uint32_t i = groupStart; i < groupEnd; ++i)
+            bounds.extend(stars[i].getPosition());
+
+        Group& group = groups[groupStart >> GroupShift];
+        group.origin = bounds.min();
+        group.step = bounds.sizes().maxCoeff() / maxStep;
+
+        double maxError = 0.0;
+        for (std::uint32_t i = groupStart; i < groupEnd; ++i)
         {
-            for (int i=0; i<8; ++i)
+            Vector3f position = stars[i].getPosition();
+            std::uint16_t q[3];
+            for (int axis = 0; axis < 3; ++axis)
             {
-                _children[i]->processVisibleObjects(processor,
-                                                    obsPosition,
-                                                    frustumPlanes,
-                                                    limitingFactor,
-                                                    scale * 0.5f,
-                                                    stats
-                                                   );
-#ifdef OCTREE_DEBUG
-                if (stats != nullptr && stats->height > h)
-                    h = stats->height;
-#endif
+                float offset = group.step > 0.0f ? (position[axis] - group.origin[axis]) / group.step : 0.0f;
+                q[axis] = static_cast<std::uint16_t>(std::clamp(std::round(offset), 0.0f, maxStep));
             }
+            x[i] = q[0];
+            y[i] = q[1];
+            z[i] = q[2];
+
+            Vector3d quantized(group.origin.x() + static_cast<float>(q[0]) * group.step,
+                               group.origin.y() + static_cast<float>(q[1]) * group.step,
+                               group.origin.z() + static_cast<float>(q[2]) * group.step);
+            maxError = std::max(maxError, (quantized - position.cast<double>()).norm());
+        }
+
+        // Allow for the rounding of the quantized positions, which may not
+        // be computed exactly the same way by cullStars().
+        float extent = group.origin.cwiseAbs().maxCoeff() + group.step * maxStep;
+        group.error = static_cast<float>(maxError) + 8.0f * std::numeric_limits<float>::epsilon() * extent;
+    }
+
+    for (std::uint32_t i = 0; i < nStars; ++i)
+    {
+        // Extinction only ever makes a star fainter, except if it is
+        // negative; those stars always get the exact test.
+        const Star& star = stars[i];
+        if (star.getExtinction() < 0.0f)
+            rootBrightness[i] = packBrightness(std::numeric_limits<float>::infinity());
+        else
+            rootBrightness[i] = packBrightness(std::max(std::pow(10.0f, -0.2f * star.getAbsoluteMagnitude()),
+                                                        std::numeric_limits<float>::min()));
+    }
+}
+
+
+template<>
+bool StarOctree::processVisibleNode(StarHandler&            processor,
+                                    const StarCullingTable& table,
+                                    const Vector3f&         obsPosition,
+                                    const Hyperplane<float, 3>* frustumPlanes,
+                                    float                   limitingFactor,
+                                    float                   scale,
+                                    OctreeProcStats         *stats) const
+{
 #ifdef OCTREE_DEBUG
-            if (stats != nullptr)
-                stats->height = h;
+    if (stats != nullptr)
+    {
+        stats->nodes++;
+        stats->objects += nObjects;
+    }
 #endif
+    // See if this node lies within the view frustum
+    for (unsigned int i = 0; i < 5; ++i)
+    {
+        const Hyperplane<float, 3>& plane = frustumPlanes[i];
+        float r = scale * plane.normal().cwiseAbs().sum();
+        if (plane.signedDistance(cellCenterPos) < -r)
+            return false;
+    }
+
+    float minDistance = (obsPosition - cellCenterPos).norm() - scale * StarOctree::SQRT3;
+    float dimmest     = minDistance > 0 ? astro::appToAbsMag(limitingFactor, minDistance) : 1000;
+
+    // Stars too dim for this node are farther than the distance at which
+    // they fall below the limit, so the table needs no test of its own
+    // for them.
+    const CullingThresholds& thresholds = getCullingThresholds(limitingFactor);
+
+    bool candidate[STAR_CULLING_BLOCK_SIZE];
+    unsigned int candidateIndex[STAR_CULLING_BLOCK_SIZE];
+    std::size_t tableStart = _firstObject - table.firstStar;
+    std::size_t tableEnd = tableStart + nObjects;
+    for (std::size_t blockStart = tableStart; blockStart < tableEnd;)
+    {
+        std::size_t groupEnd = ((blockStart >> StarCullingTable::GroupShift) + 1) << StarCullingTable::GroupShift;
+        auto blockSize = static_cast<unsigned int>(std::min({ tableEnd, groupEnd, blockStart + STAR_CULLING_BLOCK_SIZE })
+                                                   - blockStart);
+        cullStars(table, blockStart, blockSize, obsPosition, thresholds, candidate);
+
+        // Gather the candidates without branching on each of them
+        unsigned int nCandidates = 0;
+        for (unsigned int i = 0; i < blockSize; ++i)
+        {
+            candidateIndex[nCandidates] = i;
+            nCandidates += candidate[i];
+        }
+
+        const Star* blockStars = _firstObject + (blockStart - tableStart);
+        blockStart += blockSize;
+        for (unsigned int i = 0; i < nCandidates; ++i)
+        {
+            // The same test as in the version without the table
+            const Star& obj = blockStars[candidateIndex[i]];
+            if (obj.getAbsoluteMagnitude() < dimmest)
+            {
+                float distance    = (obsPosition - obj.getPosition()).norm();
+                float appMag      = obj.getApparentMagnitude(distance);
+
+                if (appMag < limitingFactor || (distance < MAX_STAR_ORBIT_RADIUS && obj.getOrbit()))
+                    processor.process(obj, distance, appMag);
+            }
         }
     }
+
+    return minDistance <= 0 || astro::absToAppMag(exclusionFactor, minDistance) <= limitingFactor;
 }
 
 
@@ -13,12 +13,62 @@
 #ifndef _CELENGINE_STAROCTREE_H_
 #define _CELENGINE_STAROCTREE_H_
 
+#include <cstdint>
+#include <vector>
 #include <celengine/star.h>
 #include <celengine/octree.h>
 
 
+// Positions and brightnesses of the stars in a StarOctree, stored as
+// separate arrays in the same order as the stars. The visibility test
+// runs over these in blocks, and only the stars that pass it are accessed
+// to compute their exact distance and apparent magnitude.
+//
+// The arrays are kept small so that the traversal stays in cache: positions
+// are quantized to 16 bits per coordinate within the bounding box of each
+// group of consecutive stars, which lie close together in octree order, and
+// brightnesses are rounded up to 16 bit floats. The test allows for the
+// rounding, so it never rejects a star that passes the exact test.
+template<> struct OctreeCullingTable<Star, float>
+{
+    // Groups of 64 stars share a quantization grid
+    static constexpr unsigned int GroupShift = 6;
+
+    struct Group
+    {
+        Eigen::Vector3f origin;
+        // Size of a quantization step, in light years
+        float step;
+        // Upper bound of the distance between the quantized and the actual
+        // positions of the stars of the group
+        float error;
+    };
+
+    const Star* firstStar{ nullptr };
+    std::vector<Group> groups;
+    std::vector<std::uint16_t> x;
+    std::vector<std::uint16_t> y;
+    std::vector<std::uint16_t> z;
+    // Upper half of the bits of the float 10^(-0.2 * absolute magnitude),
+    // the square root of the brightness, rounded up. The distance up to
+    // which a star is within the magnitude limit is proportional to it,
+    // so the limit can be tested without a logarithm or a square root.
+    std::vector<std::uint16_t> rootBrightness;
+
+    void build(const Star* stars, std::uint32_t nStars);
+};
+
 typedef DynamicOctree  <Star, float> DynamicStarOctree;
 typedef StaticOctree   <Star, float> StarOctree;
 typedef OctreeProcessor<Star, float> StarHandler;
+typedef OctreeCullingTable<Star, float> StarCullingTable;
+
+template<> bool StarOctree::processVisibleNode(StarHandler&, const Eigen::Vector3f&,
+                                               const Eigen::Hyperplane<float, 3>*,
+                                               float, float, OctreeProcStats*) const;
+template<> bool StarOctree::processVisibleNode(StarHandler&, const StarCullingTable&,
+                                               const Eigen::Vector3f&,
+                                               const Eigen::Hyperplane<float, 3>*,
+                                               float, float, OctreeProcStats*) const;
 
 #endif  // _CELENGINE_STAROCTREE_H_
@@ -7,12 +7,15 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <celutil/filetype.h>
 #include <celutil/logger.h>
 #include <celutil/fsutils.h>
 #include <fstream>
 #include <array>
+#include <memory>
 #include "multitexture.h"
 #include "texmanager.h"
+#include "virtualtex.h"
 
 using namespace std;
 using namespace celestia;
@@ -88,6 +91,38 @@ fs::path TextureInfo::resolve(const fs::path& baseDir)
 
 
 Texture* TextureInfo::load(const fs::path& name)
+{
+    Finisher finisher = prepare(name);
+    if (!finisher)
+    {
+        GetLogger()->debug("Loading virtual texture: {}\n", name);
+        return LoadVirtualTexture(name);
+    }
+
+    return finisher();
+}
+
+
+// Textures aren't rendered in sRGB formats, and their texels may be
+// normals or masks rather than colors, so they are filtered in the space
+// they are stored in, as glGenerateMipmap does.
+Image* BuildTextureMipmaps(const Image& img, Texture::AddressMode addressMode)
+{
+    if (img.isCompressed() || img.getMipLevelCount() != 1)
+        return nullptr;
+
+    return img.buildMipmaps(Image::MipmapFilter::Box, false,
+                            addressMode == Texture::Wrap,
+                            GetImageThreadPool());
+}
+
+
+// Images are read and decoded, height maps converted to normal maps and
+// mipmaps built here; only the creation of the texture object is left to
+// the finisher.
+// Virtual textures only read their tile layout up front and are left to
+// load().
+TextureInfo::Finisher TextureInfo::prepare(const fs::path& name) const
 {
     Texture::AddressMode addressMode = Texture::EdgeClamp;
     Texture::MipMapMode mipMode = Texture::DefaultMipMaps;
@@ -100,12 +135,54 @@ Texture* TextureInfo::load(const fs::path& name)
     if (flags & NoMipMaps)
         mipMode = Texture::NoMipMaps;
 
+    ContentType contentType = DetermineFileType(name);
+    if (contentType == Content_CelestiaTexture && bumpHeight == 0.0f)
+        return Finisher();
+
+    std::shared_ptr<Image> img;
     if (bumpHeight == 0.0f)
     {
         GetLogger()->debug("Loading texture: {}\n", name);
-        return LoadTextureFromFile(name, addressMode, mipMode);
+        img.reset(LoadImageFromFile(name));
+    }
+    else
+    {
+        GetLogger()->debug("Loading bump map: {}\n", name);
+        std::unique_ptr<Image> heightMap(LoadImageFromFile(name));
+        if (heightMap != nullptr)
+            img.reset(heightMap->computeNormalMap(bumpHeight, addressMode == Texture::Wrap, GetImageThreadPool()));
+        mipMode = Texture::DefaultMipMaps;
+    }
+
+    // Build the mipmaps of uncompressed images here rather than leaving
+    // them to the driver.
+    if (img != nullptr && mipMode == Texture::DefaultMipMaps)
+    {
+        Image* mipmaps = BuildTextureMipmaps(*img, addressMode);
+        if (mipmaps != nullptr)
+            img.reset(mipmaps);
     }
 
-    GetLogger()->debug("Loading bump map: {}\n", name);
-    return LoadHeightMapFromFile(name, bumpHeight, addressMode);
+    // If the texture came from a .dxt5nm file then mark it as a dxt5
+    // compressed normal map. There's no separate OpenGL format for dxt5
+    // normal maps, so the file extension is the only thing that
+    // distinguishes it from a plain old dxt5 texture.
+    bool dxt5NormalMap = contentType == Content_DXT5NormalMap && bumpHeight == 0.0f;
+
+    return [img, addressMode, mipMode, dxt5NormalMap]() -> Texture*
+    {
+        if (img == nullptr)
+            return nullptr;
+
+        Texture* tex = CreateTextureFromImage(*img, addressMode, mipMode);
+        if (dxt5NormalMap && img->getFormat() == PixelFormat::DXT5)
+            tex->setFormatOptions(Texture::DXT5NormalMap);
+        return tex;
+    };
+}
+
+
+std::size_t TextureInfo::getMemoryUsage() const
+{
+    return resource == nullptr ? 0 : resource->getMemoryUsage();
 }
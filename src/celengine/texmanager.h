@@ -65,6 +65,8 @@ class TextureInfo : public ResourceInfo<Texture>
 
     fs::path resolve(const fs::path&) override;
     Texture* load(const fs::path&) override;
+    Finisher prepare(const fs::path&) const override;
+    std::size_t getMemoryUsage() const override;
 };
 
 inline bool operator<(const TextureInfo& ti0, const TextureInfo& ti1)
@@ -82,6 +84,10 @@ inline bool operator<(const TextureInfo& ti0, const TextureInfo& ti1)
     }
 }
 
+// Build the mip chain of an uncompressed texture image on the CPU; returns
+// nullptr for images which are compressed or already have mipmaps.
+Image* BuildTextureMipmaps(const Image& img, Texture::AddressMode addressMode);
+
 typedef ResourceManager<TextureInfo> TextureManager;
 
 extern TextureManager* GetTextureManager();
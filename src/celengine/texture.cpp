@@ -345,6 +345,15 @@ void Texture::setFormatOptions(unsigned int opts)
 }
 
 
+// Approximate memory used by a texture created from img, including the
+// mipmaps generated from it, if any.
+static std::size_t TextureMemoryUsage(const Image& img, bool generatedMipMaps)
+{
+    auto size = static_cast<std::size_t>(img.getSize());
+    return generatedMipMaps ? size + size / 3 : size;
+}
+
+
 ImageTexture::ImageTexture(Image& img,
                            AddressMode addressMode,
                            MipMapMode mipMapMode) :
@@ -417,6 +426,7 @@ ImageTexture::ImageTexture(Image& img,
 
     alpha = img.hasAlpha();
     compressed = img.isCompressed();
+    memoryUsage = TextureMemoryUsage(img, genMipmaps);
 }
 
 
@@ -489,6 +499,8 @@ TiledTexture::TiledTexture(Image& img,
     if (!precomputedMipMaps && img.isCompressed())
         mipmap = false;
 
+    memoryUsage = TextureMemoryUsage(img, mipmap && !precomputedMipMaps);
+
     GLenum texAddress = GetGLTexAddressMode(EdgeClamp);
     int components = img.getComponents();
 
@@ -554,7 +566,30 @@ TiledTexture::TiledTexture(Image& img,
                 }
                 else
                 {
-                    // TODO: Handle uncompressed textures with prebuilt mipmaps
+                    for (int mip = 0; mip < tileMipLevelCount; mip++)
+                    {
+                        // Levels missing from the image are taken from the
+                        // smallest one it has.
+                        int srcMip = min(mip, mipLevelCount - 1);
+                        int mipWidth  = max(img.getWidth() >> srcMip, 1);
+                        int mipHeight = max(img.getHeight() >> srcMip, 1);
+                        int tileMipWidth  = max(tile->getWidth() >> mip, 1);
+                        int tileMipHeight = max(tile->getHeight() >> mip, 1);
+                        int srcBytesPerRow = (mipWidth * components + 3) & ~3;
+                        int destBytesPerRow = (tileMipWidth * components + 3) & ~3;
+                        int srcU = min(u * tileMipWidth, mipWidth - tileMipWidth);
+                        int srcV = min(v * tileMipHeight, mipHeight - tileMipHeight);
+                        const unsigned char* imgMip = img.getMipLevel(srcMip) +
+                            srcV * srcBytesPerRow + srcU * components;
+                        unsigned char* tileMip = tile->getMipLevel(mip);
+
+                        for (int y = 0; y < tileMipHeight; y++)
+                        {
+                            memcpy(tileMip + y * destBytesPerRow,
+                                   imgMip + y * srcBytesPerRow,
+                                   tileMipWidth * components);
+                        }
+                    }
                 }
 
                 LoadMipmapSet(*tile, GL_TEXTURE_2D);
@@ -740,6 +775,8 @@ CubeMap::CubeMap(Image* faces[]) :
     if (genMipmaps && FramebufferObject::isSupported())
         glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
     DumpTextureMipmapInfo(GL_TEXTURE_CUBE_MAP_POSITIVE_X);
+
+    memoryUsage = 6 * TextureMemoryUsage(*faces[0], genMipmaps);
 }
 
 
@@ -895,9 +932,9 @@ Texture* CreateProceduralCubeMap(int size,
 }
 
 
-static Texture* CreateTextureFromImage(Image& img,
-                                       Texture::AddressMode addressMode,
-                                       Texture::MipMapMode mipMode)
+Texture* CreateTextureFromImage(Image& img,
+                                Texture::AddressMode addressMode,
+                                Texture::MipMapMode mipMode)
 {
     Texture* tex = nullptr;
 
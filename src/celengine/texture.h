@@ -10,6 +10,7 @@
 #ifndef _CELENGINE_TEXTURE_H_
 #define _CELENGINE_TEXTURE_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <celutil/color.h>
@@ -65,6 +66,10 @@ class Texture
     virtual void beginUsage() {};
     virtual void endUsage() {};
 
+    // Level of detail at which the texture is about to be used, possibly
+    // fractional; lets virtual textures prefetch tiles while zooming in.
+    virtual void setDesiredLOD(float /* lod */) {};
+
     virtual void setBorderColor(Color);
 
     int getWidth() const;
@@ -74,6 +79,9 @@ class Texture
     bool hasAlpha() const { return alpha; }
     bool isCompressed() const { return compressed; }
 
+    //! Approximate amount of texture memory used, in bytes; 0 if unknown.
+    std::size_t getMemoryUsage() const { return memoryUsage; }
+
     /*! Identical formats may need to be treated in slightly different
      *  fashions. One (and currently the only) example is the DXT5 compressed
      *  normal map format, which is an ordinary DXT5 texture but requires some
@@ -105,6 +113,7 @@ class Texture
  protected:
     bool alpha{ false };
     bool compressed{ false };
+    std::size_t memoryUsage{ 0 };
 
  private:
     int width;
@@ -180,6 +189,12 @@ extern Texture* CreateProceduralTexture(int width, int height,
 extern Texture* CreateProceduralCubeMap(int size, celestia::PixelFormat format,
                                         ProceduralTexEval func);
 
+// Create a texture from an image which has already been loaded; this must
+// be done on the thread owning the OpenGL context.
+extern Texture* CreateTextureFromImage(Image& img,
+                                       Texture::AddressMode addressMode = Texture::EdgeClamp,
+                                       Texture::MipMapMode mipMode = Texture::DefaultMipMaps);
+
 extern Texture* LoadTextureFromFile(const fs::path& filename,
                                     Texture::AddressMode addressMode = Texture::EdgeClamp,
                                     Texture::MipMapMode mipMode = Texture::DefaultMipMaps);
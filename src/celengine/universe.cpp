@@ -10,6 +10,7 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <algorithm>
 #include <cassert>
 
 #include <celcompat/numbers.h>
@@ -26,6 +27,7 @@
 #include "location.h"
 #include "meshmanager.h"
 #include "render.h"
+#include "solarsysstate.h"
 #include "timelinephase.h"
 #include "universe.h"
 
@@ -302,15 +304,12 @@ struct PlanetPickInfo
 };
 
 
-static bool ApproxPlanetPickTraversal(Body* body, void* info)
+static void ApproxPlanetPick(Body* body, const Vector3d& bpos, PlanetPickInfo* pickInfo)
 {
-    auto* pickInfo = (PlanetPickInfo*) info;
-
     // Reject invisible bodies and bodies that don't exist at the current time
     if (!body->isVisible() || !body->extant(pickInfo->jd) || !body->isClickable())
-        return true;
+        return;
 
-    Vector3d bpos = body->getAstrocentricPosition(pickInfo->jd);
     Vector3d bodyDir = bpos - pickInfo->pickRay.origin();
     double distance = bodyDir.norm();
 
@@ -321,7 +320,7 @@ static bool ApproxPlanetPickTraversal(Body* body, void* info)
 
     if (std::max((double) pickInfo->atanTolerance, ANGULAR_RES) > appOrbitRadius)
     {
-        return true;
+        return;
     }
 
     bodyDir.normalize();
@@ -334,16 +333,12 @@ static bool ApproxPlanetPickTraversal(Body* body, void* info)
         pickInfo->closestBody = body;
         pickInfo->closestApproxDistance = distance;
     }
-
-    return true;
 }
 
 
 // Perform an intersection test between the pick ray and a body
-static bool ExactPlanetPickTraversal(Body* body, void* info)
+static void ExactPlanetPick(Body* body, const Vector3d& bpos, PlanetPickInfo* pickInfo)
 {
-    auto* pickInfo = static_cast<PlanetPickInfo*>(info);
-    Vector3d bpos = body->getAstrocentricPosition(pickInfo->jd);
     float radius = body->getRadius();
     double distance = -1.0;
 
@@ -412,40 +407,24 @@ static bool ExactPlanetPickTraversal(Body* body, void* info)
             pickInfo->closestBody = body;
         }
     }
-
-    return true;
 }
 
-// Recursively traverse a frame tree; call the specified callback function for each
-// body in the tree. The callback function returns a boolean indicating whether
-// traversal should continue.
-//
-// TODO: This function works, but could use some cleanup:
-//   * Make it a member of the frame tree class
-//   * Combine info and func into a traversal callback class
-static bool traverseFrameTree(FrameTree* frameTree,
-                              double tdb,
-                              PlanetarySystem::TraversalFunc func,
-                              void* info)
+// Call the pick function for the bodies orbiting parent and their
+// satellites, in the same order as a traversal of the frame tree. Groups
+// of bodies whose bounds fail the test are skipped.
+template<typename T>
+static void pickBodies(const SolarSystemState& state,
+                       std::uint32_t parent,
+                       PlanetPickInfo* pickInfo,
+                       void (*pick)(Body*, const Vector3d&, PlanetPickInfo*),
+                       T test)
 {
-    for (unsigned int i = 0; i < frameTree->childCount(); i++)
+    state.forEachChild(parent, test, [&](std::uint32_t i)
     {
-        auto phase = frameTree->getChild(i);
-        if (phase->includes(tdb))
-        {
-            Body* body = phase->body();
-            if (!func(body, info))
-                return false;
-
-            if (body->getFrameTree() != nullptr)
-            {
-                if (!traverseFrameTree(body->getFrameTree(), tdb, func, info))
-                    return false;
-            }
-        }
-    }
-
-    return true;
+        pick(state[i].body, state[i].position, pickInfo);
+        if (state[i].subtreeEnd > i + 1)
+            pickBodies(state, i, pickInfo, pick, test);
+    });
 }
 
 
@@ -473,9 +452,38 @@ Selection Universe::pickPlanet(SolarSystem& solarSystem,
     pickInfo.jd = when;
     pickInfo.atanTolerance = (float) atan(tolerance);
 
+    // Compute the positions of the bodies once for both passes
+    const SolarSystemState& state = solarSystem.updatePickState(when);
+
+    // Groups of bodies which the pick ray misses can't contain a body it
+    // intersects.
+    auto hitByRay = [&pickInfo](const SolarSystemState::BoundingNode& node)
+    {
+        Vector3d toCenter = node.center - pickInfo.pickRay.origin();
+        double along = toCenter.dot(pickInfo.pickRay.direction());
+        double distanceSq = toCenter.squaredNorm();
+        double radiusSq = square(node.radius);
+        return distanceSq <= radiusSq || (along > 0.0 && distanceSq - square(along) <= radiusSq);
+    };
+
+    // A body further from the pick ray than the tolerance is never chosen
+    // by the approximate test, whether or not the ray hit another body, so
+    // groups of bodies entirely outside of the tolerance can be skipped.
+    double maxAngle = 2.0 * asin(std::min(sinTol2, 1.0));
+    auto nearRay = [&pickInfo, maxAngle](const SolarSystemState::BoundingNode& node)
+    {
+        Vector3d toCenter = node.center - pickInfo.pickRay.origin();
+        double distance = toCenter.norm();
+        if (distance <= node.radius)
+            return true;
+
+        double cosAngle = std::clamp(toCenter.dot(pickInfo.pickRay.direction()) / distance, -1.0, 1.0);
+        return acos(cosAngle) - asin(node.radius / distance) <= maxAngle;
+    };
+
     // First see if there's a planet|moon that the pick ray intersects.
     // Select the closest planet|moon intersected.
-    traverseFrameTree(solarSystem.getFrameTree(), when, ExactPlanetPickTraversal, (void*) &pickInfo);
+    pickBodies(state, SolarSystemState::NoParent, &pickInfo, ExactPlanetPick, hitByRay);
 
     if (pickInfo.closestBody != nullptr)
     {
@@ -484,7 +492,7 @@ Selection Universe::pickPlanet(SolarSystem& solarSystem,
 
         // Check if there is a satellite in front of the primary body that is
         // sufficiently close to the pickRay
-        traverseFrameTree(solarSystem.getFrameTree(), when, ApproxPlanetPickTraversal, (void*) &pickInfo);
+        pickBodies(state, SolarSystemState::NoParent, &pickInfo, ApproxPlanetPick, nearRay);
 
         if (pickInfo.closestBody == closestBody)
             return  Selection(closestBody);
@@ -506,7 +514,7 @@ Selection Universe::pickPlanet(SolarSystem& solarSystem,
     // clicks on a pixel where the planet's disc has been rendered--in order
     // to make distant planets visible on the screen at all, their apparent
     // size has to be greater than their actual disc size.
-    traverseFrameTree(solarSystem.getFrameTree(), when, ApproxPlanetPickTraversal, (void*) &pickInfo);
+    pickBodies(state, SolarSystemState::NoParent, &pickInfo, ApproxPlanetPick, nearRay);
 
     if (pickInfo.sinAngle2Closest <= sinTol2)
         return Selection(pickInfo.closestBody);
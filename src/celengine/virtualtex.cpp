@@ -7,10 +7,13 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <algorithm>
 #include <cmath>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <iostream>
+#include <iterator>
 #include <fstream>
 #include <string>
 #include <utility>
@@ -18,8 +21,10 @@
 #include <celcompat/filesystem.h>
 #include <celutil/filetype.h>
 #include <celutil/logger.h>
+#include <celutil/threadpool.h>
 #include <celutil/tokenizer.h>
 #include "glsupport.h"
+#include "image.h"
 #include "parser.h"
 #include "virtualtex.h"
 
@@ -29,6 +34,26 @@ using celestia::util::GetLogger;
 
 static const int MaxResolutionLevels = 13;
 
+// Number of threads reading tiles, shared by all virtual textures
+static const unsigned int LoaderThreadCount = 2;
+
+// Maximum number of tiles kept in graphics memory, not counting the tiles
+// of the coarsest level which always stay loaded. More tiles may be kept
+// when they are all in use.
+static const std::size_t MaxResidentTiles = 256;
+
+// Requests for tiles which haven't been wanted for this many usages are
+// dropped by the loader threads.
+static const unsigned int MaxRequestAge = 8;
+
+// Number of usages ahead for which the level of detail is extrapolated
+// when prefetching the next level.
+static const float PrefetchLookahead = 30.0f;
+
+// Time per usage spent creating textures for the tiles read in the
+// background; at least one tile is created per usage.
+static const std::chrono::duration<double> TileFinishBudget(0.004);
+
 
 // Virtual textures are composed of tiles that are loaded from the hard drive
 // as they become visible.  Hidden tiles may be evicted from graphics memory
@@ -40,6 +65,14 @@ static const int MaxResolutionLevels = 13;
 // a power of two, with width = 2 * height.  The baseSplit determines the
 // number of tiles at the lowest LOD.  It is the log base 2 of the width in
 // tiles of LOD zero.  Though it's not required
+//
+// Only the tiles of the coarsest level are loaded when they're needed.
+// Finer tiles are read on loader threads and shown from the following
+// frames; meanwhile the finest loaded tile above them is used. Requests are
+// served in order of decreasing error of the displayed tile, and the
+// neighbors of visible tiles and, while zooming in, the tiles of the next
+// level are prefetched. The least recently used tiles are unloaded when
+// more than MaxResidentTiles are loaded.
 
 static bool isPow2(int x)
 {
@@ -47,6 +80,15 @@ static bool isPow2(int x)
 }
 
 
+// The loader threads are only started when a tile is first requested, so
+// that virtual textures which are never displayed cost no threads.
+static celestia::util::ThreadPool& tileLoaderPool()
+{
+    static celestia::util::ThreadPool pool(LoaderThreadCount);
+    return pool;
+}
+
+
 #if 0
 // Useful if we want to use a packed quadtree to store tiles instead of
 // the currently implemented tree structure.
@@ -81,6 +123,16 @@ VirtualTexture::VirtualTexture(const fs::path& _tilePath,
 }
 
 
+VirtualTexture::~VirtualTexture()
+{
+    // The remaining loader tasks find no requests and return right away;
+    // wait for them, as the loader threads outlive the texture.
+    std::unique_lock<std::mutex> lock(loaderMutex);
+    tileRequests.clear();
+    loaderIdle.wait(lock, [this]() { return loaderTasks == 0; });
+}
+
+
 const TextureTile VirtualTexture::getTile(int lod, int u, int v)
 {
     tilesRequested++;
@@ -101,6 +153,13 @@ const TextureTile VirtualTexture::getTile(int lod, int u, int v)
     Tile* tile = node->tile;
     unsigned int tileLOD = 0;
 
+    // Besides the finest tile, keep track of the coarsest one and of the
+    // finest one already loaded.
+    Tile* baseTile = tile;
+    unsigned int baseLOD = 0;
+    Tile* residentTile = tile != nullptr && tile->tex != nullptr ? tile : nullptr;
+    unsigned int residentLOD = 0;
+
     for (int n = 0; n < lod; n++)
     {
         unsigned int mask = 1 << (lod - n - 1);
@@ -114,6 +173,16 @@ const TextureTile VirtualTexture::getTile(int lod, int u, int v)
         {
             tile = node->tile;
             tileLOD = n + 1;
+            if (baseTile == nullptr)
+            {
+                baseTile = tile;
+                baseLOD = tileLOD;
+            }
+            if (tile->tex != nullptr)
+            {
+                residentTile = tile;
+                residentLOD = tileLOD;
+            }
         }
     }
 
@@ -121,18 +190,36 @@ const TextureTile VirtualTexture::getTile(int lod, int u, int v)
     if (!tile)
         return TextureTile(0);
 
-    // Make the tile resident.
-    unsigned int tileU = u >> (lod - tileLOD);
-    unsigned int tileV = v >> (lod - tileLOD);
-    makeResident(tile, tileLOD, tileU, tileV);
+    // There is nothing to show until the coarsest tile is loaded, so it is
+    // loaded right away.
+    if (residentTile == nullptr)
+    {
+        makeResident(baseTile);
+        if (baseTile->tex != nullptr)
+        {
+            residentTile = baseTile;
+            residentLOD = baseLOD;
+        }
+    }
+
+    // The finest tile is loaded in the background. The error of the tile
+    // shown meanwhile is the number of levels it is below the finest one:
+    // its texels appear 2^error times larger on screen.
+    if (tile != residentTile)
+        requestTile(tile, residentTile == nullptr ? tileLOD + 1 : tileLOD - residentLOD);
+    prefetchTiles(tile);
 
     // It's possible that we failed to make the tile resident, either
     // because the texture file was bad, or there was an unresolvable
     // out of memory situation.  In that case there is nothing else to
     // do but return a texture tile with a null texture name.
-    if (!tile->tex)
+    if (residentTile == nullptr)
         return TextureTile(0);
 
+    tile = residentTile;
+    tileLOD = residentLOD;
+    tile->lastUsed = ticks;
+
     // Set up the texture subrect to be the entire texture
     float texU = 0.0f;
     float texV = 0.0f;
@@ -183,11 +270,22 @@ void VirtualTexture::beginUsage()
 {
     ticks++;
     tilesRequested = 0;
+    finishLoadedTiles();
 }
 
 
 void VirtualTexture::endUsage()
 {
+    evictTiles();
+}
+
+
+void VirtualTexture::setDesiredLOD(float lod)
+{
+    // Smoothed, as the level of detail changes in steps when the frame
+    // rate is uneven
+    desiredLODRate = 0.5f * desiredLODRate + 0.5f * (lod - desiredLOD);
+    desiredLOD = lod;
 }
 
 
@@ -201,54 +299,240 @@ unsigned int VirtualTexture::tileIndex(unsigned int lod,
 #endif
 
 
-ImageTexture* VirtualTexture::loadTileTexture(unsigned int lod, unsigned int u, unsigned int v)
+fs::path VirtualTexture::tileFileName(const Tile* tile) const
 {
-    lod >>= baseSplit;
-    assert(lod < (unsigned)MaxResolutionLevels);
+    assert(tile->level < (unsigned)MaxResolutionLevels);
 
-    auto path = tilePath /
-                fmt::format("level{:d}", lod) /
-                fmt::format("{:s}{:d}_{:d}{:s}", tilePrefix, u, v, tileExt.string());
+    return tilePath /
+           fmt::format("level{:d}", tile->level) /
+           fmt::format("{:s}{:d}_{:d}{:s}", tilePrefix, tile->u, tile->v, tileExt.string());
+}
 
-    Image* img = LoadImageFromFile(path);
-    if (img == nullptr)
-        return nullptr;
 
+ImageTexture* VirtualTexture::createTileTexture(const Tile* tile, Image& img)
+{
     ImageTexture* tex = nullptr;
 
     // Only use mip maps for the LOD 0; for higher LODs, the function of mip
     // mapping is built into the texture.
-    MipMapMode mipMapMode = lod == 0 ? DefaultMipMaps : NoMipMaps;
+    MipMapMode mipMapMode = tile->level == 0 ? DefaultMipMaps : NoMipMaps;
 
-    if (isPow2(img->getWidth()) && isPow2(img->getHeight()))
-        tex = new ImageTexture(*img, EdgeClamp, mipMapMode);
+    if (isPow2(img.getWidth()) && isPow2(img.getHeight()))
+        tex = new ImageTexture(img, EdgeClamp, mipMapMode);
 
     // TODO: Virtual textures can have tiles in different formats, some
     // compressed and some not. The compression flag doesn't make much
     // sense for them.
-    compressed = img->isCompressed();
-
-    delete img;
+    compressed = img.isCompressed();
 
     return tex;
 }
 
 
-void VirtualTexture::makeResident(Tile* tile, unsigned int lod, unsigned int u, unsigned int v)
+void VirtualTexture::makeResident(Tile* tile)
 {
     if (tile->tex == nullptr && !tile->loadFailed)
     {
-        // Potentially evict other tiles in order to make this one fit
-        tile->tex = loadTileTexture(lod, u, v);
+        std::unique_ptr<Image> img(LoadImageFromFile(tileFileName(tile)));
+        if (img != nullptr)
+            tile->tex = createTileTexture(tile, *img);
+
         if (tile->tex == nullptr)
-        {
-            // cout << "Texture load failed!\n";
             tile->loadFailed = true;
+        else if (tile->level != 0)
+            residentTiles.push_back(tile);
+    }
+}
+
+
+void VirtualTexture::requestTile(Tile* tile, unsigned int error)
+{
+    tile->lastRequested = ticks.load();
+    if (tile->tex != nullptr || tile->loadFailed)
+        return;
+
+    if (tile->loadQueued && error <= tile->queuedError)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(loaderMutex);
+        if (tile->loadQueued)
+        {
+            // A request with a larger error moves the waiting request for
+            // the tile forward; a tile being read is left as it is.
+            if (tile->inQueue)
+            {
+                tileRequests.erase(TileRequest{ tile->queuedError, tile->queuedUsage, tile });
+                tileRequests.insert(TileRequest{ error, ticks, tile });
+                tile->queuedUsage = ticks;
+            }
+            tile->queuedError = error;
+            return;
+        }
+
+        tile->loadQueued = true;
+        tile->queuedError = error;
+        tile->inQueue = true;
+        tile->queuedUsage = ticks;
+        tileRequests.insert(TileRequest{ error, ticks, tile });
+        loaderTasks++;
+    }
+
+    // Each task loads the most urgent tile at the time it runs.
+    tileLoaderPool().submit([this]() { loadRequestedTile(); });
+}
+
+
+void VirtualTexture::prefetchTiles(const Tile* tile)
+{
+    unsigned int lod = tile->level + baseSplit;
+    unsigned int uCount = 2u << lod;
+    unsigned int vCount = 1u << lod;
+
+    // Neighbors at the same level are likely to come into view; u wraps
+    // around at the date line.
+    Tile* neighbors[] =
+    {
+        findTile(lod, (tile->u + 1) % uCount, tile->v),
+        findTile(lod, (tile->u + uCount - 1) % uCount, tile->v),
+        tile->v + 1 < vCount ? findTile(lod, tile->u, tile->v + 1) : nullptr,
+        tile->v > 0 ? findTile(lod, tile->u, tile->v - 1) : nullptr,
+    };
+
+    for (Tile* neighbor : neighbors)
+    {
+        if (neighbor != nullptr)
+            requestTile(neighbor, 0);
+    }
+
+    // The children are prefetched when the level of detail is expected to
+    // reach the next level soon at the rate it is changing.
+    if (desiredLODRate > 0.0f &&
+        desiredLOD + desiredLODRate * PrefetchLookahead >= static_cast<float>(tile->level + 1))
+    {
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            Tile* child = findTile(lod + 1, tile->u * 2 + (i & 1), tile->v * 2 + (i >> 1));
+            if (child != nullptr)
+                requestTile(child, 0);
         }
     }
 }
 
 
+void VirtualTexture::loadRequestedTile()
+{
+    Tile* tile = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(loaderMutex);
+        if (tileRequests.empty())
+        {
+            if (--loaderTasks == 0)
+                loaderIdle.notify_all();
+            return;
+        }
+
+        auto last = std::prev(tileRequests.end());
+        tile = last->tile;
+        tileRequests.erase(last);
+        tile->inQueue = false;
+    }
+
+    // Tiles which are no longer wanted aren't read at all.
+    bool cancelled = tile->lastRequested + MaxRequestAge < ticks;
+    std::unique_ptr<Image> img;
+    if (!cancelled)
+        img.reset(LoadImageFromFile(tileFileName(tile)));
+
+    std::lock_guard<std::mutex> lock(loaderMutex);
+    loadedTiles.push_back(LoadedTile{ tile, std::move(img), cancelled });
+    if (--loaderTasks == 0)
+        loaderIdle.notify_all();
+}
+
+
+void VirtualTexture::finishLoadedTiles()
+{
+    auto start = std::chrono::steady_clock::now();
+    for (;;)
+    {
+        LoadedTile loaded;
+        {
+            std::lock_guard<std::mutex> lock(loaderMutex);
+            if (loadedTiles.empty())
+                return;
+            loaded = std::move(loadedTiles.front());
+            loadedTiles.pop_front();
+        }
+
+        Tile* tile = loaded.tile;
+        tile->loadQueued = false;
+
+        // The tile may have been loaded synchronously meanwhile.
+        if (tile->tex == nullptr && !loaded.cancelled)
+        {
+            if (loaded.image != nullptr)
+                tile->tex = createTileTexture(tile, *loaded.image);
+
+            if (tile->tex == nullptr)
+            {
+                tile->loadFailed = true;
+            }
+            else
+            {
+                tile->lastUsed = ticks;
+                if (tile->level != 0)
+                    residentTiles.push_back(tile);
+            }
+        }
+
+        if (std::chrono::steady_clock::now() - start > TileFinishBudget)
+            return;
+    }
+}
+
+
+void VirtualTexture::evictTiles()
+{
+    if (residentTiles.size() <= MaxResidentTiles)
+        return;
+
+    // Most recently used first
+    std::sort(residentTiles.begin(), residentTiles.end(),
+              [](const Tile* a, const Tile* b) { return a->lastUsed > b->lastUsed; });
+
+    while (residentTiles.size() > MaxResidentTiles)
+    {
+        // Tiles used in this usage or the previous one are kept.
+        Tile* tile = residentTiles.back();
+        if (tile->lastUsed + 1 >= ticks)
+            break;
+
+        delete tile->tex;
+        tile->tex = nullptr;
+        residentTiles.pop_back();
+    }
+}
+
+
+VirtualTexture::Tile* VirtualTexture::findTile(unsigned int lod,
+                                               unsigned int u, unsigned int v)
+{
+    if (lod >= nResolutionLevels || u >= (2u << lod) || v >= (1u << lod))
+        return nullptr;
+
+    TileQuadtreeNode* node = tileTree[u >> lod];
+    for (unsigned int i = 0; i < lod && node != nullptr; i++)
+    {
+        unsigned int mask = 1 << (lod - i - 1);
+        unsigned int child = (((v & mask) << 1) | (u & mask)) >> (lod - i - 1);
+        node = node->children[child];
+    }
+
+    return node != nullptr ? node->tile : nullptr;
+}
+
+
 void VirtualTexture::populateTileTree()
 {
     // Count the number of resolution levels present
@@ -277,7 +561,7 @@ void VirtualTexture::populateTileTree()
                     if (u >= 0 && v >= 0 && u < uLimit && v < vLimit)
                     {
                         // Found a tile, so add it to the quadtree
-                        Tile* tile = new Tile();
+                        Tile* tile = new Tile(i, (unsigned int) u, (unsigned int) v);
                         addTileToTree(tile, maxLevel, (unsigned int) u, (unsigned int) v);
                     }
                 }
@@ -10,9 +10,18 @@
 #ifndef _CELENGINE_VIRTUALTEX_H_
 #define _CELENGINE_VIRTUALTEX_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <vector>
 #include <celengine/texture.h>
 
+class Image;
 
 class VirtualTexture : public Texture
 {
@@ -22,7 +31,7 @@ class VirtualTexture : public Texture
                    unsigned int _tileSize,
                    const std::string& _tilePrefix,
                    const std::string& _tileType);
-    ~VirtualTexture() = default;
+    ~VirtualTexture();
 
     const TextureTile getTile(int lod, int u, int v) override;
     void bind() override;
@@ -32,14 +41,30 @@ class VirtualTexture : public Texture
     int getVTileCount(int lod) const override;
     void beginUsage() override;
     void endUsage() override;
+    void setDesiredLOD(float lod) override;
 
  private:
     struct Tile
     {
-        Tile() = default;
+        Tile(unsigned int _level, unsigned int _u, unsigned int _v) :
+            level(_level), u(_u), v(_v) {};
+        unsigned int level;
+        unsigned int u;
+        unsigned int v;
         unsigned int lastUsed{ 0 };
+        // Usage in which the tile was last requested; read by the loader
+        // threads to drop requests for tiles which went out of view.
+        std::atomic<unsigned int> lastRequested{ 0 };
         ImageTexture* tex{ nullptr };
         bool loadFailed{ false };
+        // Set while the tile is waiting to be loaded or being loaded, with
+        // the error it was requested with
+        bool loadQueued{ false };
+        unsigned int queuedError{ 0 };
+        // Guarded by loaderMutex: set while the request for the tile waits
+        // in the queue, with the usage it was last raised in
+        bool inQueue{ false };
+        unsigned int queuedUsage{ 0 };
     };
 
     struct TileQuadtreeNode
@@ -49,10 +74,42 @@ class VirtualTexture : public Texture
         TileQuadtreeNode* children[4]{ nullptr, nullptr, nullptr, nullptr};
     };
 
+    // Tiles waiting to be read by the loader threads, one request per
+    // tile. Requests for tiles which are displayed with the largest error
+    // are served first, and among those the most recent ones.
+    struct TileRequest
+    {
+        unsigned int error;
+        unsigned int usage;
+        Tile* tile;
+
+        bool operator<(const TileRequest& other) const
+        {
+            if (error != other.error)
+                return error < other.error;
+            if (usage != other.usage)
+                return usage < other.usage;
+            return std::less<Tile*>()(tile, other.tile);
+        }
+    };
+
+    struct LoadedTile
+    {
+        Tile* tile;
+        std::unique_ptr<Image> image;
+        bool cancelled;
+    };
+
     void populateTileTree();
     void addTileToTree(Tile* tile, unsigned int lod, unsigned int u, unsigned int v);
-    void makeResident(Tile* tile, unsigned int lod, unsigned int u, unsigned int v);
-    ImageTexture* loadTileTexture(unsigned int lod, unsigned int u, unsigned int v);
+    void makeResident(Tile* tile);
+    void requestTile(Tile* tile, unsigned int error);
+    void prefetchTiles(const Tile* tile);
+    void loadRequestedTile();
+    void finishLoadedTiles();
+    void evictTiles();
+    ImageTexture* createTileTexture(const Tile* tile, Image& img);
+    fs::path tileFileName(const Tile* tile) const;
 
     Tile* tiles{ nullptr };
     Tile* findTile(unsigned int lod,
@@ -64,10 +121,15 @@ class VirtualTexture : public Texture
     std::string tilePrefix;
     unsigned int baseSplit{ 0 };
     unsigned int tileSize{ 0 };
-    unsigned int ticks{ 0 };
+    std::atomic<unsigned int> ticks{ 0 };
     unsigned int tilesRequested{ 0 };
     unsigned int nResolutionLevels{ 0 };
 
+    // Level of detail passed to setDesiredLOD(), and its change per usage,
+    // used to prefetch the next level while zooming in
+    float desiredLOD{ 0.0f };
+    float desiredLODRate{ 0.0f };
+
     enum
     {
         TileNotLoaded  = -1,
@@ -75,6 +137,16 @@ class VirtualTexture : public Texture
     };
 
     TileQuadtreeNode* tileTree[2];
+
+    std::vector<Tile*> residentTiles;
+
+    std::mutex loaderMutex;
+    std::set<TileRequest> tileRequests;
+    std::deque<LoadedTile> loadedTiles;
+    // Number of tasks submitted to the loader threads which haven't
+    // finished yet, signalled through loaderIdle when it drops to zero
+    unsigned int loaderTasks{ 0 };
+    std::condition_variable loaderIdle;
 };
 
 
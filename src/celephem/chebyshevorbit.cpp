@@ -0,0 +1,530 @@
+// chebyshevorbit.cpp
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// Piecewise Chebyshev approximation of orbits which are expensive to
+// compute.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "chebyshevorbit.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fmt/format.h>
+
+#include <celcompat/numbers.h>
+#include <celutil/binaryread.h>
+#include <celutil/binarywrite.h>
+#include <celutil/logger.h>
+
+using namespace std::string_view_literals;
+using celestia::util::GetLogger;
+
+namespace celutil = celestia::util;
+
+namespace celestia::ephem
+{
+
+namespace
+{
+
+constexpr inline std::string_view CHEBYSHEV_MAGIC = "CELCHEBY"sv;
+constexpr inline std::uint16_t CHEBYSHEV_VERSION  = 0x0200;
+
+// Segments are about a sixteenth of the orbital period, which is short
+// enough for a low degree fit of most orbits.
+constexpr double SegmentsPerPeriod = 16.0;
+constexpr double MinSegmentDuration = 0.25;
+constexpr double MaxSegmentDuration = 32.0;
+constexpr std::size_t MaxSegments = 1 << 20;
+
+// Degrees tried in turn when fitting a segment
+constexpr std::array<unsigned int, 2> FitDegrees{ 12, ChebyshevOrbit::MaxDegree };
+
+ChebyshevFitOptions fitOptions;
+
+// Cache files appended to by a live orbit
+std::mutex cacheFilesMutex;
+std::set<fs::path> cacheFilesInUse;
+
+// Describe the fits of source over [startTime, endTime]: the version of
+// the file format and of the fitting, the fit parameters, and positions of
+// the source orbit, which change with the theory it computes.
+std::string
+makeCacheKey(const CachingOrbit& source, double startTime, double endTime, double tolerance)
+{
+    std::string key = fmt::format("{} {} {} {} {} {} {}",
+                                  CHEBYSHEV_VERSION, SegmentsPerPeriod,
+                                  MinSegmentDuration, MaxSegmentDuration, MaxSegments,
+                                  FitDegrees[0], FitDegrees[1]);
+    key += fmt::format("\n{:a} {:a} {:a}", startTime, endTime, tolerance);
+    for (double t : { startTime, 0.5 * (startTime + endTime), endTime })
+    {
+        Eigen::Vector3d p = source.computePosition(t);
+        key += fmt::format("\n{:a} {:a} {:a}", p.x(), p.y(), p.z());
+    }
+    return key;
+}
+
+// Evaluate the sum of c[j] * T_j(u) for j < n with Clenshaw's recurrence
+double
+evalChebyshev(const double* c, unsigned int n, double u)
+{
+    double b1 = 0.0;
+    double b2 = 0.0;
+    for (unsigned int j = n - 1; j > 0; --j)
+    {
+        double b0 = 2.0 * u * b1 - b2 + c[j];
+        b2 = b1;
+        b1 = b0;
+    }
+
+    return c[0] + u * b1 - b2;
+}
+
+// Compute the n - 1 coefficients of the derivative of a Chebyshev series
+// with n coefficients.
+void
+differentiateChebyshev(const double* c, unsigned int n, double* d)
+{
+    unsigned int degree = n - 1;
+    // d[j] and d[j + 1] while computing d[j - 1]
+    double d1 = 0.0;
+    double d2 = 0.0;
+    for (unsigned int j = degree; j > 0; --j)
+    {
+        double d0 = d2 + 2.0 * static_cast<double>(j) * c[j];
+        d[j - 1] = d0;
+        d2 = d1;
+        d1 = d0;
+    }
+
+    // The first coefficient is counted half in the usual formulation
+    d[0] *= 0.5;
+}
+
+} // end unnamed namespace
+
+
+ChebyshevOrbit::ChebyshevOrbit(std::unique_ptr<CachingOrbit>&& _source,
+                               double _startTime,
+                               double endTime,
+                               double _tolerance,
+                               const fs::path& _cacheFile) :
+    source(std::move(_source)),
+    startTime(_startTime),
+    tolerance(_tolerance),
+    cacheFile(_cacheFile),
+    cacheKey(makeCacheKey(*source, _startTime, endTime, _tolerance))
+{
+    double period = source->getPeriod();
+    double duration = period > 0.0 && std::isfinite(period)
+        ? period / SegmentsPerPeriod
+        : MaxSegmentDuration;
+    duration = std::clamp(duration, MinSegmentDuration, MaxSegmentDuration);
+
+    double span = std::max(endTime - startTime, 0.0);
+    auto nSegments = static_cast<std::size_t>(std::ceil(span / duration));
+    nSegments = std::clamp(nSegments, std::size_t(1), MaxSegments);
+    segmentDuration = span > 0.0 ? span / static_cast<double>(nSegments) : duration;
+    segments.resize(nSegments);
+
+    if (cacheFile.empty())
+        return;
+
+    // Only one of the orbits sharing a cache file appends to it, so that
+    // no segment is written twice.
+    bool claimed;
+    {
+        std::lock_guard<std::mutex> lock(cacheFilesMutex);
+        claimed = cacheFilesInUse.insert(cacheFile).second;
+    }
+
+    bool damaged = !readCache();
+    if (!claimed)
+        cacheFile.clear();
+    else if (damaged)
+        GetLogger()->warn("Rewriting damaged ephemeris cache {}\n", cacheFile);
+}
+
+
+ChebyshevOrbit::~ChebyshevOrbit()
+{
+    if (!cacheFile.empty())
+    {
+        std::lock_guard<std::mutex> lock(cacheFilesMutex);
+        cacheFilesInUse.erase(cacheFile);
+    }
+}
+
+
+Eigen::Vector3d
+ChebyshevOrbit::computePosition(double jd) const
+{
+    double u;
+    const Segment* segment = findSegment(jd, u);
+    if (segment == nullptr)
+        return source->computePosition(jd);
+
+    unsigned int n = segment->degree + 1u;
+    const double* c = coeffs.data() + segment->offset;
+    return Eigen::Vector3d(evalChebyshev(c, n, u),
+                           evalChebyshev(c + n, n, u),
+                           evalChebyshev(c + 2 * n, n, u));
+}
+
+
+Eigen::Vector3d
+ChebyshevOrbit::computeVelocity(double jd) const
+{
+    double u;
+    const Segment* segment = findSegment(jd, u);
+    if (segment == nullptr)
+        return source->computeVelocity(jd);
+
+    unsigned int n = segment->degree + 1u;
+    const double* c = coeffs.data() + segment->offset;
+    std::array<double, MaxDegree> d;
+    Eigen::Vector3d v;
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        differentiateChebyshev(c + axis * n, n, d.data());
+        v[axis] = evalChebyshev(d.data(), n - 1, u);
+    }
+
+    // Convert from the derivative with respect to u to km/day
+    return v * (2.0 / segmentDuration);
+}
+
+
+double
+ChebyshevOrbit::getPeriod() const
+{
+    return source->getPeriod();
+}
+
+
+double
+ChebyshevOrbit::getBoundingRadius() const
+{
+    return source->getBoundingRadius();
+}
+
+
+bool
+ChebyshevOrbit::isPeriodic() const
+{
+    return source->isPeriodic();
+}
+
+
+void
+ChebyshevOrbit::getValidRange(double& begin, double& end) const
+{
+    source->getValidRange(begin, end);
+}
+
+
+// Orbit paths are sampled the way the source orbit chooses; they are
+// computed once and kept by the renderer, so fitting gains little there.
+void
+ChebyshevOrbit::sample(double t0, double t1, OrbitSampleProc& proc) const
+{
+    source->sample(t0, t1, proc);
+}
+
+
+// Return the segment covering jd, fitting it if needed, and the position
+// of jd within it in the range [-1, 1]. Return nullptr if jd is outside
+// the fitted span or the segment could not be fitted.
+const ChebyshevOrbit::Segment*
+ChebyshevOrbit::findSegment(double jd, double& u) const
+{
+    double t = (jd - startTime) / segmentDuration;
+    if (!(t >= 0.0 && t < static_cast<double>(segments.size())))
+        return nullptr;
+
+    auto index = std::min(static_cast<std::size_t>(t), segments.size() - 1);
+    if (segments[index].degree == NotFitted)
+        fitSegment(index);
+
+    const Segment& segment = segments[index];
+    if (segment.degree == Unfittable)
+        return nullptr;
+
+    u = 2.0 * (t - static_cast<double>(index)) - 1.0;
+    return &segment;
+}
+
+
+void
+ChebyshevOrbit::fitSegment(std::size_t index) const
+{
+    bool fitted = std::any_of(FitDegrees.begin(), FitDegrees.end(),
+                              [this, index](unsigned int degree) { return fitSegment(index, degree); });
+    if (!fitted)
+        segments[index].degree = Unfittable;
+
+    ++fittedCount;
+    writeSegment(index);
+}
+
+
+bool
+ChebyshevOrbit::fitSegment(std::size_t index, unsigned int degree) const
+{
+    // Interpolate the source orbit at the Chebyshev nodes of the segment
+    unsigned int n = degree + 1;
+    double midTime = startTime + (static_cast<double>(index) + 0.5) * segmentDuration;
+    double halfDuration = 0.5 * segmentDuration;
+
+    std::array<Eigen::Vector3d, MaxDegree + 1> samples;
+    for (unsigned int k = 0; k < n; ++k)
+    {
+        double u = std::cos(celestia::numbers::pi * (k + 0.5) / n);
+        samples[k] = source->computePosition(midTime + u * halfDuration);
+    }
+
+    std::vector<double> c(3 * n);
+    for (unsigned int j = 0; j < n; ++j)
+    {
+        Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+        for (unsigned int k = 0; k < n; ++k)
+            sum += samples[k] * std::cos(celestia::numbers::pi * j * (k + 0.5) / n);
+
+        sum *= (j == 0 ? 1.0 : 2.0) / n;
+        c[j] = sum.x();
+        c[n + j] = sum.y();
+        c[2 * n + j] = sum.z();
+    }
+
+    // The error is largest at the ends of the segment and between the
+    // nodes, so check it there.
+    for (unsigned int k = 0; k <= n; ++k)
+    {
+        double u = std::cos(celestia::numbers::pi * k / n);
+        Eigen::Vector3d p(evalChebyshev(c.data(), n, u),
+                          evalChebyshev(c.data() + n, n, u),
+                          evalChebyshev(c.data() + 2 * n, n, u));
+        if ((p - source->computePosition(midTime + u * halfDuration)).norm() > tolerance)
+            return false;
+    }
+
+    segments[index].offset = static_cast<std::uint32_t>(coeffs.size());
+    segments[index].degree = static_cast<std::uint8_t>(degree);
+    coeffs.insert(coeffs.end(), c.begin(), c.end());
+    return true;
+}
+
+
+bool
+ChebyshevOrbit::readCache()
+{
+    std::ifstream in(cacheFile, std::ios::in | std::ios::binary);
+    if (!in.good())
+        return true;
+
+    std::array<char, CHEBYSHEV_MAGIC.size()> magic;
+    std::uint16_t version;
+    std::uint32_t keyLength;
+    std::string fileKey(cacheKey.size(), '\0');
+    double fileStartTime;
+    double fileSegmentDuration;
+    double fileTolerance;
+    std::uint32_t fileSegments;
+    if (!in.read(magic.data(), magic.size()).good() ||
+        std::string_view(magic.data(), magic.size()) != CHEBYSHEV_MAGIC ||
+        !celutil::readLE<std::uint16_t>(in, version) ||
+        version != CHEBYSHEV_VERSION ||
+        !celutil::readLE<std::uint32_t>(in, keyLength) ||
+        keyLength != cacheKey.size() ||
+        !in.read(fileKey.data(), fileKey.size()).good() ||
+        fileKey != cacheKey ||
+        !celutil::readLE<double>(in, fileStartTime) ||
+        !celutil::readLE<double>(in, fileSegmentDuration) ||
+        !celutil::readLE<double>(in, fileTolerance) ||
+        !celutil::readLE<std::uint32_t>(in, fileSegments))
+    {
+        return true;
+    }
+
+    // Fits made for a different span or tolerance are discarded
+    if (fileStartTime != startTime ||
+        fileSegmentDuration != segmentDuration ||
+        fileTolerance != tolerance ||
+        fileSegments != segments.size())
+    {
+        return true;
+    }
+
+    cacheValid = true;
+    for (;;)
+    {
+        std::uint32_t index;
+        if (!celutil::readLE<std::uint32_t>(in, index))
+        {
+            // A partly written record is dropped and the file rewritten
+            cacheValid = in.gcount() == 0;
+            break;
+        }
+
+        std::uint8_t degree;
+        if (!celutil::readLE<std::uint8_t>(in, degree) ||
+            index >= segments.size() ||
+            segments[index].degree != NotFitted ||
+            (degree != Unfittable && (degree == NotFitted || degree > MaxDegree)))
+        {
+            cacheValid = false;
+            break;
+        }
+
+        if (degree != Unfittable)
+        {
+            auto offset = coeffs.size();
+            coeffs.resize(offset + 3 * (degree + 1u));
+            if (!std::all_of(coeffs.begin() + offset, coeffs.end(),
+                             [&in](double& c) { return celutil::readLE<double>(in, c); }))
+            {
+                coeffs.resize(offset);
+                cacheValid = false;
+                break;
+            }
+
+            segments[index].offset = static_cast<std::uint32_t>(offset);
+        }
+
+        segments[index].degree = degree;
+        ++fittedCount;
+    }
+
+    return cacheValid;
+}
+
+
+void
+ChebyshevOrbit::writeSegment(std::size_t index) const
+{
+    if (cacheFile.empty())
+        return;
+
+    auto writeRecord = [this](std::size_t i)
+    {
+        const Segment& segment = segments[i];
+        celutil::writeLE<std::uint32_t>(cacheOut, static_cast<std::uint32_t>(i));
+        celutil::writeLE<std::uint8_t>(cacheOut, segment.degree);
+        if (segment.degree != Unfittable)
+        {
+            auto begin = coeffs.begin() + segment.offset;
+            std::for_each(begin, begin + 3 * (segment.degree + 1u),
+                          [this](double c) { celutil::writeLE<double>(cacheOut, c); });
+        }
+    };
+
+    if (!cacheOut.is_open())
+    {
+        std::error_code ec;
+        fs::create_directories(cacheFile.parent_path(), ec);
+
+        // Fits are appended to a valid cache, otherwise it is replaced by
+        // one holding all the fits made so far.
+        if (cacheValid)
+        {
+            cacheOut.open(cacheFile, std::ios::out | std::ios::binary | std::ios::app);
+            if (cacheOut.good())
+                writeRecord(index);
+        }
+        else
+        {
+            cacheOut.open(cacheFile, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (cacheOut.good())
+            {
+                cacheOut.write(CHEBYSHEV_MAGIC.data(), CHEBYSHEV_MAGIC.size());
+                celutil::writeLE<std::uint16_t>(cacheOut, CHEBYSHEV_VERSION);
+                celutil::writeLE<std::uint32_t>(cacheOut, static_cast<std::uint32_t>(cacheKey.size()));
+                cacheOut.write(cacheKey.data(), cacheKey.size());
+                celutil::writeLE<double>(cacheOut, startTime);
+                celutil::writeLE<double>(cacheOut, segmentDuration);
+                celutil::writeLE<double>(cacheOut, tolerance);
+                celutil::writeLE<std::uint32_t>(cacheOut, static_cast<std::uint32_t>(segments.size()));
+                for (std::size_t i = 0; i < segments.size(); ++i)
+                {
+                    if (segments[i].degree != NotFitted)
+                        writeRecord(i);
+                }
+                cacheValid = true;
+            }
+        }
+    }
+    else
+    {
+        writeRecord(index);
+    }
+
+    // Flushed after every fit so that nothing is lost when the program
+    // exits without destroying the orbit.
+    cacheOut.flush();
+    if (!cacheOut.good())
+    {
+        GetLogger()->warn("Failed to write ephemeris cache {}\n", cacheFile);
+        cacheOut.close();
+        std::lock_guard<std::mutex> lock(cacheFilesMutex);
+        cacheFilesInUse.erase(cacheFile);
+        cacheFile.clear();
+    }
+}
+
+
+void
+SetChebyshevFitOptions(const ChebyshevFitOptions& options)
+{
+    fitOptions = options;
+}
+
+
+const ChebyshevFitOptions&
+GetChebyshevFitOptions()
+{
+    return fitOptions;
+}
+
+
+std::unique_ptr<Orbit>
+FitChebyshevOrbit(std::unique_ptr<Orbit>&& orbit, std::string_view name)
+{
+    if (!(fitOptions.endTime > fitOptions.startTime))
+        return std::move(orbit);
+
+    auto* cachingOrbit = dynamic_cast<CachingOrbit*>(orbit.get());
+    if (cachingOrbit == nullptr)
+        return std::move(orbit);
+
+    orbit.release();
+    std::unique_ptr<CachingOrbit> source(cachingOrbit);
+
+    fs::path cacheFile;
+    if (!fitOptions.cacheDirectory.empty())
+    {
+        std::string key = makeCacheKey(*source, fitOptions.startTime, fitOptions.endTime, fitOptions.tolerance);
+        cacheFile = fitOptions.cacheDirectory / fmt::format("{}-{:016x}.cheb", name, std::hash<std::string>()(key));
+    }
+
+    return std::make_unique<ChebyshevOrbit>(std::move(source),
+                                            fitOptions.startTime,
+                                            fitOptions.endTime,
+                                            fitOptions.tolerance,
+                                            cacheFile);
+}
+
+} // end namespace celestia::ephem
@@ -0,0 +1,129 @@
+// chebyshevorbit.h
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// Piecewise Chebyshev approximation of orbits which are expensive to
+// compute.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <celcompat/filesystem.h>
+#include "orbit.h"
+
+namespace celestia::ephem
+{
+
+struct ChebyshevFitOptions
+{
+    // Span of time (TDB) over which orbits are fitted; nothing is fitted
+    // when it is empty.
+    double startTime{ 0.0 };
+    double endTime{ 0.0 };
+    // Largest position error allowed in a fit, in kilometers
+    double tolerance{ 1.0 };
+    // Directory where fits are saved to be reused; fits are not saved if
+    // it is empty.
+    fs::path cacheDirectory;
+};
+
+
+/*! A ChebyshevOrbit returns the positions and velocities of another orbit
+ *  from Chebyshev polynomials fitted to it. The time span is split into
+ *  segments of equal length which are fitted the first time they are
+ *  used and, if a cache file is given, appended to it so that later runs
+ *  can skip the fitting. Segments which can't be fitted within the
+ *  tolerance, and times outside the span, are computed by the source
+ *  orbit.
+ *
+ *  The cache file records a key made of positions of the source orbit,
+ *  the fit parameters and the version of the fitting, and its fits are
+ *  only used when they match. When several orbits share a cache file,
+ *  only the first one appends to it; the others just read it.
+ */
+class ChebyshevOrbit : public CachingOrbit
+{
+ public:
+    ChebyshevOrbit(std::unique_ptr<CachingOrbit>&& source,
+                   double startTime,
+                   double endTime,
+                   double tolerance,
+                   const fs::path& cacheFile = fs::path());
+    ~ChebyshevOrbit() override;
+
+    Eigen::Vector3d computePosition(double jd) const override;
+    Eigen::Vector3d computeVelocity(double jd) const override;
+    double getPeriod() const override;
+    double getBoundingRadius() const override;
+    bool isPeriodic() const override;
+    void getValidRange(double& begin, double& end) const override;
+    void sample(double startTime, double endTime, OrbitSampleProc& proc) const override;
+
+    double getSegmentDuration() const { return segmentDuration; }
+    std::size_t getSegmentCount() const { return segments.size(); }
+    // Number of segments fitted so far, including those read from the
+    // cache file
+    std::size_t getFittedSegmentCount() const { return fittedCount; }
+
+    static constexpr unsigned int MaxDegree = 24;
+
+ private:
+    struct Segment
+    {
+        std::uint32_t offset{ 0 };
+        std::uint8_t degree{ NotFitted };
+    };
+
+    static constexpr std::uint8_t NotFitted = 0;
+    static constexpr std::uint8_t Unfittable = 0xff;
+
+    const Segment* findSegment(double jd, double& u) const;
+    void fitSegment(std::size_t index) const;
+    bool fitSegment(std::size_t index, unsigned int degree) const;
+    // Returns false if the cache holds fits for this orbit but is damaged
+    bool readCache();
+    void writeSegment(std::size_t index) const;
+
+    std::unique_ptr<CachingOrbit> source;
+    double startTime;
+    double segmentDuration;
+    double tolerance;
+
+    mutable std::vector<Segment> segments;
+    // Coefficients of the x, y and z polynomials of each fitted segment
+    mutable std::vector<double> coeffs;
+    mutable std::size_t fittedCount{ 0 };
+
+    mutable fs::path cacheFile;
+    mutable std::ofstream cacheOut;
+    mutable bool cacheValid{ false };
+    std::string cacheKey;
+};
+
+
+void SetChebyshevFitOptions(const ChebyshevFitOptions&);
+const ChebyshevFitOptions& GetChebyshevFitOptions();
+
+/*! Replace orbit by a ChebyshevOrbit fitted to it if fitting has been
+ *  enabled with SetChebyshevFitOptions() and it is a CachingOrbit;
+ *  otherwise return it unchanged. The cache file is named after the orbit
+ *  theory and the key of its fits, so that fits made with other
+ *  parameters or by another version are kept in separate files.
+ */
+std::unique_ptr<Orbit> FitChebyshevOrbit(std::unique_ptr<Orbit>&& orbit, std::string_view name);
+
+} // end namespace celestia::ephem
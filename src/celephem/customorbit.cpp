@@ -13,7 +13,6 @@
 #include <cassert>
 #include <cstddef>
 #include <cmath>
-#include <fstream>
 #include <initializer_list>
 #include <map>
 #include <memory>
@@ -24,6 +23,7 @@
 #include <celmath/mathlib.h>
 #include <celmath/geomutil.h>
 #include <celutil/logger.h>
+#include "chebyshevorbit.h"
 #include "customorbittype.h"
 #include "jpleph.h"
 #include "orbit.h"
@@ -1613,6 +1613,11 @@ class IoOrbit : public CachingOrbit
     {
         return 423329 * BoundingRadiusSlack;
     };
+
+    bool isThreadSafe() const override
+    {
+        return true;
+    };
 };
 
 class EuropaOrbit : public CachingOrbit
@@ -1703,6 +1708,11 @@ class EuropaOrbit : public CachingOrbit
     {
         return 678000 * BoundingRadiusSlack;
     };
+
+    bool isThreadSafe() const override
+    {
+        return true;
+    };
 };
 
 class GanymedeOrbit : public CachingOrbit
@@ -1796,6 +1806,11 @@ class GanymedeOrbit : public CachingOrbit
     {
         return 1070000 * BoundingRadiusSlack;
     };
+
+    bool isThreadSafe() const override
+    {
+        return true;
+    };
 };
 
 class CallistoOrbit : public CachingOrbit
@@ -1934,6 +1949,11 @@ class CallistoOrbit : public CachingOrbit
     {
         return 1890000 * BoundingRadiusSlack;
     };
+
+    bool isThreadSafe() const override
+    {
+        return true;
+    };
 };
 
 
@@ -3075,12 +3095,18 @@ class JPLEphOrbit : public CachingOrbit
         return boundingRadius;
     }
 
+    bool isThreadSafe() const override
+    {
+        return true;
+    }
+
     Eigen::Vector3d computePosition(double tjd) const override
     {
         // Get the position relative to the Earth (for the Moon) or
-        // the solar system barycenter.
-        Eigen::Vector3d pos = ephem.getPlanetPosition(target, tjd);
-
+        // the solar system barycenter, along with the positions needed to
+        // translate it to the center.
+        std::array<JPLEphemItem, 3> items{ target, center, JPLEphemItem::Earth };
+        std::size_t nItems = 1;
         if (center == JPLEphemItem::SSB && target != JPLEphemItem::Moon)
         {
             // No translation necessary
@@ -3091,14 +3117,23 @@ class JPLEphOrbit : public CachingOrbit
         }
         else
         {
-            Eigen::Vector3d centerPos = ephem.getPlanetPosition(center, tjd);
+            nItems = target == JPLEphemItem::Moon || center == JPLEphemItem::Moon ? 3 : 2;
+        }
+
+        std::array<Eigen::Vector3d, 3> positions;
+        ephem.getPlanetPositions(items.data(), nItems, tjd, positions.data());
+
+        Eigen::Vector3d pos = positions[0];
+        if (nItems > 1)
+        {
+            Eigen::Vector3d centerPos = positions[1];
             if (target == JPLEphemItem::Moon)
             {
-                pos += ephem.getPlanetPosition(JPLEphemItem::Earth, tjd);
+                pos += positions[2];
             }
             if (center == JPLEphemItem::Moon)
             {
-                centerPos += ephem.getPlanetPosition(JPLEphemItem::Earth, tjd);
+                centerPos += positions[2];
             }
 
             // Compute the position of target relative to the center
@@ -3133,9 +3168,8 @@ std::unique_ptr<Orbit> CreateJPLEphOrbit(JPLEphemItem target,
     if (!jplephInitialized)
     {
         jplephInitialized = true;
-        std::ifstream in("data/jpleph.dat", std::ios::in | std::ios::binary);
-        if (in.good())
-            jpleph = JPLEphemeris::load(in);
+        // The file is mapped, so only the records used are read
+        jpleph = JPLEphemeris::load(fs::path("data/jpleph.dat"));
         if (jpleph != nullptr)
         {
             if (unsigned int deNumber = jpleph->getDENumber(); deNumber != 100)
@@ -3281,25 +3315,25 @@ std::unique_ptr<Orbit> GetCustomOrbit(std::string_view name)
     case CustomOrbitType::Unknown:
         return nullptr;
     case CustomOrbitType::Mercury:
-        return std::make_unique<MixedOrbit>(std::make_unique<MercuryOrbit>(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::make_unique<MercuryOrbit>(), name), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     case CustomOrbitType::Venus:
-        return std::make_unique<MixedOrbit>(std::make_unique<VenusOrbit>(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::make_unique<VenusOrbit>(), name), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     case CustomOrbitType::Earth:
-        return std::make_unique<MixedOrbit>(std::make_unique<EarthOrbit>(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::make_unique<EarthOrbit>(), name), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     case CustomOrbitType::Moon:
-        return std::make_unique<MixedOrbit>(std::make_unique<LunarOrbit>(), yearToJD(-2000), yearToJD(4000), astro::EarthMass + astro::LunarMass);
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::make_unique<LunarOrbit>(), name), yearToJD(-2000), yearToJD(4000), astro::EarthMass + astro::LunarMass);
     case CustomOrbitType::Mars:
-        return std::make_unique<MixedOrbit>(std::make_unique<MarsOrbit>(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::make_unique<MarsOrbit>(), name), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     case CustomOrbitType::Jupiter:
-        return std::make_unique<MixedOrbit>(std::make_unique<JupiterOrbit>(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::make_unique<JupiterOrbit>(), name), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     case CustomOrbitType::Saturn:
-        return std::make_unique<MixedOrbit>(std::make_unique<SaturnOrbit>(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::make_unique<SaturnOrbit>(), name), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     case CustomOrbitType::Uranus:
-        return std::make_unique<MixedOrbit>(std::make_unique<UranusOrbit>(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::make_unique<UranusOrbit>(), name), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     case CustomOrbitType::Neptune:
-        return std::make_unique<MixedOrbit>(std::make_unique<NeptuneOrbit>(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::make_unique<NeptuneOrbit>(), name), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     case CustomOrbitType::Pluto:
-        return std::make_unique<MixedOrbit>(std::make_unique<PlutoOrbit>(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::make_unique<PlutoOrbit>(), name), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
 
     // JPL ephemerides for planets (relative to the Sun)
     case CustomOrbitType::JplMercurySun:
@@ -3358,57 +3392,57 @@ std::unique_ptr<Orbit> GetCustomOrbit(std::string_view name)
 
     // HTC2.0 ephemeris for Saturnian satellites in Lagrange points of Tethys and Dione
     case CustomOrbitType::Htc20Helene:
-        return HTC20Orbit::CreateHeleneOrbit();
+        return FitChebyshevOrbit(HTC20Orbit::CreateHeleneOrbit(), name);
     case CustomOrbitType::Htc20Telesto:
-        return HTC20Orbit::CreateTelestoOrbit();
+        return FitChebyshevOrbit(HTC20Orbit::CreateTelestoOrbit(), name);
     case CustomOrbitType::Htc20Calypso:
-        return HTC20Orbit::CreateCalypsoOrbit();
+        return FitChebyshevOrbit(HTC20Orbit::CreateCalypsoOrbit(), name);
 
     // various planetary satellite orbits
     case CustomOrbitType::Phobos:
-        return std::make_unique<PhobosOrbit>();
+        return FitChebyshevOrbit(std::make_unique<PhobosOrbit>(), name);
     case CustomOrbitType::Deimos:
-        return std::make_unique<DeimosOrbit>();
+        return FitChebyshevOrbit(std::make_unique<DeimosOrbit>(), name);
     case CustomOrbitType::Io:
-        return std::make_unique<IoOrbit>();
+        return FitChebyshevOrbit(std::make_unique<IoOrbit>(), name);
     case CustomOrbitType::Europa:
-        return std::make_unique<EuropaOrbit>();
+        return FitChebyshevOrbit(std::make_unique<EuropaOrbit>(), name);
     case CustomOrbitType::Ganymede:
-        return std::make_unique<GanymedeOrbit>();
+        return FitChebyshevOrbit(std::make_unique<GanymedeOrbit>(), name);
     case CustomOrbitType::Callisto:
-        return std::make_unique<CallistoOrbit>();
+        return FitChebyshevOrbit(std::make_unique<CallistoOrbit>(), name);
     case CustomOrbitType::Mimas:
-        return std::make_unique<MimasOrbit>();
+        return FitChebyshevOrbit(std::make_unique<MimasOrbit>(), name);
     case CustomOrbitType::Enceladus:
-        return std::make_unique<EnceladusOrbit>();
+        return FitChebyshevOrbit(std::make_unique<EnceladusOrbit>(), name);
     case CustomOrbitType::Tethys:
-        return std::make_unique<TethysOrbit>();
+        return FitChebyshevOrbit(std::make_unique<TethysOrbit>(), name);
     case CustomOrbitType::Dione:
-        return std::make_unique<DioneOrbit>();
+        return FitChebyshevOrbit(std::make_unique<DioneOrbit>(), name);
     case CustomOrbitType::Rhea:
-        return std::make_unique<RheaOrbit>();
+        return FitChebyshevOrbit(std::make_unique<RheaOrbit>(), name);
     case CustomOrbitType::Titan:
-        return std::make_unique<TitanOrbit>();
+        return FitChebyshevOrbit(std::make_unique<TitanOrbit>(), name);
     case CustomOrbitType::Hyperion:
-        return std::make_unique<HyperionOrbit>();
+        return FitChebyshevOrbit(std::make_unique<HyperionOrbit>(), name);
     case CustomOrbitType::Iapetus:
-        return std::make_unique<IapetusOrbit>();
+        return FitChebyshevOrbit(std::make_unique<IapetusOrbit>(), name);
     case CustomOrbitType::Phoebe:
-        return std::make_unique<PhoebeOrbit>();
+        return FitChebyshevOrbit(std::make_unique<PhoebeOrbit>(), name);
     case CustomOrbitType::Miranda:
-        return CreateUranianSatelliteOrbit(1);
+        return FitChebyshevOrbit(CreateUranianSatelliteOrbit(1), name);
     case CustomOrbitType::Ariel:
-        return CreateUranianSatelliteOrbit(2);
+        return FitChebyshevOrbit(CreateUranianSatelliteOrbit(2), name);
     case CustomOrbitType::Umbriel:
-        return CreateUranianSatelliteOrbit(3);
+        return FitChebyshevOrbit(CreateUranianSatelliteOrbit(3), name);
     case CustomOrbitType::Titania:
-        return CreateUranianSatelliteOrbit(4);
+        return FitChebyshevOrbit(CreateUranianSatelliteOrbit(4), name);
     case CustomOrbitType::Oberon:
-        return CreateUranianSatelliteOrbit(5);
+        return FitChebyshevOrbit(CreateUranianSatelliteOrbit(5), name);
     case CustomOrbitType::Triton:
-        return std::make_unique<TritonOrbit>();
+        return FitChebyshevOrbit(std::make_unique<TritonOrbit>(), name);
     default:
-        return CreateVSOP87Orbit(type);
+        return CreateVSOP87Orbit(type, name);
     }
 }
 
@@ -10,12 +10,16 @@
 // Load JPL's DE200, DE405, and DE406 ephemerides and compute planet
 // positions.
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <istream>
+#include <memory>
 #include <type_traits>
+#include <utility>
 
 #include <celutil/bytes.h>
 #include "jpleph.h"
@@ -57,30 +61,11 @@ inline void getMaybeSwapDouble(double& dest, const char* ptr, bool swapBytes)
 constexpr unsigned int NConstants         =  400;
 constexpr unsigned int ConstantNameLength =  6;
 
-constexpr unsigned int MaxChebyshevCoeffs = 32;
-
 constexpr unsigned int LabelSize = 84;
 
 constexpr unsigned int INPOP_DE_COMPATIBLE = 100;
 constexpr unsigned int DE200 = 200;
 
-// Read a big-endian or little endian 32-bit unsigned integer
-std::uint32_t readUint(std::istream& in, bool swap)
-{
-    std::uint32_t ret;
-    in.read((char*) &ret, sizeof(std::uint32_t));
-    return swap ? bswap_32(ret) : ret;
-}
-
-// Read a big-endian or little endian 64-bit IEEE double.
-// If the native double format isn't IEEE 754, there will be troubles.
-double readDouble(std::istream& in, bool swap)
-{
-    double d;
-    in.read((char*) &d, sizeof(double));
-    return swap ? bswap_double(d) : d;
-}
-
 #pragma pack(push, 1)
 
 // These packed structs are only used for offset calculations, they should
@@ -159,48 +144,74 @@ bool JPLEphemeris::getByteSwap() const
     return swapBytes;
 }
 
-// Return the position of an object relative to the solar system barycenter
-// or the Earth (in the case of the Moon) at a specified TDB Julian date tjd.
-// If tjd is outside the span covered by the ephemeris it is clamped to a
-// valid time.
-Eigen::Vector3d JPLEphemeris::getPlanetPosition(JPLEphemItem planet, double tjd) const
+std::size_t JPLEphemeris::getDecodedRecordCount() const
 {
-    // Solar system barycenter is the origin
-    if (planet == JPLEphemItem::SSB)
-    {
-        return Eigen::Vector3d::Zero();
-    }
+    std::scoped_lock lock(cacheMutex);
+    return decodedCount;
+}
+
+
+// Return the decoded record recNo, decoding it into the least recently used
+// cache entry if it isn't cached. Must be called with cacheMutex held; the
+// record stays valid until the mutex is released.
+const JPLEphRecord& JPLEphemeris::getRecord(unsigned int recNo) const
+{
+    ++cacheClock;
 
-    // The position of the Earth must be computed from the positions of the
-    // Earth-Moon barycenter and Moon
-    if (planet == JPLEphemItem::Earth)
+    CachedRecord* entry = &recordCache[0];
+    for (CachedRecord& cached : recordCache)
     {
-        Eigen::Vector3d embPos = getPlanetPosition(JPLEphemItem::EarthMoonBary, tjd);
+        if (cached.valid && cached.recNo == recNo)
+        {
+            cached.lastUsed = cacheClock;
+            return cached.record;
+        }
+
+        if (!cached.valid || (entry->valid && cached.lastUsed < entry->lastUsed))
+            entry = &cached;
+    }
 
-        // Get the geocentric position of the Moon
-        Eigen::Vector3d moonPos = getPlanetPosition(JPLEphemItem::Moon, tjd);
+    // Data records follow the header and constants records
+    const char* ptr = data + (std::size_t{ recNo } + 2) * recordSize * sizeof(double);
+    getMaybeSwapDouble(entry->record.t0, ptr, swapBytes);
+    getMaybeSwapDouble(entry->record.t1, ptr + sizeof(double), swapBytes);
 
-        return embPos - moonPos * (1.0 / (earthMoonMassRatio + 1.0));
+    // The first two 'coefficients' are actually the start and end time (t0
+    // and t1)
+    entry->record.coeffs.resize(recordSize - 2);
+    if (swapBytes)
+    {
+        for (unsigned int j = 0; j < recordSize - 2; j++)
+            getMaybeSwapDouble(entry->record.coeffs[j], ptr + (j + 2) * sizeof(double), true);
+    }
+    else
+    {
+        std::memcpy(entry->record.coeffs.data(), ptr + 2 * sizeof(double), (recordSize - 2) * sizeof(double));
     }
 
-    // Clamp time to [ startDate, endDate ]
-    if (tjd < startDate)
-        tjd = startDate;
-    else if (tjd > endDate)
-    tjd = endDate;
+    entry->recNo = recNo;
+    entry->valid = true;
+    entry->lastUsed = cacheClock;
+    ++decodedCount;
 
-    // recNo is always >= 0:
-    auto recNo = (unsigned int) ((tjd - startDate) / daysPerInterval);
-    // Make sure we don't go past the end of the array if t == endDate
-    if (recNo >= records.size())
-        recNo = records.size() - 1;
-    const JPLEphRecord* rec = &records[recNo];
+    return entry->record;
+}
 
-    auto planetIdx = static_cast<std::size_t>(planet);
 
-    assert(coeffInfo[planetIdx].nGranules >= 1);
-    assert(coeffInfo[planetIdx].nGranules <= 32);
-    assert(coeffInfo[planetIdx].nCoeffs <= MaxChebyshevCoeffs);
+// Evaluate the Chebyshev series of item at tjd, which must lie within the
+// record starting at t0 with coefficients recordCoeffs.
+// basis holds the values of the Chebyshev polynomials at the last u for
+// each granule count so that items with the same granules share them.
+Eigen::Vector3d JPLEphemeris::computePosition(std::size_t item,
+                                              double t0,
+                                              const double* recordCoeffs,
+                                              double tjd,
+                                              ChebyshevBasis* basis) const
+{
+    const JPLEphCoeffInfo& info = coeffInfo[item];
+
+    assert(info.nGranules >= 1);
+    assert(info.nCoeffs <= MaxChebyshevCoeffs);
 
     // u is the normalized time (in [-1, 1]) for interpolating
     // coeffs is a pointer to the Chebyshev coefficients
@@ -208,50 +219,162 @@ Eigen::Vector3d JPLEphemeris::getPlanetPosition(JPLEphemItem planet, double tjd)
     const double* coeffs = nullptr;
 
     // nGranules is unsigned int so it will be compared against FFFFFFFF:
-    if (coeffInfo[planetIdx].nGranules == (unsigned int) -1)
+    if (info.nGranules == (unsigned int) -1)
     {
-        coeffs = rec->coeffs.data() + coeffInfo[planetIdx].offset;
-        u = 2.0 * (tjd - rec->t0) / daysPerInterval - 1.0;
+        coeffs = recordCoeffs + info.offset;
+        u = 2.0 * (tjd - t0) / daysPerInterval - 1.0;
     }
     else
     {
-        double daysPerGranule = daysPerInterval / coeffInfo[planetIdx].nGranules;
-        auto granule = (int) ((tjd - rec->t0) / daysPerGranule);
-        double granuleStartDate = rec->t0 + daysPerGranule * (double) granule;
-        coeffs = rec->coeffs.data() + coeffInfo[planetIdx].offset +
-                 granule * coeffInfo[planetIdx].nCoeffs * 3;
+        assert(info.nGranules <= 32);
+        double daysPerGranule = daysPerInterval / info.nGranules;
+        auto granule = (unsigned int) ((tjd - t0) / daysPerGranule);
+        // tjd may be at the very end of the record
+        if (granule >= info.nGranules)
+            granule = info.nGranules - 1;
+        double granuleStartDate = t0 + daysPerGranule * (double) granule;
+        coeffs = recordCoeffs + info.offset + granule * info.nCoeffs * 3;
         u = 2.0 * (tjd - granuleStartDate) / daysPerGranule - 1.0;
     }
 
+    // Find the polynomial values for this granule count, or evaluate them
+    unsigned int nCoeffs = info.nCoeffs;
+    ChebyshevBasis* cc = &basis[0];
+    for (unsigned int i = 0; i < MaxBases; i++)
+    {
+        if (basis[i].nGranules == info.nGranules || basis[i].nCoeffs == 0)
+        {
+            cc = &basis[i];
+            break;
+        }
+    }
+
+    if (cc->nGranules != info.nGranules || cc->u != u || cc->nCoeffs < nCoeffs)
+    {
+        cc->nGranules = info.nGranules;
+        cc->u = u;
+        cc->nCoeffs = std::max(nCoeffs, 2u);
+        cc->values[0] = 1.0;
+        cc->values[1] = u;
+        for (unsigned int j = 2; j < cc->nCoeffs; j++)
+            cc->values[j] = 2.0 * u * cc->values[j - 1] - cc->values[j - 2];
+    }
+
     // Evaluate the Chebyshev polynomials
     double sum[3];
-    double cc[MaxChebyshevCoeffs];
-    unsigned int nCoeffs = coeffInfo[planetIdx].nCoeffs;
     for (int i = 0; i < 3; i++)
     {
-        cc[0] = 1.0;
-        cc[1] = u;
-        sum[i] = coeffs[i * nCoeffs] + coeffs[i * nCoeffs + 1] * u;
-        for (unsigned int j = 2; j < nCoeffs; j++)
-        {
-            cc[j] = 2.0 * u * cc[j - 1] - cc[j - 2];
-            sum[i] += coeffs[i * nCoeffs + j] * cc[j];
-        }
+        sum[i] = 0.0;
+        for (unsigned int j = 0; j < nCoeffs; j++)
+            sum[i] += coeffs[i * nCoeffs + j] * cc->values[j];
     }
 
     return Eigen::Vector3d(sum[0], sum[1], sum[2]);
 }
 
 
-JPLEphemeris* JPLEphemeris::load(std::istream& in)
+// Return the position of an object relative to the solar system barycenter
+// or the Earth (in the case of the Moon) at a specified TDB Julian date tjd.
+// If tjd is outside the span covered by the ephemeris it is clamped to a
+// valid time.
+Eigen::Vector3d JPLEphemeris::getPlanetPosition(JPLEphemItem planet, double tjd) const
+{
+    Eigen::Vector3d pos;
+    getPlanetPositions(&planet, 1, tjd, &pos);
+    return pos;
+}
+
+
+// Compute the positions of several objects at the same time tjd, as
+// getPlanetPosition() would. The record for tjd is only looked up once,
+// and the Chebyshev polynomials are shared by items with the same number
+// of granules.
+void JPLEphemeris::getPlanetPositions(const JPLEphemItem* items,
+                                      std::size_t count,
+                                      double tjd,
+                                      Eigen::Vector3d* positions) const
+{
+    // Clamp time to [ startDate, endDate ]
+    if (tjd < startDate)
+        tjd = startDate;
+    else if (tjd > endDate)
+        tjd = endDate;
+
+    // recNo is always >= 0:
+    auto recNo = (unsigned int) ((tjd - startDate) / daysPerInterval);
+    // Make sure we don't go past the end of the array if t == endDate
+    if (recNo >= nRecords)
+        recNo = nRecords - 1;
+
+    if (inPlace)
+    {
+        // Data records follow the header and constants records; the first
+        // two values are the start and end time of the record
+        const char* ptr = data + (std::size_t{ recNo } + 2) * recordSize * sizeof(double);
+        const auto* record = reinterpret_cast<const double*>(ptr);
+        computePositions(items, count, record[0], record + 2, tjd, positions);
+    }
+    else
+    {
+        std::scoped_lock lock(cacheMutex);
+        const JPLEphRecord& rec = getRecord(recNo);
+        computePositions(items, count, rec.t0, rec.coeffs.data(), tjd, positions);
+    }
+}
+
+
+void JPLEphemeris::computePositions(const JPLEphemItem* items,
+                                    std::size_t count,
+                                    double t0,
+                                    const double* coeffs,
+                                    double tjd,
+                                    Eigen::Vector3d* positions) const
+{
+    std::array<ChebyshevBasis, MaxBases> basis;
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        switch (items[i])
+        {
+        case JPLEphemItem::SSB:
+            // Solar system barycenter is the origin
+            positions[i] = Eigen::Vector3d::Zero();
+            break;
+
+        case JPLEphemItem::Earth:
+            {
+                // The position of the Earth must be computed from the
+                // positions of the Earth-Moon barycenter and Moon
+                Eigen::Vector3d embPos = computePosition(static_cast<std::size_t>(JPLEphemItem::EarthMoonBary),
+                                                         t0, coeffs, tjd, basis.data());
+
+                // Get the geocentric position of the Moon
+                Eigen::Vector3d moonPos = computePosition(static_cast<std::size_t>(JPLEphemItem::Moon),
+                                                          t0, coeffs, tjd, basis.data());
+
+                positions[i] = embPos - moonPos * (1.0 / (earthMoonMassRatio + 1.0));
+            }
+            break;
+
+        default:
+            positions[i] = computePosition(static_cast<std::size_t>(items[i]), t0, coeffs, tjd, basis.data());
+            break;
+        }
+    }
+}
+
+
+// Read the header and check that data holds all of the records. The
+// records themselves are only decoded when used.
+JPLEphemeris* JPLEphemeris::create(const char* fileData, std::size_t size)
 {
-    std::array<char, sizeof(JPLEFileHeader)> fh;
-    in.read(fh.data(), fh.size()); /* Flawfinder: ignore */
-    if (!in.good())
+    if (size < sizeof(JPLEFileHeader))
         return nullptr;
 
+    const char* fh = fileData;
+
     decltype(JPLEFileHeader::deNum) deNum;
-    std::memcpy(&deNum, fh.data() + offsetof(JPLEFileHeader, deNum), sizeof(deNum));
+    std::memcpy(&deNum, fh + offsetof(JPLEFileHeader, deNum), sizeof(deNum));
     std::uint32_t deNum2 = bswap_32(deNum);
 
     bool swapBytes;
@@ -283,23 +406,23 @@ JPLEphemeris* JPLEphemeris::load(std::istream& in)
         return nullptr;
     }
 
-    auto *eph = new JPLEphemeris();
+    auto eph = std::unique_ptr<JPLEphemeris>(new JPLEphemeris());
     eph->swapBytes = swapBytes;
     eph->DENum = deNum;
 
     // Read the start time, end time, and time interval
-    getMaybeSwapDouble(eph->startDate,          fh.data() + offsetof(JPLEFileHeader, startDate),          swapBytes);
-    getMaybeSwapDouble(eph->endDate,            fh.data() + offsetof(JPLEFileHeader, endDate),            swapBytes);
-    getMaybeSwapDouble(eph->daysPerInterval,    fh.data() + offsetof(JPLEFileHeader, daysPerInterval),    swapBytes);
+    getMaybeSwapDouble(eph->startDate,          fh + offsetof(JPLEFileHeader, startDate),          swapBytes);
+    getMaybeSwapDouble(eph->endDate,            fh + offsetof(JPLEFileHeader, endDate),            swapBytes);
+    getMaybeSwapDouble(eph->daysPerInterval,    fh + offsetof(JPLEFileHeader, daysPerInterval),    swapBytes);
     // kilometers per astronomical unit
-    getMaybeSwapDouble(eph->au,                 fh.data() + offsetof(JPLEFileHeader, au),                 swapBytes);
-    getMaybeSwapDouble(eph->earthMoonMassRatio, fh.data() + offsetof(JPLEFileHeader, earthMoonMassRatio), swapBytes);
+    getMaybeSwapDouble(eph->au,                 fh + offsetof(JPLEFileHeader, au),                 swapBytes);
+    getMaybeSwapDouble(eph->earthMoonMassRatio, fh + offsetof(JPLEFileHeader, earthMoonMassRatio), swapBytes);
 
     // Read the coefficient information for each item in the ephemeris
     eph->recordSize = 0;
     for (unsigned int i = 0; i < JPLEph_NItems; i++)
     {
-        const char* coeffInfo = fh.data() + offsetof(JPLEFileHeader, coeffInfo) + i * sizeof(JPLECoeff);
+        const char* coeffInfo = fh + offsetof(JPLEFileHeader, coeffInfo) + i * sizeof(JPLECoeff);
         getMaybeSwapUint32(eph->coeffInfo[i].offset,    coeffInfo + offsetof(JPLECoeff, offset),    swapBytes);
         getMaybeSwapUint32(eph->coeffInfo[i].nCoeffs,   coeffInfo + offsetof(JPLECoeff, nCoeffs),   swapBytes);
         getMaybeSwapUint32(eph->coeffInfo[i].nGranules, coeffInfo + offsetof(JPLECoeff, nGranules), swapBytes);
@@ -309,7 +432,7 @@ JPLEphemeris* JPLEphemeris::load(std::istream& in)
         eph->recordSize += eph->coeffInfo[i].nCoeffs * eph->coeffInfo[i].nGranules * nRecords;
     }
 
-    const char* librationCoeffInfo = fh.data() + offsetof(JPLEFileHeader, librationCoeffInfo);
+    const char* librationCoeffInfo = fh + offsetof(JPLEFileHeader, librationCoeffInfo);
     getMaybeSwapUint32(eph->librationCoeffInfo.offset,    librationCoeffInfo + offsetof(JPLECoeff, offset),    swapBytes);
     getMaybeSwapUint32(eph->librationCoeffInfo.nCoeffs,   librationCoeffInfo + offsetof(JPLECoeff, nCoeffs),   swapBytes);
     getMaybeSwapUint32(eph->librationCoeffInfo.nGranules, librationCoeffInfo + offsetof(JPLECoeff, nGranules), swapBytes);
@@ -319,46 +442,73 @@ JPLEphemeris* JPLEphemeris::load(std::istream& in)
     // if INPOP ephemeris, read record size
     if (deNum == INPOP_DE_COMPATIBLE)
     {
-       eph->recordSize = readUint(in, eph->swapBytes);
-       // Skip past the rest of the record
-       in.ignore(eph->recordSize * 8 - sizeof(JPLEFileHeader) - sizeof(uint32_t));
+        if (size < sizeof(JPLEFileHeader) + sizeof(std::uint32_t))
+            return nullptr;
+        getMaybeSwapUint32(eph->recordSize, fh + sizeof(JPLEFileHeader), swapBytes);
     }
-    else
+
+    for (const JPLEphCoeffInfo& info : eph->coeffInfo)
     {
-        // Skip past the rest of the record
-        in.ignore(eph->recordSize * 8 - sizeof(JPLEFileHeader));
+        if (info.nCoeffs > MaxChebyshevCoeffs ||
+            (info.nGranules != (unsigned int) -1 && info.nGranules > 32))
+        {
+            return nullptr;
+        }
     }
 
-    // The next record contains constant values (which we don't need)
-    in.ignore(eph->recordSize * 8);
-    if (!in.good())
-    {
-        delete eph;
+    if (eph->recordSize <= 2 || !(eph->daysPerInterval > 0.0))
         return nullptr;
-    }
 
+    // The header record and the record of constant values (which we don't
+    // need) are followed by the data records
     auto nRecords = (unsigned int) ((eph->endDate - eph->startDate) /
                         eph->daysPerInterval);
-    eph->records.resize(nRecords);
-    for (unsigned int i = 0; i < nRecords; i++)
-    {
-        eph->records[i].t0 = readDouble(in, eph->swapBytes);
-        eph->records[i].t1 = readDouble(in, eph->swapBytes);
+    std::size_t recordBytes = std::size_t{ eph->recordSize } * sizeof(double);
+    if (nRecords == 0 || size / recordBytes < std::size_t{ nRecords } + 2)
+        return nullptr;
 
-        // Allocate coefficient array for this record; the first two
-        // 'coefficients' are actually the start and end time (t0 and t1)
-        eph->records[i].coeffs.reserve(eph->recordSize - 2);
-        for (unsigned int j = 0; j < eph->recordSize - 2; j++)
-            eph->records[i].coeffs.push_back(readDouble(in, eph->swapBytes));
+    eph->data = fileData;
+    eph->nRecords = nRecords;
+    eph->inPlace = !swapBytes && reinterpret_cast<std::uintptr_t>(fileData) % alignof(double) == 0;
 
-        // Make sure that we read this record successfully
-        if (!in.good())
-        {
-            delete eph;
-            return nullptr;
-        }
+    return eph.release();
+}
+
+
+// Load an ephemeris from a stream. All of the data is read in, but records
+// are only decoded when they're used.
+JPLEphemeris* JPLEphemeris::load(std::istream& in)
+{
+    constexpr std::size_t chunkSize = 1 << 20;
+
+    std::vector<char> buffer;
+    while (in.good())
+    {
+        std::size_t offset = buffer.size();
+        buffer.resize(offset + chunkSize);
+        in.read(buffer.data() + offset, chunkSize); /* Flawfinder: ignore */
+        buffer.resize(offset + static_cast<std::size_t>(in.gcount()));
     }
 
+    buffer.shrink_to_fit();
+    JPLEphemeris* eph = create(buffer.data(), buffer.size());
+    if (eph != nullptr)
+        eph->buffer = std::move(buffer);
+    return eph;
+}
+
+
+// Load an ephemeris by mapping the file into memory, so that only the parts
+// of the file which hold the records used are read from disk.
+JPLEphemeris* JPLEphemeris::load(const fs::path& path)
+{
+    celestia::util::MappedFile file;
+    if (!file.open(path))
+        return nullptr;
+
+    JPLEphemeris* eph = create(file.data(), file.size());
+    if (eph != nullptr)
+        eph->file = std::move(file);
     return eph;
 }
 
@@ -16,10 +16,14 @@
 #include <cstddef>
 #include <cstdint>
 #include <iosfwd>
+#include <mutex>
 #include <vector>
 
 #include <Eigen/Core>
 
+#include <celcompat/filesystem.h>
+#include <celutil/mappedfile.h>
+
 namespace celestia::ephem
 {
 
@@ -60,6 +64,12 @@ struct JPLEphRecord
 };
 
 
+/*! The records of the ephemeris are kept in their file format, either in
+ *  a memory mapped file or in a buffer read from a stream. Records in the
+ *  native byte order are used in place; others are decoded into a small
+ *  cache when first used. Positions may be computed by several threads at
+ *  once.
+ */
 class JPLEphemeris
 {
 private:
@@ -68,11 +78,22 @@ private:
 public:
     static constexpr std::size_t JPLEph_NItems = 12;
 
+    // Number of decoded records kept
+    static constexpr std::size_t RecordCacheSize = 8;
+
     ~JPLEphemeris() = default;
 
     Eigen::Vector3d getPlanetPosition(JPLEphemItem, double t) const;
 
+    // Compute the positions of count items at the same time; the record is
+    // looked up once for all of them.
+    void getPlanetPositions(const JPLEphemItem* items,
+                            std::size_t count,
+                            double t,
+                            Eigen::Vector3d* positions) const;
+
     static JPLEphemeris* load(std::istream&);
+    static JPLEphemeris* load(const fs::path&);
 
     unsigned int getDENumber() const;
     double getStartDate() const;
@@ -80,7 +101,46 @@ public:
     bool getByteSwap() const;
     unsigned int getRecordSize() const;
 
+    // Number of records decoded since loading; always zero when the
+    // records are used in place
+    std::size_t getDecodedRecordCount() const;
+
 private:
+    static constexpr unsigned int MaxChebyshevCoeffs = 32;
+    // Number of distinct granule counts sharing polynomial values
+    static constexpr unsigned int MaxBases = 4;
+
+    struct ChebyshevBasis
+    {
+        unsigned int nGranules{ 0 };
+        unsigned int nCoeffs{ 0 };
+        double u{ 0.0 };
+        std::array<double, MaxChebyshevCoeffs> values;
+    };
+
+    struct CachedRecord
+    {
+        unsigned int recNo{ 0 };
+        bool valid{ false };
+        std::uint64_t lastUsed{ 0 };
+        JPLEphRecord record;
+    };
+
+    static JPLEphemeris* create(const char* header, std::size_t size);
+
+    const JPLEphRecord& getRecord(unsigned int recNo) const;
+    void computePositions(const JPLEphemItem* items,
+                          std::size_t count,
+                          double t0,
+                          const double* coeffs,
+                          double tjd,
+                          Eigen::Vector3d* positions) const;
+    Eigen::Vector3d computePosition(std::size_t item,
+                                    double t0,
+                                    const double* recordCoeffs,
+                                    double tjd,
+                                    ChebyshevBasis* basis) const;
+
     std::array<JPLEphCoeffInfo, JPLEph_NItems> coeffInfo;
     JPLEphCoeffInfo librationCoeffInfo;
 
@@ -95,7 +155,19 @@ private:
     unsigned int recordSize;  // number of doubles per record
     bool swapBytes;
 
-    std::vector<JPLEphRecord> records;
+    // Records in file format; data points either into the mapped file or
+    // into buffer.
+    celestia::util::MappedFile file;
+    std::vector<char> buffer;
+    const char* data{ nullptr };
+    unsigned int nRecords{ 0 };
+    // True if the coefficients can be read directly from data
+    bool inPlace{ false };
+
+    mutable std::mutex cacheMutex;
+    mutable std::array<CachedRecord, RecordCacheSize> recordCache;
+    mutable std::uint64_t cacheClock{ 0 };
+    mutable std::size_t decodedCount{ 0 };
 };
 
 } // end namespace celestia::ephem
@@ -344,6 +344,13 @@ Eigen::Vector3d Orbit::velocityAtTime(double tdb) const
 }
 
 
+void Orbit::positionsAtTimes(const double* jds, std::size_t count, Eigen::Vector3d* positions) const
+{
+    for (std::size_t i = 0; i < count; i++)
+        positions[i] = positionAtTime(jds[i]);
+}
+
+
 double EllipticalOrbit::eccentricAnomaly(double M) const
 {
     if (eccentricity == 0.0)
@@ -495,39 +502,50 @@ double EllipticalOrbit::getBoundingRadius() const
 
 Eigen::Vector3d CachingOrbit::positionAtTime(double jd) const
 {
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (jd == lastTime && positionCacheValid)
+            return lastPosition;
+    }
+
+    // Compute outside the lock, as computePosition() may be slow
+    Eigen::Vector3d position = computePosition(jd);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
     if (jd != lastTime)
     {
         lastTime = jd;
-        lastPosition = computePosition(jd);
-        positionCacheValid = true;
         velocityCacheValid = false;
     }
-    else if (!positionCacheValid)
-    {
-        lastPosition = computePosition(jd);
-        positionCacheValid = true;
-    }
+    lastPosition = position;
+    positionCacheValid = true;
 
-    return lastPosition;
+    return position;
 }
 
 
 Eigen::Vector3d CachingOrbit::velocityAtTime(double jd) const
 {
-    if (jd != lastTime)
     {
-        lastVelocity = computeVelocity(jd);
-        lastTime = jd;  // must be set *after* call to computeVelocity
-        positionCacheValid = false;
-        velocityCacheValid = true;
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (jd == lastTime && velocityCacheValid)
+            return lastVelocity;
     }
-    else if (!velocityCacheValid)
+
+    // The default computeVelocity() calls positionAtTime(), so the lock
+    // must not be held here.
+    Eigen::Vector3d velocity = computeVelocity(jd);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (jd != lastTime)
     {
-        lastVelocity = computeVelocity(jd);
-        velocityCacheValid = true;
+        lastTime = jd;
+        positionCacheValid = false;
     }
+    lastVelocity = velocity;
+    velocityCacheValid = true;
 
-    return lastVelocity;
+    return velocity;
 }
 
 
@@ -599,6 +617,31 @@ Eigen::Vector3d MixedOrbit::velocityAtTime(double jd) const
 }
 
 
+void MixedOrbit::positionsAtTimes(const double* jds, std::size_t count, Eigen::Vector3d* positions) const
+{
+    // Runs of times within the span of the primary orbit are passed on
+    // together.
+    std::size_t i = 0;
+    while (i < count)
+    {
+        std::size_t j = i;
+        while (j < count && jds[j] >= begin && jds[j] < end)
+            j++;
+
+        if (j > i)
+        {
+            primary->positionsAtTimes(jds + i, j - i, positions + i);
+            i = j;
+        }
+        else
+        {
+            positions[i] = positionAtTime(jds[i]);
+            i++;
+        }
+    }
+}
+
+
 double MixedOrbit::getPeriod() const
 {
     return primary->getPeriod();
@@ -624,6 +667,13 @@ void MixedOrbit::sample(double startTime, double endTime, OrbitSampleProc& proc)
 }
 
 
+bool MixedOrbit::isThreadSafe() const
+{
+    // The approximations before and after the span are elliptical orbits
+    return primary->isThreadSafe();
+}
+
+
 /*** FixedOrbit ***/
 
 FixedOrbit::FixedOrbit(const Eigen::Vector3d& pos) :
@@ -9,7 +9,9 @@
 
 #pragma once
 
+#include <cstddef>
 #include <memory>
+#include <mutex>
 
 #include <Eigen/Core>
 
@@ -37,6 +39,12 @@ class Orbit
      */
     virtual Eigen::Vector3d velocityAtTime(double) const;
 
+    /*! Compute the positions at count times, e.g. for plotting the orbit.
+     * Orbits which can share work between the times override this; the
+     * default implementation calls positionAtTime() for each one.
+     */
+    virtual void positionsAtTimes(const double* jds, std::size_t count, Eigen::Vector3d* positions) const;
+
     virtual double getPeriod() const = 0;
     virtual double getBoundingRadius() const = 0;
 
@@ -44,6 +52,11 @@ class Orbit
 
     virtual bool isPeriodic() const { return true; };
 
+    // Return true if positions, velocities and samples may be computed by
+    // several threads at once. Orbits which cache results or depend on
+    // libraries that aren't thread safe must keep the default.
+    virtual bool isThreadSafe() const { return false; };
+
     // Return the time range over which the orbit is valid; if the orbit
     // is always valid, begin and end should be equal.
     virtual void getValidRange(double& begin, double& end) const
@@ -77,6 +90,7 @@ class EllipticalOrbit : public Orbit
     Eigen::Vector3d velocityAtTime(double) const override;
     double getPeriod() const override;
     double getBoundingRadius() const override;
+    bool isThreadSafe() const override { return true; };
 
  private:
     double eccentricAnomaly(double) const;
@@ -108,7 +122,9 @@ class OrbitSampleProc
  * Celestia may need require position of a planet more than once per frame; in
  * order to avoid redundant calculation, the CachingOrbit class saves the
  * result of the last calculation and uses it if the time matches the cached
- * time.
+ * time. The cache is guarded by a mutex, so a subclass may be used from
+ * several threads at once as long as computePosition() and computeVelocity()
+ * don't modify shared state; such subclasses should override isThreadSafe().
  */
 class CachingOrbit : public Orbit
 {
@@ -123,6 +139,7 @@ class CachingOrbit : public Orbit
     Eigen::Vector3d velocityAtTime(double jd) const override;
 
  private:
+    mutable std::mutex cacheMutex;
     mutable Eigen::Vector3d lastPosition;
     mutable Eigen::Vector3d lastVelocity;
     mutable double lastTime{ -1.0e30 };
@@ -145,9 +162,11 @@ class MixedOrbit : public Orbit
 
     Eigen::Vector3d positionAtTime(double jd) const override;
     Eigen::Vector3d velocityAtTime(double jd) const override;
+    void positionsAtTimes(const double* jds, std::size_t count, Eigen::Vector3d* positions) const override;
     double getPeriod() const override;
     double getBoundingRadius() const override;
     void sample(double startTime, double endTime, OrbitSampleProc& proc) const override;
+    bool isThreadSafe() const override;
 
  private:
     std::unique_ptr<Orbit> primary;
@@ -197,6 +216,7 @@ class FixedOrbit : public Orbit
     bool isPeriodic() const override;
     double getBoundingRadius() const override;
     void sample(double, double, OrbitSampleProc&) const override;
+    bool isThreadSafe() const override { return true; };
 
  private:
     Eigen::Vector3d position;
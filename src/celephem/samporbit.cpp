@@ -13,15 +13,17 @@
 #include "samporbit.h"
 
 #include <algorithm>
-#include <array>
 #include <cctype>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <istream>
 #include <limits>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <Eigen/Core>
@@ -32,6 +34,7 @@
 #include <celutil/bytes.h>
 #include <celutil/gettext.h>
 #include <celutil/logger.h>
+#include <celutil/mappedfile.h>
 #include "orbit.h"
 #include "xyzvbinary.h"
 
@@ -66,14 +69,99 @@ template<typename T> struct SampleXYZV
 };
 
 
-template<typename T> bool operator<(const Sample<T>& a, const Sample<T>& b)
+/*! Directory of sample times which divides the span of a trajectory into
+ *  buckets of equal duration, each holding the index of its first sample.
+ *  A lookup only searches the samples of one bucket, which for evenly
+ *  spaced samples is a handful. The index is never modified after it's
+ *  built, so lookups may be made from several threads at once.
+ */
+class SampleTimeIndex
+{
+ public:
+    template<typename TimeFn> void build(std::size_t count, TimeFn&& timeOf);
+
+    // Return the index of the first sample at or after jd, or the number
+    // of samples if there is none.
+    template<typename TimeFn> std::size_t find(double jd, TimeFn&& timeOf) const;
+
+ private:
+    static constexpr std::size_t SamplesPerBucket = 8;
+
+    template<typename TimeFn>
+    static std::size_t search(double jd, std::size_t lo, std::size_t hi, TimeFn& timeOf);
+
+    std::vector<std::size_t> buckets;
+    std::size_t nSamples{ 0 };
+    double startTime{ 0.0 };
+    double endTime{ 0.0 };
+    double bucketsPerDay{ 0.0 };
+};
+
+
+template<typename TimeFn> void SampleTimeIndex::build(std::size_t count, TimeFn&& timeOf)
 {
-    return a.t < b.t;
+    nSamples = count;
+    buckets.clear();
+    if (count == 0)
+        return;
+
+    startTime = timeOf(0);
+    endTime = timeOf(count - 1);
+    if (!(endTime > startTime))
+        return;
+
+    std::size_t nBuckets = std::max(count / SamplesPerBucket, std::size_t{ 1 });
+    bucketsPerDay = static_cast<double>(nBuckets) / (endTime - startTime);
+    buckets.resize(nBuckets + 1);
+
+    std::size_t i = 0;
+    for (std::size_t k = 0; k < nBuckets; ++k)
+    {
+        double bucketStart = startTime + static_cast<double>(k) / bucketsPerDay;
+        while (i < count && timeOf(i) < bucketStart)
+            ++i;
+        buckets[k] = i;
+    }
+    buckets[nBuckets] = count;
 }
 
-template<typename T> bool operator<(const SampleXYZV<T>& a, const SampleXYZV<T>& b)
+
+template<typename TimeFn>
+std::size_t SampleTimeIndex::search(double jd, std::size_t lo, std::size_t hi, TimeFn& timeOf)
 {
-    return a.t < b.t;
+    while (lo < hi)
+    {
+        std::size_t mid = lo + (hi - lo) / 2;
+        if (timeOf(mid) < jd)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+template<typename TimeFn> std::size_t SampleTimeIndex::find(double jd, TimeFn&& timeOf) const
+{
+    if (nSamples == 0 || !(jd > startTime))
+        return 0;
+    if (jd > endTime)
+        return nSamples;
+    if (buckets.empty())
+        return search(jd, 0, nSamples, timeOf);
+
+    std::size_t nBuckets = buckets.size() - 1;
+    auto k = std::min(static_cast<std::size_t>((jd - startTime) * bucketsPerDay), nBuckets - 1);
+    std::size_t lo = buckets[k];
+    std::size_t hi = buckets[k + 1];
+
+    // Rounding of the bucket boundaries may put jd in a neighboring bucket;
+    // fall back to searching all of the samples then.
+    if ((lo > 0 && timeOf(lo - 1) >= jd) || (hi < nSamples && timeOf(hi) < jd))
+        return search(jd, 0, nSamples, timeOf);
+
+    return search(jd, lo, hi, timeOf);
 }
 
 
@@ -84,12 +172,20 @@ public:
     ~SampledOrbit() override = default;
 
     void addSample(double t, const Eigen::Matrix<T, 3, 1>& position);
+    // Must be called after the last sample is added
+    void finish();
 
     double getPeriod() const override;
     double getBoundingRadius() const override;
     Eigen::Vector3d computePosition(double jd) const override;
     Eigen::Vector3d computeVelocity(double jd) const override;
 
+    // Lookups don't modify the orbit, so the cached position of
+    // CachingOrbit is bypassed to allow concurrent use.
+    Eigen::Vector3d positionAtTime(double jd) const override { return computePosition(jd); }
+    Eigen::Vector3d velocityAtTime(double jd) const override { return computeVelocity(jd); }
+    bool isThreadSafe() const override { return true; }
+
     bool isPeriodic() const override;
     void getValidRange(double& begin, double& end) const override;
 
@@ -97,12 +193,13 @@ public:
 
 private:
     std::vector<Sample<T>> samples;
+    SampleTimeIndex index;
     double boundingRadius;
     double period;
-    mutable int lastSample;
 
     TrajectoryInterpolation interpolation;
 
+    int findSample(double jd) const;
     Eigen::Vector3d computePositionLinear(double jd, int n) const;
     Eigen::Vector3d computePositionCubic(double jd, int n) const;
     Eigen::Vector3d computeVelocityLinear(double jd, int n) const;
@@ -113,7 +210,6 @@ private:
 template<typename T> SampledOrbit<T>::SampledOrbit(TrajectoryInterpolation _interpolation) :
     boundingRadius(0.0),
     period(1.0),
-    lastSample(0),
     interpolation(_interpolation)
 {
 }
@@ -130,6 +226,19 @@ template<typename T> void SampledOrbit<T>::addSample(double t, const Eigen::Matr
     samp.t = t;
 }
 
+
+template<typename T> void SampledOrbit<T>::finish()
+{
+    index.build(samples.size(), [this](std::size_t i) { return samples[i].t; });
+}
+
+
+// Return the index of the first sample at or after jd
+template<typename T> int SampledOrbit<T>::findSample(double jd) const
+{
+    return static_cast<int>(index.find(jd, [this](std::size_t i) { return samples[i].t; }));
+}
+
 template<typename T> double SampledOrbit<T>::getPeriod() const
 {
     return samples[samples.size() - 1].t - samples[0].t;
@@ -188,19 +297,7 @@ template <typename T> Eigen::Vector3d SampledOrbit<T>::computePosition(double jd
     }
     else
     {
-        Sample<T> samp;
-        samp.t = jd;
-        int n = lastSample;
-
-        if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
-        {
-            auto iter = std::lower_bound(samples.begin(), samples.end(), samp);
-            n = iter == samples.end()
-                ? n = samples.size()
-                : iter - samples.begin();
-
-            lastSample = n;
-        }
+        int n = findSample(jd);
 
         if (n == 0)
         {
@@ -290,18 +387,7 @@ template<typename T> Eigen::Vector3d SampledOrbit<T>::computeVelocity(double jd)
     }
     else
     {
-        Sample<T> samp;
-        samp.t = jd;
-        int n = lastSample;
-
-        if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
-        {
-            auto iter = std::lower_bound(samples.begin(), samples.end(), samp);
-            n = iter == samples.end()
-                ? samples.size()
-                : iter - samples.begin();
-            lastSample = n;
-        }
+        int n = findSample(jd);
 
         if (n == 0)
         {
@@ -417,41 +503,107 @@ template<typename T> void SampledOrbit<T>::sample(double /* startTime */, double
 }
 
 
+// Samples with positions and velocities held in memory, as read from text
+// files
+template<typename T> class XYZVSampleVector
+{
+ public:
+    std::size_t size() const { return samples.size(); }
+    double time(std::size_t i) const { return samples[i].t; }
+    const SampleXYZV<T>& get(std::size_t i) const { return samples[i]; }
+    void add(const SampleXYZV<T>& samp) { samples.push_back(samp); }
+
+ private:
+    std::vector<SampleXYZV<T>> samples;
+};
+
+
+// Samples read in place from a memory mapped binary xyzv file, so that
+// only the parts of the trajectory which are used need to be in memory.
+class MappedXYZVSamples
+{
+ public:
+    bool open(const fs::path& filename);
+
+    std::size_t size() const { return count; }
+
+    double time(std::size_t i) const
+    {
+        double tdb;
+        std::memcpy(&tdb, record(i) + offsetof(XYZVBinaryData, tdb), sizeof(tdb));
+        return tdb;
+    }
+
+    SampleXYZV<double> get(std::size_t i) const
+    {
+        SampleXYZV<double> samp;
+        const char* data = record(i);
+        std::memcpy(&samp.t,                data + offsetof(XYZVBinaryData, tdb),      sizeof(samp.t));
+        std::memcpy(samp.position.data(),   data + offsetof(XYZVBinaryData, position), sizeof(double) * 3);
+        std::memcpy(samp.velocity.data(),   data + offsetof(XYZVBinaryData, velocity), sizeof(double) * 3);
+
+        // Convert velocities from km/sec to km/Julian day
+        samp.velocity *= astro::daysToSecs(1.0);
+        return samp;
+    }
+
+ private:
+    const char* record(std::size_t i) const
+    {
+        return file.data() + sizeof(XYZVBinaryHeader) + i * sizeof(XYZVBinaryData);
+    }
+
+    celestia::util::MappedFile file;
+    std::size_t count{ 0 };
+};
+
+
 // Sampled orbit with positions and velocities
-template <typename T> class SampledOrbitXYZV : public CachingOrbit
+template <typename T, typename Storage = XYZVSampleVector<T>> class SampledOrbitXYZV : public CachingOrbit
 {
 public:
-    SampledOrbitXYZV(TrajectoryInterpolation /*_interpolation*/);
+    SampledOrbitXYZV(TrajectoryInterpolation /*_interpolation*/, Storage&& _samples = Storage());
     ~SampledOrbitXYZV() override = default;
 
     void addSample(double t,
                    const Eigen::Matrix<T, 3, 1>& position,
                    const Eigen::Matrix<T, 3, 1>& velocity);
+    // Must be called after the last sample is added
+    void finish();
 
     double getPeriod() const override;
     double getBoundingRadius() const override;
     Eigen::Vector3d computePosition(double jd) const override;
     Eigen::Vector3d computeVelocity(double jd) const override;
 
+    // Lookups don't modify the orbit, so the cached position of
+    // CachingOrbit is bypassed to allow concurrent use.
+    Eigen::Vector3d positionAtTime(double jd) const override { return computePosition(jd); }
+    Eigen::Vector3d velocityAtTime(double jd) const override { return computeVelocity(jd); }
+    bool isThreadSafe() const override { return true; }
+
     bool isPeriodic() const override;
     void getValidRange(double& begin, double& end) const override;
 
     void sample(double startTime, double endTime, OrbitSampleProc& proc) const override;
 
 private:
-    std::vector<SampleXYZV<T>> samples;
+    Storage samples;
+    SampleTimeIndex index;
     double boundingRadius;
     double period;
-    mutable int lastSample;
 
     TrajectoryInterpolation interpolation;
+
+    int findSample(double jd) const;
 };
 
 
-template <typename T> SampledOrbitXYZV<T>::SampledOrbitXYZV(TrajectoryInterpolation _interpolation) :
+template <typename T, typename Storage>
+SampledOrbitXYZV<T, Storage>::SampledOrbitXYZV(TrajectoryInterpolation _interpolation, Storage&& _samples) :
+    samples(std::move(_samples)),
     boundingRadius(0.0),
     period(1.0),
-    lastSample(0),
     interpolation(_interpolation)
 {
 }
@@ -460,49 +612,65 @@ template <typename T> SampledOrbitXYZV<T>::SampledOrbitXYZV(TrajectoryInterpolat
 // Add a new sample to the trajectory:
 //    Position in km
 //    Velocity in km/Julian day
-template<typename T> void SampledOrbitXYZV<T>::addSample(double t,
-                                                         const Eigen::Matrix<T, 3, 1>& position,
-                                                         const Eigen::Matrix<T, 3, 1>& velocity)
+template<typename T, typename Storage>
+void SampledOrbitXYZV<T, Storage>::addSample(double t,
+                                             const Eigen::Matrix<T, 3, 1>& position,
+                                             const Eigen::Matrix<T, 3, 1>& velocity)
 {
-    double r = position.template cast<double>().norm();
-    if (r > boundingRadius)
-        boundingRadius = r;
-
-    SampleXYZV<T>& samp = samples.emplace_back();
+    SampleXYZV<T> samp;
     samp.t = t;
     samp.position = position;
     samp.velocity = velocity;
+    samples.add(samp);
 }
 
-template <typename T> double SampledOrbitXYZV<T>::getPeriod() const
+
+template<typename T, typename Storage> void SampledOrbitXYZV<T, Storage>::finish()
 {
-    if (samples.empty())
+    boundingRadius = 0.0;
+    for (std::size_t i = 0; i < samples.size(); i++)
+        boundingRadius = std::max(boundingRadius, samples.get(i).position.template cast<double>().norm());
+
+    index.build(samples.size(), [this](std::size_t i) { return samples.time(i); });
+}
+
+
+// Return the index of the first sample at or after jd
+template<typename T, typename Storage> int SampledOrbitXYZV<T, Storage>::findSample(double jd) const
+{
+    return static_cast<int>(index.find(jd, [this](std::size_t i) { return samples.time(i); }));
+}
+
+
+template <typename T, typename Storage> double SampledOrbitXYZV<T, Storage>::getPeriod() const
+{
+    if (samples.size() == 0)
         return 0.0;
 
-    return samples[samples.size() - 1].t - samples[0].t;
+    return samples.time(samples.size() - 1) - samples.time(0);
 }
 
 
-template <typename T> bool SampledOrbitXYZV<T>::isPeriodic() const
+template <typename T, typename Storage> bool SampledOrbitXYZV<T, Storage>::isPeriodic() const
 {
     return false;
 }
 
 
-template <typename T> void SampledOrbitXYZV<T>::getValidRange(double& begin, double& end) const
+template <typename T, typename Storage> void SampledOrbitXYZV<T, Storage>::getValidRange(double& begin, double& end) const
 {
-    begin = samples[0].t;
-    end = samples[samples.size() - 1].t;
+    begin = samples.time(0);
+    end = samples.time(samples.size() - 1);
 }
 
 
-template <typename T> double SampledOrbitXYZV<T>::getBoundingRadius() const
+template <typename T, typename Storage> double SampledOrbitXYZV<T, Storage>::getBoundingRadius() const
 {
     return boundingRadius;
 }
 
 
-template <typename T> Eigen::Vector3d SampledOrbitXYZV<T>::computePosition(double jd) const
+template <typename T, typename Storage> Eigen::Vector3d SampledOrbitXYZV<T, Storage>::computePosition(double jd) const
 {
     Eigen::Vector3d pos;
     if (samples.size() == 0)
@@ -511,33 +679,20 @@ template <typename T> Eigen::Vector3d SampledOrbitXYZV<T>::computePosition(doubl
     }
     else if (samples.size() == 1)
     {
-        pos = samples[0].position.template cast<double>();
+        pos = samples.get(0).position.template cast<double>();
     }
     else
     {
-        SampleXYZV<T> samp;
-        samp.t = jd;
-        int n = lastSample;
-
-        if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
-        {
-            auto iter = std::lower_bound(samples.begin(), samples.end(), samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
-
-            lastSample = n;
-        }
+        int n = findSample(jd);
 
         if (n == 0)
         {
-            pos = samples[n].position.template cast<double>();
+            pos = samples.get(n).position.template cast<double>();
         }
         else if (n < (int) samples.size())
         {
-            SampleXYZV<T> s0 = samples[n - 1];
-            SampleXYZV<T> s1 = samples[n];
+            SampleXYZV<T> s0 = samples.get(n - 1);
+            SampleXYZV<T> s1 = samples.get(n);
 
             if (interpolation == TrajectoryInterpolation::Linear)
             {
@@ -567,7 +722,7 @@ template <typename T> Eigen::Vector3d SampledOrbitXYZV<T>::computePosition(doubl
         }
         else
         {
-            pos = samples[n - 1].position.template cast<double>();
+            pos = samples.get(n - 1).position.template cast<double>();
         }
     }
 
@@ -578,31 +733,18 @@ template <typename T> Eigen::Vector3d SampledOrbitXYZV<T>::computePosition(doubl
 
 // Velocity is computed as the derivative of the interpolating function
 // for position.
-template<typename T> Eigen::Vector3d SampledOrbitXYZV<T>::computeVelocity(double jd) const
+template<typename T, typename Storage> Eigen::Vector3d SampledOrbitXYZV<T, Storage>::computeVelocity(double jd) const
 {
     Eigen::Vector3d vel(Eigen::Vector3d::Zero());
 
     if (samples.size() >= 2)
     {
-        SampleXYZV<T> samp;
-        samp.t = jd;
-        int n = lastSample;
-
-        if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
-        {
-            auto iter = std::lower_bound(samples.begin(), samples.end(), samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
-
-            lastSample = n;
-        }
+        int n = findSample(jd);
 
         if (n > 0 && n < (int) samples.size())
         {
-            SampleXYZV<T> s0 = samples[n - 1];
-            SampleXYZV<T> s1 = samples[n];
+            SampleXYZV<T> s0 = samples.get(n - 1);
+            SampleXYZV<T> s1 = samples.get(n);
 
             if (interpolation == TrajectoryInterpolation::Linear)
             {
@@ -637,11 +779,18 @@ template<typename T> Eigen::Vector3d SampledOrbitXYZV<T>::computeVelocity(double
 }
 
 
-template<typename T> void SampledOrbitXYZV<T>::sample(double /* startTime */, double /* endTime */,
-                                                      OrbitSampleProc& proc) const
+template<typename T, typename Storage> void SampledOrbitXYZV<T, Storage>::sample(double /* startTime */, double /* endTime */,
+                                                                                 OrbitSampleProc& proc) const
 {
-    for (const auto& sample : samples)
+    double lastSampleTime = -std::numeric_limits<double>::infinity();
+    for (std::size_t i = 0; i < samples.size(); i++)
     {
+        // Binary files may have samples with duplicate times
+        SampleXYZV<T> sample = samples.get(i);
+        if (sample.t == lastSampleTime)
+            continue;
+        lastSampleTime = sample.t;
+
         proc.sample(sample.t,
                     Eigen::Vector3d(sample.position.x(), sample.position.z(), -sample.position.y()),
                     Eigen::Vector3d(sample.velocity.x(), sample.velocity.z(), -sample.velocity.y()));
@@ -741,6 +890,7 @@ LoadSampledOrbit(const fs::path& filename, TrajectoryInterpolation interpolation
         }
     }
 
+    orbit->finish();
     return orbit;
 }
 
@@ -802,98 +952,104 @@ LoadSampledOrbitXYZV(const fs::path& filename, TrajectoryInterpolation interpola
         }
     }
 
+    orbit->finish();
     return orbit;
 }
 
-bool
-ParseXYZVBinaryHeader(std::istream& in, const fs::path& filename)
+// Check the header of a binary xyzv file and return the number of samples
+// that it declares, or 0 if it can't be used.
+std::uint64_t
+ParseXYZVBinaryHeader(const char* header, const fs::path& filename)
 {
-    std::array<char, sizeof(XYZVBinaryHeader)> header;
-
-    if (!in.read(header.data(), header.size())) /* Flawfinder: ignore */
-    {
-        GetLogger()->error(_("Error reading header of {}.\n"), filename);
-        return false;
-    }
-
-    if (std::string_view(header.data() + offsetof(XYZVBinaryHeader, magic), XYZV_MAGIC.size()) != XYZV_MAGIC)
+    if (std::string_view(header + offsetof(XYZVBinaryHeader, magic), XYZV_MAGIC.size()) != XYZV_MAGIC)
     {
         GetLogger()->error(_("Bad binary xyzv file {}.\n"), filename);
-        return false;
+        return 0;
     }
 
     decltype(XYZVBinaryHeader::byteOrder) byteOrder;
-    std::memcpy(&byteOrder, header.data() + offsetof(XYZVBinaryHeader, byteOrder), sizeof(byteOrder));
+    std::memcpy(&byteOrder, header + offsetof(XYZVBinaryHeader, byteOrder), sizeof(byteOrder));
     if (byteOrder != __BYTE_ORDER__)
     {
         GetLogger()->error(_("Unsupported byte order {}, expected {}.\n"),
                             byteOrder, __BYTE_ORDER__);
-        return false;
+        return 0;
     }
 
     decltype(XYZVBinaryHeader::digits) digits;
-    std::memcpy(&digits, header.data() + offsetof(XYZVBinaryHeader, digits), sizeof(digits));
+    std::memcpy(&digits, header + offsetof(XYZVBinaryHeader, digits), sizeof(digits));
     if (digits != std::numeric_limits<double>::digits)
     {
         GetLogger()->error(_("Unsupported digits number {}, expected {}.\n"),
                             digits, std::numeric_limits<double>::digits);
-        return false;
+        return 0;
     }
 
     decltype(XYZVBinaryHeader::count) count;
-    std::memcpy(&count, header.data() + offsetof(XYZVBinaryHeader, count), sizeof(count));
-    if (count == 0)
-    {
-        return false;
-    }
-
-    return true;
+    std::memcpy(&count, header + offsetof(XYZVBinaryHeader, count), sizeof(count));
+    return count;
 }
 
-/* Load a binary xyzv sampled trajectory file.
- */
-template <typename T> std::unique_ptr<SampledOrbitXYZV<T>>
-LoadSampledOrbitXYZVBinary(const fs::path& filename, TrajectoryInterpolation interpolation)
+
+bool MappedXYZVSamples::open(const fs::path& filename)
 {
-    std::ifstream in(filename, std::ios::binary);
-    if (!in.good())
+    if (!file.open(filename))
     {
         GetLogger()->error(_("Error opening {}.\n"), filename);
-        return nullptr;
+        return false;
     }
 
-    ParseXYZVBinaryHeader(in, filename);
-
-    auto orbit = std::make_unique<SampledOrbitXYZV<T>>(interpolation);
-    double lastSampleTime = -std::numeric_limits<T>::infinity();
-
-    while (in.good())
+    if (file.size() < sizeof(XYZVBinaryHeader))
     {
-        std::array<char, sizeof(XYZVBinaryData)> data;
-        if (!in.read(data.data(), data.size())) /* Flawfinder: ignore */
-            break;
+        GetLogger()->error(_("Error reading header of {}.\n"), filename);
+        return false;
+    }
 
-        double tdb;
-        Eigen::Vector3d position;
-        Eigen::Vector3d velocity;
+    std::uint64_t declared = ParseXYZVBinaryHeader(file.data(), filename);
+    // Only whole records are used
+    std::size_t available = (file.size() - sizeof(XYZVBinaryHeader)) / sizeof(XYZVBinaryData);
+    count = static_cast<std::size_t>(std::min<std::uint64_t>(declared, available));
 
-        std::memcpy(&tdb,            data.data() + offsetof(XYZVBinaryData, tdb),      sizeof(tdb));
-        std::memcpy(position.data(), data.data() + offsetof(XYZVBinaryData, position), sizeof(double) * 3);
-        std::memcpy(velocity.data(), data.data() + offsetof(XYZVBinaryData, velocity), sizeof(double) * 3);
+    return count > 0;
+}
 
-        // Convert velocities from km/sec to km/Julian day
-        velocity *= astro::daysToSecs(1.0);
 
-        if (tdb != lastSampleTime)
+/* Load a binary xyzv sampled trajectory file. Double precision trajectories
+ * are interpolated from the mapped file; single precision ones are copied.
+ */
+template <typename T> std::unique_ptr<Orbit>
+LoadSampledOrbitXYZVBinary(const fs::path& filename, TrajectoryInterpolation interpolation)
+{
+    MappedXYZVSamples samples;
+    if (!samples.open(filename))
+        return nullptr;
+
+    if constexpr (std::is_same_v<T, double>)
+    {
+        auto orbit = std::make_unique<SampledOrbitXYZV<double, MappedXYZVSamples>>(interpolation,
+                                                                                    std::move(samples));
+        orbit->finish();
+        return orbit;
+    }
+    else
+    {
+        auto orbit = std::make_unique<SampledOrbitXYZV<T>>(interpolation);
+        double lastSampleTime = -std::numeric_limits<double>::infinity();
+        for (std::size_t i = 0; i < samples.size(); i++)
         {
-            Eigen::Matrix<T, 3, 1> pos = position.cast<T>();
-            Eigen::Matrix<T, 3, 1> vel = velocity.cast<T>();
-            orbit->addSample(tdb, pos, vel);
-            lastSampleTime = tdb;
+            SampleXYZV<double> samp = samples.get(i);
+            if (samp.t != lastSampleTime)
+            {
+                Eigen::Matrix<T, 3, 1> pos = samp.position.cast<T>();
+                Eigen::Matrix<T, 3, 1> vel = samp.velocity.cast<T>();
+                orbit->addSample(samp.t, pos, vel);
+                lastSampleTime = samp.t;
+            }
         }
-    }
 
-    return orbit;
+        orbit->finish();
+        return orbit;
+    }
 }
 
 } // end unnamed namespace
@@ -12,15 +12,20 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include <celcompat/numbers.h>
 #include <celmath/mathlib.h>
 #include <celengine/astro.h>
+#include "chebyshevorbit.h"
 #include "orbit.h"
 #include "vsop87.h"
 
@@ -35,14 +40,44 @@ struct VSOPTerm
     double A, B, C;
 };
 
+// The terms of a series as separate arrays of amplitudes, phases and
+// frequencies, which lets the evaluation work on several terms or times
+// at once.
+template<std::size_t N>
+struct VSOPTermArrays
+{
+    std::array<double, N> A;
+    std::array<double, N> B;
+    std::array<double, N> C;
+};
+
+template<std::size_t N>
+constexpr VSOPTermArrays<N> splitTerms(const std::array<VSOPTerm, N>& terms)
+{
+    VSOPTermArrays<N> arrays{};
+    for (std::size_t i = 0; i < N; ++i)
+    {
+        arrays.A[i] = terms[i].A;
+        arrays.B[i] = terms[i].B;
+        arrays.C[i] = terms[i].C;
+    }
+    return arrays;
+}
+
+// Built at compile time from the tables of terms below
+template<const auto& Terms>
+constexpr inline auto SplitTerms = splitTerms(Terms);
+
 struct VSOPSeries
 {
     template<typename std::size_t N>
-    explicit constexpr VSOPSeries(const std::array<VSOPTerm, N>& arr)
-        : terms(arr.data()), nTerms(arr.size())
+    explicit constexpr VSOPSeries(const VSOPTermArrays<N>& arrays)
+        : A(arrays.A.data()), B(arrays.B.data()), C(arrays.C.data()), nTerms(N)
     {};
 
-    const VSOPTerm* terms;
+    const double* A;
+    const double* B;
+    const double* C;
     std::size_t nTerms;
 };
 
@@ -10848,160 +10883,260 @@ constexpr std::array<VSOPTerm, 7> sun_Z2 {
 };
 
 constexpr std::array mercury_L {
-    VSOPSeries(mercury_L0), VSOPSeries(mercury_L1), VSOPSeries(mercury_L2),
-    VSOPSeries(mercury_L3), VSOPSeries(mercury_L4), VSOPSeries(mercury_L5),
+    VSOPSeries(SplitTerms<mercury_L0>), VSOPSeries(SplitTerms<mercury_L1>), VSOPSeries(SplitTerms<mercury_L2>),
+    VSOPSeries(SplitTerms<mercury_L3>), VSOPSeries(SplitTerms<mercury_L4>), VSOPSeries(SplitTerms<mercury_L5>),
 };
 
 constexpr std::array mercury_B {
-    VSOPSeries(mercury_B0), VSOPSeries(mercury_B1), VSOPSeries(mercury_B2),
-    VSOPSeries(mercury_B3), VSOPSeries(mercury_B4), VSOPSeries(mercury_B5),
+    VSOPSeries(SplitTerms<mercury_B0>), VSOPSeries(SplitTerms<mercury_B1>), VSOPSeries(SplitTerms<mercury_B2>),
+    VSOPSeries(SplitTerms<mercury_B3>), VSOPSeries(SplitTerms<mercury_B4>), VSOPSeries(SplitTerms<mercury_B5>),
 };
 
 constexpr std::array mercury_R {
-    VSOPSeries(mercury_R0), VSOPSeries(mercury_R1), VSOPSeries(mercury_R2),
-    VSOPSeries(mercury_R3), VSOPSeries(mercury_R4),
+    VSOPSeries(SplitTerms<mercury_R0>), VSOPSeries(SplitTerms<mercury_R1>), VSOPSeries(SplitTerms<mercury_R2>),
+    VSOPSeries(SplitTerms<mercury_R3>), VSOPSeries(SplitTerms<mercury_R4>),
 };
 
 
 constexpr std::array venus_L {
-    VSOPSeries(venus_L0), VSOPSeries(venus_L1), VSOPSeries(venus_L2),
-    VSOPSeries(venus_L3), VSOPSeries(venus_L4), VSOPSeries(venus_L5),
+    VSOPSeries(SplitTerms<venus_L0>), VSOPSeries(SplitTerms<venus_L1>), VSOPSeries(SplitTerms<venus_L2>),
+    VSOPSeries(SplitTerms<venus_L3>), VSOPSeries(SplitTerms<venus_L4>), VSOPSeries(SplitTerms<venus_L5>),
 };
 
 constexpr std::array venus_B {
-    VSOPSeries(venus_B0), VSOPSeries(venus_B1), VSOPSeries(venus_B2),
-    VSOPSeries(venus_B3), VSOPSeries(venus_B4), VSOPSeries(venus_B5),
+    VSOPSeries(SplitTerms<venus_B0>), VSOPSeries(SplitTerms<venus_B1>), VSOPSeries(SplitTerms<venus_B2>),
+    VSOPSeries(SplitTerms<venus_B3>), VSOPSeries(SplitTerms<venus_B4>), VSOPSeries(SplitTerms<venus_B5>),
 };
 
 constexpr std::array venus_R {
-    VSOPSeries(venus_R0), VSOPSeries(venus_R1), VSOPSeries(venus_R2),
-    VSOPSeries(venus_R3), VSOPSeries(venus_R4),
+    VSOPSeries(SplitTerms<venus_R0>), VSOPSeries(SplitTerms<venus_R1>), VSOPSeries(SplitTerms<venus_R2>),
+    VSOPSeries(SplitTerms<venus_R3>), VSOPSeries(SplitTerms<venus_R4>),
 };
 
 
 constexpr std::array earth_L {
-    VSOPSeries(earth_L0), VSOPSeries(earth_L1), VSOPSeries(earth_L2),
-    VSOPSeries(earth_L3), VSOPSeries(earth_L4), VSOPSeries(earth_L5),
+    VSOPSeries(SplitTerms<earth_L0>), VSOPSeries(SplitTerms<earth_L1>), VSOPSeries(SplitTerms<earth_L2>),
+    VSOPSeries(SplitTerms<earth_L3>), VSOPSeries(SplitTerms<earth_L4>), VSOPSeries(SplitTerms<earth_L5>),
 };
 
 constexpr std::array earth_B {
-    VSOPSeries(earth_B0), VSOPSeries(earth_B1), VSOPSeries(earth_B2),
+    VSOPSeries(SplitTerms<earth_B0>), VSOPSeries(SplitTerms<earth_B1>), VSOPSeries(SplitTerms<earth_B2>),
 };
 
 constexpr std::array earth_R {
-    VSOPSeries(earth_R0), VSOPSeries(earth_R1), VSOPSeries(earth_R2),
-    VSOPSeries(earth_R3), VSOPSeries(earth_R4), VSOPSeries(earth_R5),
+    VSOPSeries(SplitTerms<earth_R0>), VSOPSeries(SplitTerms<earth_R1>), VSOPSeries(SplitTerms<earth_R2>),
+    VSOPSeries(SplitTerms<earth_R3>), VSOPSeries(SplitTerms<earth_R4>), VSOPSeries(SplitTerms<earth_R5>),
 };
 
 
 constexpr std::array mars_L {
-    VSOPSeries(mars_L0), VSOPSeries(mars_L1), VSOPSeries(mars_L2),
-    VSOPSeries(mars_L3), VSOPSeries(mars_L4), VSOPSeries(mars_L5),
+    VSOPSeries(SplitTerms<mars_L0>), VSOPSeries(SplitTerms<mars_L1>), VSOPSeries(SplitTerms<mars_L2>),
+    VSOPSeries(SplitTerms<mars_L3>), VSOPSeries(SplitTerms<mars_L4>), VSOPSeries(SplitTerms<mars_L5>),
 };
 
 constexpr std::array mars_B {
-    VSOPSeries(mars_B0), VSOPSeries(mars_B1), VSOPSeries(mars_B2),
-    VSOPSeries(mars_B3), VSOPSeries(mars_B4), VSOPSeries(mars_B5),
+    VSOPSeries(SplitTerms<mars_B0>), VSOPSeries(SplitTerms<mars_B1>), VSOPSeries(SplitTerms<mars_B2>),
+    VSOPSeries(SplitTerms<mars_B3>), VSOPSeries(SplitTerms<mars_B4>), VSOPSeries(SplitTerms<mars_B5>),
 };
 
 constexpr std::array mars_R {
-    VSOPSeries(mars_R0), VSOPSeries(mars_R1), VSOPSeries(mars_R2),
-    VSOPSeries(mars_R3), VSOPSeries(mars_R4), VSOPSeries(mars_R5),
+    VSOPSeries(SplitTerms<mars_R0>), VSOPSeries(SplitTerms<mars_R1>), VSOPSeries(SplitTerms<mars_R2>),
+    VSOPSeries(SplitTerms<mars_R3>), VSOPSeries(SplitTerms<mars_R4>), VSOPSeries(SplitTerms<mars_R5>),
 };
 
 
 constexpr std::array jupiter_L {
-    VSOPSeries(jupiter_L0), VSOPSeries(jupiter_L1), VSOPSeries(jupiter_L2),
-    VSOPSeries(jupiter_L3), VSOPSeries(jupiter_L4), VSOPSeries(jupiter_L5),
+    VSOPSeries(SplitTerms<jupiter_L0>), VSOPSeries(SplitTerms<jupiter_L1>), VSOPSeries(SplitTerms<jupiter_L2>),
+    VSOPSeries(SplitTerms<jupiter_L3>), VSOPSeries(SplitTerms<jupiter_L4>), VSOPSeries(SplitTerms<jupiter_L5>),
 };
 
 constexpr std::array jupiter_B {
-    VSOPSeries(jupiter_B0), VSOPSeries(jupiter_B1), VSOPSeries(jupiter_B2),
-    VSOPSeries(jupiter_B3), VSOPSeries(jupiter_B4), VSOPSeries(jupiter_B5),
+    VSOPSeries(SplitTerms<jupiter_B0>), VSOPSeries(SplitTerms<jupiter_B1>), VSOPSeries(SplitTerms<jupiter_B2>),
+    VSOPSeries(SplitTerms<jupiter_B3>), VSOPSeries(SplitTerms<jupiter_B4>), VSOPSeries(SplitTerms<jupiter_B5>),
 };
 
 constexpr std::array jupiter_R {
-    VSOPSeries(jupiter_R0), VSOPSeries(jupiter_R1), VSOPSeries(jupiter_R2),
-    VSOPSeries(jupiter_R3), VSOPSeries(jupiter_R4), VSOPSeries(jupiter_R5),
+    VSOPSeries(SplitTerms<jupiter_R0>), VSOPSeries(SplitTerms<jupiter_R1>), VSOPSeries(SplitTerms<jupiter_R2>),
+    VSOPSeries(SplitTerms<jupiter_R3>), VSOPSeries(SplitTerms<jupiter_R4>), VSOPSeries(SplitTerms<jupiter_R5>),
 };
 
 
 constexpr std::array saturn_L {
-    VSOPSeries(saturn_L0), VSOPSeries(saturn_L1), VSOPSeries(saturn_L2),
-    VSOPSeries(saturn_L3), VSOPSeries(saturn_L4), VSOPSeries(saturn_L5),
+    VSOPSeries(SplitTerms<saturn_L0>), VSOPSeries(SplitTerms<saturn_L1>), VSOPSeries(SplitTerms<saturn_L2>),
+    VSOPSeries(SplitTerms<saturn_L3>), VSOPSeries(SplitTerms<saturn_L4>), VSOPSeries(SplitTerms<saturn_L5>),
 };
 
 constexpr std::array saturn_B {
-    VSOPSeries(saturn_B0), VSOPSeries(saturn_B1), VSOPSeries(saturn_B2),
-    VSOPSeries(saturn_B3), VSOPSeries(saturn_B4), VSOPSeries(saturn_B5),
+    VSOPSeries(SplitTerms<saturn_B0>), VSOPSeries(SplitTerms<saturn_B1>), VSOPSeries(SplitTerms<saturn_B2>),
+    VSOPSeries(SplitTerms<saturn_B3>), VSOPSeries(SplitTerms<saturn_B4>), VSOPSeries(SplitTerms<saturn_B5>),
 };
 
 constexpr std::array saturn_R {
-    VSOPSeries(saturn_R0), VSOPSeries(saturn_R1), VSOPSeries(saturn_R2),
-    VSOPSeries(saturn_R3), VSOPSeries(saturn_R4), VSOPSeries(saturn_R5),
+    VSOPSeries(SplitTerms<saturn_R0>), VSOPSeries(SplitTerms<saturn_R1>), VSOPSeries(SplitTerms<saturn_R2>),
+    VSOPSeries(SplitTerms<saturn_R3>), VSOPSeries(SplitTerms<saturn_R4>), VSOPSeries(SplitTerms<saturn_R5>),
 };
 
 
 constexpr std::array uranus_L {
-    VSOPSeries(uranus_L0), VSOPSeries(uranus_L1), VSOPSeries(uranus_L2),
-    VSOPSeries(uranus_L3), VSOPSeries(uranus_L4),
+    VSOPSeries(SplitTerms<uranus_L0>), VSOPSeries(SplitTerms<uranus_L1>), VSOPSeries(SplitTerms<uranus_L2>),
+    VSOPSeries(SplitTerms<uranus_L3>), VSOPSeries(SplitTerms<uranus_L4>),
 };
 
 constexpr std::array uranus_B {
-    VSOPSeries(uranus_B0), VSOPSeries(uranus_B1), VSOPSeries(uranus_B2),
-    VSOPSeries(uranus_B3),
+    VSOPSeries(SplitTerms<uranus_B0>), VSOPSeries(SplitTerms<uranus_B1>), VSOPSeries(SplitTerms<uranus_B2>),
+    VSOPSeries(SplitTerms<uranus_B3>),
 };
 
 constexpr std::array uranus_R {
-    VSOPSeries(uranus_R0), VSOPSeries(uranus_R1), VSOPSeries(uranus_R2),
-    VSOPSeries(uranus_R3), VSOPSeries(uranus_R4),
+    VSOPSeries(SplitTerms<uranus_R0>), VSOPSeries(SplitTerms<uranus_R1>), VSOPSeries(SplitTerms<uranus_R2>),
+    VSOPSeries(SplitTerms<uranus_R3>), VSOPSeries(SplitTerms<uranus_R4>),
 };
 
 
 constexpr std::array neptune_L {
-    VSOPSeries(neptune_L0), VSOPSeries(neptune_L1), VSOPSeries(neptune_L2),
-    VSOPSeries(neptune_L3),
+    VSOPSeries(SplitTerms<neptune_L0>), VSOPSeries(SplitTerms<neptune_L1>), VSOPSeries(SplitTerms<neptune_L2>),
+    VSOPSeries(SplitTerms<neptune_L3>),
 };
 
 constexpr std::array neptune_B {
-    VSOPSeries(neptune_B0), VSOPSeries(neptune_B1), VSOPSeries(neptune_B2),
-    VSOPSeries(neptune_B3),
+    VSOPSeries(SplitTerms<neptune_B0>), VSOPSeries(SplitTerms<neptune_B1>), VSOPSeries(SplitTerms<neptune_B2>),
+    VSOPSeries(SplitTerms<neptune_B3>),
 };
 
 constexpr std::array neptune_R {
-    VSOPSeries(neptune_R0), VSOPSeries(neptune_R1), VSOPSeries(neptune_R2),
-    VSOPSeries(neptune_R3), VSOPSeries(neptune_R4),
+    VSOPSeries(SplitTerms<neptune_R0>), VSOPSeries(SplitTerms<neptune_R1>), VSOPSeries(SplitTerms<neptune_R2>),
+    VSOPSeries(SplitTerms<neptune_R3>), VSOPSeries(SplitTerms<neptune_R4>),
 };
 
 
 constexpr std::array sun_X {
-    VSOPSeries(sun_X0), VSOPSeries(sun_X1), VSOPSeries(sun_X2),
-    VSOPSeries(sun_X3), VSOPSeries(sun_X4),
+    VSOPSeries(SplitTerms<sun_X0>), VSOPSeries(SplitTerms<sun_X1>), VSOPSeries(SplitTerms<sun_X2>),
+    VSOPSeries(SplitTerms<sun_X3>), VSOPSeries(SplitTerms<sun_X4>),
 };
 
 constexpr std::array sun_Y {
-    VSOPSeries(sun_Y0), VSOPSeries(sun_Y1), VSOPSeries(sun_Y2),
-    VSOPSeries(sun_Y3), VSOPSeries(sun_Y4),
+    VSOPSeries(SplitTerms<sun_Y0>), VSOPSeries(SplitTerms<sun_Y1>), VSOPSeries(SplitTerms<sun_Y2>),
+    VSOPSeries(SplitTerms<sun_Y3>), VSOPSeries(SplitTerms<sun_Y4>),
 };
 
 constexpr std::array sun_Z {
-    VSOPSeries(sun_Z0), VSOPSeries(sun_Z1), VSOPSeries(sun_Z2),
+    VSOPSeries(SplitTerms<sun_Z0>), VSOPSeries(SplitTerms<sun_Z1>), VSOPSeries(SplitTerms<sun_Z2>),
 };
 
+} // end unnamed namespace
+
+// Cosine used for the sums of terms. Unlike std::cos it has no branches
+// or calls, so that loops using it can be vectorized. The argument is
+// reduced to [-pi/4, pi/4] with a two-part pi/2, which keeps the error
+// within a few units in the last place for the arguments of the series.
+double VSOP87Cos(double x)
+{
+    constexpr double twoOverPi = 6.36619772367581382433e-01;
+    constexpr double pio2Hi = 1.57079632673412561417e+00; // 33 bits of pi/2
+    constexpr double pio2Lo = 6.07710050650619224932e-11; // pi/2 - pio2Hi
+    constexpr double roundingShift = 6755399441055744.0;  // 1.5 * 2^52
+
+    // Adding the shift rounds to the nearest integer, which ends up in the
+    // low bits of the result. Both the multiple of pi/2 and the quadrant
+    // are taken from those bits: computing the multiple as
+    // shifted - roundingShift would be folded back to x * twoOverPi by
+    // -ffast-math, leaving it inconsistent with the quadrant. The
+    // arguments of the series are well within the 32 bit range.
+    double shifted = x * twoOverPi + roundingShift;
+    std::uint64_t bits;
+    std::memcpy(&bits, &shifted, sizeof(bits));
+    auto k = static_cast<std::int32_t>(static_cast<std::uint32_t>(bits));
+    auto n = static_cast<double>(k);
+    double r = (x - n * pio2Hi) - n * pio2Lo;
+    double r2 = r * r;
+
+    double c = 1.0 + r2 * (-1.0 / 2.0 + r2 * (1.0 / 24.0 + r2 * (-1.0 / 720.0 + r2 * (1.0 / 40320.0
+             + r2 * (-1.0 / 3628800.0 + r2 * (1.0 / 479001600.0 + r2 * (-1.0 / 87178291200.0
+             + r2 * (1.0 / 20922789888000.0))))))));
+    double s = r * (1.0 + r2 * (-1.0 / 6.0 + r2 * (1.0 / 120.0 + r2 * (-1.0 / 5040.0 + r2 * (1.0 / 362880.0
+             + r2 * (-1.0 / 39916800.0 + r2 * (1.0 / 6227020800.0 + r2 * (-1.0 / 1307674368000.0))))))));
+
+    // cos(r + q * pi / 2) for the quadrant q
+    auto q = static_cast<unsigned int>(k) & 3U;
+    double v = (q & 1) != 0 ? s : c;
+    return ((q + 1) & 2) != 0 ? -v : v;
+}
+
+namespace
+{
 
 double SumSeries(const VSOPSeries& series, double t)
 {
-    if (series.nTerms < 1)
-        return 0.0;
+    // Separate sums for groups of consecutive terms, so that each group
+    // can be computed as a vector.
+    constexpr std::size_t Lanes = 4;
+    std::array<double, Lanes> sums{};
+    std::size_t i = 0;
+    for (; i + Lanes <= series.nTerms; i += Lanes)
+    {
+        for (std::size_t j = 0; j < Lanes; ++j)
+            sums[j] += series.A[i + j] * VSOP87Cos(series.B[i + j] + series.C[i + j] * t);
+    }
 
+    double x = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    for (; i < series.nTerms; ++i)
+        x += series.A[i] * VSOP87Cos(series.B[i] + series.C[i] * t);
+
+    return x;
+}
+
+// Evaluate the sum of series[i] * t^i, the form of each coordinate
+double SumSeriesPowers(const VSOPSeries* series, std::size_t nSeries, double t)
+{
     double x = 0.0;
-    const VSOPTerm* term = &series.terms[0];
-    for (int i = 0; i < series.nTerms; i++, term++)
-        x += term->A * std::cos(term->B + term->C * t);
+    double T = 1.0;
+    for (std::size_t i = 0; i < nSeries; i++)
+    {
+        x += SumSeries(series[i], t) * T;
+        T = t * T;
+    }
 
     return x;
 }
 
+// Number of times evaluated together by the batch functions
+constexpr std::size_t VSOPBatchSize = 64;
+
+// Evaluate a coordinate at count <= VSOPBatchSize times. The loops over
+// the times have no dependencies between iterations and are vectorized.
+void SumSeriesPowers(const VSOPSeries* series, std::size_t nSeries,
+                     const double* t, std::size_t count, double* x)
+{
+    std::array<double, VSOPBatchSize> T;
+    std::array<double, VSOPBatchSize> sum;
+    std::fill_n(x, count, 0.0);
+    std::fill_n(T.begin(), count, 1.0);
+    for (std::size_t i = 0; i < nSeries; i++)
+    {
+        std::fill_n(sum.begin(), count, 0.0);
+        for (std::size_t term = 0; term < series[i].nTerms; term++)
+        {
+            double A = series[i].A[term];
+            double B = series[i].B[term];
+            double C = series[i].C[term];
+            for (std::size_t k = 0; k < count; k++)
+                sum[k] += A * VSOP87Cos(B + C * t[k]);
+        }
+
+        for (std::size_t k = 0; k < count; k++)
+        {
+            x[k] += sum[k] * T[k];
+            T[k] *= t[k];
+        }
+    }
+}
+
+// Julian millenia since J2000.0
+inline double vsopTime(double jd)
+{
+    return (jd - 2451545.0) / 365250.0;
+}
+
 class VSOP87Orbit : public CachingOrbit
 {
  private:
@@ -11014,6 +11149,19 @@ class VSOP87Orbit : public CachingOrbit
     double period;
     double boundingRadius;
 
+    static Eigen::Vector3d toPosition(double l, double b, double r)
+    {
+        r *= KM_PER_AU<double>;
+
+        // Corrections for internal coordinate system
+        b -= celestia::numbers::pi / 2;
+        l += celestia::numbers::pi;
+
+        return Eigen::Vector3d(std::cos(l) * std::sin(b) * r,
+                               std::cos(b) * r,
+                               -std::sin(l) * std::sin(b) * r);
+    }
+
  public:
     template<std::size_t NL, std::size_t NB, std::size_t NR>
     VSOP87Orbit(const std::array<VSOPSeries, NL>& _vsL,
@@ -11040,73 +11188,75 @@ class VSOP87Orbit : public CachingOrbit
         return boundingRadius;
     }
 
-    Eigen::Vector3d computePosition(double jd) const override
+    bool isThreadSafe() const override
     {
-        // t is Julian millenia since J2000.0
-        double t = (jd - 2451545.0) / 365250.0;
-
-        // Heliocentric coordinates
-        double l = 0.0; // longitude
-        double b = 0.0; // latitude
-        double r = 0.0; // radius
-
-        std::size_t i;
-        double T;
+        return true;
+    }
 
-        // Evaluate series for l
-        T = 1;
-        for (i = 0; i < nL; i++)
-        {
-            l += SumSeries(vsL[i], t) * T;
-            T = t * T;
-        }
+    Eigen::Vector3d computePosition(double jd) const override
+    {
+        double t = vsopTime(jd);
 
-        // Evaluate series for b
-        T = 1;
-        for (i = 0; i < nB; i++)
-        {
-            b += SumSeries(vsB[i], t) * T;
-            T = t * T;
-        }
+        // Heliocentric longitude, latitude and radius
+        return toPosition(SumSeriesPowers(vsL, nL, t),
+                          SumSeriesPowers(vsB, nB, t),
+                          SumSeriesPowers(vsR, nR, t));
+    }
 
-        // Evaluate series for r
-        T = 1;
-        for (i = 0; i < nR; i++)
+    void positionsAtTimes(const double* jds, std::size_t count, Eigen::Vector3d* positions) const override
+    {
+        std::array<double, VSOPBatchSize> t;
+        std::array<double, VSOPBatchSize> l;
+        std::array<double, VSOPBatchSize> b;
+        std::array<double, VSOPBatchSize> r;
+        for (std::size_t start = 0; start < count; start += VSOPBatchSize)
         {
-            r += SumSeries(vsR[i], t) * T;
-            T = t * T;
+            std::size_t n = std::min(VSOPBatchSize, count - start);
+            std::transform(jds + start, jds + start + n, t.begin(), vsopTime);
+            SumSeriesPowers(vsL, nL, t.data(), n, l.data());
+            SumSeriesPowers(vsB, nB, t.data(), n, b.data());
+            SumSeriesPowers(vsR, nR, t.data(), n, r.data());
+            for (std::size_t k = 0; k < n; k++)
+                positions[start + k] = toPosition(l[k], b[k], r[k]);
         }
-
-        r *= KM_PER_AU<double>;
-
-        // Corrections for internal coordinate system
-        b -= celestia::numbers::pi / 2;
-        l += celestia::numbers::pi;
-
-        return Eigen::Vector3d(std::cos(l) * std::sin(b) * r,
-                               std::cos(b) * r,
-                               -std::sin(l) * std::sin(b) * r);
     }
 
-
     /** Custom implementation of sample() for VSOP87 orbits. The default
       * implementation runs too slowly and produces too many samples.
       */
     void sample(double startTime, double endTime, OrbitSampleProc& proc) const override
     {
-        double span = getPeriod();
+        // The samples are uniformly spaced, with the velocities computed
+        // from positions a minute later, so all the positions can be
+        // computed in batches.
+        constexpr double velocityDelta = 1.0 / 1440.0;
+        double step = getPeriod() / 150.0;
+        if (!(step > 0.0))
+        {
+            Orbit::sample(startTime, endTime, proc);
+            return;
+        }
 
-        AdaptiveSamplingParameters samplingParams{};
-        samplingParams.tolerance = 1.0; // kilometers
+        std::vector<double> times;
+        times.push_back(startTime);
+        for (double t = startTime; t < endTime;)
+        {
+            t += std::min(step, endTime - t);
+            times.push_back(t);
+        }
 
-        // startStep, minStep, and maxStep are all set to identical values,
-        // so the adaptive sampling function actuall behaves like uniform
-        // sampling.
-        samplingParams.startStep = span / 150.0;
-        samplingParams.minStep   = samplingParams.startStep;
-        samplingParams.maxStep   = samplingParams.startStep;
+        std::size_t nSamples = times.size();
+        times.resize(2 * nSamples);
+        for (std::size_t i = 0; i < nSamples; i++)
+            times[nSamples + i] = times[i] + velocityDelta;
 
-        adaptiveSample(startTime, endTime, proc, samplingParams);
+        std::vector<Eigen::Vector3d> positions(times.size());
+        positionsAtTimes(times.data(), times.size(), positions.data());
+        for (std::size_t i = 0; i < nSamples; i++)
+        {
+            Eigen::Vector3d velocity = (positions[nSamples + i] - positions[i]) * (1.0 / velocityDelta);
+            proc.sample(times[i], positions[i], velocity);
+        }
     }
 
 };
@@ -11156,44 +11306,37 @@ class VSOP87OrbitRect : public CachingOrbit
         return boundingRadius;
     }
 
-    Eigen::Vector3d computePosition(double jd) const override
+    bool isThreadSafe() const override
     {
-        // t is Julian millenia since J2000.0
-        double t = (jd - 2451545.0) / 365250.0;
-
-        Eigen::Vector3d v(Eigen::Vector3d::Zero());
-
-        std::size_t i;
-        double T;
+        return true;
+    }
 
-        // Evaluate series for x
-        T = 1;
-        for (i = 0; i < nX; i++)
-        {
-            v.x() += SumSeries(vsX[i], t) * T;
-            T = t * T;
-        }
+    Eigen::Vector3d computePosition(double jd) const override
+    {
+        double t = vsopTime(jd);
 
-        // Evaluate series for y
-        T = 1;
-        for (i = 0; i < nY; i++)
-        {
-            v.y() += SumSeries(vsY[i], t) * T;
-            T = t * T;
-        }
+        // Corrections for internal coordinate system
+        return Eigen::Vector3d(SumSeriesPowers(vsX, nX, t),
+                               SumSeriesPowers(vsZ, nZ, t),
+                               -SumSeriesPowers(vsY, nY, t)) * KM_PER_AU<double>;
+    }
 
-        // Evaluate series for z
-        T = 1;
-        for (i = 0; i < nZ; i++)
+    void positionsAtTimes(const double* jds, std::size_t count, Eigen::Vector3d* positions) const override
+    {
+        std::array<double, VSOPBatchSize> t;
+        std::array<double, VSOPBatchSize> x;
+        std::array<double, VSOPBatchSize> y;
+        std::array<double, VSOPBatchSize> z;
+        for (std::size_t start = 0; start < count; start += VSOPBatchSize)
         {
-            v.z() += SumSeries(vsZ[i], t) * T;
-            T = t * T;
+            std::size_t n = std::min(VSOPBatchSize, count - start);
+            std::transform(jds + start, jds + start + n, t.begin(), vsopTime);
+            SumSeriesPowers(vsX, nX, t.data(), n, x.data());
+            SumSeriesPowers(vsY, nY, t.data(), n, y.data());
+            SumSeriesPowers(vsZ, nZ, t.data(), n, z.data());
+            for (std::size_t k = 0; k < n; k++)
+                positions[start + k] = Eigen::Vector3d(x[k], z[k], -y[k]) * KM_PER_AU<double>;
         }
-
-        v *= KM_PER_AU<double>;
-
-        // Corrections for internal coordinate system
-        return Eigen::Vector3d(v.x(), v.z(), -v.y());
     }
 };
 
@@ -11206,7 +11349,7 @@ double yearToJD(int year)
 
 } // end unnamed namespace
 
-std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type)
+std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type, std::string_view name)
 {
     switch (type)
     {
@@ -11217,7 +11360,7 @@ std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type)
                                                mercury_R,
                                                0.2408 * 365.25,
                                                60000000.0);
-        return std::make_unique<MixedOrbit>(std::move(o), yearToJD(-4000), yearToJD(4000),
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::move(o), name), yearToJD(-4000), yearToJD(4000),
                                             astro::SolarMass);
     }
     case CustomOrbitType::VSOP87Venus:
@@ -11227,7 +11370,7 @@ std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type)
                                                venus_R,
                                                0.6152 * 365.25,
                                                100000000.0);
-        return std::make_unique<MixedOrbit>(std::move(o), yearToJD(-4000), yearToJD(4000),
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::move(o), name), yearToJD(-4000), yearToJD(4000),
                                             astro::SolarMass);
     }
     case CustomOrbitType::VSOP87Earth:
@@ -11237,7 +11380,7 @@ std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type)
                                                earth_R,
                                                365.25,
                                                160000000.0);
-        return std::make_unique<MixedOrbit>(std::move(o), yearToJD(-4000), yearToJD(4000),
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::move(o), name), yearToJD(-4000), yearToJD(4000),
                                             astro::SolarMass);
     }
     case CustomOrbitType::VSOP87Mars:
@@ -11247,7 +11390,7 @@ std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type)
                                                mars_R,
                                                1.8809 * 365.25,
                                                240000000);
-        return std::make_unique<MixedOrbit>(std::move(o), yearToJD(-4000), yearToJD(4000),
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::move(o), name), yearToJD(-4000), yearToJD(4000),
                                             astro::SolarMass);
     }
     case CustomOrbitType::VSOP87Jupiter:
@@ -11257,7 +11400,7 @@ std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type)
                                                jupiter_R,
                                                11.86 * 365.25,
                                                800000000.0);
-        return std::make_unique<MixedOrbit>(std::move(o), yearToJD(-4000), yearToJD(4000),
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::move(o), name), yearToJD(-4000), yearToJD(4000),
                                             astro::SolarMass);
     }
     case CustomOrbitType::VSOP87Saturn:
@@ -11267,7 +11410,7 @@ std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type)
                                                saturn_R,
                                                29.4577 * 365.25,
                                                1.5e9);
-        return std::make_unique<MixedOrbit>(std::move(o), yearToJD(-4000), yearToJD(4000),
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::move(o), name), yearToJD(-4000), yearToJD(4000),
                                             astro::SolarMass);
     }
     case CustomOrbitType::VSOP87Uranus:
@@ -11277,7 +11420,7 @@ std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type)
                                                uranus_R,
                                                84.0139 * 365.25,
                                                3.0e9);
-        return std::make_unique<MixedOrbit>(std::move(o), yearToJD(-4000), yearToJD(4000),
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::move(o), name), yearToJD(-4000), yearToJD(4000),
                                             astro::SolarMass);
     }
     case CustomOrbitType::VSOP87Neptune:
@@ -11287,7 +11430,7 @@ std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type)
                                                neptune_R,
                                                164.793 * 365.25,
                                                4.7e9);
-        return std::make_unique<MixedOrbit>(std::move(o), yearToJD(-4000), yearToJD(4000),
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::move(o), name), yearToJD(-4000), yearToJD(4000),
                                             astro::SolarMass);
     }
     case CustomOrbitType::VSOP87Sun:
@@ -11297,7 +11440,7 @@ std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType type)
                                                    sun_Z,
                                                    0.0,
                                                    2000000);
-        return std::make_unique<MixedOrbit>(std::move(o), yearToJD(-4000), yearToJD(6000),
+        return std::make_unique<MixedOrbit>(FitChebyshevOrbit(std::move(o), name), yearToJD(-4000), yearToJD(6000),
                                             astro::SolarMass);
     }
     default:
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <memory>
+#include <string_view>
 
 #include "customorbittype.h"
 
@@ -18,6 +19,9 @@ namespace celestia::ephem
 
 class Orbit;
 
-std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType);
+std::unique_ptr<Orbit> CreateVSOP87Orbit(CustomOrbitType, std::string_view name);
+
+// The vectorizable cosine used to sum the series
+double VSOP87Cos(double x);
 
 }
@@ -27,9 +27,13 @@
 #include <celengine/overlay.h>
 #include <celengine/console.h>
 #include <celengine/starname.h>
+#include <celengine/parser.h>
 #include <celscript/legacy/execution.h>
 #include <celscript/legacy/cmdparser.h>
 #include <celengine/multitexture.h>
+#include <celengine/meshmanager.h>
+#include <celengine/texmanager.h>
+#include <celephem/chebyshevorbit.h>
 #ifdef USE_SPICE
 #include <celephem/spiceinterface.h>
 #endif
@@ -45,6 +49,7 @@
 #include <celutil/fsutils.h>
 #include <celutil/logger.h>
 #include <celutil/gettext.h>
+#include <celutil/threadpool.h>
 #include <celutil/utf8.h>
 #include <celcompat/filesystem.h>
 #include <Eigen/Geometry>
@@ -52,6 +57,9 @@
 #include <fstream>
 #include <iomanip>
 #include <algorithm>
+#include <array>
+#include <future>
+#include <optional>
 #include <cstdlib>
 #include <cctype>
 #include <cstring>
@@ -2147,6 +2155,13 @@ void CelestiaCore::draw()
         return;
     viewChanged = false;
 
+    // Textures loaded in the background are created within a per-frame
+    // time budget, and unused textures and models are unloaded when over
+    // their memory budgets. This is done once for all the views, so that
+    // the resources used by each of them count as used in this frame.
+    GetTextureManager()->startFrame();
+    GetGeometryManager()->startFrame();
+
     // Render each view
     for (const auto view : views)
         draw(view);
@@ -3655,19 +3670,47 @@ void CelestiaCore::renderOverlay()
 }
 
 
+// A catalog file which is read and parsed on the thread pool while the
+// catalogs queued before it are loaded. The result is empty if the file
+// could not be opened.
+struct QueuedCatalog
+{
+    fs::path path;
+    std::future<std::optional<ParsedCatalog>> catalog;
+};
+
+static QueuedCatalog queueCatalog(ThreadPool& pool, const fs::path& path)
+{
+    return
+    {
+        path,
+        pool.submit([path]() -> std::optional<ParsedCatalog>
+        {
+            ifstream catalogFile(path, ios::in);
+            if (!catalogFile.good())
+                return std::nullopt;
+            return ParsedCatalog::read(catalogFile);
+        })
+    };
+}
+
 class SolarSystemLoader
 {
     Universe* universe;
     ProgressNotifier* notifier;
     const vector<fs::path>& skip;
+    ThreadPool& pool;
+    vector<QueuedCatalog> queue;
 
  public:
     SolarSystemLoader(Universe* u,
                       ProgressNotifier* pn,
-                      const vector<fs::path>& skip) :
+                      const vector<fs::path>& skip,
+                      ThreadPool& pool) :
         universe(u),
         notifier(pn),
-        skip(skip)
+        skip(skip),
+        pool(pool)
     {
     }
 
@@ -3681,39 +3724,50 @@ class SolarSystemLoader
             GetLogger()->info(_("Skipping solar system catalog: {}\n"), filepath);
             return;
         }
-        GetLogger()->info(_("Loading solar system catalog: {}\n"), filepath);
-        if (notifier != nullptr)
-            notifier->update(filepath.filename().string());
+        queue.push_back(queueCatalog(pool, filepath));
+    }
 
-        ifstream solarSysFile(filepath, ios::in);
-        if (solarSysFile.good())
+    // Load the processed catalogs in the order they were found; later
+    // catalogs may modify or replace objects from earlier ones.
+    void load()
+    {
+        for (auto& entry : queue)
         {
-            LoadSolarSystemObjects(solarSysFile,
-                                   *universe,
-                                   filepath.parent_path());
+            GetLogger()->info(_("Loading solar system catalog: {}\n"), entry.path);
+            if (notifier != nullptr)
+                notifier->update(entry.path.filename().string());
+
+            if (std::optional<ParsedCatalog> catalog = entry.catalog.get(); catalog.has_value())
+            {
+                LoadSolarSystemObjects(*catalog,
+                                       *universe,
+                                       entry.path.parent_path());
+            }
         }
+        queue.clear();
     }
 };
 
 template <class OBJDB> class CatalogLoader
 {
-    OBJDB*      objDB;
     string      typeDesc;
     ContentType contentType;
     ProgressNotifier* notifier;
     const vector<fs::path>& skip;
+    ThreadPool& pool;
+    vector<QueuedCatalog> queue;
 
  public:
-    CatalogLoader(OBJDB* db,
-                  const std::string& typeDesc,
+    CatalogLoader(const std::string& typeDesc,
                   const ContentType& contentType,
                   ProgressNotifier* pn,
-                  const vector<fs::path>& skip) :
-        objDB      (db),
+                  const vector<fs::path>& skip,
+                  ThreadPool& pool) :
         typeDesc   (typeDesc),
         contentType(contentType),
         notifier   (pn),
-        skip       (skip)
+        skip       (skip),
+        pool       (pool)
     {
     }
 
@@ -3727,16 +3781,25 @@ template <class OBJDB> class CatalogLoader
             GetLogger()->info(_("Skipping {} catalog: {}\n"), typeDesc, filepath);
             return;
         }
-        GetLogger()->info(_("Loading {} catalog: {}\n"), typeDesc, filepath);
-        if (notifier != nullptr)
-            notifier->update(filepath.filename().string());
+        queue.push_back(queueCatalog(pool, filepath));
+    }
 
-        ifstream catalogFile(filepath, ios::in);
-        if (catalogFile.good())
+    // Load the processed catalogs into objDB in the order they were found
+    void load(OBJDB* objDB)
+    {
+        for (auto& entry : queue)
         {
-            if (!objDB->load(catalogFile, filepath.parent_path()))
-                GetLogger()->error(_("Error reading {} catalog file: {}\n"), typeDesc, filepath);
+            GetLogger()->info(_("Loading {} catalog: {}\n"), typeDesc, entry.path);
+            if (notifier != nullptr)
+                notifier->update(entry.path.filename().string());
+
+            if (std::optional<ParsedCatalog> catalog = entry.catalog.get(); catalog.has_value())
+            {
+                if (!objDB->load(*catalog, entry.path.parent_path()))
+                    GetLogger()->error(_("Error reading {} catalog file: {}\n"), typeDesc, entry.path);
+            }
         }
+        queue.clear();
     }
 };
 
@@ -3778,6 +3841,14 @@ bool CelestiaCore::initSimulation(const fs::path& configFileName,
     if (!config->leapSecondsFile.empty())
         ReadLeapSecondsFile(config->leapSecondsFile, leapSeconds);
 
+#ifndef PORTABLE_BUILD
+    // Caches of data derived from the catalogs live with the user's data
+    if (config->cacheDirectory.empty())
+        config->cacheDirectory = WriteableDataPath() / "cache";
+    else if (config->cacheDirectory.is_relative())
+        config->cacheDirectory = WriteableDataPath() / config->cacheDirectory;
+#endif
+
 #ifdef USE_SPICE
     if (!celestia::ephem::InitializeSpice())
     {
@@ -3820,9 +3891,74 @@ bool CelestiaCore::initSimulation(const fs::path& configFileName,
     universe = new Universe();
 
 
+    // Text catalogs are read and parsed on the thread pool ahead of being
+    // loaded. Loading itself stays on this thread and follows the order of
+    // the files, so later catalogs still override earlier ones.
+    ThreadPool loaderPool(config->serialCatalogLoading ? 0 : ThreadPool::defaultThreadCount());
+
+    // The deep sky catalogs listed in the config file (deepsky.dsc,
+    // globulars.dsc,...) are loaded first, then those in the extras
+    // directories.
+    vector<QueuedCatalog> dsoCatalogs;
+    for (const auto& file : config->dsoCatalogFiles)
+        dsoCatalogs.push_back(queueCatalog(loaderPool, file));
+
+    DeepSkyLoader dsoLoader("deep sky object",
+                            Content_CelestiaDeepSkyCatalog,
+                            progressNotifier,
+                            config->skipExtras,
+                            loaderPool);
+    for (const auto& dir : config->extrasDirs)
+    {
+        if (!is_valid_directory(dir))
+            continue;
+
+        vector<fs::path> entries;
+        std::error_code ec;
+        auto iter = fs::recursive_directory_iterator(dir, ec);
+        for (; iter != end(iter); iter.increment(ec))
+        {
+            if (ec)
+                continue;
+            if (!fs::is_directory(iter->path(), ec))
+                entries.push_back(iter->path());
+        }
+        std::sort(begin(entries), end(entries));
+        for (const auto& fn : entries)
+            dsoLoader.process(fn);
+    }
+
+    // Likewise the solar system files listed individually in the config
+    // file come before those in the extras directories.
+    vector<QueuedCatalog> solarSystemCatalogs;
+    for (const auto& file : config->solarSystemFiles)
+        solarSystemCatalogs.push_back(queueCatalog(loaderPool, file));
+
+    SolarSystemLoader solarSystemLoader(universe, progressNotifier, config->skipExtras, loaderPool);
+    for (const auto& dir : config->extrasDirs)
+    {
+        if (!is_valid_directory(dir))
+            continue;
+
+        vector<fs::path> entries;
+        std::error_code ec;
+        auto iter = fs::recursive_directory_iterator(dir, ec);
+        for (; iter != end(iter); iter.increment(ec))
+        {
+            if (ec)
+                continue;
+            if (!fs::is_directory(iter->path(), ec))
+                entries.push_back(iter->path());
+        }
+        sort(begin(entries), end(entries));
+        for(const auto& fn : entries)
+            solarSystemLoader.process(fn);
+    }
+
+
     /***** Load star catalogs *****/
 
-    if (!readStars(*config, progressNotifier))
+    if (!readStars(*config, progressNotifier, loaderPool))
     {
         fatalError(_("Cannot read star database."), false);
         return false;
@@ -3834,104 +3970,63 @@ bool CelestiaCore::initSimulation(const fs::path& configFileName,
     DSONameDatabase* dsoNameDB  = new DSONameDatabase;
     DSODatabase*     dsoDB      = new DSODatabase;
     dsoDB->setNameDatabase(dsoNameDB);
+    if (!config->cacheDirectory.empty())
+        dsoDB->setOctreeCacheFile(config->cacheDirectory / "dso.octree");
 
-    // Load first the vector of dsoCatalogFiles in the data directory (deepsky.dsc, globulars.dsc,...):
-
-    for (const auto& file : config->dsoCatalogFiles)
+    for (auto& entry : dsoCatalogs)
     {
         if (progressNotifier)
-            progressNotifier->update(file.string());
+            progressNotifier->update(entry.path.string());
 
-        ifstream dsoFile(file, ios::in);
-        if (!dsoFile.good())
+        std::optional<ParsedCatalog> catalog = entry.catalog.get();
+        if (!catalog.has_value())
         {
-            GetLogger()->error(_("Error opening deepsky catalog file {}.\n"), file);
+            GetLogger()->error(_("Error opening deepsky catalog file {}.\n"), entry.path);
         }
-        if (!dsoDB->load(dsoFile, ""))
+        else if (!dsoDB->load(*catalog, ""))
         {
-            GetLogger()->error(_("Cannot read Deep Sky Objects database {}.\n"), file);
+            GetLogger()->error(_("Cannot read Deep Sky Objects database {}.\n"), entry.path);
         }
     }
 
-    // Next, read all the deep sky files in the extras directories
-    {
-        vector<fs::path> entries;
-        DeepSkyLoader loader(dsoDB, "deep sky object",
-                             Content_CelestiaDeepSkyCatalog,
-                             progressNotifier,
-                             config->skipExtras);
-        for (const auto& dir : config->extrasDirs)
-        {
-            if (!is_valid_directory(dir))
-                continue;
-
-            entries.clear();
-            std::error_code ec;
-            auto iter = fs::recursive_directory_iterator(dir, ec);
-            for (; iter != end(iter); iter.increment(ec))
-            {
-                if (ec)
-                    continue;
-                if (!fs::is_directory(iter->path(), ec))
-                    entries.push_back(iter->path());
-            }
-            std::sort(begin(entries), end(entries));
-            for (const auto& fn : entries)
-                loader.process(fn);
-        }
-    }
+    dsoLoader.load(dsoDB);
     dsoDB->finish();
     universe->setDSOCatalog(dsoDB);
 
 
     /***** Load the solar system catalogs *****/
-    // First read the solar system files listed individually in the
-    // config file.
-    {
-        SolarSystemCatalog* solarSystemCatalog = new SolarSystemCatalog();
-        universe->setSolarSystemCatalog(solarSystemCatalog);
-        for (const auto& file : config->solarSystemFiles)
-        {
-            if (progressNotifier)
-                progressNotifier->update(file.string());
 
-            ifstream solarSysFile(file, ios::in);
-            if (!solarSysFile.good())
-            {
-                GetLogger()->error(_("Error opening solar system catalog {}.\n"), file);
-            }
-            else
-            {
-                LoadSolarSystemObjects(solarSysFile, *universe);
-            }
-        }
+    if (config->ephemerisFitEndYear > config->ephemerisFitStartYear)
+    {
+        celestia::ephem::ChebyshevFitOptions fitOptions;
+        fitOptions.startTime = static_cast<double>(astro::Date(config->ephemerisFitStartYear, 1, 1));
+        fitOptions.endTime = static_cast<double>(astro::Date(config->ephemerisFitEndYear, 1, 1));
+        fitOptions.tolerance = std::max(config->ephemerisFitTolerance, 1.0e-6);
+        if (!config->cacheDirectory.empty())
+            fitOptions.cacheDirectory = config->cacheDirectory / "ephemeris";
+        celestia::ephem::SetChebyshevFitOptions(fitOptions);
     }
 
-    // Next, read all the solar system files in the extras directories
+    SolarSystemCatalog* solarSystemCatalog = new SolarSystemCatalog();
+    universe->setSolarSystemCatalog(solarSystemCatalog);
+    for (auto& entry : solarSystemCatalogs)
     {
-        vector<fs::path> entries;
-        SolarSystemLoader loader(universe, progressNotifier, config->skipExtras);
-        for (const auto& dir : config->extrasDirs)
-        {
-            if (!is_valid_directory(dir))
-                continue;
+        if (progressNotifier)
+            progressNotifier->update(entry.path.string());
 
-            entries.clear();
-            std::error_code ec;
-            auto iter = fs::recursive_directory_iterator(dir, ec);
-            for (; iter != end(iter); iter.increment(ec))
-            {
-                if (ec)
-                    continue;
-                if (!fs::is_directory(iter->path(), ec))
-                    entries.push_back(iter->path());
-            }
-            sort(begin(entries), end(entries));
-            for(const auto& fn : entries)
-                loader.process(fn);
+        std::optional<ParsedCatalog> catalog = entry.catalog.get();
+        if (!catalog.has_value())
+        {
+            GetLogger()->error(_("Error opening solar system catalog {}.\n"), entry.path);
+        }
+        else
+        {
+            LoadSolarSystemObjects(*catalog, *universe);
         }
     }
 
+    solarSystemLoader.load();
+
     // Load asterisms:
     if (!config->asterismsFile.empty())
     {
@@ -4084,6 +4179,9 @@ bool CelestiaCore::initRenderer()
     detailOptions.orbitWindowEnd = config->orbitWindowEnd;
     detailOptions.orbitPeriodsShown = config->orbitPeriodsShown;
     detailOptions.linearFadeFraction = config->linearFadeFraction;
+    detailOptions.octreeTraversalThreads = config->octreeTraversalThreads;
+    detailOptions.orbitSamplingThreads = config->orbitSamplingThreads;
+    detailOptions.bodyStateThreads = config->bodyStateThreads;
 
     // Prepare the scene for rendering.
     if (!renderer->init((int) width, (int) height, detailOptions))
@@ -4098,6 +4196,13 @@ bool CelestiaCore::initRenderer()
         setFaintestAutoMag();
     }
 
+    if (config->asyncTextureLoading)
+        GetTextureManager()->setAsyncLoading(ThreadPool::defaultThreadCount());
+    GetTextureManager()->setMemoryBudget(static_cast<std::size_t>(config->textureMemoryBudget) << 20);
+    GetGeometryManager()->setMemoryBudget(static_cast<std::size_t>(config->modelMemoryBudget) << 20);
+    if (!config->cacheDirectory.empty())
+        SetModelCacheDirectory(config->cacheDirectory / "models");
+
     if (config->mainFont.empty())
         font = LoadTextureFont(renderer, "fonts/DejaVuSans.ttf,12");
     else
@@ -4149,99 +4254,113 @@ static void loadCrossIndex(StarDatabase* starDB,
 
 
 bool CelestiaCore::readStars(const CelestiaConfig& cfg,
-                             ProgressNotifier* progressNotifier)
+                             ProgressNotifier* progressNotifier,
+                             ThreadPool& loaderPool)
 {
     StarDetails::SetStarTextures(cfg.starTextures);
 
-    StarNameDatabase* starNameDB = nullptr;
-    ifstream starNamesFile(cfg.starNamesFile, ios::in);
-    if (starNamesFile.good())
+    // The star names and the text star catalogs don't depend on the binary
+    // star database, so read them while it loads.
+    std::future<StarNameDatabase*> starNames = loaderPool.submit([&cfg]()
     {
-        starNameDB = StarNameDatabase::readNames(starNamesFile);
-        if (starNameDB == nullptr)
-            GetLogger()->error(_("Error reading star names file\n"));
+        StarNameDatabase* starNameDB = nullptr;
+        ifstream starNamesFile(cfg.starNamesFile, ios::in);
+        if (starNamesFile.good())
+        {
+            starNameDB = StarNameDatabase::readNames(starNamesFile);
+            if (starNameDB == nullptr)
+                GetLogger()->error(_("Error reading star names file\n"));
+        }
+        else
+        {
+            GetLogger()->error(_("Error opening {}\n"), cfg.starNamesFile);
+        }
+        return starNameDB;
+    });
+
+    // ASCII star catalog files specified in the StarCatalogs list
+    vector<QueuedCatalog> starCatalogs;
+    for (const auto& file : cfg.starCatalogFiles)
+    {
+        if (!file.empty())
+            starCatalogs.push_back(queueCatalog(loaderPool, file));
     }
-    else
+
+    // Supplemental star files from the extras directories
+    StarLoader loader("star",
+                      Content_CelestiaStarCatalog,
+                      progressNotifier,
+                      cfg.skipExtras,
+                      loaderPool);
+    for (const auto& dir : cfg.extrasDirs)
     {
-        GetLogger()->error(_("Error opening {}\n"), cfg.starNamesFile);
+        if (!is_valid_directory(dir))
+            continue;
+
+        vector<fs::path> entries;
+        std::error_code ec;
+        auto iter = fs::recursive_directory_iterator(dir, ec);
+        for (; iter != end(iter); iter.increment(ec))
+        {
+            if (ec)
+                continue;
+            if (!fs::is_directory(iter->path(), ec))
+                entries.push_back(iter->path());
+        }
+        std::sort(begin(entries), end(entries));
+        for (const auto& fn : entries)
+            loader.process(fn);
     }
 
+    // Each cross index is stored separately from the stars, so these can
+    // be read concurrently with the binary database too.
+    StarDatabase* starDB = new StarDatabase();
+    std::array<std::future<void>, 3> crossIndexes
+    {
+        loaderPool.submit([starDB, &cfg]() { loadCrossIndex(starDB, StarDatabase::HenryDraper, cfg.HDCrossIndexFile); }),
+        loaderPool.submit([starDB, &cfg]() { loadCrossIndex(starDB, StarDatabase::SAO, cfg.SAOCrossIndexFile); }),
+        loaderPool.submit([starDB, &cfg]() { loadCrossIndex(starDB, StarDatabase::Gliese, cfg.GlieseCrossIndexFile); }),
+    };
+
     // First load the binary star database file.  The majority of stars
     // will be defined here.
-    StarDatabase* starDB = new StarDatabase();
+    bool binaryLoaded = true;
     if (!cfg.starDatabaseFile.empty())
     {
         if (progressNotifier)
             progressNotifier->update(cfg.starDatabaseFile.string());
 
-        ifstream starFile(cfg.starDatabaseFile, ios::in | ios::binary);
-        if (!starFile.good())
-        {
-            GetLogger()->error(_("Error opening {}\n"), cfg.starDatabaseFile);
-            delete starDB;
-            delete starNameDB;
-            return false;
-        }
+        binaryLoaded = starDB->loadBinary(cfg.starDatabaseFile);
+    }
 
-        if (!starDB->loadBinary(starFile))
-        {
-            GetLogger()->error(_("Error reading stars file\n"));
-            delete starDB;
-            delete starNameDB;
-            return false;
-        }
+    for (auto& crossIndex : crossIndexes)
+        crossIndex.wait();
+    StarNameDatabase* starNameDB = starNames.get();
+
+    if (!binaryLoaded)
+    {
+        GetLogger()->error(_("Error reading stars file\n"));
+        delete starDB;
+        delete starNameDB;
+        return false;
     }
 
     if (starNameDB == nullptr)
         starNameDB = new StarNameDatabase();
     starDB->setNameDatabase(starNameDB);
+    if (!cfg.cacheDirectory.empty())
+        starDB->setOctreeCacheFile(cfg.cacheDirectory / "stars.octree");
 
-    loadCrossIndex(starDB, StarDatabase::HenryDraper, cfg.HDCrossIndexFile);
-    loadCrossIndex(starDB, StarDatabase::SAO,         cfg.SAOCrossIndexFile);
-    loadCrossIndex(starDB, StarDatabase::Gliese,      cfg.GlieseCrossIndexFile);
-
-    // Next, read any ASCII star catalog files specified in the StarCatalogs
-    // list.
-    for (const auto& file : config->starCatalogFiles)
+    for (auto& entry : starCatalogs)
     {
-        if (file.empty())
-            continue;
-
-        ifstream starFile(file, ios::in);
-        if (starFile.good())
-            starDB->load(starFile);
+        std::optional<ParsedCatalog> catalog = entry.catalog.get();
+        if (catalog.has_value())
+            starDB->load(*catalog);
         else
-            GetLogger()->error(_("Error opening star catalog {}\n"), file);
+            GetLogger()->error(_("Error opening star catalog {}\n"), entry.path);
     }
 
-    // Now, read supplemental star files from the extras directories
-    {
-        vector<fs::path> entries;
-        StarLoader loader(starDB,
-                          "star",
-                          Content_CelestiaStarCatalog,
-                          progressNotifier,
-                          config->skipExtras);
-        for (const auto& dir : config->extrasDirs)
-        {
-            if (!is_valid_directory(dir))
-                continue;
-
-            entries.clear();
-            std::error_code ec;
-            auto iter = fs::recursive_directory_iterator(dir, ec);
-            for (; iter != end(iter); iter.increment(ec))
-            {
-                if (ec)
-                    continue;
-                if (!fs::is_directory(iter->path(), ec))
-                    entries.push_back(iter->path());
-            }
-            std::sort(begin(entries), end(entries));
-            for (const auto& fn : entries)
-                loader.process(fn);
-        }
-    }
+    loader.load(starDB);
 
     starDB->finish();
 
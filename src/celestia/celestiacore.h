@@ -54,6 +54,10 @@ class TextPrintPosition;
 #ifdef USE_MINIAUDIO
 class AudioSession;
 #endif
+namespace util
+{
+class ThreadPool;
+}
 }
 
 typedef Watcher<CelestiaCore> CelestiaWatcher;
@@ -418,7 +422,7 @@ class CelestiaCore // : public Watchable<CelestiaCore>
     TemperatureScale getTemperatureScale() const;
 
  protected:
-    bool readStars(const CelestiaConfig&, ProgressNotifier*);
+    bool readStars(const CelestiaConfig&, ProgressNotifier*, celestia::util::ThreadPool&);
     void renderOverlay();
 #ifdef CELX
     bool initLuaHook(ProgressNotifier*);
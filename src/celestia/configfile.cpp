@@ -83,6 +83,8 @@ CelestiaConfig* ReadCelestiaConfig(const fs::path& filename, CelestiaConfig *con
         config->GlieseCrossIndexFile = *path;
     if (auto path = configParams->getPath("LeapSecondsFile"); path.has_value())
         config->leapSecondsFile = *path;
+    if (auto path = configParams->getPath("CacheDirectory"); path.has_value())
+        config->cacheDirectory = *path;
     if (const std::string* font = configParams->getString("Font"); font != nullptr)
         config->mainFont = *font;
     if (const std::string* labelFont = configParams->getString("LabelFont"); labelFont != nullptr)
@@ -118,6 +120,16 @@ CelestiaConfig* ReadCelestiaConfig(const fs::path& filename, CelestiaConfig *con
     config->rotateAcceleration = configParams->getNumber<float>("RotateAcceleration").value_or(120.0f);
     config->mouseRotationSensitivity = configParams->getNumber<float>("MouseRotationSensitivity").value_or(1.0f);
     config->reverseMouseWheel = configParams->getBoolean("ReverseMouseWheel").value_or(false);
+    config->serialCatalogLoading = configParams->getBoolean("SerialCatalogLoading").value_or(false);
+    config->octreeTraversalThreads = configParams->getNumber<unsigned int>("OctreeTraversalThreads").value_or(0u);
+    config->orbitSamplingThreads = configParams->getNumber<unsigned int>("OrbitSamplingThreads").value_or(0u);
+    config->bodyStateThreads = configParams->getNumber<unsigned int>("BodyStateThreads").value_or(0u);
+    config->asyncTextureLoading = configParams->getBoolean("AsyncTextureLoading").value_or(false);
+    config->textureMemoryBudget = configParams->getNumber<unsigned int>("TextureMemoryBudget").value_or(0u);
+    config->modelMemoryBudget = configParams->getNumber<unsigned int>("ModelMemoryBudget").value_or(0u);
+    config->ephemerisFitStartYear = configParams->getNumber<int>("EphemerisFitStartYear").value_or(0);
+    config->ephemerisFitEndYear = configParams->getNumber<int>("EphemerisFitEndYear").value_or(0);
+    config->ephemerisFitTolerance = configParams->getNumber<double>("EphemerisFitTolerance").value_or(1.0);
     if (auto path = configParams->getPath("ScriptScreenshotDirectory"); path.has_value())
         config->scriptScreenshotDirectory = *path;
     config->scriptSystemAccessPolicy = "ask";
@@ -345,9 +357,5 @@ CelestiaConfig* ReadCelestiaConfig(const fs::path& filename, CelestiaConfig *con
     // TODO: not cleaning up properly here--we're just saving the hash, not the instance of Value
     config->params = configParams;
 
-#ifndef CELX
-     delete configParamsValue;
-#endif
-
     return config;
 }
@@ -84,6 +84,36 @@ public:
     std::string ffvhEncoderOptions;
 
     fs::path leapSecondsFile;
+
+    // Directory for data derived from the catalogs, such as sorted octrees
+    fs::path cacheDirectory;
+
+    // Read catalog files one at a time on the main thread
+    bool serialCatalogLoading;
+
+    // Number of threads traversing the star and DSO octrees while rendering
+    unsigned int octreeTraversalThreads;
+
+    // Number of threads sampling orbit paths in the background
+    unsigned int orbitSamplingThreads;
+
+    // Number of threads computing the positions of solar system bodies
+    unsigned int bodyStateThreads;
+
+    // Read and decode textures on worker threads rather than when they are
+    // first rendered
+    bool asyncTextureLoading;
+
+    // Memory budgets for textures and models in MiB; 0 for no limit
+    unsigned int textureMemoryBudget;
+    unsigned int modelMemoryBudget;
+
+    // Years over which custom orbits are computed from fitted Chebyshev
+    // polynomials, and the largest error of the fits in km; nothing is
+    // fitted unless the end year is after the start year
+    int ephemerisFitStartYear;
+    int ephemerisFitEndYear;
+    double ephemerisFitTolerance;
 };
 
 CelestiaConfig* ReadCelestiaConfig(const fs::path& filename, CelestiaConfig* config = nullptr);
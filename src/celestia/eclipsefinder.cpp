@@ -10,20 +10,38 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
-#include <cstring>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
 
 #include <Eigen/Geometry>
 
 #include <celengine/body.h>
+#include <celengine/frame.h>
+#include <celengine/timeline.h>
+#include <celengine/timelinephase.h>
 #include <celmath/distance.h>
 #include <celmath/ray.h>
+#include <celutil/threadpool.h>
 #include "eclipsefinder.h"
 
 using namespace Eigen;
 using namespace std;
 using namespace celmath;
 
+using celestia::util::ThreadPool;
+
+
+namespace
+{
 
 constexpr const double dT = 1.0 / (24.0 * 60.0);
 constexpr const int EclipseObjectMask = Body::Planet      |
@@ -33,175 +51,435 @@ constexpr const int EclipseObjectMask = Body::Planet      |
                                         Body::Asteroid;
 
 // TODO: share this constant and function with render.cpp
-static const float MinRelativeOccluderRadius = 0.005f;
+constexpr float MinRelativeOccluderRadius = 0.005f;
 
-EclipseFinder::EclipseFinder(Body* _body,
-                             EclipseFinderWatcher* _watcher) :
-    body(_body),
-    watcher(_watcher)
-{
-}
+// Bounds of the adaptive search step. The smallest step is also the
+// shortest eclipse which is guaranteed to be found.
+constexpr double MinSearchStep = dT;
+constexpr double MaxSearchStep = 1.0;
 
+// Fraction of the time the shadow needs to reach the receiver at the
+// current speed which is taken as a step. It allows for the speed growing
+// during the step.
+constexpr double StepSafetyFactor = 0.75;
 
-bool testEclipse(const Body& receiver, const Body& caster, double now)
+// Precision of the eclipse start and end times
+constexpr double ContactPrecision = 1.0 / 86400.0; // one second
+constexpr int MaxFalsePositionIterations = 10;
+
+// An eclipse is not followed further than this; it prevents an endless
+// search when bodies never leave each other's shadow.
+constexpr double MaxEclipseDuration = 365.25;
+
+// Each satellite's time span is split into this many tasks per thread,
+// to balance the load when eclipses cluster.
+constexpr unsigned int ChunksPerThread = 4;
+
+constexpr auto ProgressInterval = chrono::milliseconds(100);
+
+constexpr array<Eclipse::Type, 2> EclipseTypes{ Eclipse::Solar, Eclipse::Lunar };
+
+
+/*! Return how far the receiver is from the shadow of the caster, in km:
+ *  negative when the receiver is in eclipse. Infinity is returned when the
+ *  caster can't cast relevant shadows, and zero when the bodies' bounding
+ *  spheres intersect, as those "eclipses" are ignored.
+ */
+double shadowMargin(const Body& receiver, const Body& caster,
+                    const Vector3d& posReceiver, const Vector3d& posCaster)
 {
     // Ignore situations where the shadow casting body is much smaller than
     // the receiver, as these shadows aren't likely to be relevant.  Also,
     // ignore eclipses where the caster is not an ellipsoid, since we can't
     // generate correct shadows in this case.
-    if (caster.getRadius() >= receiver.getRadius() * MinRelativeOccluderRadius &&
-        caster.isEllipsoid())
+    if (caster.getRadius() < receiver.getRadius() * MinRelativeOccluderRadius ||
+        !caster.isEllipsoid())
     {
-        // All of the eclipse related code assumes that both the caster
-        // and receiver are spherical.  Irregular receivers will work more
-        // or less correctly, but casters that are sufficiently non-spherical
-        // will produce obviously incorrect shadows.  Another assumption we
-        // make is that the distance between the caster and receiver is much
-        // less than the distance between the sun and the receiver.  This
-        // approximation works everywhere in the solar system, and likely
-        // works for any orbitally stable pair of objects orbiting a star.
-        Vector3d posReceiver = receiver.getAstrocentricPosition(now);
-        Vector3d posCaster = caster.getAstrocentricPosition(now);
-
-        const Star* sun = receiver.getSystem()->getStar();
-        assert(sun != nullptr);
-        double distToSun = posReceiver.norm();
-        float appSunRadius = (float) (sun->getRadius() / distToSun);
-
-        Vector3d dir = posCaster - posReceiver;
-        double distToCaster = dir.norm() - receiver.getRadius();
-        float appOccluderRadius = (float) (caster.getRadius() / distToCaster);
-
-        // The shadow radius is the radius of the occluder plus some additional
-        // amount that depends upon the apparent radius of the sun.  For
-        // a sun that's distant/small and effectively a point, the shadow
-        // radius will be the same as the radius of the occluder.
-        float shadowRadius = (1 + appSunRadius / appOccluderRadius) *
-            caster.getRadius();
-
-        // Test whether a shadow is cast on the receiver.  We want to know
-        // if the receiver lies within the shadow volume of the caster.  Since
-        // we're assuming that everything is a sphere and the sun is far
-        // away relative to the caster, the shadow volume is a
-        // cylinder capped at one end.  Testing for the intersection of a
-        // singly capped cylinder is as simple as checking the distance
-        // from the center of the receiver to the axis of the shadow cylinder.
-        // If the distance is less than the sum of the caster's and receiver's
-        // radii, then we have an eclipse.
-        float R = receiver.getRadius() + shadowRadius;
-        double dist = distance(posReceiver, Eigen::ParametrizedLine<double, 3>(posCaster, posCaster));
-        if (dist < R)
+        return numeric_limits<double>::infinity();
+    }
+
+    // All of the eclipse related code assumes that both the caster
+    // and receiver are spherical.  Irregular receivers will work more
+    // or less correctly, but casters that are sufficiently non-spherical
+    // will produce obviously incorrect shadows.  Another assumption we
+    // make is that the distance between the caster and receiver is much
+    // less than the distance between the sun and the receiver.  This
+    // approximation works everywhere in the solar system, and likely
+    // works for any orbitally stable pair of objects orbiting a star.
+    const Star* sun = receiver.getSystem()->getStar();
+    assert(sun != nullptr);
+    double distToSun = posReceiver.norm();
+    float appSunRadius = (float) (sun->getRadius() / distToSun);
+
+    Vector3d dir = posCaster - posReceiver;
+    double distToCaster = dir.norm() - receiver.getRadius();
+    float appOccluderRadius = (float) (caster.getRadius() / distToCaster);
+
+    // The shadow radius is the radius of the occluder plus some additional
+    // amount that depends upon the apparent radius of the sun.  For
+    // a sun that's distant/small and effectively a point, the shadow
+    // radius will be the same as the radius of the occluder.
+    float shadowRadius = (1 + appSunRadius / appOccluderRadius) *
+        caster.getRadius();
+
+    // Test whether a shadow is cast on the receiver.  We want to know
+    // if the receiver lies within the shadow volume of the caster.  Since
+    // we're assuming that everything is a sphere and the sun is far
+    // away relative to the caster, the shadow volume is a
+    // cylinder capped at one end.  Testing for the intersection of a
+    // singly capped cylinder is as simple as checking the distance
+    // from the center of the receiver to the axis of the shadow cylinder.
+    // If the distance is less than the sum of the caster's and receiver's
+    // radii, then we have an eclipse.
+    float R = receiver.getRadius() + shadowRadius;
+    double dist = distance(posReceiver, Eigen::ParametrizedLine<double, 3>(posCaster, posCaster));
+
+    // Ignore "eclipses" where the caster and receiver have
+    // intersecting bounding spheres.
+    if (distToCaster <= caster.getRadius())
+        return max(dist - R, 0.0);
+
+    return dist - R;
+}
+
+
+// Return true if the positions of the body may be computed from several
+// threads at once.
+bool isThreadSafe(const Body& body)
+{
+    const Timeline* timeline = body.getTimeline();
+    for (unsigned int i = 0; i < timeline->phaseCount(); i++)
+    {
+        const TimelinePhase& phase = *timeline->getPhase(i);
+        if (!phase.orbit()->isThreadSafe())
+            return false;
+
+        // Other frames cache their orientation
+        const ReferenceFrame* frame = phase.orbitFrame().get();
+        if (dynamic_cast<const J2000EclipticFrame*>(frame) == nullptr &&
+            dynamic_cast<const J2000EquatorFrame*>(frame) == nullptr)
         {
-            // Ignore "eclipses" where the caster and receiver have
-            // intersecting bounding spheres.
-            if (distToCaster > caster.getRadius())
-                return true;
+            return false;
         }
+
+        const Body* center = frame->getCenter().body();
+        if (center != nullptr && !isThreadSafe(*center))
+            return false;
     }
 
-    return false;
+    return true;
 }
 
-#if 1
-double findEclipseSpan(const Body& receiver, const Body& caster,
-                       double now, double dt)
+
+// Positions of a planet and one of its satellites at an instant, with the
+// shadow margins of each eclipse type.
+struct SearchState
+{
+    double t;
+    Vector3d planetPos;
+    Vector3d satellitePos;
+    Vector3d planetVel;
+    Vector3d satelliteVel;
+    array<double, 2> margins;
+};
+
+
+/*! Finds the eclipses between a planet and one satellite. The search steps
+ *  through time as far as the shadow can't reach the receiver, given how
+ *  fast the bodies move, so it slows down only when near an eclipse; the
+ *  start and end of each eclipse are then found by root finding on the
+ *  distance between the receiver and the shadow.
+ */
+class SatelliteSearch
+{
+ public:
+    SatelliteSearch(const Body& _planet, const Body& _satellite, int _typeMask) :
+        planet(_planet),
+        satellite(_satellite),
+        typeMask(_typeMask)
+    {
+    }
+
+    void search(double startDate, double endDate, bool first,
+                vector<Eclipse>& eclipses,
+                const function<bool(double)>& progress) const;
+
+ private:
+    SearchState evaluate(double t, const SearchState* previous = nullptr) const;
+    double margin(size_t type, double t) const;
+    double safeStep(const SearchState& state, double distance) const;
+    double findContact(size_t type, double tOut, double mOut, double tIn, double mIn) const;
+    double followEclipse(size_t type, const SearchState& state, double direction) const;
+    Eclipse makeEclipse(size_t type, double startTime, double endTime) const;
+
+    const Body& planet;
+    const Body& satellite;
+    int typeMask;
+};
+
+
+// Velocities are estimated from the previous state if there is one, and
+// by differentiating otherwise. Over a step, the chord underestimates
+// the speed by a few percent at most, which is covered by the safety factor.
+SearchState SatelliteSearch::evaluate(double t, const SearchState* previous) const
 {
-    double t = now;
-    while (testEclipse(receiver, caster, t))
-        t += dt;
+    SearchState state;
+    state.t = t;
+    state.planetPos = planet.getAstrocentricPosition(t);
+    state.satellitePos = satellite.getAstrocentricPosition(t);
 
-    return t;
+    if (previous != nullptr && previous->t != t)
+    {
+        double h = 1.0 / (t - previous->t);
+        state.planetVel = (state.planetPos - previous->planetPos) * h;
+        state.satelliteVel = (state.satellitePos - previous->satellitePos) * h;
+    }
+    else
+    {
+        state.planetVel = (planet.getAstrocentricPosition(t + dT) - state.planetPos) / dT;
+        state.satelliteVel = (satellite.getAstrocentricPosition(t + dT) - state.satellitePos) / dT;
+    }
+
+    for (size_t i = 0; i < EclipseTypes.size(); i++)
+    {
+        if ((typeMask & EclipseTypes[i]) == 0)
+            state.margins[i] = numeric_limits<double>::infinity();
+        else if (EclipseTypes[i] == Eclipse::Solar)
+            state.margins[i] = shadowMargin(planet, satellite, state.planetPos, state.satellitePos);
+        else
+            state.margins[i] = shadowMargin(satellite, planet, state.satellitePos, state.planetPos);
+    }
+
+    return state;
 }
-#else
-// Given a time during an eclipse, find the start of the eclipse to
-// a precision of minStep.
-double findEclipseStart(const Body& receiver, const Body& occulter,
-                        double now,
-                        double startStep,
-                        double minStep)
+
+
+double SatelliteSearch::margin(size_t type, double t) const
 {
-    double step = startStep / 2;
-    double t = now - step;
-    bool eclipsed = true;
+    Vector3d planetPos = planet.getAstrocentricPosition(t);
+    Vector3d satellitePos = satellite.getAstrocentricPosition(t);
+    if (EclipseTypes[type] == Eclipse::Solar)
+        return shadowMargin(planet, satellite, planetPos, satellitePos);
+    return shadowMargin(satellite, planet, satellitePos, planetPos);
+}
 
-    // Perform a binary search to find the end of the eclipse
-    while (step > minStep)
+
+// Return the longest step from state over which the receiver can't cover
+// the given distance to or from a shadow.
+double SatelliteSearch::safeStep(const SearchState& state, double distance) const
+{
+    if (!isfinite(distance))
+        return MaxSearchStep;
+
+    // The distance between a receiver and the shadow axis changes with the
+    // relative motion of the bodies, and with the axis turning to follow
+    // the caster around the sun.
+    Vector3d separation = state.satellitePos - state.planetPos;
+    double turnRate = max(state.planetVel.norm() / state.planetPos.norm(),
+                          state.satelliteVel.norm() / state.satellitePos.norm());
+    double speed = (state.satelliteVel - state.planetVel).norm() + separation.norm() * turnRate;
+    if (speed <= 0.0)
+        return MaxSearchStep;
+
+    return clamp(StepSafetyFactor * distance / speed, MinSearchStep, MaxSearchStep);
+}
+
+
+// Given a time tOut outside of an eclipse and a time tIn during it, find
+// the contact between them with the Illinois variant of the false position
+// method. Like the times of the old fixed step search, the time returned
+// is always one when the receiver is /not/ in eclipse.
+double SatelliteSearch::findContact(size_t type, double tOut, double mOut, double tIn, double mIn) const
+{
+    int lastSide = 0;
+    for (int iteration = 0; abs(tIn - tOut) > ContactPrecision; iteration++)
     {
-        eclipsed = testEclipse(receiver, occulter, t);
-        step *= 0.5;
-        if (eclipsed)
-            t -= step;
+        double t = (tOut * mIn - tIn * mOut) / (mIn - mOut);
+
+        // Fall back to bisection if the margin isn't well behaved
+        if (iteration >= MaxFalsePositionIterations ||
+            !(t > min(tIn, tOut) && t < max(tIn, tOut)))
+        {
+            t = 0.5 * (tIn + tOut);
+        }
+
+        double m = margin(type, t);
+        if (m < 0.0)
+        {
+            tIn = t;
+            mIn = m;
+            if (lastSide < 0)
+                mOut *= 0.5;
+            lastSide = -1;
+        }
         else
-            t += step;
+        {
+            tOut = t;
+            mOut = m;
+            if (lastSide > 0)
+                mIn *= 0.5;
+            lastSide = 1;
+        }
     }
 
-    // Always return a time when the receiver is /not/ in eclipse
-    if (eclipsed)
-        t -= step;
+    return tOut;
+}
+
+
+// Follow an eclipse in progress at state forward (direction 1) or backward
+// (direction -1) in time, returning the time of its end or start.
+double SatelliteSearch::followEclipse(size_t type, const SearchState& state, double direction) const
+{
+    double limit = state.t + direction * MaxEclipseDuration;
+    SearchState current = state;
+    for (;;)
+    {
+        double step = safeStep(current, -current.margins[type]);
+        SearchState next = evaluate(current.t + direction * step, &current);
+        if (next.margins[type] >= 0.0)
+            return findContact(type, next.t, next.margins[type], current.t, current.margins[type]);
 
-    return t;
+        if ((next.t - limit) * direction >= 0.0)
+            return next.t;
+
+        current = next;
+    }
 }
 
-// Given a time during an eclipse, find the end of the eclipse to
-// a precision of minStep.
-double findEclipseEnd(const Body& receiver, const Body& occulter,
-                      double now,
-                      double startStep,
-                      double minStep)
+
+Eclipse SatelliteSearch::makeEclipse(size_t type, double startTime, double endTime) const
 {
-    // First do a coarse search to find the eclipse end to within the precision
-    // of startStep.
-    while (testEclipse(receiver, occulter, now + startStep))
-        now += startStep;
+    Eclipse eclipse;
+    eclipse.startTime = startTime;
+    eclipse.endTime = endTime;
+    if (EclipseTypes[type] == Eclipse::Solar)
+    {
+        eclipse.receiver = const_cast<Body*>(&planet);
+        eclipse.occulter = const_cast<Body*>(&satellite);
+    }
+    else
+    {
+        eclipse.receiver = const_cast<Body*>(&satellite);
+        eclipse.occulter = const_cast<Body*>(&planet);
+    }
+
+    return eclipse;
+}
 
-    double step = startStep / 2;
-    double t = now + step;
-    bool eclipsed = true;
 
+/*! Search for eclipses which start between startDate and endDate. An
+ *  eclipse is reported by the search which first finds it in progress, so
+ *  one already in progress at startDate is left to the search of the
+ *  preceding span, unless this is the first span. The progress function
+ *  is called with each time reached, and returns false to stop the search.
+ */
+void SatelliteSearch::search(double startDate, double endDate, bool first,
+                             vector<Eclipse>& eclipses,
+                             const function<bool(double)>& progress) const
+{
+    SearchState state = evaluate(startDate);
 
-    // Perform a binary search to find the end of the eclipse
-    while (step > minStep)
+    double resumeTime = startDate;
+    for (size_t i = 0; i < EclipseTypes.size(); i++)
     {
-        eclipsed = testEclipse(receiver, occulter, t);
-        step *= 0.5;
-        if (eclipsed)
-            t += step;
-        else
-            t -= step;
+        if (state.margins[i] >= 0.0)
+            continue;
+
+        double endTime = followEclipse(i, state, 1.0);
+        if (first)
+            eclipses.push_back(makeEclipse(i, followEclipse(i, state, -1.0), endTime));
+        resumeTime = max(resumeTime, endTime);
     }
+    if (resumeTime != startDate)
+        state = evaluate(resumeTime);
 
-    // Always return a time when the receiver is /not/ in eclipse
-    if (eclipsed)
-        t += step;
+    while (state.t < endDate)
+    {
+        if (!progress(state.t))
+            return;
 
-    return t;
+        double step = safeStep(state, min(state.margins[0], state.margins[1]));
+        SearchState next = evaluate(min(state.t + step, endDate), &state);
+
+        resumeTime = next.t;
+        for (size_t i = 0; i < EclipseTypes.size(); i++)
+        {
+            // Only an eclipse which starts during the step is new; the
+            // receiver may still be in one which was followed as far as
+            // MaxEclipseDuration.
+            if (next.margins[i] >= 0.0 || state.margins[i] < 0.0)
+                continue;
+
+            double startTime = findContact(i, state.t, state.margins[i], next.t, next.margins[i]);
+            double endTime = followEclipse(i, next, 1.0);
+            eclipses.push_back(makeEclipse(i, startTime, endTime));
+            resumeTime = max(resumeTime, endTime);
+        }
+
+        state = resumeTime == next.t ? next : evaluate(resumeTime);
+    }
+
+    progress(endDate);
 }
-#endif
 
-void addEclipse(const Body& receiver, const Body& occulter,
-                double now,
-                double /*startStep*/, double /*minStep*/,
-                vector<Eclipse>& eclipses,
-                vector<double>& previousEclipseEndTimes, int i)
+
+// Tracks the progress of searches running on several threads. Each search
+// only writes its own slot.
+class SearchProgress
 {
-    if (testEclipse(receiver, occulter, now))
+ public:
+    SearchProgress(size_t nSearches, size_t _nSatellites, double _startDate) :
+        done(make_unique<atomic<double>[]>(nSearches)),
+        nDone(nSearches),
+        nSatellites(static_cast<double>(_nSatellites)),
+        startDate(_startDate)
+    {
+        for (size_t i = 0; i < nDone; i++)
+            done[i].store(0.0, memory_order_relaxed);
+    }
+
+    void update(size_t search, double daysDone)
+    {
+        done[search].store(daysDone, memory_order_relaxed);
+    }
+
+    // The date up to which all the satellites would have been searched if
+    // they had been searched together
+    double currentDate() const
     {
-        Eclipse eclipse;
-#if 1
-        eclipse.startTime = findEclipseSpan(receiver, occulter, now, -dT);
-        eclipse.endTime = findEclipseSpan(receiver, occulter, now, dT);
-#else
-        eclipse.startTime = findEclipseStart(receiver, occulter, now, searchStep, minStep);
-        eclipse.endTime = findEclipseEnd(receiver, occulter, now, searchStep, minStep);
-#endif
-        eclipse.receiver = const_cast<Body*>(&receiver);
-        eclipse.occulter = const_cast<Body*>(&occulter);
-        eclipses.emplace_back(eclipse);
-
-        previousEclipseEndTimes[i] = eclipse.endTime;
+        double days = 0.0;
+        for (size_t i = 0; i < nDone; i++)
+            days += done[i].load(memory_order_relaxed);
+        return startDate + days / nSatellites;
     }
+
+    atomic<bool> aborted{ false };
+
+ private:
+    unique_ptr<atomic<double>[]> done;
+    size_t nDone;
+    double nSatellites;
+    double startDate;
+};
+
+} // end unnamed namespace
+
+
+EclipseFinder::EclipseFinder(Body* _body,
+                             EclipseFinderWatcher* _watcher) :
+    body(_body),
+    watcher(_watcher),
+    threadCount(ThreadPool::defaultThreadCount())
+{
+}
+
+
+void EclipseFinder::setThreadCount(unsigned int _threadCount)
+{
+    threadCount = _threadCount;
 }
 
+
 void EclipseFinder::findEclipses(double startDate,
                                  double endDate,
                                  int eclipseTypeMask,
@@ -213,53 +491,101 @@ void EclipseFinder::findEclipses(double startDate,
     if (satellites == nullptr)
         return;
 
-    // For each body, we'll need to store the time when the last eclipse ended
-    vector<double> previousEclipseEndTimes;
-
     // Make a list of satellites that we'll actually test for eclipses; ignore
     // spacecraft and very small objects.
-    vector<Body*> testBodies;
+    vector<SatelliteSearch> searches;
+    bool threadSafe = isThreadSafe(*body);
     for (int i = 0; i < satellites->getSystemSize(); i++)
     {
         Body* obj = satellites->getBody(i);
         if ((obj->getClassification() & EclipseObjectMask) != 0 &&
             obj->getRadius() >= body->getRadius() * MinRelativeOccluderRadius)
         {
-            testBodies.push_back(obj);
-            previousEclipseEndTimes.push_back(startDate - 1.0);
+            searches.emplace_back(*body, *obj, eclipseTypeMask);
+            threadSafe = threadSafe && isThreadSafe(*obj);
         }
     }
 
-    if (testBodies.empty())
+    if (searches.empty() || !(endDate >= startDate))
         return;
 
-    // TODO: Use a fixed step of one hour for now; we should use a binary
-    // search instead.
-    double searchStep = 1.0 / 24.0; // one hour
+    // Each satellite's span is divided into chunks which are searched
+    // independently. The chunk boundaries are shared between neighbouring
+    // chunks so that an eclipse at a boundary is found exactly once.
+    unsigned int nThreads = threadSafe ? threadCount : 0;
+    if (nThreads <= 1)
+        nThreads = 0;
+    size_t nChunks = 1;
+    if (nThreads > 0)
+    {
+        size_t nTasks = static_cast<size_t>(nThreads) * ChunksPerThread;
+        nChunks = (nTasks + searches.size() - 1) / searches.size();
+        nChunks = clamp(nChunks, size_t(1), static_cast<size_t>(ceil(endDate - startDate)) + 1);
+    }
 
-    // Precision of eclipse duration calculation
-    double durationPrecision = 1.0 / (24.0 * 360.0); // ten seconds
+    vector<double> boundaries(nChunks + 1);
+    for (size_t i = 0; i <= nChunks; i++)
+        boundaries[i] = startDate + (endDate - startDate) * static_cast<double>(i) / static_cast<double>(nChunks);
+    boundaries.back() = endDate;
 
-    for (double t = startDate; t <= endDate; t += searchStep)
+    size_t nTasks = searches.size() * nChunks;
+    vector<vector<Eclipse>> results(nTasks);
+    SearchProgress progress(nTasks, searches.size(), startDate);
+
+    auto runTask = [&](size_t task)
     {
-        if (watcher != nullptr)
+        size_t chunk = task % nChunks;
+        double chunkStart = boundaries[chunk];
+        auto update = [&](double t)
         {
-            if (watcher->eclipseFinderProgressUpdate(t) == EclipseFinderWatcher::AbortOperation)
-                return;
-        }
-
-        for (unsigned int i = 0; i < testBodies.size(); i++)
+            progress.update(task, t - chunkStart);
+            if (nThreads == 0 && watcher != nullptr && !progress.aborted &&
+                watcher->eclipseFinderProgressUpdate(progress.currentDate()) == EclipseFinderWatcher::AbortOperation)
+            {
+                progress.aborted = true;
+            }
+            return !progress.aborted;
+        };
+
+        searches[task / nChunks].search(chunkStart, boundaries[chunk + 1], chunk == 0,
+                                        results[task], update);
+    };
+
+    if (nThreads == 0)
+    {
+        for (size_t task = 0; task < nTasks && !progress.aborted; task++)
+            runTask(task);
+    }
+    else
+    {
+        ThreadPool pool(nThreads);
+        vector<future<void>> futures;
+        futures.reserve(nTasks);
+        for (size_t task = 0; task < nTasks; task++)
+            futures.push_back(pool.submit([&runTask, task]() { runTask(task); }));
+
+        // Report progress from this thread while the searches run; on abort,
+        // the searches stop at their next step.
+        for (auto& f : futures)
         {
-            // Only test for an eclipse if we're not in the middle of
-            // of previous one.
-            if (t <= previousEclipseEndTimes[i])
-                continue;
-
-            if (eclipseTypeMask & Eclipse::Solar)
-                addEclipse(*body, *testBodies[i], t, searchStep, durationPrecision, eclipses, previousEclipseEndTimes, i);
-
-            if (eclipseTypeMask & Eclipse::Lunar)
-                addEclipse(*testBodies[i], *body, t, searchStep, durationPrecision, eclipses, previousEclipseEndTimes, i);
+            while (f.wait_for(ProgressInterval) != future_status::ready)
+            {
+                if (watcher != nullptr && !progress.aborted &&
+                    watcher->eclipseFinderProgressUpdate(progress.currentDate()) == EclipseFinderWatcher::AbortOperation)
+                {
+                    progress.aborted = true;
+                }
+            }
+            f.get();
         }
     }
+
+    // Solar eclipses are listed before lunar ones and satellites in system
+    // order when eclipses start together.
+    vector<Eclipse> found;
+    for (const auto& result : results)
+        found.insert(found.end(), result.begin(), result.end());
+    stable_sort(found.begin(), found.end(),
+                [](const Eclipse& a, const Eclipse& b) { return a.startTime < b.startTime; });
+    eclipses.insert(eclipses.end(), found.begin(), found.end());
 }
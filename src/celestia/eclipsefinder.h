@@ -49,13 +49,24 @@ class EclipseFinder
  public:
     EclipseFinder(Body*, EclipseFinderWatcher* = nullptr);
 
+    // Eclipses are appended to the list in order of start time. The search
+    // is split across threads when the positions of all the bodies involved
+    // may be computed concurrently; the watcher is always called from the
+    // calling thread.
     void findEclipses(double startDate,
                       double endDate,
                       int eclipseTypeMask,
                       std::vector<Eclipse>& eclipses);
+
+    // Set the number of threads used by the search. With zero or one thread
+    // the search runs on the calling thread. The default is one thread per
+    // hardware thread.
+    void setThreadCount(unsigned int);
+
  private:
     Body* body;
     EclipseFinderWatcher* watcher;
+    unsigned int threadCount;
 };
 #endif // _ECLIPSEFINDER_H_
 
@@ -12,11 +12,14 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <future>
 #include <memory>
+#include <vector>
 #include <celengine/glsupport.h>
 #include <celengine/image.h>
 #include <celutil/logger.h>
 #include <celutil/bytes.h>
+#include <celutil/threadpool.h>
 #include "dds_decompress.h"
 
 using namespace celestia;
@@ -86,51 +89,103 @@ constexpr uint32_t FourCC(const char* s)
             (uint32_t) s[0]);
 }
 
-// decompress a DXTc texture to a RGBA texture, taken from https://github.com/ptitSeb/gl4es
-uint32_t* decompressDXTc(uint32_t width, uint32_t height, GLenum format, bool transparent0, ifstream &in)
+// Block rows are decompressed in parallel when there are more than this
+constexpr uint32_t MinBlockRowsPerTask = 64;
+
+uint32_t blockSize(GLenum format)
 {
-    // TODO: check with the size of the input data stream if the stream is in fact decompressed
-    // alloc memory
-    auto *pixels = new uint32_t[((width + 3) & ~3) * ((height + 3) & ~3)];
+    return format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 8 : 16;
+}
 
-    int blocksize = 0;
-#define DDS_MAX_BLOCK_SIZE      16
-    switch (format)
-    {
-    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
-        blocksize = 8;
-        break;
-    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
-    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
-        blocksize = 16;
-        break;
-    }
-    uint8_t block[DDS_MAX_BLOCK_SIZE]; // enough to hold DXT1/3/5 blocks
-    for (uint32_t y = 0; y < height; y += 4)
+uint32_t levelDataSize(GLenum format, uint32_t width, uint32_t height)
+{
+    return ((width + 3) / 4) * ((height + 3) / 4) * blockSize(format);
+}
+
+// Decompress the block rows [firstRow, endRow) of a DXTc texture, taken from
+// https://github.com/ptitSeb/gl4es, to RGB or RGBA pixels; the blocks
+// overhanging the edges of the texture are cropped.
+void decompressBlockRows(GLenum format, const uint8_t* blocks,
+                         uint32_t width, uint32_t height, bool transparent0,
+                         uint8_t* pixels, uint32_t pitch, uint32_t components,
+                         uint32_t firstRow, uint32_t endRow)
+{
+    uint32_t nBlocks = (width + 3) / 4;
+    std::vector<uint32_t> texels(nBlocks * 16);
+    for (uint32_t row = firstRow; row < endRow; row++)
     {
-        for (uint32_t x = 0; x < width; x += 4)
+        const uint8_t* blockRow = blocks + std::size_t(row) * nBlocks * blockSize(format);
+        switch (format)
         {
-            if (!in.good())
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+            DecompressBlockRowDXT1(blockRow, nBlocks, transparent0, texels.data());
+            break;
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+            DecompressBlockRowDXT3(blockRow, nBlocks, transparent0, texels.data());
+            break;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            DecompressBlockRowDXT5(blockRow, nBlocks, transparent0, texels.data());
+            break;
+        }
+
+        for (uint32_t y = row * 4; y < min(row * 4 + 4, height); y++)
+        {
+            const uint32_t* src = texels.data() + (y - row * 4) * nBlocks * 4;
+            uint8_t* dest = pixels + std::size_t(y) * pitch;
+            for (uint32_t x = 0; x < width; x++, dest += components)
             {
-                delete[] pixels;
-                return nullptr;
+                dest[0] = src[x] & 0xff;
+                dest[1] = (src[x] >> 8) & 0xff;
+                dest[2] = (src[x] >> 16) & 0xff;
+                if (components == 4)
+                    dest[3] = src[x] >> 24;
             }
-            in.read((char*)block, blocksize);
-            switch(format)
+        }
+    }
+}
+
+// Decompress each mip level of a DXTc texture from the blocks in data, split
+// by block rows across the image processing threads.
+void decompressDXTc(GLenum format, const uint8_t* data, bool transparent0, Image& img)
+{
+    util::ThreadPool& pool = *GetImageThreadPool();
+    std::vector<std::future<void>> tasks;
+
+    uint32_t components = img.getComponents();
+    for (int mip = 0; mip < img.getMipLevelCount(); mip++)
+    {
+        uint32_t width = max(img.getWidth() >> mip, 1);
+        uint32_t height = max(img.getHeight() >> mip, 1);
+        uint32_t nRows = (height + 3) / 4;
+        uint8_t* pixels = img.getMipLevel(mip);
+        // Rows of every mip level are padded to a multiple of 4 bytes
+        uint32_t levelPitch = (width * components + 3) & ~3u;
+
+        if (pool.threadCount() == 0 || nRows < 2 * MinBlockRowsPerTask)
+        {
+            decompressBlockRows(format, data, width, height, transparent0,
+                                pixels, levelPitch, components, 0, nRows);
+        }
+        else
+        {
+            uint32_t nTasks = pool.threadCount() * 4;
+            uint32_t taskRows = max((nRows + nTasks - 1) / nTasks, MinBlockRowsPerTask);
+            for (uint32_t first = 0; first < nRows; first += taskRows)
             {
-            case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
-                DecompressBlockDXT1(x, y, width, block, transparent0, pixels);
-                break;
-            case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
-                DecompressBlockDXT3(x, y, width, block, transparent0, pixels);
-                break;
-            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
-                DecompressBlockDXT5(x, y, width, block, transparent0, pixels);
-                break;
+                uint32_t end = min(first + taskRows, nRows);
+                tasks.push_back(pool.submit([=]()
+                {
+                    decompressBlockRows(format, data, width, height, transparent0,
+                                        pixels, levelPitch, components, first, end);
+                }));
             }
         }
+
+        data += levelDataSize(format, width, height);
     }
-    return pixels;
+
+    for (auto& task : tasks)
+        task.get();
 }
 
 } // anonymous namespace
@@ -245,50 +300,41 @@ Image* LoadDDSImage(const fs::path& filename)
     {
         if (!gl::EXT_texture_compression_s3tc)
         {
-            // DXTc texture not supported, decompress DXTc to RGB/RGBA
-            uint32_t *pixels = nullptr;
-            bool transparent0 = format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
-            if ((ddsd.width & 3) != 0 || (ddsd.height & 3) != 0)
-            {
-                uint32_t nw = max(ddsd.width, 4u);
-                uint32_t nh = max(ddsd.height, 4u);
-                auto *tmp = decompressDXTc(nw, nh, format, transparent0, in);
-                if (tmp != nullptr)
-                {
-                    pixels = new uint32_t[ddsd.width * ddsd.height];
-                    // crop
-                    for (uint32_t y = 0; y < ddsd.height; y++)
-                        memcpy((char *)pixels + y * ddsd.width * 4, (char *)tmp + y * nw * 4, ddsd.width * 4);
-                    delete[] tmp;
-                }
-            }
-            else
+            // DXTc texture not supported, decompress DXTc to RGB/RGBA. All
+            // the mip levels are read into memory at once; a truncated
+            // file keeps the complete levels.
+            uint32_t levelCount = 1;
+            while (levelCount < ddsd.mipMapLevels && (max(ddsd.width, ddsd.height) >> levelCount) != 0)
+                levelCount++;
+            std::size_t dataSize = 0;
+            for (uint32_t mip = 0; mip < levelCount; mip++)
+                dataSize += levelDataSize(format, max(ddsd.width >> mip, 1u), max(ddsd.height >> mip, 1u));
+
+            std::vector<uint8_t> data(dataSize);
+            in.read(reinterpret_cast<char*>(data.data()), dataSize);
+            auto available = static_cast<std::size_t>(in.gcount());
+
+            int mipLevels = 0;
+            for (std::size_t offset = 0; mipLevels < (int) levelCount; mipLevels++)
             {
-                pixels = decompressDXTc(ddsd.width, ddsd.height, format, transparent0, in);
+                offset += levelDataSize(format, max(ddsd.width >> mipLevels, 1u), max(ddsd.height >> mipLevels, 1u));
+                if (offset > available)
+                    break;
             }
 
-            if (pixels == nullptr)
+            if (mipLevels == 0)
             {
                 GetLogger()->error("Failed to decompress DDS texture file {}.\n", filename);
                 return nullptr;
             }
 
-            if (transparent0)
-            {
-                // Remove the alpha channel for DXT1 since DXT1 textures
-                // are deemed not to contain alpha values in Celestia
-                // https://github.com/CelestiaProject/Celestia/pull/1086
-                char *ptr = reinterpret_cast<char*>(pixels);
-                uint32_t numberOfPixels = ddsd.width * ddsd.height;
-                for (uint32_t index = 0; index < numberOfPixels; ++index)
-                {
-                    memcpy(&ptr[3 * index], &ptr[4 * index], sizeof(char) * 3);
-                }
-            }
-
-            Image *img = new Image(transparent0 ? PixelFormat::RGB : PixelFormat::RGBA, ddsd.width, ddsd.height);
-            memcpy(img->getPixels(), pixels, (transparent0 ? 3 : 4) * ddsd.width * ddsd.height);
-            delete[] pixels;
+            // Remove the alpha channel for DXT1 since DXT1 textures
+            // are deemed not to contain alpha values in Celestia
+            // https://github.com/CelestiaProject/Celestia/pull/1086
+            bool transparent0 = format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+            Image *img = new Image(transparent0 ? PixelFormat::RGB : PixelFormat::RGBA,
+                                   ddsd.width, ddsd.height, mipLevels);
+            decompressDXTc(format, data.data(), transparent0, *img);
             return img;
         }
     }
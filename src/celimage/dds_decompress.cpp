@@ -60,310 +60,297 @@ constexpr uint32_t PackRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
     return r | (g << 8) | (b << 16) | (a << 24);
 }
 
-static void DecompressBlockDXT1Internal(const uint8_t* block,
-                                        uint32_t* output,
-                                        uint32_t outputStride,
-                                        bool transparent0,
-                                        const uint8_t* alphaValues)
+static uint16_t ReadUint16(const uint8_t* p)
 {
-    uint32_t temp, code;
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t ReadUint32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-    uint16_t color0, color1;
-    uint8_t r0, g0, b0, r1, g1, b1;
+/*
+Blocks are decoded in batches of BLOCK_BATCH. The first pass decodes the
+palettes and codes of the blocks of a batch and copies them to each of the
+four texel columns of the block; the second pass then writes each texel row
+of the batch in a loop without branches or table lookups: each texel picks
+its palette entry by comparing its bits of the code with masks, so the
+compiler can vectorize the loop.
+*/
+#define BLOCK_BATCH 16
+#define BATCH_TEXELS (BLOCK_BATCH * 4)
 
-    int i, j;
+struct BlockBatch
+{
+    uint32_t palette[4][BATCH_TEXELS];
+    uint32_t code[BATCH_TEXELS];
+    uint32_t alpha[4][BATCH_TEXELS];
+};
+
+/* The mask of the code of each texel of a row of a block, and the value of
+its code 1 */
+struct RowCodeMasks
+{
+    uint32_t mask[BATCH_TEXELS];
+    uint32_t unit[BATCH_TEXELS];
+};
 
-    color0 = *(const uint16_t*)(block);
-    color1 = *(const uint16_t*)(block + 2);
+static constexpr struct RowCodeMasks MakeRowCodeMasks(int row)
+{
+    struct RowCodeMasks masks = {};
+    for (int i = 0; i < BATCH_TEXELS; ++i)
+    {
+        masks.unit[i] = 1u << (8 * row + 2 * (i % 4));
+        masks.mask[i] = 3u * masks.unit[i];
+    }
+    return masks;
+}
 
-    temp = (color0 >> 11) * 255 + 16;
-    r0 = (uint8_t)((temp / 32 + temp) / 32);
-    temp = ((color0 & 0x07E0) >> 5) * 255 + 32;
-    g0 = (uint8_t)((temp / 64 + temp) / 64);
-    temp = (color0 & 0x001F) * 255 + 16;
-    b0 = (uint8_t)((temp / 32 + temp) / 32);
+static constexpr struct RowCodeMasks CodeMasks[4] =
+{
+    MakeRowCodeMasks(0), MakeRowCodeMasks(1), MakeRowCodeMasks(2), MakeRowCodeMasks(3),
+};
 
-    temp = (color1 >> 11) * 255 + 16;
-    r1 = (uint8_t)((temp / 32 + temp) / 32);
-    temp = ((color1 & 0x07E0) >> 5) * 255 + 32;
-    g1 = (uint8_t)((temp / 64 + temp) / 64);
-    temp = (color1 & 0x001F) * 255 + 16;
-    b1 = (uint8_t)((temp / 32 + temp) / 32);
+static inline uint32_t SelectMask(uint32_t a, uint32_t b)
+{
+    return 0u - (uint32_t)(a == b);
+}
 
-    code = *(const uint32_t*)(block + 4);
+/*
+Expand the 565 endpoint colors of the blocks of a batch to palettes and copy
+them with the codes to each texel column of the blocks. The third and fourth
+entries are interpolated; in three color mode the fourth one is black. This
+is written without branches so that it can be vectorized across the blocks.
+With transparent0, opaque black entries become fully transparent.
+*/
+static void SetBatchColors(struct BlockBatch* batch,
+                           uint32_t count,
+                           const uint32_t* color0,
+                           const uint32_t* color1,
+                           const uint32_t* code,
+                           bool fourColors,
+                           uint32_t alpha,
+                           bool transparent0)
+{
+    uint32_t palette[4][BLOCK_BATCH];
+    uint32_t transparentMask = 0u - (uint32_t)transparent0;
+    uint32_t i;
+    int k;
 
-    if (color0 > color1)
+    for (i = 0; i < count; ++i)
     {
-        for (j = 0; j < 4; ++j)
+        uint32_t temp;
+        uint32_t r0, g0, b0, r1, g1, b1;
+        uint32_t interpolate;
+
+        temp = (color0[i] >> 11) * 255 + 16;
+        r0 = (temp / 32 + temp) / 32;
+        temp = ((color0[i] & 0x07E0) >> 5) * 255 + 32;
+        g0 = (temp / 64 + temp) / 64;
+        temp = (color0[i] & 0x001F) * 255 + 16;
+        b0 = (temp / 32 + temp) / 32;
+
+        temp = (color1[i] >> 11) * 255 + 16;
+        r1 = (temp / 32 + temp) / 32;
+        temp = ((color1[i] & 0x07E0) >> 5) * 255 + 32;
+        g1 = (temp / 64 + temp) / 64;
+        temp = (color1[i] & 0x001F) * 255 + 16;
+        b1 = (temp / 32 + temp) / 32;
+
+        interpolate = 0u - (uint32_t)(fourColors || color0[i] > color1[i]);
+        palette[0][i] = r0 | (g0 << 8) | (b0 << 16);
+        palette[1][i] = r1 | (g1 << 8) | (b1 << 16);
+        palette[2][i] = (((2 * r0 + r1) / 3 | ((2 * g0 + g1) / 3 << 8) | ((2 * b0 + b1) / 3 << 16)) & interpolate) |
+                        (((r0 + r1) / 2 | ((g0 + g1) / 2 << 8) | ((b0 + b1) / 2 << 16)) & ~interpolate);
+        palette[3][i] = ((r0 + 2 * r1) / 3 | ((g0 + 2 * g1) / 3 << 8) | ((b0 + 2 * b1) / 3 << 16)) & interpolate;
+        for (k = 0; k < 4; ++k)
         {
-            for (i = 0; i < 4; ++i)
-            {
-                uint32_t finalColor, positionCode;
-                uint8_t alpha;
-
-                alpha = alphaValues[j * 4 + i];
-
-                finalColor = 0;
-                positionCode = (code >> 2 * (4 * j + i)) & 0x03;
-
-                switch (positionCode)
-                {
-                case 0:
-                    finalColor = PackRGBA(r0, g0, b0, alpha);
-                    break;
-                case 1:
-                    finalColor = PackRGBA(r1, g1, b1, alpha);
-                    break;
-                case 2:
-                    finalColor = PackRGBA((2 * r0 + r1) / 3, (2 * g0 + g1) / 3,
-                                          (2 * b0 + b1) / 3, alpha);
-                    break;
-                case 3:
-                    finalColor = PackRGBA((r0 + 2 * r1) / 3, (g0 + 2 * g1) / 3,
-                                          (b0 + 2 * b1) / 3, alpha);
-                    break;
-                }
-                if (transparent0 && (finalColor == PackRGBA(0, 0, 0, 0xff)))
-                {
-                    alpha = 0;
-                    finalColor = 0;
-                }
-                output[j * outputStride + i] = finalColor;
-            }
+            palette[k][i] |= alpha;
+            palette[k][i] &= ~(transparentMask & SelectMask(palette[k][i], PackRGBA(0, 0, 0, 0xff)));
         }
     }
-    else
+
+    for (k = 0; k < 4; ++k)
     {
-        for (j = 0; j < 4; ++j)
-        {
-            for (i = 0; i < 4; ++i)
-            {
-                uint32_t finalColor, positionCode;
-                uint8_t alpha;
-
-                alpha = alphaValues[j * 4 + i];
-
-                finalColor = 0;
-                positionCode = (code >> 2 * (4 * j + i)) & 0x03;
-
-                switch (positionCode)
-                {
-                case 0:
-                    finalColor = PackRGBA(r0, g0, b0, alpha);
-                    break;
-                case 1:
-                    finalColor = PackRGBA(r1, g1, b1, alpha);
-                    break;
-                case 2:
-                    finalColor = PackRGBA((r0 + r1) / 2, (g0 + g1) / 2, (b0 + b1) / 2, alpha);
-                    break;
-                case 3:
-                    finalColor = PackRGBA(0, 0, 0, alpha);
-                    break;
-                }
-
-                if (transparent0 && (finalColor == PackRGBA(0, 0, 0, 0xff)))
-                {
-                    alpha = 0;
-                    finalColor = 0;
-                }
-
-                output[j * outputStride + i] = finalColor;
-            }
-        }
+        for (i = 0; i < count * 4; ++i)
+            batch->palette[k][i] = palette[k][i / 4];
     }
+    for (i = 0; i < count * 4; ++i)
+        batch->code[i] = code[i / 4];
 }
 
 /*
-void DecompressBlockDXT1(): Decompresses one block of a DXT1 texture and stores the resulting pixels at the appropriate offset in 'image'.
-
-uint32_t x:                     x-coordinate of the first pixel in the block.
-uint32_t y:                     y-coordinate of the first pixel in the block.
-uint32_t width:                 width of the texture being decompressed.
-const uint8_t *blockStorage:    pointer to the block to decompress.
-uint32_t *image:                pointer to image where the decompressed pixel data should be stored.
+Write the texels of the first count blocks of a batch to four output rows.
+With transparent0, opaque black texels become fully transparent.
 */
-void DecompressBlockDXT1(uint32_t x,
-                         uint32_t y,
-                         uint32_t width,
-                         const uint8_t* blockStorage,
-                         bool transparent0,
-                         uint32_t* image)
+static inline void WriteBlockBatch(const struct BlockBatch* batch,
+                                   uint32_t count,
+                                   bool hasAlpha,
+                                   bool transparent0,
+                                   uint32_t* output,
+                                   uint32_t outputStride)
 {
-    static const uint8_t const_alpha[] = { 255, 255, 255, 255, 255, 255,
-                                           255, 255, 255, 255, 255, 255,
-                                           255, 255, 255, 255 };
+    uint32_t transparentMask = 0u - (uint32_t)transparent0;
+    uint32_t nTexels = count * 4;
+    uint32_t i;
+    int j;
 
-    DecompressBlockDXT1Internal(blockStorage, image + x + (y * width), width,
-                                transparent0, const_alpha);
+    for (j = 0; j < 4; ++j)
+    {
+        const uint32_t* mask = CodeMasks[j].mask;
+        const uint32_t* unit = CodeMasks[j].unit;
+        const uint32_t* alpha = batch->alpha[j];
+        uint32_t* row = output + j * outputStride;
+        for (i = 0; i < nTexels; ++i)
+        {
+            uint32_t bits = batch->code[i] & mask[i];
+            uint32_t color = (batch->palette[0][i] & SelectMask(bits, 0)) |
+                             (batch->palette[1][i] & SelectMask(bits, unit[i])) |
+                             (batch->palette[2][i] & SelectMask(bits, 2 * unit[i])) |
+                             (batch->palette[3][i] & SelectMask(bits, 3 * unit[i]));
+            if (hasAlpha)
+                color |= alpha[i];
+            row[i] = color & ~(transparentMask & SelectMask(color, PackRGBA(0, 0, 0, 0xff)));
+        }
+    }
 }
 
-/*
-void DecompressBlockDXT5(): Decompresses one block of a DXT5 texture and stores the resulting pixels at the appropriate offset in 'image'.
-
-uint32_t x:                     x-coordinate of the first pixel in the block.
-uint32_t y:                     y-coordinate of the first pixel in the block.
-uint32_t width:                 width of the texture being decompressed.
-const uint8_t *blockStorage:    pointer to the block to decompress.
-uint32_t *image:                pointer to image where the decompressed pixel data should be stored.
-*/
-void DecompressBlockDXT5(uint32_t x,
-                         uint32_t y,
-                         uint32_t width,
-                         const uint8_t* blockStorage,
-                         bool transparent0,
-                         uint32_t* image)
+static void DecodeAlphaDXT3(const uint8_t* block, struct BlockBatch* batch, uint32_t index)
 {
-    uint8_t alpha0, alpha1;
-    const uint8_t* bits;
-    uint32_t alphaCode1;
-    uint16_t alphaCode2;
+    int i;
 
-    uint16_t color0, color1;
-    uint8_t r0, g0, b0, r1, g1, b1;
+    for (i = 0; i < 8; ++i)
+    {
+        batch->alpha[i / 2][index * 4 + (i % 2) * 2 + 0] = (uint32_t)((block[i] & 0xF) * 17) << 24;
+        batch->alpha[i / 2][index * 4 + (i % 2) * 2 + 1] = (uint32_t)((block[i] >> 4) * 17) << 24;
+    }
+}
 
-    int i, j;
+/*
+The alpha of DXT5 blocks is a lookup by three bit codes in a palette of
+eight values interpolated between two endpoints.
+*/
+static void DecodeAlphaDXT5(const uint8_t* block, struct BlockBatch* batch, uint32_t index)
+{
+    uint32_t alphaPalette[8];
+    uint64_t alphaCode;
+    uint32_t alpha0, alpha1;
+    int i;
 
-    uint32_t temp, code;
+    alpha0 = block[0];
+    alpha1 = block[1];
+    alphaPalette[0] = alpha0;
+    alphaPalette[1] = alpha1;
+    if (alpha0 > alpha1)
+    {
+        for (i = 2; i < 8; ++i)
+            alphaPalette[i] = ((8 - i) * alpha0 + (i - 1) * alpha1) / 7;
+    }
+    else
+    {
+        for (i = 2; i < 6; ++i)
+            alphaPalette[i] = ((6 - i) * alpha0 + (i - 1) * alpha1) / 5;
+        alphaPalette[6] = 0;
+        alphaPalette[7] = 255;
+    }
 
-    alpha0 = *(blockStorage);
-    alpha1 = *(blockStorage + 1);
+    alphaCode = (uint64_t)ReadUint16(block + 2) | ((uint64_t)ReadUint32(block + 4) << 16);
+    for (i = 0; i < 16; ++i)
+        batch->alpha[i / 4][index * 4 + i % 4] = alphaPalette[(alphaCode >> (3 * i)) & 0x07] << 24;
+}
 
-    bits = blockStorage + 2;
-    alphaCode1 = bits[2] | (bits[3] << 8) | (bits[4] << 16) | (bits[5] << 24);
-    alphaCode2 = bits[0] | (bits[1] << 8);
+/*
+void DecompressBlockRowDXT1(): Decompresses a row of blocks of a DXT1 texture.
 
-    color0 = *(const uint16_t*)(blockStorage + 8);
-    color1 = *(const uint16_t*)(blockStorage + 10);
+const uint8_t *blocks:          pointer to the first block of the row.
+uint32_t nBlocks:               number of blocks in the row.
+bool transparent0:              whether opaque black texels are made transparent.
+uint32_t *output:               pointer to four rows of 4 * nBlocks texels where
+                                the decompressed texels are stored.
+*/
+void DecompressBlockRowDXT1(const uint8_t* blocks,
+                            uint32_t nBlocks,
+                            bool transparent0,
+                            uint32_t* output)
+{
+    struct BlockBatch batch;
+    uint32_t color0[BLOCK_BATCH], color1[BLOCK_BATCH], code[BLOCK_BATCH];
+    uint32_t first, count, i;
 
-    temp = (color0 >> 11) * 255 + 16;
-    r0 = (uint8_t)((temp / 32 + temp) / 32);
-    temp = ((color0 & 0x07E0) >> 5) * 255 + 32;
-    g0 = (uint8_t)((temp / 64 + temp) / 64);
-    temp = (color0 & 0x001F) * 255 + 16;
-    b0 = (uint8_t)((temp / 32 + temp) / 32);
+    for (first = 0; first < nBlocks; first += count)
+    {
+        count = nBlocks - first < BLOCK_BATCH ? nBlocks - first : BLOCK_BATCH;
+        for (i = 0; i < count; ++i)
+        {
+            const uint8_t* block = blocks + (first + i) * 8;
+            color0[i] = ReadUint16(block);
+            color1[i] = ReadUint16(block + 2);
+            code[i] = ReadUint32(block + 4);
+        }
 
-    temp = (color1 >> 11) * 255 + 16;
-    r1 = (uint8_t)((temp / 32 + temp) / 32);
-    temp = ((color1 & 0x07E0) >> 5) * 255 + 32;
-    g1 = (uint8_t)((temp / 64 + temp) / 64);
-    temp = (color1 & 0x001F) * 255 + 16;
-    b1 = (uint8_t)((temp / 32 + temp) / 32);
+        SetBatchColors(&batch, count, color0, color1, code, false, PackRGBA(0, 0, 0, 0xff), transparent0);
+        WriteBlockBatch(&batch, count, false, false, output + first * 4, nBlocks * 4);
+    }
+}
 
-    code = *(const uint32_t*)(blockStorage + 12);
+/*
+void DecompressBlockRowDXT3(): Decompresses a row of blocks of a DXT3 texture,
+see DecompressBlockRowDXT1().
+*/
+void DecompressBlockRowDXT3(const uint8_t* blocks,
+                            uint32_t nBlocks,
+                            bool transparent0,
+                            uint32_t* output)
+{
+    struct BlockBatch batch;
+    uint32_t color0[BLOCK_BATCH], color1[BLOCK_BATCH], code[BLOCK_BATCH];
+    uint32_t first, count, i;
 
-    for (j = 0; j < 4; j++)
+    for (first = 0; first < nBlocks; first += count)
     {
-        for (i = 0; i < 4; i++)
+        count = nBlocks - first < BLOCK_BATCH ? nBlocks - first : BLOCK_BATCH;
+        for (i = 0; i < count; ++i)
         {
-            uint8_t finalAlpha;
-            int alphaCode, alphaCodeIndex;
-            uint8_t colorCode;
-            uint32_t finalColor;
-
-            alphaCodeIndex = 3 * (4 * j + i);
-            if (alphaCodeIndex <= 12)
-            {
-                alphaCode = (alphaCode2 >> alphaCodeIndex) & 0x07;
-            }
-            else if (alphaCodeIndex == 15)
-            {
-                alphaCode = (alphaCode2 >> 15) | ((alphaCode1 << 1) & 0x06);
-            }
-            else /* alphaCodeIndex >= 18 && alphaCodeIndex <= 45 */
-            {
-                alphaCode = (alphaCode1 >> (alphaCodeIndex - 16)) & 0x07;
-            }
-
-            if (alphaCode == 0)
-            {
-                finalAlpha = alpha0;
-            }
-            else if (alphaCode == 1)
-            {
-                finalAlpha = alpha1;
-            }
-            else
-            {
-                if (alpha0 > alpha1)
-                {
-                    finalAlpha = (uint8_t)(((8 - alphaCode) * alpha0 + (alphaCode - 1) * alpha1) / 7);
-                }
-                else
-                {
-                    if (alphaCode == 6)
-                    {
-                        finalAlpha = 0;
-                    }
-                    else if (alphaCode == 7)
-                    {
-                        finalAlpha = 255;
-                    }
-                    else
-                    {
-                        finalAlpha = (uint8_t)(((6 - alphaCode) * alpha0 + (alphaCode - 1) * alpha1) / 5);
-                    }
-                }
-            }
-
-            colorCode = (code >> 2 * (4 * j + i)) & 0x03;
-            finalColor = 0;
-
-            switch (colorCode)
-            {
-            case 0:
-                finalColor = PackRGBA(r0, g0, b0, finalAlpha);
-                break;
-            case 1:
-                finalColor = PackRGBA(r1, g1, b1, finalAlpha);
-                break;
-            case 2:
-                finalColor = PackRGBA((2 * r0 + r1) / 3, (2 * g0 + g1) / 3,
-                                      (2 * b0 + b1) / 3, finalAlpha);
-                break;
-            case 3:
-                finalColor = PackRGBA((r0 + 2 * r1) / 3, (g0 + 2 * g1) / 3,
-                                      (b0 + 2 * b1) / 3, finalAlpha);
-                break;
-            }
-
-            image[i + x + (width * (y + j))] = finalColor;
+            const uint8_t* block = blocks + (first + i) * 16;
+            DecodeAlphaDXT3(block, &batch, i);
+            color0[i] = ReadUint16(block + 8);
+            color1[i] = ReadUint16(block + 10);
+            code[i] = ReadUint32(block + 12);
         }
+
+        SetBatchColors(&batch, count, color0, color1, code, false, 0, false);
+        WriteBlockBatch(&batch, count, true, transparent0, output + first * 4, nBlocks * 4);
     }
 }
 
 /*
-void DecompressBlockDXT3(): Decompresses one block of a DXT3 texture and stores the resulting pixels at the appropriate offset in 'image'.
-
-uint32_t x:                     x-coordinate of the first pixel in the block.
-uint32_t y:                     y-coordinate of the first pixel in the block.
-uint32_t height:                height of the texture being decompressed.
-const uint8_t *blockStorage:    pointer to the block to decompress.
-uint32_t *image:                pointer to image where the decompressed pixel data should be stored.
+void DecompressBlockRowDXT5(): Decompresses a row of blocks of a DXT5 texture,
+see DecompressBlockRowDXT1(). Like the original decompressor, this always
+decodes the colors in four color mode and ignores transparent0.
 */
-void DecompressBlockDXT3(uint32_t x,
-                         uint32_t y,
-                         uint32_t width,
-                         const uint8_t* blockStorage,
-                         bool transparent0,
-                         uint32_t* image)
+void DecompressBlockRowDXT5(const uint8_t* blocks,
+                            uint32_t nBlocks,
+                            bool /* transparent0 */,
+                            uint32_t* output)
 {
-    int i;
+    struct BlockBatch batch;
+    uint32_t color0[BLOCK_BATCH], color1[BLOCK_BATCH], code[BLOCK_BATCH];
+    uint32_t first, count, i;
 
-    uint8_t alphaValues[16] = { 0 };
-
-    for (i = 0; i < 4; ++i)
+    for (first = 0; first < nBlocks; first += count)
     {
-        const uint16_t* alphaData = (const uint16_t*)(blockStorage);
-
-        alphaValues[i * 4 + 0] = (((*alphaData) >> 0) & 0xF) * 17;
-        alphaValues[i * 4 + 1] = (((*alphaData) >> 4) & 0xF) * 17;
-        alphaValues[i * 4 + 2] = (((*alphaData) >> 8) & 0xF) * 17;
-        alphaValues[i * 4 + 3] = (((*alphaData) >> 12) & 0xF) * 17;
+        count = nBlocks - first < BLOCK_BATCH ? nBlocks - first : BLOCK_BATCH;
+        for (i = 0; i < count; ++i)
+        {
+            const uint8_t* block = blocks + (first + i) * 16;
+            DecodeAlphaDXT5(block, &batch, i);
+            color0[i] = ReadUint16(block + 8);
+            color1[i] = ReadUint16(block + 10);
+            code[i] = ReadUint32(block + 12);
+        }
 
-        blockStorage += 2;
+        SetBatchColors(&batch, count, color0, color1, code, true, 0, false);
+        WriteBlockBatch(&batch, count, true, false, output + first * 4, nBlocks * 4);
     }
-
-    DecompressBlockDXT1Internal(blockStorage, image + x + (y * width), width,
-                                transparent0, alphaValues);
 }
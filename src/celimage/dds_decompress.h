@@ -1,16 +1,20 @@
 #pragma once
 
-void DecompressBlockDXT1(uint32_t x, uint32_t y, uint32_t width,
-    const uint8_t* blockStorage,
+#include <stdint.h>
+
+// Decompress a row of 4x4 texel blocks into four rows of 4 * nBlocks RGBA
+// texels, packed with red in the lowest byte.
+void DecompressBlockRowDXT1(const uint8_t* blocks,
+    uint32_t nBlocks,
     bool transparent0,
-    uint32_t* image);
+    uint32_t* output);
 
-void DecompressBlockDXT3(uint32_t x, uint32_t y, uint32_t width,
-    const uint8_t* blockStorage,
+void DecompressBlockRowDXT3(const uint8_t* blocks,
+    uint32_t nBlocks,
     bool transparent0,
-    uint32_t* image);
+    uint32_t* output);
 
-void DecompressBlockDXT5(uint32_t x, uint32_t y, uint32_t width,
-    const uint8_t* blockStorage,
+void DecompressBlockRowDXT5(const uint8_t* blocks,
+    uint32_t nBlocks,
     bool transparent0,
-    uint32_t* image);
+    uint32_t* output);
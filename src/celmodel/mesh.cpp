@@ -10,8 +10,10 @@
 
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstring>
 #include <iterator>
+#include <limits>
 #include <tuple>
 #include <utility>
 #include <celutil/logger.h>
@@ -29,6 +31,16 @@ namespace cmod
 namespace
 {
 
+// Meshes with fewer triangles than this are picked by testing each of
+// them, which is faster than building a hierarchy.
+constexpr std::uint32_t MinPickTreeTriangles = 256;
+constexpr std::uint32_t MaxLeafTriangles = 4;
+constexpr unsigned int PickTreeBins = 16;
+
+// Beyond this depth nodes are split at the median, which bounds the depth
+// of the hierarchy whatever the distribution of the triangles.
+constexpr unsigned int MaxSAHDepth = 48;
+
 bool
 isOpaqueMaterial(const Material &material)
 {
@@ -36,9 +48,358 @@ isOpaqueMaterial(const Material &material)
              material.blend != BlendMode::AdditiveBlend;
 }
 
+
+bool
+isPickableGroup(const PrimitiveGroup& group)
+{
+    auto nIndices = group.indices.size();
+    return (group.prim == PrimitiveGroupType::TriList
+            || group.prim == PrimitiveGroupType::TriStrip
+            || group.prim == PrimitiveGroupType::TriFan) &&
+           nIndices >= 3 &&
+           !(group.prim == PrimitiveGroupType::TriList && nIndices % 3 != 0);
+}
+
+
+// Call f(i0, i1, i2, primitiveIndex) for each of the triangles of a group
+// tested by pick.
+template<typename F>
+void
+forEachPickTriangle(const PrimitiveGroup& group, F&& f)
+{
+    PrimitiveGroupType primType = group.prim;
+    Index32 nIndices = group.indices.size();
+
+    unsigned int primitiveIndex = 0;
+    Index32 index = 0;
+    Index32 i0 = group.indices[0];
+    Index32 i1 = group.indices[1];
+    Index32 i2 = group.indices[2];
+
+    // Iterate over the triangles in the primitive group
+    do
+    {
+        f(i0, i1, i2, primitiveIndex);
+
+        // Get the indices for the next triangle
+        if (primType == PrimitiveGroupType::TriList)
+        {
+            index += 3;
+            if (index < nIndices)
+            {
+                i0 = group.indices[index + 0];
+                i1 = group.indices[index + 1];
+                i2 = group.indices[index + 2];
+            }
+        }
+        else if (primType == PrimitiveGroupType::TriStrip)
+        {
+            index += 1;
+            if (index < nIndices)
+            {
+                i0 = i1;
+                i1 = i2;
+                i2 = group.indices[index];
+                // TODO: alternate orientation of triangles in a strip
+            }
+        }
+        else // primType == TriFan
+        {
+            index += 1;
+            if (index < nIndices)
+            {
+                index += 1;
+                i1 = i2;
+                i2 = group.indices[index];
+            }
+        }
+
+        primitiveIndex++;
+
+    } while (index < nIndices);
+}
+
+
+Eigen::Vector3f
+getVertexPosition(const VWord* vdata, unsigned int stride, Index32 index)
+{
+    float fv[3];
+    std::memcpy(fv, vdata + index * stride, sizeof(float) * 3);
+    return Eigen::Map<Eigen::Vector3f>(fv);
+}
+
+
+/*! Intersect a ray with a triangle. Returns true and sets t to the distance
+ *  along the ray if the ray hits the triangle at 0 < t <= maxDistance.
+ */
+bool
+intersectTriangle(const Eigen::Vector3d& v0,
+                  const Eigen::Vector3d& v1,
+                  const Eigen::Vector3d& v2,
+                  const Eigen::Vector3d& rayOrigin,
+                  const Eigen::Vector3d& rayDirection,
+                  double maxDistance,
+                  double& t)
+{
+    // Compute the edge vectors e0 and e1, and the normal n
+    Eigen::Vector3d e0 = v1 - v0;
+    Eigen::Vector3d e1 = v2 - v0;
+    Eigen::Vector3d n = e0.cross(e1);
+
+    // c is the cosine of the angle between the ray and triangle normal
+    double c = n.dot(rayDirection);
+
+    // If the ray is parallel to the triangle, it either misses the
+    // triangle completely, or is contained in the triangle's plane.
+    // If it's contained in the plane, we'll still call it a miss.
+    if (c == 0.0)
+        return false;
+
+    t = (n.dot(v0 - rayOrigin)) / c;
+    if (!(t <= maxDistance && t > 0.0))
+        return false;
+
+    double m00 = e0.dot(e0);
+    double m01 = e0.dot(e1);
+    double m10 = e1.dot(e0);
+    double m11 = e1.dot(e1);
+    double det = m00 * m11 - m01 * m10;
+    if (det == 0.0)
+        return false;
+
+    Eigen::Vector3d p = rayOrigin + rayDirection * t;
+    Eigen::Vector3d q = p - v0;
+    double q0 = e0.dot(q);
+    double q1 = e1.dot(q);
+    double d = 1.0 / det;
+    double s0 = (m11 * q0 - m01 * q1) * d;
+    double s1 = (m00 * q1 - m10 * q0) * d;
+    return s0 >= 0.0 && s1 >= 0.0 && s0 + s1 <= 1.0;
+}
+
+
+/*! Intersect a ray with a box, returning whether the ray enters it at a
+ *  distance of at most maxDistance, and setting entry to that distance.
+ */
+bool
+intersectBox(const Eigen::AlignedBox3f& box,
+             const Eigen::Vector3d& rayOrigin,
+             const Eigen::Vector3d& invDirection,
+             double maxDistance,
+             double& entry)
+{
+    double tMin = 0.0;
+    double tMax = maxDistance;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        double lo = box.min()[axis];
+        double hi = box.max()[axis];
+        if (std::isinf(invDirection[axis]))
+        {
+            // The ray is parallel to the slab
+            if (rayOrigin[axis] < lo || rayOrigin[axis] > hi)
+                return false;
+            continue;
+        }
+
+        double t0 = (lo - rayOrigin[axis]) * invDirection[axis];
+        double t1 = (hi - rayOrigin[axis]) * invDirection[axis];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tMin = std::max(tMin, t0);
+        tMax = std::min(tMax, t1);
+        if (tMin > tMax)
+            return false;
+    }
+
+    entry = tMin;
+    return true;
+}
+
+// Nodes of a pick tree are stored depth first: the first child of an
+// inner node follows it, and first is the index of its second child. The
+// triangles of a leaf are triangles[first, first + count).
+struct PickTreeNode
+{
+    Eigen::AlignedBox3f bounds;
+    std::uint32_t first;
+    std::uint32_t count;
+};
+
+struct PickTreeTriangle
+{
+    std::array<Index32, 3> vertices;
+    std::uint32_t group;
+    std::uint32_t primitive;
+};
+
+
+class PickTreeBuilder
+{
+ public:
+    PickTreeBuilder(std::vector<PickTreeNode>& _nodes,
+                    std::vector<PickTreeTriangle>& _triangles,
+                    std::vector<Eigen::AlignedBox3f>&& _bounds) :
+        nodes(_nodes),
+        triangles(_triangles),
+        bounds(std::move(_bounds)),
+        order(bounds.size())
+    {
+        for (std::uint32_t i = 0; i < order.size(); i++)
+            order[i] = i;
+    }
+
+    void build()
+    {
+        buildNode(0, static_cast<std::uint32_t>(order.size()), 0);
+
+        std::vector<PickTreeTriangle> sorted;
+        sorted.reserve(order.size());
+        for (std::uint32_t i : order)
+            sorted.push_back(triangles[i]);
+        triangles = std::move(sorted);
+    }
+
+ private:
+    void buildNode(std::uint32_t first, std::uint32_t count, unsigned int depth);
+    std::uint32_t findSplit(std::uint32_t first, std::uint32_t count, const Eigen::AlignedBox3f& centroids);
+
+    Eigen::Vector3f centroid(std::uint32_t i) const { return bounds[i].center(); }
+
+    static float area(const Eigen::AlignedBox3f& box)
+    {
+        if (box.isEmpty())
+            return 0.0f;
+        Eigen::Vector3f d = box.sizes();
+        return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+    }
+
+    std::vector<PickTreeNode>& nodes;
+    std::vector<PickTreeTriangle>& triangles;
+    std::vector<Eigen::AlignedBox3f> bounds;
+    std::vector<std::uint32_t> order;
+};
+
+
+void
+PickTreeBuilder::buildNode(std::uint32_t first, std::uint32_t count, unsigned int depth)
+{
+    auto nodeIndex = static_cast<std::uint32_t>(nodes.size());
+
+    Eigen::AlignedBox3f nodeBounds;
+    Eigen::AlignedBox3f centroids;
+    for (std::uint32_t i = first; i < first + count; i++)
+    {
+        nodeBounds.extend(bounds[order[i]]);
+        centroids.extend(centroid(order[i]));
+    }
+
+    // Widen the box a little, so that rays grazing a triangle at its edge
+    // aren't rejected by rounding in the box test.
+    float pad = nodeBounds.min().cwiseAbs().cwiseMax(nodeBounds.max().cwiseAbs()).maxCoeff() * 1.0e-6f;
+    nodeBounds.min().array() -= pad;
+    nodeBounds.max().array() += pad;
+    nodes.push_back({ nodeBounds, first, count });
+
+    if (count <= MaxLeafTriangles)
+        return;
+
+    // Triangles with (nearly) coincident centroids can't be binned
+    float extent = centroids.sizes().maxCoeff();
+    std::uint32_t half;
+    if (depth < MaxSAHDepth && extent > 0.0f && std::isfinite(static_cast<float>(PickTreeBins) / extent))
+    {
+        half = findSplit(first, count, centroids);
+    }
+    else
+    {
+        half = count / 2;
+        int axis;
+        centroids.sizes().maxCoeff(&axis);
+        auto begin = order.begin() + first;
+        std::nth_element(begin, begin + half, begin + count,
+                         [this, axis](std::uint32_t a, std::uint32_t b) { return centroid(a)[axis] < centroid(b)[axis]; });
+    }
+
+    buildNode(first, half, depth + 1);
+    nodes[nodeIndex].first = static_cast<std::uint32_t>(nodes.size());
+    nodes[nodeIndex].count = 0;
+    buildNode(first + half, count - half, depth + 1);
+}
+
+
+/*! Sort the triangles of a node into bins along the longest axis of their
+ *  centroids, and split them at the bin boundary with the lowest surface
+ *  area heuristic cost. Returns the number of triangles before the split.
+ */
+std::uint32_t
+PickTreeBuilder::findSplit(std::uint32_t first, std::uint32_t count, const Eigen::AlignedBox3f& centroids)
+{
+    int axis;
+    centroids.sizes().maxCoeff(&axis);
+    float lo = centroids.min()[axis];
+    float scale = static_cast<float>(PickTreeBins) / (centroids.max()[axis] - lo);
+    auto binIndex = [&](std::uint32_t i)
+    {
+        auto bin = static_cast<unsigned int>((centroid(i)[axis] - lo) * scale);
+        return std::min(bin, PickTreeBins - 1);
+    };
+
+    std::array<Eigen::AlignedBox3f, PickTreeBins> binBounds;
+    std::array<std::uint32_t, PickTreeBins> binCounts{};
+    for (std::uint32_t i = first; i < first + count; i++)
+    {
+        unsigned int bin = binIndex(order[i]);
+        binBounds[bin].extend(bounds[order[i]]);
+        binCounts[bin]++;
+    }
+
+    // Cost of the triangles after each boundary, swept from the right
+    std::array<float, PickTreeBins> rightCost{};
+    Eigen::AlignedBox3f right;
+    std::uint32_t rightCount = 0;
+    for (unsigned int bin = PickTreeBins - 1; bin > 0; bin--)
+    {
+        right.extend(binBounds[bin]);
+        rightCount += binCounts[bin];
+        rightCost[bin] = area(right) * static_cast<float>(rightCount);
+    }
+
+    // The first and last bins hold triangles, so both sides of every
+    // boundary are non-empty.
+    unsigned int bestBin = 1;
+    float bestCost = std::numeric_limits<float>::max();
+    Eigen::AlignedBox3f left;
+    std::uint32_t leftCount = 0;
+    for (unsigned int bin = 1; bin < PickTreeBins; bin++)
+    {
+        left.extend(binBounds[bin - 1]);
+        leftCount += binCounts[bin - 1];
+        float cost = area(left) * static_cast<float>(leftCount) + rightCost[bin];
+        if (cost < bestCost)
+        {
+            bestCost = cost;
+            bestBin = bin;
+        }
+    }
+
+    auto middle = std::partition(order.begin() + first, order.begin() + first + count,
+                                 [&](std::uint32_t i) { return binIndex(i) < bestBin; });
+    return static_cast<std::uint32_t>(middle - (order.begin() + first));
+}
+
 } // end unnamed namespace
 
 
+// Bounding volume hierarchy of the triangles of a mesh
+struct Mesh::PickTree
+{
+    // No nodes for meshes picked without a hierarchy
+    std::vector<PickTreeNode> nodes;
+    std::vector<PickTreeTriangle> triangles;
+};
+
+
 bool operator==(const VertexAttribute& a, const VertexAttribute& b)
 {
     return std::tie(a.semantic, a.format, a.offsetWords) == std::tie(b.semantic, b.format, b.offsetWords);
@@ -172,6 +533,7 @@ Mesh::setVertices(unsigned int _nVertices, std::vector<VWord>&& vertexData)
 {
     nVertices = _nVertices;
     vertices = std::move(vertexData);
+    pickTree.reset();
 }
 
 
@@ -182,6 +544,7 @@ Mesh::setVertexDescription(VertexDescription&& desc)
         return false;
 
     vertexDesc = std::move(desc);
+    pickTree.reset();
     return true;
 }
 
@@ -208,6 +571,8 @@ Mesh::getGroup(unsigned int index)
     if (index >= groups.size())
         return nullptr;
 
+    // The group may be changed through the pointer
+    pickTree.reset();
     return &groups[index];
 }
 
@@ -216,6 +581,7 @@ unsigned int
 Mesh::addGroup(PrimitiveGroup&& group)
 {
     groups.push_back(std::move(group));
+    pickTree.reset();
     return groups.size();
 }
 
@@ -245,6 +611,7 @@ void
 Mesh::clearGroups()
 {
     groups.clear();
+    pickTree.reset();
 }
 
 
@@ -272,6 +639,8 @@ Mesh::remapIndices(const std::vector<Index32>& indexMap)
             index = indexMap[index];
         }
     }
+
+    pickTree.reset();
 }
 
 
@@ -348,6 +717,7 @@ Mesh::mergePrimitiveGroups()
     }
     GetLogger()->info("Optimized mesh groups: had {} groups, now: {} of them.\n", groups.size(), newGroups.size());
     groups = std::move(newGroups);
+    pickTree.reset();
 }
 
 void
@@ -362,6 +732,7 @@ Mesh::optimize()
     meshopt_optimizeVertexCache(g.indices.data(), g.indices.data(), g.indices.size(), nVertices);
     meshopt_optimizeOverdraw(g.indices.data(), g.indices.data(), g.indices.size(), reinterpret_cast<float*>(vertices.data()), nVertices, vertexDesc.strideBytes, 1.05f);
     meshopt_optimizeVertexFetch(vertices.data(), g.indices.data(), g.indices.size(), vertices.data(), nVertices, vertexDesc.strideBytes);
+    pickTree.reset();
 #endif
 }
 
@@ -380,125 +751,111 @@ Mesh::pick(const Eigen::Vector3d& rayOrigin, const Eigen::Vector3d& rayDirection
     }
 
     unsigned int stride = vertexDesc.strideBytes / sizeof(VWord);
-    unsigned int posOffset = vertexDesc.getAttribute(VertexAttributeSemantic::Position).offsetWords;
-    const VWord* vdata = vertices.data();
+    const VWord* vdata = vertices.data() + vertexDesc.getAttribute(VertexAttributeSemantic::Position).offsetWords;
 
-    // Iterate over all primitive groups in the mesh
-    for (const auto& group : groups)
+    std::shared_ptr<const PickTree> tree = getPickTree();
+    if (tree->nodes.empty())
     {
-        PrimitiveGroupType primType = group.prim;
-        Index32 nIndices = group.indices.size();
-
-        // Only attempt to compute the intersection of the ray with triangle
-        // groups.
-        if ((primType == PrimitiveGroupType::TriList
-             || primType == PrimitiveGroupType::TriStrip
-             || primType == PrimitiveGroupType::TriFan) &&
-            (nIndices >= 3) &&
-            !(primType == PrimitiveGroupType::TriList && nIndices % 3 != 0))
+        // Iterate over all primitive groups in the mesh
+        for (const auto& group : groups)
         {
-            unsigned int primitiveIndex = 0;
-            Index32 index = 0;
-            Index32 i0 = group.indices[0];
-            Index32 i1 = group.indices[1];
-            Index32 i2 = group.indices[2];
-
-            // Iterate over the triangles in the primitive group
-            do
+            // Only attempt to compute the intersection of the ray with
+            // triangle groups.
+            if (!isPickableGroup(group))
+                continue;
+
+            forEachPickTriangle(group, [&](Index32 i0, Index32 i1, Index32 i2, unsigned int primitiveIndex)
             {
-                // Get the triangle vertices v0, v1, and v2
-                float fv[3];
-                std::memcpy(fv, vdata + i0 * stride + posOffset, sizeof(float) * 3);
-                Eigen::Vector3d v0 = Eigen::Map<Eigen::Vector3f>(fv).cast<double>();
-                std::memcpy(fv, vdata + i1 * stride + posOffset, sizeof(float) * 3);
-                Eigen::Vector3d v1 = Eigen::Map<Eigen::Vector3f>(fv).cast<double>();
-                std::memcpy(fv, vdata + i2 * stride + posOffset, sizeof(float) * 3);
-                Eigen::Vector3d v2 = Eigen::Map<Eigen::Vector3f>(fv).cast<double>();
-
-                // Compute the edge vectors e0 and e1, and the normal n
-                Eigen::Vector3d e0 = v1 - v0;
-                Eigen::Vector3d e1 = v2 - v0;
-                Eigen::Vector3d n = e0.cross(e1);
-
-                // c is the cosine of the angle between the ray and triangle normal
-                double c = n.dot(rayDirection);
-
-                // If the ray is parallel to the triangle, it either misses the
-                // triangle completely, or is contained in the triangle's plane.
-                // If it's contained in the plane, we'll still call it a miss.
-                if (c != 0.0)
+                double t;
+                if (intersectTriangle(getVertexPosition(vdata, stride, i0).cast<double>(),
+                                      getVertexPosition(vdata, stride, i1).cast<double>(),
+                                      getVertexPosition(vdata, stride, i2).cast<double>(),
+                                      rayOrigin, rayDirection, closest, t) &&
+                    t < closest)
                 {
-                    double t = (n.dot(v0 - rayOrigin)) / c;
-                    if (t < closest && t > 0.0)
+                    closest = t;
+                    if (result)
                     {
-                        double m00 = e0.dot(e0);
-                        double m01 = e0.dot(e1);
-                        double m10 = e1.dot(e0);
-                        double m11 = e1.dot(e1);
-                        double det = m00 * m11 - m01 * m10;
-                        if (det != 0.0)
-                        {
-                            Eigen::Vector3d p = rayOrigin + rayDirection * t;
-                            Eigen::Vector3d q = p - v0;
-                            double q0 = e0.dot(q);
-                            double q1 = e1.dot(q);
-                            double d = 1.0 / det;
-                            double s0 = (m11 * q0 - m01 * q1) * d;
-                            double s1 = (m00 * q1 - m10 * q0) * d;
-                            if (s0 >= 0.0 && s1 >= 0.0 && s0 + s1 <= 1.0)
-                            {
-                                closest = t;
-                                if (result)
-                                {
-                                    result->group = &group;
-                                    result->primitiveIndex = primitiveIndex;
-                                    result->distance = closest;
-                                }
-                            }
-                        }
+                        result->group = &group;
+                        result->primitiveIndex = primitiveIndex;
+                        result->distance = closest;
                     }
                 }
+            });
+        }
 
-                // Get the indices for the next triangle
-                if (primType == PrimitiveGroupType::TriList)
-                {
-                    index += 3;
-                    if (index < nIndices)
-                    {
-                        i0 = group.indices[index + 0];
-                        i1 = group.indices[index + 1];
-                        i2 = group.indices[index + 2];
-                    }
-                }
-                else if (primType == PrimitiveGroupType::TriStrip)
-                {
-                    index += 1;
-                    if (index < nIndices)
-                    {
-                        i0 = i1;
-                        i1 = i2;
-                        i2 = group.indices[index];
-                        // TODO: alternate orientation of triangles in a strip
-                    }
-                }
-                else // primType == TriFan
-                {
-                    index += 1;
-                    if (index < nIndices)
-                    {
-                        index += 1;
-                        i1 = i2;
-                        i2 = group.indices[index];
-                    }
-                }
+        return closest != maxDistance;
+    }
 
-                primitiveIndex++;
+    // Visit the nodes the ray passes through, nearest first. Of the
+    // triangles hit at the same distance, the one which comes first in the
+    // mesh is picked, as when testing them in order.
+    const PickTreeTriangle* best = nullptr;
+    Eigen::Vector3d invDirection = rayDirection.cwiseInverse();
+
+    std::vector<std::pair<std::uint32_t, double>> stack;
+    double entry;
+    if (intersectBox(tree->nodes[0].bounds, rayOrigin, invDirection, closest, entry))
+        stack.emplace_back(0, entry);
+
+    while (!stack.empty())
+    {
+        auto [nodeIndex, nodeEntry] = stack.back();
+        stack.pop_back();
+        if (nodeEntry > closest)
+            continue;
+
+        const PickTreeNode& node = tree->nodes[nodeIndex];
+        if (node.count == 0)
+        {
+            std::uint32_t children[2] = { nodeIndex + 1, node.first };
+            double entries[2];
+            bool hits[2];
+            for (int i = 0; i < 2; i++)
+                hits[i] = intersectBox(tree->nodes[children[i]].bounds, rayOrigin, invDirection, closest, entries[i]);
+
+            // Push the farther child first, so that the nearer one is
+            // visited next
+            int nearer = hits[0] && hits[1] && entries[1] < entries[0] ? 1 : 0;
+            if (hits[1 - nearer])
+                stack.emplace_back(children[1 - nearer], entries[1 - nearer]);
+            if (hits[nearer])
+                stack.emplace_back(children[nearer], entries[nearer]);
+            continue;
+        }
+
+        for (std::uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            const PickTreeTriangle& triangle = tree->triangles[i];
+            double t;
+            if (!intersectTriangle(getVertexPosition(vdata, stride, triangle.vertices[0]).cast<double>(),
+                                   getVertexPosition(vdata, stride, triangle.vertices[1]).cast<double>(),
+                                   getVertexPosition(vdata, stride, triangle.vertices[2]).cast<double>(),
+                                   rayOrigin, rayDirection, closest, t))
+            {
+                continue;
+            }
 
-            } while (index < nIndices);
+            if (t < closest ||
+                (t == closest && best != nullptr &&
+                 std::tie(triangle.group, triangle.primitive) < std::tie(best->group, best->primitive)))
+            {
+                closest = t;
+                best = &triangle;
+            }
         }
     }
 
-    return closest != maxDistance;
+    if (best == nullptr)
+        return false;
+
+    if (result)
+    {
+        result->group = &groups[best->group];
+        result->primitiveIndex = best->primitive;
+        result->distance = closest;
+    }
+    return true;
 }
 
 
@@ -516,6 +873,61 @@ Mesh::pick(const Eigen::Vector3d& rayOrigin, const Eigen::Vector3d& rayDirection
 }
 
 
+std::shared_ptr<const Mesh::PickTree>
+Mesh::getPickTree() const
+{
+    // Picks from several threads may each build a tree, but they all see
+    // a complete one.
+    std::shared_ptr<const PickTree> tree = std::atomic_load(&pickTree);
+    if (tree == nullptr)
+    {
+        tree = buildPickTree();
+        std::atomic_store(&pickTree, tree);
+    }
+    return tree;
+}
+
+
+std::shared_ptr<const Mesh::PickTree>
+Mesh::buildPickTree() const
+{
+    auto tree = std::make_shared<PickTree>();
+
+    unsigned int stride = vertexDesc.strideBytes / sizeof(VWord);
+    const VWord* vdata = vertices.data() + vertexDesc.getAttribute(VertexAttributeSemantic::Position).offsetWords;
+
+    std::vector<Eigen::AlignedBox3f> bounds;
+    for (std::uint32_t groupIndex = 0; groupIndex < groups.size(); groupIndex++)
+    {
+        if (!isPickableGroup(groups[groupIndex]))
+            continue;
+
+        forEachPickTriangle(groups[groupIndex], [&](Index32 i0, Index32 i1, Index32 i2, unsigned int primitiveIndex)
+        {
+            // Triangles with a repeated vertex have no normal, and are
+            // never hit
+            if (i0 == i1 || i1 == i2 || i2 == i0)
+                return;
+
+            tree->triangles.push_back({ { i0, i1, i2 }, groupIndex, primitiveIndex });
+            Eigen::AlignedBox3f& box = bounds.emplace_back(getVertexPosition(vdata, stride, i0));
+            box.extend(getVertexPosition(vdata, stride, i1));
+            box.extend(getVertexPosition(vdata, stride, i2));
+        });
+    }
+
+    if (tree->triangles.size() < MinPickTreeTriangles)
+    {
+        tree->triangles.clear();
+        tree->triangles.shrink_to_fit();
+        return tree;
+    }
+
+    PickTreeBuilder(tree->nodes, tree->triangles, std::move(bounds)).build();
+    return tree;
+}
+
+
 Eigen::AlignedBox<float, 3>
 Mesh::getBoundingBox() const
 {
@@ -594,6 +1006,8 @@ Mesh::transform(const Eigen::Vector3f& translation, float scale)
             std::memcpy(vdata, &f, sizeof(float));
         }
     }
+
+    pickTree.reset();
 }
 
 
@@ -622,6 +1036,7 @@ Mesh::merge(const Mesh &other)
     vertices.insert(vertices.end(), other.vertices.begin(), other.vertices.end());
 
     nVertices += other.nVertices;
+    pickTree.reset();
 }
 
 bool
@@ -13,6 +13,7 @@
 #include <array>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -235,7 +236,11 @@ class Mesh
     void optimize();
 
  private:
+    struct PickTree;
+
     void mergePrimitiveGroups();
+    std::shared_ptr<const PickTree> getPickTree() const;
+    std::shared_ptr<const PickTree> buildPickTree() const;
 
     VertexDescription vertexDesc{ };
 
@@ -245,6 +250,10 @@ class Mesh
     std::vector<PrimitiveGroup> groups;
 
     std::string name;
+
+    // Bounding volume hierarchy of the triangles, built by the first pick
+    // and dropped whenever the geometry changes
+    mutable std::shared_ptr<const PickTree> pickTree;
 };
 
 } // namespace cmod
@@ -15,6 +15,7 @@
 #include <istream>
 #include <optional>
 #include <ostream>
+#include <streambuf>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -24,6 +25,7 @@
 
 #include <celutil/binaryread.h>
 #include <celutil/binarywrite.h>
+#include <celutil/bytes.h>
 #include <celutil/logger.h>
 #include <celutil/tokenizer.h>
 #include "mesh.h"
@@ -41,9 +43,18 @@ namespace
 {
 constexpr std::string_view CEL_MODEL_HEADER_ASCII = "#celmodel__ascii"sv;
 constexpr std::string_view CEL_MODEL_HEADER_BINARY = "#celmodel_binary"sv;
+constexpr std::string_view CEL_MODEL_HEADER_ALIGNED = "#celmodel__align"sv;
 static_assert(CEL_MODEL_HEADER_ASCII.size() == CEL_MODEL_HEADER_BINARY.size());
+static_assert(CEL_MODEL_HEADER_ASCII.size() == CEL_MODEL_HEADER_ALIGNED.size());
 constexpr std::size_t CEL_MODEL_HEADER_LENGTH = CEL_MODEL_HEADER_ASCII.size();
 
+// Aligned binary models are binary models in which the vertex data and the
+// indices of each primitive group are preceded by a padding count byte and
+// that many zero bytes, so that they start at a multiple of this many bytes
+// from the start of the model. Loaded from memory, the blocks can then be
+// used in place.
+constexpr std::size_t CEL_MODEL_BLOCK_ALIGNMENT = 16;
+
 // Material default values
 constexpr Color DefaultDiffuse(0.0f, 0.0f, 0.0f);
 constexpr Color DefaultSpecular(0.0f, 0.0f, 0.0f);
@@ -92,6 +103,36 @@ enum class CmodType
 };
 
 
+// Vertices are stored with their attributes in the order of the
+// description, all of them four byte words. When the description packs the
+// attributes in that order too, the file layout is the memory layout.
+bool
+isPackedLayout(const VertexDescription& desc)
+{
+    unsigned int offset = 0;
+    for (const auto& attr : desc.attributes)
+    {
+        if (attr.offsetWords != offset)
+            return false;
+        offset += VertexAttribute::getFormatSizeWords(attr.format);
+    }
+
+    return offset * sizeof(VWord) == desc.strideBytes;
+}
+
+
+// Stream buffer reading directly from a block of memory
+class MemoryStreamBuffer : public std::streambuf
+{
+public:
+    MemoryStreamBuffer(const char* data, std::size_t size)
+    {
+        char* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+};
+
+
 class ModelLoader
 {
 public:
@@ -1333,9 +1374,10 @@ bool ignoreValue(std::istream& in)
 class BinaryModelLoader : public ModelLoader
 {
 public:
-    BinaryModelLoader(std::istream* _in, HandleGetter&& _handleGetter) :
+    BinaryModelLoader(std::istream* _in, HandleGetter&& _handleGetter, bool _aligned) :
         ModelLoader(std::move(_handleGetter)),
-        in(_in)
+        in(_in),
+        aligned(_aligned)
     {}
     ~BinaryModelLoader() override = default;
 
@@ -1352,8 +1394,11 @@ private:
                                     unsigned int& vertexCount);
     bool loadAttribute(const VertexAttribute& attr,
                        cmod::VWord* destination);
+    bool readWords(VWord* destination, std::size_t count);
+    bool skipPadding();
 
     std::istream* in;
+    bool aligned;
 };
 
 
@@ -1645,19 +1690,22 @@ BinaryModelLoader::loadMesh(Mesh& mesh)
             return false;
         }
 
-        std::vector<Index32> indices;
-        indices.reserve(indexCount);
-
-        for (unsigned int i = 0; i < indexCount; i++)
+        std::vector<Index32> indices(indexCount);
+        if (!skipPadding() || !readWords(indices.data(), indexCount))
         {
-            std::uint32_t index;
-            if (!celutil::readLE<std::uint32_t>(*in, index) || index >= vertexCount)
-            {
-                reportError("Index out of range");
-                return false;
-            }
+            reportError("Could not read primitive indices");
+            return false;
+        }
 
-            indices.push_back(index);
+#ifdef WORDS_BIGENDIAN
+        for (Index32& index : indices)
+            index = bswap_32(index);
+#endif
+
+        if (std::any_of(indices.begin(), indices.end(), [vertexCount](Index32 index) { return index >= vertexCount; }))
+        {
+            reportError("Index out of range");
+            return false;
         }
 
         mesh.addGroup(type, materialIndex, std::move(indices));
@@ -1683,10 +1731,44 @@ BinaryModelLoader::loadVertices(const VertexDescription& vertexDesc,
         return {};
     }
 
+    if (!skipPadding())
+    {
+        reportError("Bad vertex data alignment");
+        return {};
+    }
+
     unsigned int stride = vertexDesc.strideBytes / sizeof(VWord);
     unsigned int vertexDataSize = stride * vertexCount;
     std::vector<VWord> vertexData(vertexDataSize);
 
+    // Packed vertices are read as a whole block
+    if (isPackedLayout(vertexDesc))
+    {
+        if (!readWords(vertexData.data(), vertexDataSize))
+        {
+            reportError("Failed to load vertex attribute");
+            return {};
+        }
+
+#ifdef WORDS_BIGENDIAN
+        // Floats are stored little endian, colors byte by byte
+        for (const auto& attr : vertexDesc.attributes)
+        {
+            if (attr.format == VertexAttributeFormat::UByte4)
+                continue;
+
+            unsigned int size = VertexAttribute::getFormatSizeWords(attr.format);
+            for (unsigned int offset = attr.offsetWords; offset < vertexDataSize; offset += stride)
+            {
+                for (unsigned int i = 0; i < size; i++)
+                    vertexData[offset + i] = bswap_32(vertexData[offset + i]);
+            }
+        }
+#endif
+
+        return vertexData;
+    }
+
     unsigned int offset = 0;
     for (unsigned int i = 0; i < vertexCount; i++, offset += stride)
     {
@@ -1705,6 +1787,29 @@ BinaryModelLoader::loadVertices(const VertexDescription& vertexDesc,
 }
 
 
+// Read count words as they are stored, in a single read
+bool
+BinaryModelLoader::readWords(VWord* destination, std::size_t count)
+{
+    auto size = static_cast<std::streamsize>(count * sizeof(VWord));
+    return in->read(reinterpret_cast<char*>(destination), size).gcount() == size;
+}
+
+
+// Skip the padding before a block of an aligned model
+bool
+BinaryModelLoader::skipPadding()
+{
+    if (!aligned)
+        return true;
+
+    std::uint8_t padding;
+    return celutil::readLE<std::uint8_t>(*in, padding)
+        && padding < CEL_MODEL_BLOCK_ALIGNMENT
+        && in->ignore(padding).good();
+}
+
+
 bool
 BinaryModelLoader::loadAttribute(const VertexAttribute& attr,
                                  cmod::VWord* destination)
@@ -1786,9 +1891,10 @@ bool writeTypeString(std::ostream& out, const std::string& s)
 class BinaryModelWriter : public ModelWriter
 {
 public:
-    BinaryModelWriter(std::ostream* _out, SourceGetter&& _sourceGetter) :
+    BinaryModelWriter(std::ostream* _out, SourceGetter&& _sourceGetter, bool _aligned) :
         ModelWriter(std::move(_sourceGetter)),
-        out(_out)
+        out(_out),
+        aligned(_aligned)
     {}
     ~BinaryModelWriter() override = default;
 
@@ -1803,15 +1909,28 @@ private:
                        unsigned int nVertices,
                        unsigned int strideWords,
                        const VertexDescription& desc);
+    bool writePadding();
 
     std::ostream* out;
+    bool aligned;
+    std::streampos start{ -1 };
 };
 
 
 bool
 BinaryModelWriter::write(const Model& model)
 {
-    if (!out->write(CEL_MODEL_HEADER_BINARY.data(), CEL_MODEL_HEADER_BINARY.size()).good())
+    std::string_view header = CEL_MODEL_HEADER_BINARY;
+    if (aligned)
+    {
+        // Blocks are aligned relative to the start of the model
+        start = out->tellp();
+        if (start == std::streampos(-1))
+            return false;
+        header = CEL_MODEL_HEADER_ALIGNED;
+    }
+
+    if (!out->write(header.data(), header.size()).good())
         return false;
 
     for (unsigned int matIndex = 0; model.getMaterial(matIndex) != nullptr; matIndex++)
@@ -1833,7 +1952,8 @@ BinaryModelWriter::writeGroup(const PrimitiveGroup& group)
 {
     if (!celutil::writeLE<std::int16_t>(*out, static_cast<std::int16_t>(group.prim))
         || !celutil::writeLE<std::uint32_t>(*out, group.materialIndex)
-        || !celutil::writeLE<std::uint32_t>(*out, static_cast<std::uint32_t>(group.indices.size())))
+        || !celutil::writeLE<std::uint32_t>(*out, static_cast<std::uint32_t>(group.indices.size()))
+        || !writePadding())
     {
         return false;
     }
@@ -1875,11 +1995,21 @@ BinaryModelWriter::writeVertices(const VWord* vertexData,
                                  unsigned int strideWords,
                                  const VertexDescription& desc)
 {
-    if (!writeToken(*out, CmodToken::Vertices) || !celutil::writeLE<std::uint32_t>(*out, nVertices))
+    if (!writeToken(*out, CmodToken::Vertices)
+        || !celutil::writeLE<std::uint32_t>(*out, nVertices)
+        || !writePadding())
     {
         return false;
     }
 
+#ifndef WORDS_BIGENDIAN
+    if (isPackedLayout(desc))
+    {
+        auto size = static_cast<std::streamsize>(nVertices * strideWords * sizeof(VWord));
+        return out->write(reinterpret_cast<const char*>(vertexData), size).good();
+    }
+#endif
+
     for (unsigned int i = 0; i < nVertices; i++, vertexData += strideWords)
     {
         for (const auto& attr : desc.attributes)
@@ -1929,6 +2059,28 @@ BinaryModelWriter::writeVertices(const VWord* vertexData,
 }
 
 
+// Pad an aligned model so that the next block starts at a multiple of the
+// block alignment, counting the padding count byte itself
+bool
+BinaryModelWriter::writePadding()
+{
+    if (!aligned)
+        return true;
+
+    std::streampos position = out->tellp();
+    if (position == std::streampos(-1))
+        return false;
+
+    auto offset = static_cast<std::size_t>(position - start) + 1;
+    auto padding = static_cast<std::uint8_t>((CEL_MODEL_BLOCK_ALIGNMENT - offset % CEL_MODEL_BLOCK_ALIGNMENT) % CEL_MODEL_BLOCK_ALIGNMENT);
+    if (!celutil::writeLE<std::uint8_t>(*out, padding))
+        return false;
+
+    std::array<char, CEL_MODEL_BLOCK_ALIGNMENT> zeros{};
+    return out->write(zeros.data(), padding).good();
+}
+
+
 bool
 BinaryModelWriter::writeVertexDescription(const VertexDescription& desc)
 {
@@ -2025,7 +2177,11 @@ openModel(std::istream& in, HandleGetter&& getHandle)
     }
     if (headerType == CEL_MODEL_HEADER_BINARY)
     {
-        return std::make_unique<BinaryModelLoader>(&in, std::move(getHandle));
+        return std::make_unique<BinaryModelLoader>(&in, std::move(getHandle), false);
+    }
+    if (headerType == CEL_MODEL_HEADER_ALIGNED)
+    {
+        return std::make_unique<BinaryModelLoader>(&in, std::move(getHandle), true);
     }
     else
     {
@@ -2055,6 +2211,15 @@ LoadModel(std::istream& in, HandleGetter handleGetter)
 }
 
 
+std::unique_ptr<Model>
+LoadModel(const char* data, std::size_t size, HandleGetter handleGetter)
+{
+    MemoryStreamBuffer buffer(data, size);
+    std::istream in(&buffer);
+    return LoadModel(in, std::move(handleGetter));
+}
+
+
 bool
 SaveModelAscii(const Model* model, std::ostream& out, SourceGetter sourceGetter)
 {
@@ -2068,7 +2233,16 @@ bool
 SaveModelBinary(const Model* model, std::ostream& out, SourceGetter sourceGetter)
 {
     if (model == nullptr) { return false; }
-    BinaryModelWriter writer(&out, std::move(sourceGetter));
+    BinaryModelWriter writer(&out, std::move(sourceGetter), false);
+    return writer.write(*model);
+}
+
+
+bool
+SaveModelAlignedBinary(const Model* model, std::ostream& out, SourceGetter sourceGetter)
+{
+    if (model == nullptr) { return false; }
+    BinaryModelWriter writer(&out, std::move(sourceGetter), true);
     return writer.write(*model);
 }
 } // end namespace cmod
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <functional>
 #include <iosfwd>
 #include <memory>
@@ -25,7 +26,11 @@ using HandleGetter = std::function<ResourceHandle(const fs::path&)>;
 using SourceGetter = std::function<fs::path(ResourceHandle)>;
 
 std::unique_ptr<Model> LoadModel(std::istream& in, HandleGetter getHandle);
+// Load a model from memory, e.g. a memory mapped file
+std::unique_ptr<Model> LoadModel(const char* data, std::size_t size, HandleGetter getHandle);
 
 bool SaveModelAscii(const Model* model, std::ostream& out, SourceGetter getSource);
 bool SaveModelBinary(const Model* model, std::ostream& out, SourceGetter getSource);
+// Save a binary model with its vertex and index blocks aligned
+bool SaveModelAlignedBinary(const Model* model, std::ostream& out, SourceGetter getSource);
 }
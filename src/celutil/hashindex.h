@@ -0,0 +1,193 @@
+// hashindex.h
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// Open addressing hash table for lookups by catalog number.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <celutil/array_view.h>
+
+namespace celestia::util
+{
+
+/*! Hash table from 32 bit keys, such as catalog numbers, to values. Keys
+ *  and values are stored together in a single array and collisions are
+ *  resolved by linear probing, so that a lookup usually touches a single
+ *  cache line. The largest key is reserved to mark empty slots and can't
+ *  be stored.
+ */
+template<typename V>
+class HashIndex
+{
+ public:
+    static constexpr std::uint32_t EmptyKey = std::numeric_limits<std::uint32_t>::max();
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    void clear()
+    {
+        slots.clear();
+        count = 0;
+        mask = 0;
+        shift = 64;
+    }
+
+    // Make room for n entries without rehashing
+    void reserve(std::size_t n)
+    {
+        if (n > maxCount(slots.size()))
+            rehash(n);
+    }
+
+    // Add an entry unless there already is one with the key. Returns
+    // whether the entry was added.
+    bool insert(std::uint32_t key, const V& value)
+    {
+        if (key == EmptyKey)
+            return false;
+        if (count + 1 > maxCount(slots.size()))
+            rehash(count + 1);
+
+        Slot& slot = slots[findSlot(key)];
+        if (slot.key == key)
+            return false;
+
+        slot.key = key;
+        slot.value = value;
+        ++count;
+        return true;
+    }
+
+    // Add an entry, or replace the value of the existing one
+    void insertOrAssign(std::uint32_t key, const V& value)
+    {
+        if (!insert(key, value) && key != EmptyKey)
+            slots[findSlot(key)].value = value;
+    }
+
+    // Return a pointer to the value for the key, or nullptr if there is
+    // no entry with the key
+    const V* find(std::uint32_t key) const
+    {
+        if (count == 0 || key == EmptyKey)
+            return nullptr;
+
+        const Slot& slot = slots[findSlot(key)];
+        return slot.key == key ? &slot.value : nullptr;
+    }
+
+    /*! Look up many keys at once, storing the value for each key in
+     *  values, or notFound for the keys without an entry. The slots of a
+     *  batch of keys are requested from memory before any of them is
+     *  probed, so that the cache misses of a large table overlap.
+     */
+    void find(array_view<std::uint32_t> keys, V* values, V notFound) const
+    {
+        constexpr std::size_t BatchSize = 16;
+
+        std::size_t slotIndex[BatchSize];
+        for (std::size_t first = 0; first < keys.size(); first += BatchSize)
+        {
+            std::size_t batchSize = std::min(BatchSize, keys.size() - first);
+            if (count == 0)
+            {
+                std::fill(values + first, values + first + batchSize, notFound);
+                continue;
+            }
+
+            for (std::size_t i = 0; i < batchSize; ++i)
+            {
+                slotIndex[i] = hash(keys[first + i]);
+#if defined(__GNUC__) || defined(__clang__)
+                __builtin_prefetch(&slots[slotIndex[i]]);
+#endif
+            }
+
+            for (std::size_t i = 0; i < batchSize; ++i)
+            {
+                std::uint32_t key = keys[first + i];
+                values[first + i] = notFound;
+                if (key == EmptyKey)
+                    continue;
+
+                for (std::size_t j = slotIndex[i]; slots[j].key != EmptyKey; j = (j + 1) & mask)
+                {
+                    if (slots[j].key == key)
+                    {
+                        values[first + i] = slots[j].value;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+ private:
+    struct Slot
+    {
+        std::uint32_t key{ EmptyKey };
+        V value{};
+    };
+
+    // At most 3/4 of the slots are used, so that probe sequences stay short
+    static std::size_t maxCount(std::size_t nSlots) { return nSlots - nSlots / 4; }
+
+    // Fibonacci hashing: the golden ratio multiplication spreads runs of
+    // consecutive catalog numbers over the whole table.
+    std::size_t hash(std::uint32_t key) const
+    {
+        return static_cast<std::size_t>((static_cast<std::uint64_t>(key) * UINT64_C(0x9e3779b97f4a7c15)) >> shift) & mask;
+    }
+
+    // Return the index of the slot with the key, or of the empty slot
+    // where it belongs. There must be at least one empty slot.
+    std::size_t findSlot(std::uint32_t key) const
+    {
+        std::size_t i = hash(key);
+        while (slots[i].key != key && slots[i].key != EmptyKey)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void rehash(std::size_t n)
+    {
+        std::size_t nSlots = 16;
+        unsigned int bits = 4;
+        while (maxCount(nSlots) < n)
+        {
+            nSlots *= 2;
+            ++bits;
+        }
+
+        std::vector<Slot> oldSlots(nSlots);
+        oldSlots.swap(slots);
+        mask = nSlots - 1;
+        shift = 64 - bits;
+
+        for (const Slot& slot : oldSlots)
+        {
+            if (slot.key != EmptyKey)
+                slots[findSlot(slot.key)] = slot;
+        }
+    }
+
+    std::vector<Slot> slots;
+    std::size_t count{ 0 };
+    std::size_t mask{ 0 };
+    unsigned int shift{ 64 };
+};
+
+} // end namespace celestia::util
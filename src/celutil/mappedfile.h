@@ -0,0 +1,56 @@
+// mappedfile.h
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// Read-only memory mapped files.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstddef>
+
+#include <celcompat/filesystem.h>
+
+namespace celestia::util
+{
+
+/**
+ * Read-only view of the complete contents of a file, backed by the
+ * operating system's virtual memory. Pages are only read from disk when
+ * they are first touched.
+ */
+class MappedFile
+{
+ public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&&) noexcept;
+    MappedFile& operator=(MappedFile&&) noexcept;
+
+    /**
+     * Map the file at path, replacing any previous mapping. Returns false
+     * if the file cannot be opened, is empty, or cannot be mapped.
+     */
+    bool open(const fs::path& path);
+    void close();
+
+    bool isOpen() const { return m_data != nullptr; }
+    const char* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+
+ private:
+    const char* m_data{ nullptr };
+    std::size_t m_size{ 0 };
+#ifdef _WIN32
+    void* m_mapping{ nullptr };
+#endif
+};
+
+} // end namespace celestia::util
@@ -10,9 +10,20 @@
 #ifndef _CELUTIL_RESMANAGER_H_
 #define _CELUTIL_RESMANAGER_H_
 
-#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+#include <celutil/logger.h>
 #include <celutil/reshandle.h>
+#include <celutil/threadpool.h>
 #include <celcompat/filesystem.h>
 
 
@@ -20,6 +31,21 @@ enum ResourceState {
     ResourceNotLoaded     = 0,
     ResourceLoaded        = 1,
     ResourceLoadingFailed = 2,
+    ResourceLoading       = 3,
+};
+
+
+// Counters kept by a ResourceManager for tuning its memory budget
+struct ResourceStatistics
+{
+    // Memory used by the loaded resources, in bytes
+    std::size_t residentBytes{ 0 };
+    // Calls to find() which returned a resource already loaded
+    std::uint64_t hits{ 0 };
+    // Calls to find() which started loading a resource
+    std::uint64_t misses{ 0 };
+    // Resources unloaded to stay within the memory budget
+    std::uint64_t evictions{ 0 };
 };
 
 
@@ -32,6 +58,20 @@ template<class T> class ResourceInfo
     virtual fs::path resolve(const fs::path&) = 0;
     virtual T* load(const fs::path&) = 0;
 
+    typedef std::function<T*()> Finisher;
+
+    // Loading in two steps, used when the ResourceManager loads in the
+    // background: prepare() runs on a worker thread, on a copy of this
+    // object, and does the slow part of the work such as reading and
+    // decoding files. The function it returns then creates the resource on
+    // the thread calling find(). If it returns an empty function, the
+    // resource is loaded with load() instead.
+    virtual Finisher prepare(const fs::path&) const { return Finisher(); }
+
+    // Approximate memory used by the loaded resource in bytes, for the
+    // memory budget of the ResourceManager; 0 if unknown.
+    virtual std::size_t getMemoryUsage() const { return 0; }
+
     typedef T ResourceType;
     ResourceState state;
     fs::path resolvedName;
@@ -52,9 +92,16 @@ template<class T> class ResourceManager
     typedef typename T::ResourceType ResourceType;
 
  private:
+    struct LoadedResource
+    {
+        ResourceType* resource;
+        std::size_t memoryUsage;
+    };
+
     typedef std::vector<T> ResourceTable;
     typedef std::map<T, ResourceHandle> ResourceHandleMap;
-    typedef std::map<fs::path, ResourceType*> NameMap;
+    typedef std::map<fs::path, LoadedResource> NameMap;
+    typedef std::map<ResourceHandle, std::future<typename T::Finisher>> PendingMap;
 
     typedef typename ResourceHandleMap::value_type ResourceHandleMapValue;
     typedef typename NameMap::value_type NameMapValue;
@@ -63,6 +110,19 @@ template<class T> class ResourceManager
     ResourceHandleMap handles;
     NameMap loadedResources;
 
+    // Frame in which each resource was last returned by find()
+    std::vector<std::uint64_t> lastUsed;
+    std::uint64_t currentFrame{ 0 };
+    std::size_t memoryBudget{ 0 };
+    ResourceStatistics statistics;
+
+    // Background loading state; loadingPool is null when resources are
+    // loaded synchronously by find().
+    PendingMap pendingResources;
+    std::chrono::duration<double> finishBudget{ 0.0 };
+    std::chrono::duration<double> finishTime{ 0.0 };
+    std::unique_ptr<celestia::util::ThreadPool> loadingPool;
+
  public:
     ResourceHandle getHandle(const T& info)
     {
@@ -75,11 +135,67 @@ template<class T> class ResourceManager
         {
             ResourceHandle h = handles.size();
             resources.push_back(info);
+            lastUsed.push_back(0);
             handles.insert(ResourceHandleMapValue(info, h));
             return h;
         }
     }
 
+    // Load resources on threadCount worker threads instead of inside
+    // find(), which returns nullptr for a resource until it is ready.
+    // Creating the loaded resources takes place in find() on the calling
+    // thread, for at most budget seconds per frame (but at least one
+    // resource per frame.) A threadCount of 0 restores synchronous loading.
+    void setAsyncLoading(unsigned int threadCount, double budget = 0.005)
+    {
+        finishBudget = std::chrono::duration<double>(budget);
+
+        // Tasks queued on the old pool are completed by its destructor, and
+        // the resources they prepared are finished by later calls to find().
+        if (threadCount == 0)
+            loadingPool = nullptr;
+        else if (loadingPool == nullptr || loadingPool->threadCount() != threadCount)
+            loadingPool = std::make_unique<celestia::util::ThreadPool>(threadCount);
+    }
+
+    bool isAsyncLoading() const
+    {
+        return loadingPool != nullptr;
+    }
+
+    // Unload the least recently used resources at the start of a frame
+    // when the loaded resources take up more than budget bytes; they are
+    // loaded again by the next find() which needs them. Resources used in
+    // the previous frame are always kept. A budget of 0, the default,
+    // means that nothing is ever unloaded. Only usable when the resources
+    // returned by find() aren't kept from one frame to the next.
+    void setMemoryBudget(std::size_t budget)
+    {
+        memoryBudget = budget;
+    }
+
+    std::size_t getMemoryBudget() const
+    {
+        return memoryBudget;
+    }
+
+    const ResourceStatistics& getStatistics() const
+    {
+        return statistics;
+    }
+
+    // Marks the start of a new frame, for the budgets of setAsyncLoading()
+    // and setMemoryBudget(); must be called once per frame when either is
+    // in use.
+    void startFrame()
+    {
+        ++currentFrame;
+        finishTime = std::chrono::duration<double>::zero();
+
+        if (memoryBudget != 0 && statistics.residentBytes > memoryBudget)
+            evict();
+    }
+
     ResourceType* find(ResourceHandle h)
     {
         if (h >= (int) handles.size() || h < 0)
@@ -88,6 +204,14 @@ template<class T> class ResourceManager
         }
         else
         {
+            lastUsed[h] = currentFrame;
+
+            if (resources[h].state == ResourceLoaded)
+            {
+                ++statistics.hits;
+                return resources[h].resource;
+            }
+
             if (resources[h].state == ResourceNotLoaded)
             {
                 resources[h].resolvedName = resources[h].resolve(baseDir);
@@ -95,24 +219,26 @@ template<class T> class ResourceManager
                     loadedResources.find(resources[h].resolvedName);
                 if (iter != loadedResources.end())
                 {
-                    resources[h].resource = iter->second;
+                    ++statistics.hits;
+                    resources[h].resource = iter->second.resource;
                     resources[h].state = ResourceLoaded;
                 }
+                else if (loadingPool != nullptr)
+                {
+                    ++statistics.misses;
+                    queueLoad(h);
+                }
                 else
                 {
+                    ++statistics.misses;
                     resources[h].resource = resources[h].load(resources[h].resolvedName);
-                    if (resources[h].resource == nullptr)
-                    {
-                        resources[h].state = ResourceLoadingFailed;
-                    }
-                    else
-                    {
-                        resources[h].state = ResourceLoaded;
-                        loadedResources.insert(NameMapValue(resources[h].resolvedName, resources[h].resource));
-                    }
+                    setLoaded(h);
                 }
             }
 
+            if (resources[h].state == ResourceLoading)
+                finishLoad(h);
+
             if (resources[h].state == ResourceLoaded)
                 return resources[h].resource;
             else
@@ -127,7 +253,121 @@ template<class T> class ResourceManager
         else
             return &resources[h];
     }
+
+ private:
+    // Update the state of resource h after an attempt to load it
+    void setLoaded(ResourceHandle h)
+    {
+        if (resources[h].resource == nullptr)
+        {
+            resources[h].state = ResourceLoadingFailed;
+            return;
+        }
+
+        resources[h].state = ResourceLoaded;
+        std::size_t memoryUsage = resources[h].getMemoryUsage();
+        loadedResources.insert(NameMapValue(resources[h].resolvedName,
+                                            LoadedResource{ resources[h].resource, memoryUsage }));
+        statistics.residentBytes += memoryUsage;
+    }
+
+    void queueLoad(ResourceHandle h)
+    {
+        // The worker gets its own copy of the resource info, as the
+        // resource table may be reallocated while it runs.
+        resources[h].state = ResourceLoading;
+        pendingResources[h] = loadingPool->submit([info = resources[h]]()
+        {
+            return info.prepare(info.resolvedName);
+        });
+    }
+
+    void finishLoad(ResourceHandle h)
+    {
+        auto pending = pendingResources.find(h);
+        if (finishTime > finishBudget ||
+            pending->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        typename T::Finisher finisher = pending->second.get();
+        pendingResources.erase(pending);
+
+        // Another handle may have loaded the same file meanwhile
+        typename NameMap::iterator iter = loadedResources.find(resources[h].resolvedName);
+        if (iter != loadedResources.end())
+        {
+            resources[h].resource = iter->second.resource;
+            resources[h].state = ResourceLoaded;
+        }
+        else
+        {
+            if (finisher)
+                resources[h].resource = finisher();
+            else
+                resources[h].resource = resources[h].load(resources[h].resolvedName);
+            setLoaded(h);
+        }
+
+        finishTime += std::chrono::steady_clock::now() - start;
+    }
+
+    void evict()
+    {
+        // Several handles may refer to the same resource, so resources are
+        // identified by their file name.
+        std::map<fs::path, std::uint64_t> lastUsedByName;
+        for (std::size_t h = 0; h < resources.size(); ++h)
+        {
+            if (resources[h].state != ResourceLoaded)
+                continue;
+            std::uint64_t& frame = lastUsedByName[resources[h].resolvedName];
+            frame = std::max(frame, lastUsed[h]);
+        }
+
+        std::vector<std::pair<std::uint64_t, const fs::path*>> candidates;
+        for (const auto& entry : lastUsedByName)
+        {
+            if (entry.second + 1 < currentFrame)
+                candidates.emplace_back(entry.second, &entry.first);
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        std::set<fs::path> evicted;
+        for (const auto& candidate : candidates)
+        {
+            if (statistics.residentBytes <= memoryBudget)
+                break;
+
+            // Unloading resources of unknown size wouldn't help
+            typename NameMap::iterator iter = loadedResources.find(*candidate.second);
+            if (iter->second.memoryUsage == 0)
+                continue;
+
+            statistics.residentBytes -= iter->second.memoryUsage;
+            delete iter->second.resource;
+            loadedResources.erase(iter);
+            evicted.insert(*candidate.second);
+        }
+
+        if (evicted.empty())
+            return;
+
+        for (auto& info : resources)
+        {
+            if (info.state == ResourceLoaded && evicted.count(info.resolvedName) != 0)
+            {
+                info.state = ResourceNotLoaded;
+                info.resource = nullptr;
+            }
+        }
+
+        statistics.evictions += evicted.size();
+        celestia::util::GetLogger()->debug("Unloaded {} resources, {} bytes in use, {} evictions in total\n",
+                                           evicted.size(), statistics.residentBytes, statistics.evictions);
+    }
 };
 
 #endif // _CELUTIL_RESMANAGER_H_
-
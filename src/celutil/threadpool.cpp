@@ -0,0 +1,81 @@
+// threadpool.cpp
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// A fixed size pool of worker threads.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+
+#include "threadpool.h"
+
+namespace celestia::util
+{
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+    workers.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; ++i)
+        workers.emplace_back([this]() { run(); });
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+
+unsigned int
+ThreadPool::defaultThreadCount()
+{
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+
+void
+ThreadPool::enqueue(std::function<void()>&& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    condition.notify_one();
+}
+
+
+void
+ThreadPool::run()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+            // Pending tasks are drained before the pool shuts down so that
+            // no future is left without a value.
+            if (tasks.empty())
+                return;
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+} // end namespace celestia::util
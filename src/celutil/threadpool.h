@@ -0,0 +1,80 @@
+// threadpool.h
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// A fixed size pool of worker threads.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace celestia::util
+{
+
+/**
+ * Runs submitted tasks on a fixed number of worker threads in submission
+ * order. A pool created with zero threads runs each task synchronously
+ * inside submit(), which gives the same results as the threaded case and
+ * is useful for debugging.
+ */
+class ThreadPool
+{
+ public:
+    explicit ThreadPool(unsigned int threadCount = defaultThreadCount());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /// Number of threads to use when the caller has no preference: one
+    /// per hardware thread.
+    static unsigned int defaultThreadCount();
+
+    unsigned int threadCount() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    template<typename F>
+    std::future<std::invoke_result_t<std::decay_t<F>>> submit(F&& f)
+    {
+        using R = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        std::future<R> result = task->get_future();
+        if (workers.empty())
+        {
+            (*task)();
+        }
+        else
+        {
+            enqueue([task]() { (*task)(); });
+        }
+        return result;
+    }
+
+ private:
+    void enqueue(std::function<void()>&&);
+    void run();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping{ false };
+};
+
+} // end namespace celestia::util
@@ -151,20 +151,33 @@ struct VisitorInteger
 } // end unnamed namespace
 
 
+struct TokenList::Token
+{
+    Tokenizer::TokenType type;
+    int lineNumber;
+    std::variant<std::monostate, std::int32_t, double, std::string> value;
+    std::optional<std::size_t> parsedGroup;
+};
+
+
 class TokenizerImpl
 {
 public:
     using TokenValue = std::variant<std::monostate, std::int32_t, double, std::string_view, std::string>;
 
     TokenizerImpl(std::istream*, std::size_t);
+    explicit TokenizerImpl(const TokenList*);
 
     Tokenizer::TokenType nextToken();
 
     const TokenValue& getTokenValue() const { return tokenValue; }
     int getLineNumber() const { return lineNumber; }
+    std::optional<std::size_t> getParsedGroupIndex() const;
 
 private:
-    std::istream* in;
+    std::istream* in{ nullptr };
+    const TokenList* tokenList{ nullptr };
+    std::size_t tokenIndex{ 0 };
     std::vector<char> buffer;
     std::size_t position{ 0 };
     std::size_t length{ 0 };
@@ -193,6 +206,8 @@ private:
 
     bool fillBuffer(std::size_t* = nullptr);
     std::optional<char> peekAt(std::size_t&);
+
+    Tokenizer::TokenType replayToken();
 };
 
 
@@ -202,9 +217,16 @@ TokenizerImpl::TokenizerImpl(std::istream* _in, std::size_t _bufferSize)
 {}
 
 
+TokenizerImpl::TokenizerImpl(const TokenList* _tokenList)
+    : tokenList(_tokenList)
+{}
+
+
 Tokenizer::TokenType
 TokenizerImpl::nextToken()
 {
+    if (tokenList != nullptr) { return replayToken(); }
+
     tokenValue.emplace<std::monostate>();
 
     // skip UTF8 BOM
@@ -227,6 +249,39 @@ TokenizerImpl::nextToken()
 }
 
 
+Tokenizer::TokenType
+TokenizerImpl::replayToken()
+{
+    const auto& tokens = tokenList->tokens;
+    if (tokens.empty()) { return Tokenizer::TokenEnd; }
+
+    // The final token is always the end of the stream or an error, keep
+    // returning it once it has been reached
+    if (tokenIndex < tokens.size()) { ++tokenIndex; }
+
+    const TokenList::Token& token = tokens[tokenIndex - 1];
+    lineNumber = token.lineNumber;
+    std::visit([this](const auto& arg)
+    {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, std::string>)
+            tokenValue.emplace<std::string_view>(arg);
+        else
+            tokenValue.emplace<T>(arg);
+    }, token.value);
+
+    return token.type;
+}
+
+
+std::optional<std::size_t>
+TokenizerImpl::getParsedGroupIndex() const
+{
+    if (tokenList == nullptr || tokenIndex == 0) { return std::nullopt; }
+    return tokenList->tokens[tokenIndex - 1].parsedGroup;
+}
+
+
 std::variant<char, Tokenizer::TokenType>
 TokenizerImpl::skipWhitespace()
 {
@@ -744,6 +799,11 @@ Tokenizer::Tokenizer(std::istream* _in, std::size_t buffer_size)
 {}
 
 
+Tokenizer::Tokenizer(const TokenList* tokenList)
+    : impl(std::make_unique<TokenizerImpl>(tokenList))
+{}
+
+
 Tokenizer::~Tokenizer() = default;
 
 
@@ -813,3 +873,47 @@ Tokenizer::getLineNumber() const
 }
 
 
+std::optional<std::size_t>
+Tokenizer::getParsedGroupIndex() const
+{
+    if (tokenType != TokenType::TokenBeginGroup) { return std::nullopt; }
+    return impl->getParsedGroupIndex();
+}
+
+
+TokenList::TokenList() = default;
+TokenList::~TokenList() = default;
+TokenList::TokenList(TokenList&&) noexcept = default;
+TokenList& TokenList::operator=(TokenList&&) noexcept = default;
+
+
+void
+TokenList::append(const Tokenizer& tokenizer)
+{
+    Token& token = tokens.emplace_back();
+    token.type = tokenizer.tokenType;
+    token.lineNumber = tokenizer.getLineNumber();
+    std::visit([&token](const auto& arg)
+    {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, std::string_view>)
+            token.value.emplace<std::string>(arg);
+        else
+            token.value.emplace<T>(arg);
+    }, tokenizer.impl->getTokenValue());
+}
+
+
+void
+TokenList::appendParsedGroup(int beginLine, int endLine, std::size_t index)
+{
+    tokens.push_back({ Tokenizer::TokenBeginGroup, beginLine, std::monostate(), index });
+    tokens.push_back({ Tokenizer::TokenEndGroup, endLine, std::monostate(), std::nullopt });
+}
+
+
+void
+TokenList::appendError(int lineNumber)
+{
+    tokens.push_back({ Tokenizer::TokenError, lineNumber, std::monostate(), std::nullopt });
+}
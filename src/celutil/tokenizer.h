@@ -16,9 +16,11 @@
 #include <memory>
 #include <optional>
 #include <string_view>
+#include <vector>
 
 
 class TokenizerImpl;
+class TokenList;
 
 class Tokenizer
 {
@@ -45,6 +47,7 @@ public:
     static constexpr std::size_t DEFAULT_BUFFER_SIZE = 4096;
 
     Tokenizer(std::istream*, std::size_t = DEFAULT_BUFFER_SIZE);
+    explicit Tokenizer(const TokenList*);
     ~Tokenizer();
 
     TokenType nextToken();
@@ -57,8 +60,40 @@ public:
 
     int getLineNumber() const;
 
+    // When replaying a TokenList, the index of the parsed group which the
+    // current TokenBeginGroup stands for.
+    std::optional<std::size_t> getParsedGroupIndex() const;
+
 private:
     std::unique_ptr<TokenizerImpl> impl;
     TokenType tokenType{ TokenType::TokenBegin };
     bool isPushedBack{ false };
+
+    friend class TokenList;
+};
+
+
+// A recorded sequence of tokens which a Tokenizer can replay later,
+// possibly on another thread. Groups may be recorded as a single
+// placeholder whose contents were parsed while recording; the placeholder
+// replays as a TokenBeginGroup with a parsed group index followed by the
+// TokenEndGroup.
+class TokenList
+{
+public:
+    TokenList();
+    ~TokenList();
+    TokenList(TokenList&&) noexcept;
+    TokenList& operator=(TokenList&&) noexcept;
+
+    // Record the current token of the tokenizer
+    void append(const Tokenizer&);
+    void appendParsedGroup(int beginLine, int endLine, std::size_t index);
+    void appendError(int lineNumber);
+
+private:
+    struct Token;
+    std::vector<Token> tokens;
+
+    friend class TokenizerImpl;
 };
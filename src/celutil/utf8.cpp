@@ -8,6 +8,7 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <cctype>
 #include <wchar.h>
 #include "utf8.h"
 
@@ -498,6 +499,33 @@ int UTF8StringCompare(std::string_view s0, std::string_view s1)
         return 0;
 }
 
+//! Append str to dest with each character normalized and lower cased, as
+//! UTF8StringCompare() compares them when ignoring case. The byte order of
+//! folded strings is the order of that comparison, so they can be sorted
+//! and searched as plain strings. Stops once dest is at least maxSize bytes
+//! long.
+void UTF8FoldCase(std::string_view str, std::string &dest, size_t maxSize)
+{
+    int len = str.length();
+    int i = 0;
+    while (i < len && dest.size() < maxSize)
+    {
+        wchar_t ch = 0;
+        if (!UTF8Decode(str, i, ch))
+        {
+            // Invalid sequences are kept byte by byte
+            dest += str[i++];
+            continue;
+        }
+
+        i += UTF8EncodedSize(ch);
+        ch = UTF8Normalize(ch);
+        if (ch < 0x80)
+            ch = std::tolower(ch);
+        UTF8Encode(static_cast<std::uint32_t>(ch), dest);
+    }
+}
+
 int UTF8StringCompare(std::string_view s0, std::string_view s1, size_t n, bool ignoreCase)
 {
     int len0 = s0.length();
@@ -0,0 +1,57 @@
+// sortstardb.cpp
+//
+// Copyright (C) 2023-present, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Rewrite a binary Celestia star database in octree order, so that it
+// can be loaded without sorting the stars at startup.
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <celengine/stardb.h>
+
+using namespace std;
+
+
+void Usage()
+{
+    cerr << "Usage: sortstardb <input star database> <output star database>\n";
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        Usage();
+        return 1;
+    }
+
+    ifstream in(argv[1], ios::in | ios::binary);
+    if (!in.good())
+    {
+        cerr << "Error opening " << argv[1] << '\n';
+        return 1;
+    }
+
+    ofstream out(argv[2], ios::out | ios::binary);
+    if (!out.good())
+    {
+        cerr << "Error opening " << argv[2] << '\n';
+        return 1;
+    }
+
+    if (!StarDatabase::writeOctreeBinary(in, out))
+    {
+        cerr << "Error converting star database " << argv[1] << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,20 @@
+#include <benchmark/benchmark.h>
+#include <celutil/logger.h>
+
+int main(int argc, char* argv[])
+{
+    // setup; the loaders log at info level on every iteration otherwise
+    celestia::util::CreateLogger(celestia::util::Level::Error);
+
+    // run the benchmarks
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    // cleanup
+    celestia::util::DestroyLogger();
+
+    return 0;
+}
@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <celengine/astro.h>
+#include <celengine/compactstarstore.h>
+#include <celengine/dsodb.h>
+#include <celengine/name.h>
+#include <celengine/render.h>
+#include <celengine/solarsys.h>
+#include <celengine/stardb.h>
+#include <celengine/staroctree.h>
+#include <celengine/stellarclass.h>
+#include <celengine/univcoord.h>
+#include <celengine/universe.h>
+#include <celutil/binarywrite.h>
+#include <celutil/threadpool.h>
+
+#include <benchmark/benchmark.h>
+
+namespace
+{
+
+// Synthetic stars.dat contents: stars with pseudo-random positions within
+// 10000 ly of the Sun and pseudo-random magnitudes
+std::string makeStarsDat(std::uint32_t nStars)
+{
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    out.write("CELSTARS", 8);
+    celestia::util::writeLE<std::uint16_t>(out, 0x0100);
+    celestia::util::writeLE<std::uint32_t>(out, nStars);
+
+    StellarClass sc(StellarClass::NormalStar, StellarClass::Spectral_G, 2, StellarClass::Lum_V);
+    std::uint16_t spectralType = sc.packV1();
+
+    std::uint32_t seed = 12345;
+    auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+    for (std::uint32_t i = 0; i < nStars; ++i)
+    {
+        celestia::util::writeLE<std::uint32_t>(out, i + 1);
+        for (int j = 0; j < 3; ++j)
+            celestia::util::writeLE<float>(out, static_cast<float>(next() % 20000) - 10000.0f);
+        celestia::util::writeLE<std::int16_t>(out, static_cast<std::int16_t>(next() % 4096) - 1024);
+        celestia::util::writeLE<std::uint16_t>(out, spectralType);
+    }
+
+    return out.str();
+}
+
+std::unique_ptr<StarDatabase> makeStarDatabase(std::uint32_t nStars)
+{
+    auto starDB = std::make_unique<StarDatabase>();
+    std::istringstream in(makeStarsDat(nStars), std::ios::in | std::ios::binary);
+    starDB->loadBinary(in);
+    starDB->finish();
+    return starDB;
+}
+
+class CountingStarHandler : public StarHandler
+{
+ public:
+    void process(const Star&, float, float) override { ++count; }
+
+    std::size_t count{ 0 };
+};
+
+void BM_StarDatabaseLoadBinary(benchmark::State& state)
+{
+    std::string data = makeStarsDat(static_cast<std::uint32_t>(state.range(0)));
+    for (auto _ : state)
+    {
+        StarDatabase starDB;
+        std::istringstream in(data, std::ios::in | std::ios::binary);
+        benchmark::DoNotOptimize(starDB.loadBinary(in));
+        starDB.finish();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_StarOctreeVisibleStars(benchmark::State& state)
+{
+    std::unique_ptr<StarDatabase> starDB = makeStarDatabase(200000);
+    float limitingMag = static_cast<float>(state.range(0));
+    auto threads = static_cast<unsigned int>(state.range(1));
+    std::unique_ptr<celestia::util::ThreadPool> pool;
+    if (threads > 0)
+        pool = std::make_unique<celestia::util::ThreadPool>(threads);
+
+    for (auto _ : state)
+    {
+        CountingStarHandler handler;
+        starDB->findVisibleStars(handler,
+                                 Eigen::Vector3f(10.0f, -20.0f, 30.0f),
+                                 Eigen::Quaternionf::Identity(),
+                                 0.8f, 1.5f, limitingMag,
+                                 nullptr, pool.get());
+        benchmark::DoNotOptimize(handler.count);
+    }
+}
+
+class CountingCompactStarHandler : public CompactStarHandler
+{
+ public:
+    void process(const StarView&, float, float) override { ++count; }
+
+    std::size_t count{ 0 };
+};
+
+// Same search as BM_StarOctreeVisibleStars over a CompactStarStore with
+// exact or quantized positions, with the memory used per star for
+// comparison with sizeof(Star)
+void BM_CompactStarStoreVisibleStars(benchmark::State& state)
+{
+    std::unique_ptr<StarDatabase> starDB = makeStarDatabase(200000);
+    float limitingMag = static_cast<float>(state.range(0));
+    float positionTolerance = state.range(1) != 0 ? 0.1f : 0.0f;
+    std::unique_ptr<CompactStarStore> store = starDB->createCompactStore(positionTolerance);
+
+    for (auto _ : state)
+    {
+        CountingCompactStarHandler handler;
+        store->findVisibleStars(handler,
+                                Eigen::Vector3f(10.0f, -20.0f, 30.0f),
+                                Eigen::Quaternionf::Identity(),
+                                0.8f, 1.5f, limitingMag);
+        benchmark::DoNotOptimize(handler.count);
+    }
+
+    state.counters["bytes_per_star"] = static_cast<double>(store->memoryUsage()) / store->size();
+    state.counters["star_size"] = static_cast<double>(sizeof(Star));
+}
+
+// The stars of makeStarsDat() sorted into an octree of their own, so that
+// the traversal can be run with and without the culling table
+struct StarOctreeData
+{
+    std::vector<Star> stars;
+    std::unique_ptr<StarOctree> octree;
+    StarCullingTable table;
+};
+
+std::unique_ptr<StarOctreeData> makeStarOctree(std::uint32_t nStars)
+{
+    constexpr float rootSize = 1.0e9f;
+    StarDetails* details = StarDetails::GetStarDetails(StellarClass(StellarClass::NormalStar,
+                                                                    StellarClass::Spectral_G, 2,
+                                                                    StellarClass::Lum_V));
+    std::vector<Star> unsorted(nStars);
+    std::uint32_t seed = 12345;
+    auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+    for (std::uint32_t i = 0; i < nStars; ++i)
+    {
+        Star& star = unsorted[i];
+        star.setIndex(i + 1);
+        star.setDetails(details);
+        float x = static_cast<float>(next() % 20000) - 10000.0f;
+        float y = static_cast<float>(next() % 20000) - 10000.0f;
+        float z = static_cast<float>(next() % 20000) - 10000.0f;
+        star.setPosition(x, y, z);
+        star.setAbsoluteMagnitude(static_cast<float>(static_cast<int>(next() % 4096) - 1024) / 256.0f);
+    }
+
+    DynamicStarOctree root(Eigen::Vector3f(1000.0f, 1000.0f, 1000.0f),
+                           astro::appToAbsMag(6.0f, rootSize * std::sqrt(3.0f)));
+    for (const Star& star : unsorted)
+        root.insertObject(star, rootSize);
+
+    auto data = std::make_unique<StarOctreeData>();
+    data->stars.resize(nStars);
+    Star* firstStar = data->stars.data();
+    StarOctree* octree = nullptr;
+    root.rebuildAndSort(octree, firstStar);
+    data->octree.reset(octree);
+    data->table.build(data->stars.data(), nStars);
+    return data;
+}
+
+// All-sky traversal of the star octree down to the limiting magnitude
+// given by the first argument, without (0) or with (1) the culling table
+void BM_StarOctreeCulling(benchmark::State& state)
+{
+    std::unique_ptr<StarOctreeData> data = makeStarOctree(200000);
+    float limitingMag = static_cast<float>(state.range(0));
+    bool useTable = state.range(1) != 0;
+
+    Eigen::Hyperplane<float, 3> frustumPlanes[5];
+    for (auto& plane : frustumPlanes)
+        plane = Eigen::Hyperplane<float, 3>(Eigen::Vector3f::UnitZ(), 1.0e12f);
+    Eigen::Vector3f observer(10.0f, -20.0f, 30.0f);
+
+    std::size_t count = 0;
+    for (auto _ : state)
+    {
+        CountingStarHandler handler;
+        if (useTable)
+            data->octree->processVisibleObjects(handler, data->table, observer, frustumPlanes, limitingMag, 1.0e9f);
+        else
+            data->octree->processVisibleObjects(handler, observer, frustumPlanes, limitingMag, 1.0e9f);
+        count = handler.count;
+        benchmark::DoNotOptimize(count);
+    }
+    state.counters["visible"] = static_cast<double>(count);
+}
+
+// Pseudo-random catalog numbers, a tenth of them not in the catalog
+std::vector<AstroCatalog::IndexNumber> makeLookupNumbers(std::uint32_t nStars, std::size_t count)
+{
+    std::vector<AstroCatalog::IndexNumber> numbers;
+    std::uint32_t seed = 54321;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        numbers.push_back((seed >> 8) % (nStars + nStars / 10) + 1);
+    }
+    return numbers;
+}
+
+// Look up catalog numbers one by one (arg = 0) or all at once (arg = 1)
+void BM_StarDatabaseFind(benchmark::State& state)
+{
+    constexpr std::uint32_t nStars = 2000000;
+    std::unique_ptr<StarDatabase> starDB = makeStarDatabase(nStars);
+    std::vector<AstroCatalog::IndexNumber> numbers = makeLookupNumbers(nStars, 10000);
+    std::vector<Star*> found(numbers.size());
+
+    bool bulk = state.range(0) != 0;
+    for (auto _ : state)
+    {
+        if (bulk)
+        {
+            starDB->find(numbers, found.data());
+        }
+        else
+        {
+            for (std::size_t i = 0; i < numbers.size(); ++i)
+                found[i] = starDB->find(numbers[i]);
+        }
+        benchmark::DoNotOptimize(found.data());
+    }
+    state.SetItemsProcessed(state.iterations() * numbers.size());
+}
+
+// The same lookups as BM_StarDatabaseFind, by binary search in an array of
+// stars sorted by catalog number as the database used to do.
+void BM_SortedCatalogNumberSearch(benchmark::State& state)
+{
+    constexpr std::uint32_t nStars = 2000000;
+    std::unique_ptr<StarDatabase> starDB = makeStarDatabase(nStars);
+    std::vector<AstroCatalog::IndexNumber> numbers = makeLookupNumbers(nStars, 10000);
+    std::vector<Star*> found(numbers.size());
+
+    std::vector<Star*> index(starDB->size());
+    for (std::uint32_t i = 0; i < starDB->size(); ++i)
+        index[i] = starDB->getStar(i);
+    std::sort(index.begin(), index.end(),
+              [](const Star* a, const Star* b) { return a->getIndex() < b->getIndex(); });
+
+    for (auto _ : state)
+    {
+        for (std::size_t i = 0; i < numbers.size(); ++i)
+        {
+            auto iter = std::lower_bound(index.begin(), index.end(), numbers[i],
+                                         [](const Star* star, AstroCatalog::IndexNumber n) { return star->getIndex() < n; });
+            found[i] = iter != index.end() && (*iter)->getIndex() == numbers[i] ? *iter : nullptr;
+        }
+        benchmark::DoNotOptimize(found.data());
+    }
+    state.SetItemsProcessed(state.iterations() * numbers.size());
+}
+
+void BM_UniversePick(benchmark::State& state)
+{
+    std::unique_ptr<StarDatabase> starDB = makeStarDatabase(200000);
+    DSODatabase dsoDB;
+    dsoDB.finish();
+    SolarSystemCatalog solarSystems;
+
+    Universe universe;
+    universe.setStarCatalog(starDB.get());
+    universe.setDSOCatalog(&dsoDB);
+    universe.setSolarSystemCatalog(&solarSystems);
+
+    Eigen::Vector3f direction = Eigen::Vector3f(0.3f, -0.2f, -1.0f).normalized();
+    for (auto _ : state)
+    {
+        Selection sel = universe.pick(UniversalCoord::Zero(), direction, 2451545.0,
+                                      Renderer::ShowStars | Renderer::ShowPlanets,
+                                      8.0f, 0.001f);
+        benchmark::DoNotOptimize(sel);
+    }
+}
+
+void BM_NameDatabaseCompletion(benchmark::State& state)
+{
+    NameDatabase names;
+    for (AstroCatalog::IndexNumber i = 0; i < 100000; ++i)
+        names.add(i, "Star " + std::to_string(i * 7919 % 1000003));
+
+    const std::string prefix = "Star 12";
+    for (auto _ : state)
+    {
+        std::vector<std::string> completion = names.getCompletion(prefix, false);
+        benchmark::DoNotOptimize(completion.data());
+    }
+}
+
+} // end unnamed namespace
+
+BENCHMARK(BM_StarDatabaseLoadBinary)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_StarOctreeVisibleStars)
+    ->ArgsProduct({ { 6, 10, 14 }, { 0, 4 } })
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_CompactStarStoreVisibleStars)
+    ->ArgsProduct({ { 6, 10, 14 }, { 0, 1 } })
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_StarOctreeCulling)
+    ->ArgsProduct({ { 6, 10, 14, 18 }, { 0, 1 } })
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_StarDatabaseFind)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_SortedCatalogNumberSearch)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_UniversePick)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_NameDatabaseCompletion)->Unit(benchmark::kMicrosecond);
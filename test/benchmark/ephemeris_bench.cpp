@@ -0,0 +1,281 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <celcompat/filesystem.h>
+#include <celephem/chebyshevorbit.h>
+#include <celephem/customorbittype.h>
+#include <celephem/jpleph.h>
+#include <celephem/orbit.h>
+#include <celephem/samporbit.h>
+#include <celephem/vsop87.h>
+
+#include <benchmark/benchmark.h>
+
+using celestia::ephem::CachingOrbit;
+using celestia::ephem::CustomOrbitType;
+using celestia::ephem::JPLEphemeris;
+using celestia::ephem::JPLEphemItem;
+using celestia::ephem::Orbit;
+
+namespace
+{
+
+template<typename T>
+void putValue(std::string& buffer, std::size_t offset, T value)
+{
+    std::memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+// Synthetic DE405-style ephemeris with 13 coefficients and 2 granules per
+// item and pseudo-random coefficients; only the layout matters here.
+std::string makeJPLEphemeris(unsigned int nRecords)
+{
+    constexpr unsigned int nItems = JPLEphemeris::JPLEph_NItems;
+    constexpr std::uint32_t nCoeffs = 13;
+    constexpr std::uint32_t nGranules = 2;
+    constexpr double daysPerInterval = 32.0;
+    constexpr double startDate = 2451536.5;
+
+    // The nutations (the last item) and librations are left out
+    std::uint32_t recordSize = (nItems - 1) * nCoeffs * nGranules * 3 + 2;
+    std::string header(recordSize * sizeof(double), '\0');
+
+    // Offsets of the fields in the header record
+    constexpr std::size_t dateOffset = 3 * 84 + 400 * 6;
+    putValue(header, dateOffset, startDate);
+    putValue(header, dateOffset + 8, startDate + daysPerInterval * nRecords);
+    putValue(header, dateOffset + 16, daysPerInterval);
+    putValue(header, dateOffset + 28, 149597870.691);
+    putValue(header, dateOffset + 36, 81.30056);
+    constexpr std::size_t coeffInfoOffset = dateOffset + 44;
+    for (unsigned int i = 0; i < nItems - 1; ++i)
+    {
+        putValue<std::uint32_t>(header, coeffInfoOffset + i * 12, 3 + i * nCoeffs * nGranules * 3);
+        putValue<std::uint32_t>(header, coeffInfoOffset + i * 12 + 4, nCoeffs);
+        putValue<std::uint32_t>(header, coeffInfoOffset + i * 12 + 8, nGranules);
+    }
+    putValue<std::uint32_t>(header, coeffInfoOffset + nItems * 12, 405);
+
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    out.write(header.data(), header.size());
+    // Constants record
+    out.write(std::string(header.size(), '\0').data(), header.size());
+
+    std::uint32_t seed = 4321;
+    for (unsigned int i = 0; i < nRecords; ++i)
+    {
+        double t0 = startDate + daysPerInterval * i;
+        double t1 = t0 + daysPerInterval;
+        out.write(reinterpret_cast<const char*>(&t0), sizeof(t0));
+        out.write(reinterpret_cast<const char*>(&t1), sizeof(t1));
+        for (std::uint32_t j = 0; j < recordSize - 2; ++j)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            double coeff = static_cast<double>(seed >> 8) / 1.0e3;
+            out.write(reinterpret_cast<const char*>(&coeff), sizeof(coeff));
+        }
+    }
+
+    return out.str();
+}
+
+void BM_VSOP87Position(benchmark::State& state)
+{
+    // The time changes on every call so that the cached position is never
+    // reused.
+    std::unique_ptr<Orbit> orbit = celestia::ephem::CreateVSOP87Orbit(CustomOrbitType::VSOP87Earth, "vsop87-earth");
+    double t = 2451545.0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(orbit->positionAtTime(t));
+        t += 0.37;
+    }
+}
+
+void BM_VSOP87Positions(benchmark::State& state)
+{
+    // A batch of times across one orbit, as when plotting it
+    std::unique_ptr<Orbit> orbit = celestia::ephem::CreateVSOP87Orbit(CustomOrbitType::VSOP87Earth, "vsop87-earth");
+    std::vector<double> jds(static_cast<std::size_t>(state.range(0)));
+    for (std::size_t i = 0; i < jds.size(); ++i)
+        jds[i] = 2451545.0 + 365.25 * static_cast<double>(i) / static_cast<double>(jds.size());
+
+    std::vector<Eigen::Vector3d> positions(jds.size());
+    for (auto _ : state)
+    {
+        orbit->positionsAtTimes(jds.data(), jds.size(), positions.data());
+        benchmark::DoNotOptimize(positions.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_ChebyshevVSOP87Position(benchmark::State& state)
+{
+    constexpr double startTime = 2451545.0;
+    constexpr double span = 36525.0;
+
+    celestia::ephem::ChebyshevFitOptions options;
+    options.startTime = startTime;
+    options.endTime = startTime + span;
+    celestia::ephem::SetChebyshevFitOptions(options);
+    std::unique_ptr<Orbit> orbit = celestia::ephem::CreateVSOP87Orbit(CustomOrbitType::VSOP87Earth, "vsop87-earth");
+    celestia::ephem::SetChebyshevFitOptions(celestia::ephem::ChebyshevFitOptions());
+
+    // Fit all the segments before timing
+    for (double t = startTime; t < startTime + span; t += 1.0)
+        orbit->positionAtTime(t);
+
+    double t = 0.0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(orbit->positionAtTime(startTime + t));
+        t = std::fmod(t + 0.37, span);
+    }
+}
+
+void BM_JPLEphemerisPosition(benchmark::State& state)
+{
+    std::istringstream in(makeJPLEphemeris(1000), std::ios::in | std::ios::binary);
+    std::unique_ptr<JPLEphemeris> eph(JPLEphemeris::load(in));
+    if (eph == nullptr)
+    {
+        state.SkipWithError("Failed to load the ephemeris");
+        return;
+    }
+
+    auto item = static_cast<JPLEphemItem>(state.range(0));
+    double span = eph->getEndDate() - eph->getStartDate();
+    double t = 0.0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(eph->getPlanetPosition(item, eph->getStartDate() + t));
+        t += 3.7;
+        if (t >= span)
+            t -= span;
+    }
+}
+
+void BM_JPLEphemerisPositions(benchmark::State& state)
+{
+    // The planets, Sun and Moon at once, as for a frame showing the solar
+    // system
+    std::istringstream in(makeJPLEphemeris(1000), std::ios::in | std::ios::binary);
+    std::unique_ptr<JPLEphemeris> eph(JPLEphemeris::load(in));
+    if (eph == nullptr)
+    {
+        state.SkipWithError("Failed to load the ephemeris");
+        return;
+    }
+
+    std::vector<JPLEphemItem> items;
+    for (int i = static_cast<int>(JPLEphemItem::Mercury); i <= static_cast<int>(JPLEphemItem::Sun); ++i)
+        items.push_back(static_cast<JPLEphemItem>(i));
+    items.push_back(JPLEphemItem::Earth);
+
+    std::vector<Eigen::Vector3d> positions(items.size());
+    double span = eph->getEndDate() - eph->getStartDate();
+    double t = 0.0;
+    for (auto _ : state)
+    {
+        eph->getPlanetPositions(items.data(), items.size(), eph->getStartDate() + t, positions.data());
+        benchmark::DoNotOptimize(positions.data());
+        t += 3.7;
+        if (t >= span)
+            t -= span;
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(items.size()));
+}
+
+void BM_JPLEphemerisLoad(benchmark::State& state)
+{
+    // Loading a file and computing one position, streamed or mapped
+    fs::path path = fs::temp_directory_path() / "celestia_bench_jpleph.dat";
+    {
+        std::string data = makeJPLEphemeris(20000);
+        std::ofstream out(path, std::ios::out | std::ios::binary);
+        out.write(data.data(), data.size());
+    }
+
+    for (auto _ : state)
+    {
+        std::unique_ptr<JPLEphemeris> eph;
+        if (state.range(0) == 0)
+        {
+            std::ifstream in(path, std::ios::in | std::ios::binary);
+            eph.reset(JPLEphemeris::load(in));
+        }
+        else
+        {
+            eph.reset(JPLEphemeris::load(path));
+        }
+
+        if (eph == nullptr)
+        {
+            state.SkipWithError("Failed to load the ephemeris");
+            break;
+        }
+        benchmark::DoNotOptimize(eph->getPlanetPosition(JPLEphemItem::Mars, 2451545.0));
+    }
+
+    fs::remove(path);
+}
+
+void BM_SampledOrbitPosition(benchmark::State& state)
+{
+    // A circular orbit with a one day step
+    constexpr int nSamples = 20000;
+    fs::path path = fs::temp_directory_path() / "celestia_bench_orbit.xyz";
+    {
+        std::ofstream out(path);
+        out.precision(17);
+        for (int i = 0; i < nSamples; ++i)
+        {
+            double angle = i * 0.01;
+            out << 2451545.0 + i << ' ' << 1.0e8 * std::cos(angle) << ' '
+                << 1.0e8 * std::sin(angle) << " 0\n";
+        }
+    }
+
+    auto interpolation = state.range(0) == 0
+        ? celestia::ephem::TrajectoryInterpolation::Linear
+        : celestia::ephem::TrajectoryInterpolation::Cubic;
+    std::unique_ptr<Orbit> orbit = celestia::ephem::LoadSampledTrajectoryDoublePrec(path, interpolation);
+    fs::remove(path);
+    const auto* sampled = dynamic_cast<const CachingOrbit*>(orbit.get());
+    if (sampled == nullptr)
+    {
+        state.SkipWithError("Failed to load the trajectory");
+        return;
+    }
+
+    // Times jump around the trajectory, as when many are sampled at once
+    double t = 0.0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(sampled->computePosition(2451545.0 + t));
+        t += 1234.567;
+        if (t >= nSamples - 1)
+            t -= nSamples - 1;
+    }
+}
+
+} // end unnamed namespace
+
+BENCHMARK(BM_VSOP87Position);
+BENCHMARK(BM_VSOP87Positions)->Arg(150);
+BENCHMARK(BM_ChebyshevVSOP87Position);
+BENCHMARK(BM_JPLEphemerisPosition)
+    ->Arg(static_cast<int>(JPLEphemItem::Mars))
+    ->Arg(static_cast<int>(JPLEphemItem::Earth));
+BENCHMARK(BM_JPLEphemerisPositions);
+BENCHMARK(BM_JPLEphemerisLoad)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SampledOrbitPosition)->Arg(0)->Arg(1);
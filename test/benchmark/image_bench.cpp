@@ -0,0 +1,179 @@
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <celcompat/filesystem.h>
+#include <celengine/image.h>
+#include <celimage/dds_decompress.h>
+#include <celimage/imageformats.h>
+
+#include <benchmark/benchmark.h>
+
+namespace
+{
+
+void writeLE(std::ofstream& out, std::uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.put(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+// Write a DDS file of random blocks with a complete mip chain
+void writeDDS(const fs::path& path, std::string_view fourCC, std::uint32_t width, std::uint32_t height)
+{
+    std::uint32_t blockSize = fourCC == "DXT1" ? 8 : 16;
+    std::uint32_t mipLevels = 1;
+    while (((width > height ? width : height) >> mipLevels) != 0)
+        ++mipLevels;
+
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write("DDS ", 4);
+    std::uint32_t desc[31] = { 124, 0x000a1007, height, width, 0, 0, mipLevels };
+    desc[18] = 32;
+    desc[19] = 4;
+    desc[20] = static_cast<std::uint32_t>(fourCC[0]) | (static_cast<std::uint32_t>(fourCC[1]) << 8) |
+               (static_cast<std::uint32_t>(fourCC[2]) << 16) | (static_cast<std::uint32_t>(fourCC[3]) << 24);
+    for (std::uint32_t value : desc)
+        writeLE(out, value);
+
+    std::uint32_t seed = 1;
+    for (std::uint32_t mip = 0; mip < mipLevels; ++mip)
+    {
+        std::uint32_t w = width >> mip > 0 ? width >> mip : 1;
+        std::uint32_t h = height >> mip > 0 ? height >> mip : 1;
+        std::uint32_t size = ((w + 3) / 4) * ((h + 3) / 4) * blockSize;
+        for (std::uint32_t i = 0; i < size / 4; ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            writeLE(out, seed);
+        }
+    }
+}
+
+// Load a 4k x 2k DDS texture without S3TC support, which decompresses all
+// of its mip levels
+void loadDDS(benchmark::State& state, std::string_view fourCC)
+{
+    fs::path path = fs::temp_directory_path() / "celestia-image-bench.dds";
+    writeDDS(path, fourCC, 4096, 2048);
+
+    for (auto _ : state)
+    {
+        std::unique_ptr<Image> img(LoadDDSImage(path));
+        benchmark::DoNotOptimize(img.get());
+    }
+
+    std::error_code ec;
+    fs::remove(path, ec);
+}
+
+void BM_LoadDDSDXT1(benchmark::State& state)
+{
+    loadDDS(state, "DXT1");
+}
+
+void BM_LoadDDSDXT5(benchmark::State& state)
+{
+    loadDDS(state, "DXT5");
+}
+
+using DecompressRowFunction = void (*)(const std::uint8_t*, std::uint32_t, bool, std::uint32_t*);
+
+// Decompress the blocks of a 4k x 2k texture in memory, a row at a time
+void decompressDXT(benchmark::State& state, DecompressRowFunction decompressRow, std::uint32_t blockSize)
+{
+    constexpr std::uint32_t width = 4096;
+    constexpr std::uint32_t height = 2048;
+    constexpr std::uint32_t nBlocks = width / 4;
+
+    std::vector<std::uint8_t> blocks(nBlocks * (height / 4) * blockSize);
+    std::uint32_t seed = 1;
+    for (std::uint8_t& b : blocks)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        b = static_cast<std::uint8_t>(seed >> 24);
+    }
+
+    bool transparent0 = state.range(0) != 0;
+    std::vector<std::uint32_t> texels(width * height);
+    for (auto _ : state)
+    {
+        for (std::uint32_t row = 0; row < height / 4; ++row)
+            decompressRow(blocks.data() + row * nBlocks * blockSize, nBlocks, transparent0, texels.data() + row * 4 * width);
+        benchmark::DoNotOptimize(texels.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * width * height);
+}
+
+void BM_DecompressDXT1(benchmark::State& state)
+{
+    decompressDXT(state, DecompressBlockRowDXT1, 8);
+}
+
+void BM_DecompressDXT3(benchmark::State& state)
+{
+    decompressDXT(state, DecompressBlockRowDXT3, 16);
+}
+
+void BM_DecompressDXT5(benchmark::State& state)
+{
+    decompressDXT(state, DecompressBlockRowDXT5, 16);
+}
+
+// A 4k x 2k image of random texels
+std::unique_ptr<Image> randomImage(celestia::PixelFormat format)
+{
+    auto img = std::make_unique<Image>(format, 4096, 2048);
+    std::uint32_t seed = 1;
+    for (int i = 0; i < img->getSize(); i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        img->getPixels()[i] = static_cast<std::uint8_t>(seed >> 24);
+    }
+    return img;
+}
+
+void BM_ComputeNormalMap(benchmark::State& state)
+{
+    std::unique_ptr<Image> heightMap = randomImage(celestia::PixelFormat::LUMINANCE);
+    for (auto _ : state)
+    {
+        std::unique_ptr<Image> normalMap(heightMap->computeNormalMap(2.5f, true, GetImageThreadPool()));
+        benchmark::DoNotOptimize(normalMap.get());
+    }
+}
+
+void buildMipmaps(benchmark::State& state, Image::MipmapFilter filter)
+{
+    std::unique_ptr<Image> img = randomImage(celestia::PixelFormat::RGB);
+    for (auto _ : state)
+    {
+        std::unique_ptr<Image> mipmaps(img->buildMipmaps(filter, true, true, GetImageThreadPool()));
+        benchmark::DoNotOptimize(mipmaps.get());
+    }
+}
+
+void BM_BuildBoxMipmaps(benchmark::State& state)
+{
+    buildMipmaps(state, Image::MipmapFilter::Box);
+}
+
+void BM_BuildKaiserMipmaps(benchmark::State& state)
+{
+    buildMipmaps(state, Image::MipmapFilter::Kaiser);
+}
+
+} // end unnamed namespace
+
+BENCHMARK(BM_LoadDDSDXT1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_LoadDDSDXT5)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DecompressDXT1)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DecompressDXT3)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DecompressDXT5)->Arg(0)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ComputeNormalMap)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BuildBoxMipmaps)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BuildKaiserMipmaps)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,170 @@
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <celcompat/filesystem.h>
+#include <celengine/geometry.h>
+#include <celengine/meshmanager.h>
+#include <celmodel/model.h>
+#include <celmodel/modelfile.h>
+#include <celutil/reshandle.h>
+
+#include <benchmark/benchmark.h>
+
+namespace
+{
+
+class ModelData
+{
+ public:
+    ModelData()
+    {
+        std::ifstream f(fs::path(CELESTIA_TEST_DATA_DIR) / "iss" / "models" / "iss.cmod",
+                        std::ios::in | std::ios::binary);
+        std::stringstream data;
+        data << f.rdbuf();
+        binary = data.str();
+
+        // The ASCII version is made from the binary one
+        data.seekg(0);
+        std::unique_ptr<cmod::Model> model = cmod::LoadModel(data, handleGetter);
+        if (model == nullptr)
+            return;
+
+        std::ostringstream out;
+        cmod::SourceGetter sourceGetter = [this](ResourceHandle h) { return paths[h]; };
+        if (cmod::SaveModelAscii(model.get(), out, sourceGetter))
+            ascii = out.str();
+    }
+
+    std::string binary;
+    std::string ascii;
+
+    std::vector<fs::path> paths;
+    cmod::HandleGetter handleGetter = [this](const fs::path& path)
+    {
+        paths.push_back(path);
+        return static_cast<ResourceHandle>(paths.size() - 1);
+    };
+};
+
+void loadModel(benchmark::State& state, const std::string& data, const cmod::HandleGetter& handleGetter)
+{
+    if (data.empty())
+    {
+        state.SkipWithError("Failed to read iss.cmod");
+        return;
+    }
+
+    for (auto _ : state)
+    {
+        std::istringstream in(data, std::ios::in | std::ios::binary);
+        std::unique_ptr<cmod::Model> model = cmod::LoadModel(in, handleGetter);
+        benchmark::DoNotOptimize(model.get());
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(data.size()));
+}
+
+void BM_LoadBinaryModel(benchmark::State& state)
+{
+    ModelData data;
+    loadModel(state, data.binary, data.handleGetter);
+}
+
+void BM_LoadAsciiModel(benchmark::State& state)
+{
+    ModelData data;
+    loadModel(state, data.ascii, data.handleGetter);
+}
+
+// Pick the ISS model with rays from all around it, as when hovering
+// the mouse over it
+void BM_PickModel(benchmark::State& state)
+{
+    ModelData data;
+    std::istringstream in(data.binary, std::ios::in | std::ios::binary);
+    std::unique_ptr<cmod::Model> model = cmod::LoadModel(in, data.handleGetter);
+    if (model == nullptr)
+    {
+        state.SkipWithError("Failed to read iss.cmod");
+        return;
+    }
+
+    Eigen::AlignedBox3d bounds;
+    for (unsigned int i = 0; i < model->getMeshCount(); i++)
+        bounds.extend(model->getMesh(i)->getBoundingBox().cast<double>());
+
+    std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d>> rays;
+    std::uint32_t seed = 12345;
+    auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return static_cast<double>(seed >> 8) / 16777216.0; };
+    for (int i = 0; i < 100; i++)
+    {
+        Eigen::Vector3d origin = bounds.center() +
+            Eigen::Vector3d(next() - 0.5, next() - 0.5, next() - 0.5).normalized() * bounds.diagonal().norm();
+        Eigen::Vector3d target = bounds.min() + bounds.sizes().cwiseProduct(Eigen::Vector3d(next(), next(), next()));
+        rays.emplace_back(origin, (target - origin).normalized());
+    }
+
+    for (auto _ : state)
+    {
+        for (const auto& [origin, direction] : rays)
+        {
+            cmod::Mesh::PickResult result;
+            benchmark::DoNotOptimize(model->pick(origin, direction, &result));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(rays.size()));
+}
+
+// Load the ASCII model as an add-on model, converting it on each load or
+// reading it from the cache of converted models
+void loadGeometry(benchmark::State& state, bool cached)
+{
+    ModelData data;
+    fs::path dir = fs::temp_directory_path() / "celestia-model-bench";
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    fs::create_directories(dir, ec);
+    {
+        std::ofstream out(dir / "iss.cmod", std::ios::out | std::ios::binary);
+        out << data.ascii;
+    }
+
+    SetModelCacheDirectory(cached ? dir / "cache" : fs::path());
+    GeometryInfo info("iss.cmod");
+    fs::path resolvedName = info.resolve(dir);
+    for (auto _ : state)
+    {
+        std::unique_ptr<Geometry> geometry(info.load(resolvedName));
+        benchmark::DoNotOptimize(geometry.get());
+    }
+
+    SetModelCacheDirectory(fs::path());
+    fs::remove_all(dir, ec);
+}
+
+void BM_LoadAsciiGeometry(benchmark::State& state)
+{
+    loadGeometry(state, false);
+}
+
+void BM_LoadCachedGeometry(benchmark::State& state)
+{
+    loadGeometry(state, true);
+}
+
+} // end unnamed namespace
+
+BENCHMARK(BM_LoadBinaryModel)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_LoadAsciiModel)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_PickModel)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_LoadAsciiGeometry)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_LoadCachedGeometry)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,94 @@
+#include <sstream>
+#include <string>
+
+#include <fmt/format.h>
+
+#include <celengine/parser.h>
+#include <celengine/stardb.h>
+
+#include <benchmark/benchmark.h>
+
+namespace
+{
+
+// Synthetic .ssc file with asteroids on elliptical orbits, as in the
+// minor body add-ons
+std::string makeSsc(int nBodies)
+{
+    std::string ssc;
+    for (int i = 0; i < nBodies; ++i)
+    {
+        ssc += fmt::format(
+            "\"Asteroid {0}:{0} Minor\" \"Sol\"\n"
+            "{{\n"
+            "    Class \"asteroid\"\n"
+            "    Radius {1}\n"
+            "    Texture \"asteroid.jpg\"\n"
+            "    EllipticalOrbit\n"
+            "    {{\n"
+            "        Epoch 2458600.5\n"
+            "        Period {2}\n"
+            "        SemiMajorAxis {3}\n"
+            "        Eccentricity {4}\n"
+            "        Inclination {5}\n"
+            "        AscendingNode {6}\n"
+            "        ArgOfPericenter {7}\n"
+            "        MeanAnomaly {8}\n"
+            "    }}\n"
+            "    RotationPeriod 7.5\n"
+            "    Albedo 0.1\n"
+            "}}\n\n",
+            i, 1.0 + i % 50, 3.5 + i % 7 * 0.1, 2.3 + i % 11 * 0.05,
+            0.01 * (i % 30), i % 25, i % 360, (i * 7) % 360, (i * 13) % 360);
+    }
+    return ssc;
+}
+
+// Synthetic .stc file with stars given by their coordinates
+std::string makeStc(int nStars)
+{
+    std::string stc;
+    for (int i = 0; i < nStars; ++i)
+    {
+        stc += fmt::format(
+            "{0} \"Star {0}\"\n"
+            "{{\n"
+            "    RA {1}\n"
+            "    Dec {2}\n"
+            "    Distance {3}\n"
+            "    SpectralType \"G2V\"\n"
+            "    AppMag {4}\n"
+            "}}\n\n",
+            3000000 + i, (i * 37) % 360 + 0.5, (i * 17) % 180 - 89.5, 10.0 + i % 1000, 5.0 + (i % 100) * 0.1);
+    }
+    return stc;
+}
+
+void BM_ParseSsc(benchmark::State& state)
+{
+    std::string ssc = makeSsc(static_cast<int>(state.range(0)));
+    for (auto _ : state)
+    {
+        std::istringstream in(ssc);
+        ParsedCatalog catalog = ParsedCatalog::read(in);
+        benchmark::DoNotOptimize(catalog.getTokens());
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(ssc.size()));
+}
+
+void BM_StarDatabaseLoadStc(benchmark::State& state)
+{
+    std::string stc = makeStc(static_cast<int>(state.range(0)));
+    for (auto _ : state)
+    {
+        StarDatabase starDB;
+        std::istringstream in(stc);
+        benchmark::DoNotOptimize(starDB.load(in));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+} // end unnamed namespace
+
+BENCHMARK(BM_ParseSsc)->Arg(1000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_StarDatabaseLoadStc)->Arg(1000)->Unit(benchmark::kMillisecond);
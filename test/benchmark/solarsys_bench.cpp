@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <celengine/body.h>
+#include <celengine/frame.h>
+#include <celengine/frametree.h>
+#include <celengine/solarsys.h>
+#include <celengine/solarsysstate.h>
+#include <celengine/star.h>
+#include <celengine/timeline.h>
+#include <celengine/timelinephase.h>
+#include <celephem/orbit.h>
+#include <celephem/rotation.h>
+#include <celutil/threadpool.h>
+
+#include <benchmark/benchmark.h>
+
+using celestia::ephem::ConstantOrientation;
+using celestia::ephem::EllipticalOrbit;
+using celestia::ephem::Orbit;
+using celestia::ephem::RotationModel;
+
+namespace
+{
+
+constexpr double Epoch = 2451545.0;
+
+// A star with many asteroids on elliptical orbits, as added by minor body
+// catalogs.
+class AsteroidSystem
+{
+ public:
+    explicit AsteroidSystem(int nAsteroids)
+    {
+        solarSystem = std::make_unique<SolarSystem>(&star);
+        rotation = std::make_unique<ConstantOrientation>(Eigen::Quaterniond::Identity());
+        FrameTree* tree = solarSystem->getFrameTree();
+        auto frame = std::make_shared<J2000EclipticFrame>(Selection(&star));
+
+        for (int i = 0; i < nAsteroids; i++)
+        {
+            auto& body = bodies.emplace_back(std::make_unique<Body>(solarSystem->getPlanets(),
+                                                                    "Asteroid " + std::to_string(i)));
+            auto& orbit = orbits.emplace_back(std::make_unique<EllipticalOrbit>(3.0e8 + 100.0 * i, 0.1, 0.1, 0.001 * i,
+                                                                                0.002 * i, 0.003 * i, 1500.0, Epoch));
+            auto phase = std::make_shared<const TimelinePhase>(body.get(), -1.0e10, 1.0e10,
+                                                               frame, orbit.get(), frame, rotation.get(),
+                                                               tree);
+            tree->addChild(phase);
+            auto timeline = std::make_unique<Timeline>();
+            timeline->appendPhase(phase);
+            body->setTimeline(timeline.release());
+        }
+    }
+
+    const FrameTree& getFrameTree() const { return *solarSystem->getFrameTree(); }
+
+ private:
+    Star star;
+    std::unique_ptr<SolarSystem> solarSystem;
+    std::unique_ptr<RotationModel> rotation;
+    std::vector<std::unique_ptr<Orbit>> orbits;
+
+ public:
+    std::vector<std::unique_ptr<Body>> bodies;
+};
+
+// Walk the frame tree and compute each body's position, as each of the
+// render list builders and the picker did.
+void BM_FrameTreePositions(benchmark::State& state)
+{
+    AsteroidSystem system(static_cast<int>(state.range(0)));
+    const FrameTree& tree = system.getFrameTree();
+    double tdb = Epoch;
+    for (auto _ : state)
+    {
+        Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+        for (unsigned int i = 0; i < tree.childCount(); i++)
+        {
+            const auto& phase = tree.getChild(i);
+            if (phase->includes(tdb))
+                sum += phase->body()->getAstrocentricPosition(tdb);
+        }
+        benchmark::DoNotOptimize(sum);
+        tdb += 0.01;
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Arg 0: number of bodies; arg 1: number of threads
+void BM_SolarSystemStateUpdate(benchmark::State& state)
+{
+    AsteroidSystem system(static_cast<int>(state.range(0)));
+    std::unique_ptr<celestia::util::ThreadPool> pool;
+    if (state.range(1) > 0)
+        pool = std::make_unique<celestia::util::ThreadPool>(static_cast<unsigned int>(state.range(1)));
+
+    SolarSystemState systemState;
+    double tdb = Epoch;
+    for (auto _ : state)
+    {
+        systemState.update(system.getFrameTree(), tdb, pool.get());
+        benchmark::DoNotOptimize(systemState[0].position);
+        tdb += 0.01;
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Find the bodies in a narrow view cone, testing each body (arg 1 = 0) or
+// skipping groups of bodies outside of the cone (arg 1 = 1).
+// Arg 0: number of bodies
+void BM_BodiesInViewCone(benchmark::State& state)
+{
+    AsteroidSystem system(static_cast<int>(state.range(0)));
+    SolarSystemState systemState;
+    systemState.update(system.getFrameTree(), Epoch);
+
+    Eigen::Vector3d observer(0.0, 0.0, 0.0);
+    Eigen::Vector3d viewDirection = (systemState[0].position - observer).normalized();
+    const double cosConeAngle = std::cos(0.01);
+    auto inCone = [&](const Eigen::Vector3d& center, double radius)
+    {
+        Eigen::Vector3d offset = center - observer;
+        double distance = offset.norm();
+        return distance <= radius ||
+               std::acos(std::clamp(offset.dot(viewDirection) / distance, -1.0, 1.0)) - std::asin(radius / distance)
+                   <= std::acos(cosConeAngle);
+    };
+
+    bool culled = state.range(1) != 0;
+    for (auto _ : state)
+    {
+        std::size_t nVisible = 0;
+        systemState.forEachChild(SolarSystemState::NoParent,
+                                 [&](const SolarSystemState::BoundingNode& node)
+                                 {
+                                     return !culled || inCone(node.center, node.radius);
+                                 },
+                                 [&](std::uint32_t i)
+                                 {
+                                     if (inCone(systemState[i].position, systemState[i].body->getCullingRadius()))
+                                         nVisible++;
+                                 });
+        benchmark::DoNotOptimize(nVisible);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+} // end unnamed namespace
+
+BENCHMARK(BM_FrameTreePositions)->Arg(100000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BodiesInViewCone)->Args({ 100000, 0 })->Args({ 100000, 1 })->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SolarSystemStateUpdate)->Args({ 100000, 0 })->Args({ 100000, 4 })->Unit(benchmark::kMillisecond);
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <catch.hpp>
+
+#include <celcompat/filesystem.h>
+#include <celmodel/mesh.h>
+#include <celmodel/model.h>
+#include <celmodel/modelfile.h>
+#include <celutil/reshandle.h>
+
+namespace
+{
+
+Eigen::Vector3d
+vertexPosition(const cmod::Mesh& mesh, cmod::Index32 index)
+{
+    const auto& attribute = mesh.getVertexDescription().getAttribute(cmod::VertexAttributeSemantic::Position);
+    float fv[3];
+    std::memcpy(fv, mesh.getVertexData() + index * mesh.getVertexStrideWords() + attribute.offsetWords,
+                sizeof(float) * 3);
+    return Eigen::Map<Eigen::Vector3f>(fv).cast<double>();
+}
+
+// Test each triangle of each triangle list in order, as picking did
+// before meshes had hierarchies.
+bool
+pickTriangles(const cmod::Mesh& mesh,
+              const Eigen::Vector3d& rayOrigin,
+              const Eigen::Vector3d& rayDirection,
+              cmod::Mesh::PickResult& result)
+{
+    double closest = 1.0e30;
+    bool hit = false;
+    for (unsigned int g = 0; g < mesh.getGroupCount(); g++)
+    {
+        const cmod::PrimitiveGroup* group = mesh.getGroup(g);
+        if (group->prim != cmod::PrimitiveGroupType::TriList)
+            continue;
+
+        for (std::size_t i = 0; i + 2 < group->indices.size(); i += 3)
+        {
+            Eigen::Vector3d v0 = vertexPosition(mesh, group->indices[i]);
+            Eigen::Vector3d e0 = vertexPosition(mesh, group->indices[i + 1]) - v0;
+            Eigen::Vector3d e1 = vertexPosition(mesh, group->indices[i + 2]) - v0;
+            Eigen::Vector3d n = e0.cross(e1);
+            double c = n.dot(rayDirection);
+            if (c == 0.0)
+                continue;
+
+            double t = n.dot(v0 - rayOrigin) / c;
+            if (!(t < closest && t > 0.0))
+                continue;
+
+            double m00 = e0.dot(e0);
+            double m01 = e0.dot(e1);
+            double m11 = e1.dot(e1);
+            double det = m00 * m11 - m01 * m01;
+            if (det == 0.0)
+                continue;
+
+            Eigen::Vector3d q = rayOrigin + rayDirection * t - v0;
+            double q0 = e0.dot(q);
+            double q1 = e1.dot(q);
+            double d = 1.0 / det;
+            double s0 = (m11 * q0 - m01 * q1) * d;
+            double s1 = (m00 * q1 - m01 * q0) * d;
+            if (s0 >= 0.0 && s1 >= 0.0 && s0 + s1 <= 1.0)
+            {
+                closest = t;
+                hit = true;
+                result.group = group;
+                result.primitiveIndex = static_cast<unsigned int>(i / 3);
+                result.distance = t;
+            }
+        }
+    }
+
+    return hit;
+}
+
+} // end unnamed namespace
+
+
+TEST_CASE("CMOD mesh picking", "[cmod] [integration]")
+{
+    std::vector<fs::path> paths;
+    cmod::HandleGetter handleGetter = [&](const fs::path& path)
+    {
+        paths.push_back(path);
+        return static_cast<ResourceHandle>(paths.size() - 1);
+    };
+
+    std::ifstream f("iss.cmod", std::ios::in | std::ios::binary);
+    REQUIRE(f.good());
+    std::unique_ptr<cmod::Model> model = cmod::LoadModel(f, handleGetter);
+    REQUIRE(model != nullptr);
+
+    Eigen::AlignedBox3d bounds;
+    for (unsigned int i = 0; i < model->getMeshCount(); i++)
+        bounds.extend(model->getMesh(i)->getBoundingBox().cast<double>());
+    double radius = bounds.diagonal().norm();
+
+    // Rays from all around the model towards points within its bounds
+    std::uint32_t seed = 12345;
+    auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return static_cast<double>(seed >> 8) / 16777216.0; };
+
+    int nHits = 0;
+    for (int ray = 0; ray < 500; ray++)
+    {
+        Eigen::Vector3d origin = bounds.center() +
+            Eigen::Vector3d(next() - 0.5, next() - 0.5, next() - 0.5).normalized() * radius;
+        Eigen::Vector3d target = bounds.min() + bounds.sizes().cwiseProduct(Eigen::Vector3d(next(), next(), next()));
+        Eigen::Vector3d direction = (target - origin).normalized();
+
+        for (unsigned int i = 0; i < model->getMeshCount(); i++)
+        {
+            const cmod::Mesh* mesh = model->getMesh(i);
+            cmod::Mesh::PickResult expected;
+            bool expectedHit = pickTriangles(*mesh, origin, direction, expected);
+
+            cmod::Mesh::PickResult result;
+            REQUIRE(mesh->pick(origin, direction, &result) == expectedHit);
+            if (expectedHit)
+            {
+                REQUIRE(result.distance == expected.distance);
+                REQUIRE(result.group == expected.group);
+                REQUIRE(result.primitiveIndex == expected.primitiveIndex);
+                nHits++;
+            }
+        }
+    }
+
+    REQUIRE(nHits > 100);
+}
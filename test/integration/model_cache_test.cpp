@@ -0,0 +1,96 @@
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <catch.hpp>
+
+#include <celcompat/filesystem.h>
+#include <celengine/geometry.h>
+#include <celengine/meshmanager.h>
+
+namespace
+{
+
+std::vector<fs::path> cacheFiles(const fs::path& dir)
+{
+    std::vector<fs::path> files;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec))
+        files.push_back(entry.path());
+    return files;
+}
+
+// Distances to the model along rays through its center from a few
+// directions, or -1 for the rays which miss it
+std::vector<double> pickDistances(const Geometry& geometry)
+{
+    std::vector<Eigen::Vector3d> directions
+    {
+        Eigen::Vector3d::UnitX(), Eigen::Vector3d::UnitY(), Eigen::Vector3d::UnitZ(), Eigen::Vector3d(1.0, -2.0, 3.0),
+    };
+
+    std::vector<double> distances;
+    for (const Eigen::Vector3d& direction : directions)
+    {
+        Eigen::ParametrizedLine<double, 3> ray(-2.0 * direction.normalized(), direction.normalized());
+        double distance = -1.0;
+        geometry.pick(ray, distance);
+        distances.push_back(distance);
+    }
+    return distances;
+}
+
+} // end unnamed namespace
+
+
+TEST_CASE("Model cache", "[GeometryInfo] [integration]")
+{
+    fs::path cacheDir = fs::temp_directory_path() / "celestia-model-cache-test";
+    std::error_code ec;
+    fs::remove_all(cacheDir, ec);
+    SetModelCacheDirectory(cacheDir);
+
+    GeometryInfo info("huygens.3ds");
+    fs::path resolvedName = info.resolve(".");
+
+    std::unique_ptr<Geometry> converted(info.load(resolvedName));
+    REQUIRE(converted != nullptr);
+    REQUIRE(cacheFiles(cacheDir).size() == 1);
+
+    SECTION("Cached model matches the converted one")
+    {
+        std::unique_ptr<Geometry> cached(info.load(resolvedName));
+        REQUIRE(cached != nullptr);
+        REQUIRE(cached->getMemoryUsage() == converted->getMemoryUsage());
+        REQUIRE(cached->isOpaque() == converted->isOpaque());
+        REQUIRE(pickDistances(*cached) == pickDistances(*converted));
+    }
+
+    SECTION("Model options have separate cache files")
+    {
+        GeometryInfo scaledInfo("huygens.3ds", "", Eigen::Vector3f::Zero(), 2.0f, false);
+        std::unique_ptr<Geometry> scaled(scaledInfo.load(scaledInfo.resolve(".")));
+        REQUIRE(scaled != nullptr);
+        REQUIRE(cacheFiles(cacheDir).size() == 2);
+    }
+
+    SECTION("Damaged cache files are replaced")
+    {
+        fs::path cacheFile = cacheFiles(cacheDir).front();
+        fs::resize_file(cacheFile, fs::file_size(cacheFile) / 2);
+
+        std::unique_ptr<Geometry> reloaded(info.load(resolvedName));
+        REQUIRE(reloaded != nullptr);
+        REQUIRE(pickDistances(*reloaded) == pickDistances(*converted));
+
+        std::unique_ptr<Geometry> cached(info.load(resolvedName));
+        REQUIRE(cached != nullptr);
+        REQUIRE(pickDistances(*cached) == pickDistances(*converted));
+    }
+
+    SetModelCacheDirectory(fs::path());
+    fs::remove_all(cacheDir, ec);
+}
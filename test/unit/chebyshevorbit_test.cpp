@@ -0,0 +1,237 @@
+#include <cmath>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+#include <Eigen/Core>
+
+#include <celcompat/filesystem.h>
+#include <celcompat/numbers.h>
+#include <celephem/chebyshevorbit.h>
+#include <celephem/orbit.h>
+
+#include <catch.hpp>
+
+using namespace celestia::ephem;
+
+namespace
+{
+
+constexpr double Period = 30.0;
+constexpr double Radius = 1.0e6;
+
+// A perturbed circular orbit with a jump in position at jumpTime
+class TestOrbit : public CachingOrbit
+{
+ public:
+    explicit TestOrbit(double _jumpTime = 1.0e10) : jumpTime(_jumpTime) {}
+
+    Eigen::Vector3d computePosition(double jd) const override
+    {
+        ++calls;
+        double a = 2.0 * celestia::numbers::pi * jd / Period;
+        double jump = jd > jumpTime ? 1.0e4 : 0.0;
+        return Eigen::Vector3d(Radius * std::cos(a) + 500.0 * std::cos(7.0 * a) + jump,
+                               Radius * std::sin(a),
+                               300.0 * std::sin(3.0 * a));
+    }
+
+    Eigen::Vector3d computeVelocity(double jd) const override
+    {
+        double w = 2.0 * celestia::numbers::pi / Period;
+        double a = w * jd;
+        return Eigen::Vector3d(-Radius * w * std::sin(a) - 3500.0 * w * std::sin(7.0 * a),
+                               Radius * w * std::cos(a),
+                               900.0 * w * std::cos(3.0 * a));
+    }
+
+    double getPeriod() const override { return Period; }
+    double getBoundingRadius() const override { return 2.0 * Radius; }
+
+    double jumpTime;
+    mutable int calls{ 0 };
+};
+
+} // end unnamed namespace
+
+TEST_CASE("Chebyshev orbit fitting", "[ChebyshevOrbit]")
+{
+    constexpr double tolerance = 1.0e-3;
+    auto source = std::make_unique<TestOrbit>();
+    const TestOrbit* testOrbit = source.get();
+    ChebyshevOrbit orbit(std::move(source), 0.0, 300.0, tolerance);
+
+    REQUIRE(orbit.getSegmentCount() == 160);
+    REQUIRE(orbit.getFittedSegmentCount() == 0);
+
+    SECTION("Positions and velocities are within the tolerance")
+    {
+        for (double t = 0.0; t < 300.0; t += 0.173)
+        {
+            Eigen::Vector3d expected = testOrbit->computePosition(t);
+            REQUIRE((orbit.computePosition(t) - expected).norm() <= tolerance);
+            Eigen::Vector3d expectedVelocity = testOrbit->computeVelocity(t);
+            REQUIRE((orbit.computeVelocity(t) - expectedVelocity).norm() <= 1.0e-6 * expectedVelocity.norm());
+        }
+        REQUIRE(orbit.getFittedSegmentCount() == orbit.getSegmentCount());
+    }
+
+    SECTION("Segments are fitted once")
+    {
+        orbit.computePosition(10.0);
+        REQUIRE(orbit.getFittedSegmentCount() == 1);
+        int calls = testOrbit->calls;
+        orbit.computePosition(10.1);
+        orbit.computeVelocity(10.2);
+        REQUIRE(testOrbit->calls == calls);
+    }
+
+    SECTION("Times outside the span use the source orbit")
+    {
+        REQUIRE(orbit.computePosition(-10.0) == testOrbit->computePosition(-10.0));
+        REQUIRE(orbit.computePosition(300.0) == testOrbit->computePosition(300.0));
+        REQUIRE(orbit.getFittedSegmentCount() == 0);
+    }
+
+    REQUIRE(orbit.getPeriod() == Period);
+    REQUIRE(orbit.getBoundingRadius() == 2.0 * Radius);
+}
+
+TEST_CASE("Chebyshev orbit fallback", "[ChebyshevOrbit]")
+{
+    // The segment holding the jump can't be fitted
+    auto source = std::make_unique<TestOrbit>(100.9);
+    const TestOrbit* testOrbit = source.get();
+    ChebyshevOrbit orbit(std::move(source), 0.0, 300.0, 1.0e-3);
+
+    REQUIRE(orbit.computePosition(100.5) == testOrbit->computePosition(100.5));
+    REQUIRE(orbit.computePosition(101.0) == testOrbit->computePosition(101.0));
+    REQUIRE(orbit.getFittedSegmentCount() == 1);
+    REQUIRE((orbit.computePosition(110.0) - testOrbit->computePosition(110.0)).norm() <= 1.0e-3);
+}
+
+TEST_CASE("Chebyshev orbit cache", "[ChebyshevOrbit]")
+{
+    fs::path cachePath = fs::temp_directory_path() / "celestia_chebyshevorbit_test.cheb";
+    fs::remove(cachePath);
+
+    Eigen::Vector3d position;
+    {
+        ChebyshevOrbit orbit(std::make_unique<TestOrbit>(), 0.0, 300.0, 1.0e-3, cachePath);
+        position = orbit.computePosition(42.0);
+        orbit.computePosition(142.0);
+        orbit.computePosition(242.0);
+    }
+    REQUIRE(fs::exists(cachePath));
+
+    SECTION("Fits are reused")
+    {
+        auto source = std::make_unique<TestOrbit>();
+        const TestOrbit* testOrbit = source.get();
+        ChebyshevOrbit orbit(std::move(source), 0.0, 300.0, 1.0e-3, cachePath);
+        REQUIRE(orbit.getFittedSegmentCount() == 3);
+        int calls = testOrbit->calls;
+        REQUIRE(orbit.computePosition(42.0) == position);
+        orbit.computePosition(142.3);
+        REQUIRE(testOrbit->calls == calls);
+
+        // New fits are appended
+        orbit.computePosition(200.0);
+        REQUIRE(orbit.getFittedSegmentCount() == 4);
+    }
+
+    SECTION("Fits with other parameters are discarded")
+    {
+        ChebyshevOrbit orbit(std::make_unique<TestOrbit>(), 0.0, 300.0, 1.0e-2, cachePath);
+        REQUIRE(orbit.getFittedSegmentCount() == 0);
+    }
+
+    SECTION("Fits of another orbit are discarded")
+    {
+        ChebyshevOrbit orbit(std::make_unique<TestOrbit>(100.9), 0.0, 300.0, 1.0e-3, cachePath);
+        REQUIRE(orbit.getFittedSegmentCount() == 0);
+    }
+
+    SECTION("Only the first orbit sharing a cache appends to it")
+    {
+        {
+            ChebyshevOrbit first(std::make_unique<TestOrbit>(), 0.0, 300.0, 1.0e-3, cachePath);
+            ChebyshevOrbit second(std::make_unique<TestOrbit>(), 0.0, 300.0, 1.0e-3, cachePath);
+            REQUIRE(second.getFittedSegmentCount() == 3);
+            first.computePosition(200.0);
+            second.computePosition(210.0);
+            second.computePosition(42.0);
+        }
+
+        ChebyshevOrbit orbit(std::make_unique<TestOrbit>(), 0.0, 300.0, 1.0e-3, cachePath);
+        REQUIRE(orbit.getFittedSegmentCount() == 4);
+    }
+
+    SECTION("Truncated caches are rewritten")
+    {
+        fs::resize_file(cachePath, fs::file_size(cachePath) - 5);
+        {
+            ChebyshevOrbit orbit(std::make_unique<TestOrbit>(), 0.0, 300.0, 1.0e-3, cachePath);
+            REQUIRE(orbit.getFittedSegmentCount() == 2);
+            orbit.computePosition(200.0);
+        }
+
+        ChebyshevOrbit orbit(std::make_unique<TestOrbit>(), 0.0, 300.0, 1.0e-3, cachePath);
+        REQUIRE(orbit.getFittedSegmentCount() == 3);
+    }
+
+    SECTION("Reused after appending")
+    {
+        {
+            ChebyshevOrbit orbit(std::make_unique<TestOrbit>(), 0.0, 300.0, 1.0e-3, cachePath);
+            orbit.computePosition(200.0);
+        }
+
+        ChebyshevOrbit orbit(std::make_unique<TestOrbit>(), 0.0, 300.0, 1.0e-3, cachePath);
+        REQUIRE(orbit.getFittedSegmentCount() == 4);
+    }
+
+    fs::remove(cachePath);
+}
+
+TEST_CASE("Chebyshev fit options", "[ChebyshevOrbit]")
+{
+    std::unique_ptr<Orbit> orbit = std::make_unique<TestOrbit>();
+    const Orbit* original = orbit.get();
+
+    // Fitting is disabled by default
+    orbit = FitChebyshevOrbit(std::move(orbit), "test");
+    REQUIRE(orbit.get() == original);
+
+    ChebyshevFitOptions options;
+    options.startTime = 0.0;
+    options.endTime = 300.0;
+    SetChebyshevFitOptions(options);
+
+    orbit = FitChebyshevOrbit(std::move(orbit), "test");
+    REQUIRE(dynamic_cast<ChebyshevOrbit*>(orbit.get()) != nullptr);
+
+    SECTION("Fits with other parameters are cached in other files")
+    {
+        fs::path cacheDir = fs::temp_directory_path() / "celestia_chebyshevorbit_test";
+        fs::remove_all(cacheDir);
+        options.cacheDirectory = cacheDir;
+        SetChebyshevFitOptions(options);
+        FitChebyshevOrbit(std::make_unique<TestOrbit>(), "test")->positionAtTime(10.0);
+        FitChebyshevOrbit(std::make_unique<TestOrbit>(), "test")->positionAtTime(10.0);
+        options.tolerance *= 10.0;
+        SetChebyshevFitOptions(options);
+        FitChebyshevOrbit(std::make_unique<TestOrbit>(), "test")->positionAtTime(10.0);
+
+        auto files = std::distance(fs::directory_iterator(cacheDir), fs::directory_iterator());
+        REQUIRE(files == 2);
+        fs::remove_all(cacheDir);
+    }
+
+    // Only caching orbits are fitted
+    std::unique_ptr<Orbit> fixed = std::make_unique<FixedOrbit>(Eigen::Vector3d::Zero());
+    const Orbit* fixedOriginal = fixed.get();
+    REQUIRE(FitChebyshevOrbit(std::move(fixed), "fixed").get() == fixedOriginal);
+
+    SetChebyshevFitOptions(ChebyshevFitOptions());
+}
@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <celcompat/filesystem.h>
+#include <celengine/image.h>
+#include <celimage/imageformats.h>
+
+#include <catch.hpp>
+
+namespace
+{
+
+std::uint32_t readLE(const std::uint8_t* p, int nBytes)
+{
+    std::uint32_t value = 0;
+    for (int i = nBytes - 1; i >= 0; --i)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+int expand(int value, int bits)
+{
+    int maxValue = (1 << bits) - 1;
+    int temp = value * 255 + (maxValue + 1) / 2;
+    return (temp / (maxValue + 1) + temp) / (maxValue + 1);
+}
+
+std::array<int, 3> expand565(std::uint32_t color)
+{
+    return { expand((color >> 11) & 0x1f, 5), expand((color >> 5) & 0x3f, 6), expand(color & 0x1f, 5) };
+}
+
+// Decode one texel of a block following the DXTn specification, with the
+// alpha conventions of Celestia's decompressor: DXT1 texels are opaque and
+// DXT5 colors always use four color mode.
+std::array<std::uint8_t, 4> decodeTexel(const std::string& fourCC, const std::uint8_t* block, int texel)
+{
+    int alpha = 255;
+    if (fourCC == "DXT3")
+    {
+        alpha = ((block[texel / 2] >> (4 * (texel % 2))) & 0xf) * 17;
+        block += 8;
+    }
+    else if (fourCC == "DXT5")
+    {
+        int a0 = block[0];
+        int a1 = block[1];
+        std::uint64_t bits = 0;
+        for (int i = 7; i >= 2; --i)
+            bits = (bits << 8) | block[i];
+        int code = static_cast<int>((bits >> (3 * texel)) & 7);
+        if (code == 0)
+            alpha = a0;
+        else if (code == 1)
+            alpha = a1;
+        else if (a0 > a1)
+            alpha = ((8 - code) * a0 + (code - 1) * a1) / 7;
+        else if (code == 6)
+            alpha = 0;
+        else if (code == 7)
+            alpha = 255;
+        else
+            alpha = ((6 - code) * a0 + (code - 1) * a1) / 5;
+        block += 8;
+    }
+
+    std::uint32_t color0 = readLE(block, 2);
+    std::uint32_t color1 = readLE(block + 2, 2);
+    auto c0 = expand565(color0);
+    auto c1 = expand565(color1);
+    int code = (readLE(block + 4, 4) >> (2 * texel)) & 3;
+    bool fourColors = fourCC == "DXT5" || color0 > color1;
+
+    std::array<std::uint8_t, 4> result;
+    for (int i = 0; i < 3; ++i)
+    {
+        int c = 0;
+        switch (code)
+        {
+        case 0: c = c0[i]; break;
+        case 1: c = c1[i]; break;
+        case 2: c = fourColors ? (2 * c0[i] + c1[i]) / 3 : (c0[i] + c1[i]) / 2; break;
+        case 3: c = fourColors ? (c0[i] + 2 * c1[i]) / 3 : 0; break;
+        }
+        result[i] = static_cast<std::uint8_t>(c);
+    }
+    result[3] = static_cast<std::uint8_t>(alpha);
+    return result;
+}
+
+struct DDSFile
+{
+    DDSFile(const std::string& _fourCC, std::uint32_t _width, std::uint32_t _height, std::uint32_t _mipLevels) :
+        fourCC(_fourCC), width(_width), height(_height), mipLevels(_mipLevels)
+    {
+        std::uint32_t seed = 1;
+        for (std::uint32_t mip = 0; mip < mipLevels; ++mip)
+        {
+            std::size_t size = blocksWide(mip) * ((levelHeight(mip) + 3) / 4) * blockSize();
+            auto& level = levels.emplace_back(size);
+            for (auto& byte : level)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                byte = static_cast<std::uint8_t>(seed >> 24);
+            }
+        }
+    }
+
+    std::uint32_t blockSize() const { return fourCC == "DXT1" ? 8 : 16; }
+    std::uint32_t levelWidth(std::uint32_t mip) const { return std::max(width >> mip, 1u); }
+    std::uint32_t levelHeight(std::uint32_t mip) const { return std::max(height >> mip, 1u); }
+    std::uint32_t blocksWide(std::uint32_t mip) const { return (levelWidth(mip) + 3) / 4; }
+
+    void write(const fs::path& path, std::uint32_t nLevels) const
+    {
+        std::vector<std::uint32_t> desc(31, 0);
+        desc[0] = 124;                   // size
+        desc[1] = 0x000a1007;            // flags
+        desc[2] = height;
+        desc[3] = width;
+        desc[6] = mipLevels;
+        desc[18] = 32;                   // pixel format size
+        desc[19] = 4;                    // DDPF_FOURCC
+        desc[20] = readLE(reinterpret_cast<const std::uint8_t*>(fourCC.data()), 4);
+
+        std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        out.write("DDS ", 4);
+        for (std::uint32_t value : desc)
+        {
+            for (int i = 0; i < 4; ++i)
+                out.put(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+        for (std::uint32_t mip = 0; mip < nLevels; ++mip)
+            out.write(reinterpret_cast<const char*>(levels[mip].data()), levels[mip].size());
+    }
+
+    // Compare a decompressed mip level with the reference decoding
+    void check(Image& img, std::uint32_t mip) const
+    {
+        int components = img.getComponents();
+        int pitch = (levelWidth(mip) * components + 3) & ~3;
+        const std::uint8_t* pixels = img.getMipLevel(mip);
+        for (std::uint32_t y = 0; y < levelHeight(mip); ++y)
+        {
+            for (std::uint32_t x = 0; x < levelWidth(mip); ++x)
+            {
+                const std::uint8_t* block = levels[mip].data() + ((y / 4) * blocksWide(mip) + x / 4) * blockSize();
+                auto expected = decodeTexel(fourCC, block, (y % 4) * 4 + x % 4);
+                const std::uint8_t* pixel = pixels + y * pitch + x * components;
+                for (int i = 0; i < components; ++i)
+                {
+                    if (pixel[i] != expected[i])
+                    {
+                        INFO("mip " << mip << " texel " << x << "," << y << " component " << i);
+                        REQUIRE(int(pixel[i]) == int(expected[i]));
+                    }
+                }
+            }
+        }
+    }
+
+    std::string fourCC;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t mipLevels;
+    std::vector<std::vector<std::uint8_t>> levels;
+};
+
+} // end unnamed namespace
+
+
+TEST_CASE("DDS decompression", "[DDS]")
+{
+    fs::path path = fs::temp_directory_path() / "celestia-dds-test.dds";
+
+    SECTION("Sizes which aren't multiples of the block size")
+    {
+        for (const char* fourCC : { "DXT1", "DXT3", "DXT5" })
+        {
+            INFO(fourCC);
+            DDSFile dds(fourCC, 1030, 1035, 1);
+            dds.write(path, 1);
+            std::unique_ptr<Image> img(LoadDDSImage(path));
+            REQUIRE(img != nullptr);
+            REQUIRE(img->getFormat() == (dds.fourCC == "DXT1" ? celestia::PixelFormat::RGB : celestia::PixelFormat::RGBA));
+            REQUIRE(img->getWidth() == 1030);
+            REQUIRE(img->getHeight() == 1035);
+            REQUIRE(img->getMipLevelCount() == 1);
+            dds.check(*img, 0);
+        }
+    }
+
+    SECTION("All mip levels are decompressed")
+    {
+        for (const char* fourCC : { "DXT1", "DXT5" })
+        {
+            INFO(fourCC);
+            DDSFile dds(fourCC, 64, 32, 7);
+            dds.write(path, 7);
+            std::unique_ptr<Image> img(LoadDDSImage(path));
+            REQUIRE(img != nullptr);
+            REQUIRE(img->getMipLevelCount() == 7);
+            for (std::uint32_t mip = 0; mip < 7; ++mip)
+                dds.check(*img, mip);
+        }
+    }
+
+    SECTION("Truncated files keep the complete mip levels")
+    {
+        DDSFile dds("DXT5", 64, 32, 7);
+        dds.write(path, 3);
+        std::unique_ptr<Image> img(LoadDDSImage(path));
+        REQUIRE(img != nullptr);
+        REQUIRE(img->getMipLevelCount() == 3);
+        for (std::uint32_t mip = 0; mip < 3; ++mip)
+            dds.check(*img, mip);
+
+        dds.write(path, 0);
+        REQUIRE(LoadDDSImage(path) == nullptr);
+    }
+
+    std::error_code ec;
+    fs::remove(path, ec);
+}
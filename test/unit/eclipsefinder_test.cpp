@@ -0,0 +1,250 @@
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <celcompat/numbers.h>
+#include <celengine/body.h>
+#include <celengine/frame.h>
+#include <celengine/frametree.h>
+#include <celengine/solarsys.h>
+#include <celengine/star.h>
+#include <celengine/stellarclass.h>
+#include <celengine/timeline.h>
+#include <celengine/timelinephase.h>
+#include <celephem/orbit.h>
+#include <celephem/rotation.h>
+#include <celestia/eclipsefinder.h>
+
+#include <catch.hpp>
+
+using namespace celestia::ephem;
+
+namespace
+{
+
+constexpr double StartDate = 2451545.0;
+// The bodies are aligned at StartDate, so the search starts a bit later
+constexpr double SearchStart = StartDate + 0.25;
+constexpr double PlanetDistance = 149597870.7;
+constexpr double PlanetPeriod = 365.25;
+constexpr double MoonDistance = 100000.0;
+constexpr double MoonPeriod = 1.0;
+constexpr float PlanetRadius = 6378.0f;
+constexpr float MoonRadius = 1737.0f;
+
+constexpr double Second = 1.0 / 86400.0;
+
+// A circular orbit which can't be used from several threads
+class UnsafeCircularOrbit : public CachingOrbit
+{
+ public:
+    UnsafeCircularOrbit(double _radius, double _period) : radius(_radius), period(_period) {}
+
+    Eigen::Vector3d computePosition(double jd) const override
+    {
+        double angle = 2.0 * celestia::numbers::pi * (jd - StartDate) / period;
+        return Eigen::Vector3d(std::cos(angle), 0.0, -std::sin(angle)) * radius;
+    }
+
+    double getPeriod() const override { return period; }
+    double getBoundingRadius() const override { return radius; }
+
+ private:
+    double radius;
+    double period;
+};
+
+// A star with a planet and a moon on circular orbits in the same plane,
+// so that there is a solar and a lunar eclipse every synodic period.
+struct TestSystem
+{
+    explicit TestSystem(bool threadSafe)
+    {
+        star.setDetails(StarDetails::GetStarDetails(StellarClass(StellarClass::NormalStar,
+                                                                 StellarClass::Spectral_G, 2,
+                                                                 StellarClass::Lum_V)));
+        star.setAbsoluteMagnitude(4.83f);
+        solarSystem = std::make_unique<SolarSystem>(&star);
+
+        if (threadSafe)
+        {
+            planetOrbit = std::make_unique<EllipticalOrbit>(PlanetDistance, 0.0, 0.0, 0.0, 0.0, 0.0, PlanetPeriod, StartDate);
+            moonOrbit = std::make_unique<EllipticalOrbit>(MoonDistance, 0.0, 0.0, 0.0, 0.0, 0.0, MoonPeriod, StartDate);
+        }
+        else
+        {
+            planetOrbit = std::make_unique<UnsafeCircularOrbit>(PlanetDistance, PlanetPeriod);
+            moonOrbit = std::make_unique<UnsafeCircularOrbit>(MoonDistance, MoonPeriod);
+        }
+        rotation = std::make_unique<ConstantOrientation>(Eigen::Quaterniond::Identity());
+
+        planet = std::make_unique<Body>(solarSystem->getPlanets(), "Planet");
+        planet->setClassification(Body::Planet);
+        planet->setSemiAxes(Eigen::Vector3f::Constant(PlanetRadius));
+        setOrbit(*planet, Selection(&star), *planetOrbit, solarSystem->getFrameTree());
+
+        planet->setSatellites(new PlanetarySystem(planet.get()));
+        moon = std::make_unique<Body>(planet->getSatellites(), "Moon");
+        moon->setClassification(Body::Moon);
+        moon->setSemiAxes(Eigen::Vector3f::Constant(MoonRadius));
+        setOrbit(*moon, Selection(planet.get()), *moonOrbit, planet->getOrCreateFrameTree());
+    }
+
+    void setOrbit(Body& body, Selection center, Orbit& orbit, FrameTree* frameTree)
+    {
+        auto frame = std::make_shared<J2000EclipticFrame>(center);
+        auto phase = std::make_shared<const TimelinePhase>(&body, -1.0e10, 1.0e10,
+                                                           frame, &orbit, frame, rotation.get(),
+                                                           frameTree);
+        frameTree->addChild(phase);
+        auto timeline = std::make_unique<Timeline>();
+        timeline->appendPhase(phase);
+        body.setTimeline(timeline.release());
+    }
+
+    Star star;
+    std::unique_ptr<SolarSystem> solarSystem;
+    std::unique_ptr<Orbit> planetOrbit;
+    std::unique_ptr<Orbit> moonOrbit;
+    std::unique_ptr<RotationModel> rotation;
+    std::unique_ptr<Body> planet;
+    std::unique_ptr<Body> moon;
+};
+
+class TestWatcher : public EclipseFinderWatcher
+{
+ public:
+    Status eclipseFinderProgressUpdate(double t) override
+    {
+        times.push_back(t);
+        threads.push_back(std::this_thread::get_id());
+        return abort ? AbortOperation : ContinueOperation;
+    }
+
+    bool abort{ false };
+    std::vector<double> times;
+    std::vector<std::thread::id> threads;
+};
+
+std::vector<Eclipse> findEclipses(Body* planet, double start, double end, unsigned int threads,
+                                  EclipseFinderWatcher* watcher = nullptr)
+{
+    EclipseFinder finder(planet, watcher);
+    finder.setThreadCount(threads);
+    std::vector<Eclipse> eclipses;
+    finder.findEclipses(start, end, Eclipse::Solar | Eclipse::Lunar, eclipses);
+    return eclipses;
+}
+
+} // end unnamed namespace
+
+TEST_CASE("Eclipse finder", "[EclipseFinder]")
+{
+    TestSystem system(true);
+    double endDate = SearchStart + 20.0;
+    std::vector<Eclipse> eclipses = findEclipses(system.planet.get(), SearchStart, endDate, 4);
+
+    double synodicPeriod = 1.0 / (1.0 / MoonPeriod - 1.0 / PlanetPeriod);
+    double relativeSpeed = 2.0 * celestia::numbers::pi * MoonDistance / synodicPeriod;
+
+    SECTION("Eclipses match the geometry")
+    {
+        // One solar and one lunar eclipse per synodic period
+        REQUIRE(eclipses.size() >= 38);
+        REQUIRE(eclipses.size() <= 40);
+
+        double sunRadius = system.star.getRadius();
+        for (std::size_t i = 0; i < eclipses.size(); i++)
+        {
+            const Eclipse& eclipse = eclipses[i];
+            REQUIRE(eclipse.startTime < eclipse.endTime);
+            REQUIRE(eclipse.startTime >= SearchStart);
+            REQUIRE(eclipse.startTime <= endDate);
+            if (i > 0)
+                REQUIRE(eclipse.startTime >= eclipses[i - 1].startTime);
+            if (i > 1)
+                REQUIRE(eclipse.startTime - eclipses[i - 2].startTime == Approx(synodicPeriod).margin(Second * 5));
+
+            // The moon is between the planet and the sun during a solar
+            // eclipse, and behind the planet during a lunar eclipse.
+            double middle = 0.5 * (eclipse.startTime + eclipse.endTime);
+            Eigen::Vector3d planetPos = system.planet->getAstrocentricPosition(middle);
+            Eigen::Vector3d moonPos = system.moon->getAstrocentricPosition(middle);
+            double cosAngle = planetPos.normalized().dot((moonPos - planetPos).normalized());
+            bool solar = eclipse.receiver == system.planet.get();
+            if (solar)
+            {
+                REQUIRE(eclipse.occulter == system.moon.get());
+                REQUIRE(cosAngle < -0.999);
+            }
+            else
+            {
+                REQUIRE(eclipse.receiver == system.moon.get());
+                REQUIRE(eclipse.occulter == system.planet.get());
+                REQUIRE(cosAngle > 0.999);
+            }
+
+            // The receiver crosses the whole width of the shadow
+            double receiverRadius = solar ? PlanetRadius : MoonRadius;
+            double casterRadius = solar ? MoonRadius : PlanetRadius;
+            double distToCaster = MoonDistance - receiverRadius;
+            double shadowRadius = casterRadius * (1.0 + sunRadius * distToCaster / (PlanetDistance * casterRadius));
+            double duration = 2.0 * (receiverRadius + shadowRadius) / relativeSpeed;
+            REQUIRE(eclipse.endTime - eclipse.startTime == Approx(duration).epsilon(0.01));
+        }
+    }
+
+    SECTION("Results don't depend on the number of threads")
+    {
+        std::vector<Eclipse> serial = findEclipses(system.planet.get(), SearchStart, endDate, 1);
+        REQUIRE(serial.size() == eclipses.size());
+        for (std::size_t i = 0; i < serial.size(); i++)
+        {
+            REQUIRE(serial[i].receiver == eclipses[i].receiver);
+            REQUIRE(serial[i].startTime == Approx(eclipses[i].startTime).margin(Second * 2));
+            REQUIRE(serial[i].endTime == Approx(eclipses[i].endTime).margin(Second * 2));
+        }
+    }
+
+    SECTION("Orbits which aren't thread safe are searched on the calling thread")
+    {
+        TestSystem unsafe(false);
+        TestWatcher watcher;
+        std::vector<Eclipse> serial = findEclipses(unsafe.planet.get(), SearchStart, endDate, 4, &watcher);
+        REQUIRE(serial.size() == eclipses.size());
+        for (std::size_t i = 0; i < serial.size(); i++)
+            REQUIRE(serial[i].startTime == Approx(eclipses[i].startTime).margin(Second * 2));
+
+        REQUIRE(!watcher.times.empty());
+        for (std::size_t i = 0; i < watcher.times.size(); i++)
+        {
+            REQUIRE(watcher.threads[i] == std::this_thread::get_id());
+            if (i > 0)
+                REQUIRE(watcher.times[i] >= watcher.times[i - 1]);
+        }
+    }
+
+    SECTION("An eclipse in progress at the start is found")
+    {
+        const Eclipse& eclipse = eclipses[2];
+        double middle = 0.5 * (eclipse.startTime + eclipse.endTime);
+        std::vector<Eclipse> later = findEclipses(system.planet.get(), middle, endDate, 4);
+        REQUIRE(!later.empty());
+        REQUIRE(later.front().receiver == eclipse.receiver);
+        REQUIRE(later.front().startTime == Approx(eclipse.startTime).margin(Second * 2));
+        REQUIRE(later.front().endTime == Approx(eclipse.endTime).margin(Second * 2));
+    }
+
+    SECTION("The search can be aborted")
+    {
+        TestWatcher watcher;
+        watcher.abort = true;
+        std::vector<Eclipse> aborted = findEclipses(system.planet.get(), SearchStart, endDate, 1, &watcher);
+        REQUIRE(watcher.times.size() == 1);
+        REQUIRE(aborted.size() < eclipses.size());
+    }
+}
@@ -0,0 +1,73 @@
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <celutil/hashindex.h>
+
+#include <catch.hpp>
+
+using celestia::util::HashIndex;
+
+TEST_CASE("Hash index", "[HashIndex]")
+{
+    SECTION("Empty index")
+    {
+        HashIndex<int> index;
+        REQUIRE(index.empty());
+        REQUIRE(index.find(42) == nullptr);
+
+        std::vector<std::uint32_t> keys{ 1, 2, 3 };
+        std::vector<int> values(keys.size(), 0);
+        index.find(keys, values.data(), -1);
+        REQUIRE(values == std::vector<int>{ -1, -1, -1 });
+    }
+
+    SECTION("Same results as a map")
+    {
+        // Runs of consecutive numbers, like catalog numbers, and scattered
+        // ones which collide in the low bits
+        HashIndex<std::uint32_t> index;
+        std::map<std::uint32_t, std::uint32_t> expected;
+        for (std::uint32_t i = 0; i < 20000; ++i)
+        {
+            std::uint32_t key = i < 10000 ? i + 1 : (i << 12);
+            REQUIRE(index.insert(key, i));
+            expected[key] = i;
+        }
+        REQUIRE(index.size() == expected.size());
+
+        // Existing entries are kept by insert, replaced by insertOrAssign
+        REQUIRE(!index.insert(5, 123));
+        REQUIRE(*index.find(5) == expected[5]);
+        index.insertOrAssign(5, 123);
+        expected[5] = 123;
+        REQUIRE(index.size() == expected.size());
+
+        std::vector<std::uint32_t> keys;
+        for (const auto& [key, value] : expected)
+        {
+            const std::uint32_t* found = index.find(key);
+            REQUIRE(found != nullptr);
+            REQUIRE(*found == value);
+            keys.push_back(key);
+            keys.push_back(key + 1000000000);
+        }
+        REQUIRE(index.find(0) == nullptr);
+        REQUIRE(index.find(HashIndex<std::uint32_t>::EmptyKey) == nullptr);
+
+        std::vector<std::uint32_t> values(keys.size());
+        index.find(keys, values.data(), HashIndex<std::uint32_t>::EmptyKey);
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            auto iter = expected.find(keys[i]);
+            REQUIRE(values[i] == (iter == expected.end() ? HashIndex<std::uint32_t>::EmptyKey : iter->second));
+        }
+    }
+
+    SECTION("The reserved key can't be added")
+    {
+        HashIndex<int> index;
+        REQUIRE(!index.insert(HashIndex<int>::EmptyKey, 1));
+        REQUIRE(index.empty());
+    }
+}
@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <celengine/image.h>
+#include <celengine/texmanager.h>
+#include <celutil/threadpool.h>
+
+#include <catch.hpp>
+
+using celestia::PixelFormat;
+using celestia::util::ThreadPool;
+
+namespace
+{
+
+std::unique_ptr<Image> randomImage(PixelFormat format, int width, int height)
+{
+    auto img = std::make_unique<Image>(format, width, height);
+    std::uint32_t seed = 1;
+    for (int i = 0; i < img->getSize(); i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        img->getPixels()[i] = static_cast<std::uint8_t>(seed >> 24);
+    }
+    return img;
+}
+
+// The normal of each texel computed by itself, with the edge handling of
+// a straightforward implementation
+std::vector<std::uint8_t> referenceNormalMap(Image& img, float scale, bool wrap)
+{
+    int width = img.getWidth();
+    int height = img.getHeight();
+    int components = img.getComponents();
+    std::vector<std::uint8_t> normals;
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            int i0 = i;
+            int j0 = j;
+            int i1 = i - 1;
+            int j1 = j - 1;
+            if (i1 < 0)
+            {
+                if (wrap)
+                    i1 = height - 1;
+                else
+                    i0++, i1++;
+            }
+            if (j1 < 0)
+            {
+                if (wrap)
+                    j1 = width - 1;
+                else
+                    j0++, j1++;
+            }
+
+            auto h00 = (int) img.getPixelRow(i0)[j0 * components];
+            auto h10 = (int) img.getPixelRow(i0)[j1 * components];
+            auto h01 = (int) img.getPixelRow(i1)[j0 * components];
+
+            float dx = (float) (h10 - h00) * (1.0f / 255.0f) * scale;
+            float dy = (float) (h01 - h00) * (1.0f / 255.0f) * scale;
+            float rmag = 1.0f / std::sqrt(dx * dx + dy * dy + 1.0f);
+
+            normals.push_back((std::uint8_t) (128 + 127 * dx * rmag));
+            normals.push_back((std::uint8_t) (128 + 127 * dy * rmag));
+            normals.push_back((std::uint8_t) (128 + 127 * rmag));
+            normals.push_back(255);
+        }
+    }
+    return normals;
+}
+
+std::vector<std::uint8_t> mipLevel(Image& img, int mip)
+{
+    const std::uint8_t* pixels = img.getMipLevel(mip);
+    return std::vector<std::uint8_t>(pixels, pixels + img.getMipLevelSize(mip));
+}
+
+} // end unnamed namespace
+
+
+TEST_CASE("Normal maps", "[Image]")
+{
+    ThreadPool pool(2);
+    for (PixelFormat format : { PixelFormat::LUMINANCE, PixelFormat::RGB })
+    {
+        for (bool wrap : { false, true })
+        {
+            INFO("wrap " << wrap);
+            std::unique_ptr<Image> heightMap = randomImage(format, 64, 300);
+            std::unique_ptr<Image> normalMap(heightMap->computeNormalMap(2.5f, wrap, &pool));
+            REQUIRE(normalMap != nullptr);
+            REQUIRE(normalMap->getFormat() == PixelFormat::RGBA);
+            REQUIRE(mipLevel(*normalMap, 0) == referenceNormalMap(*heightMap, 2.5f, wrap));
+
+            std::unique_ptr<Image> serialNormalMap(heightMap->computeNormalMap(2.5f, wrap));
+            REQUIRE(mipLevel(*serialNormalMap, 0) == mipLevel(*normalMap, 0));
+        }
+    }
+}
+
+
+TEST_CASE("Mipmaps", "[Image]")
+{
+    SECTION("Complete mip chains")
+    {
+        Image img(PixelFormat::RGB, 5, 3);
+        std::unique_ptr<Image> mipmaps(img.buildMipmaps(Image::MipmapFilter::Box, true, false));
+        REQUIRE(mipmaps != nullptr);
+        REQUIRE(mipmaps->getMipLevelCount() == 3);
+        REQUIRE(mipmaps->getWidth() == 5);
+        REQUIRE(mipmaps->getHeight() == 3);
+
+        Image compressed(PixelFormat::DXT1, 8, 8);
+        REQUIRE(compressed.buildMipmaps(Image::MipmapFilter::Box, true, false) == nullptr);
+    }
+
+    SECTION("Box filter")
+    {
+        Image img(PixelFormat::LUMINANCE, 4, 2);
+        const std::uint8_t texels[] = { 0, 10, 20, 30, 40, 50, 60, 71 };
+        std::memcpy(img.getPixelRow(0), texels, 4);
+        std::memcpy(img.getPixelRow(1), texels + 4, 4);
+
+        std::unique_ptr<Image> mipmaps(img.buildMipmaps(Image::MipmapFilter::Box, false, false));
+        REQUIRE(mipmaps->getMipLevelCount() == 3);
+        REQUIRE(mipmaps->getMipLevel(1)[0] == 25);
+        REQUIRE(mipmaps->getMipLevel(1)[1] == 45);
+        REQUIRE(mipmaps->getMipLevel(2)[0] == 35);
+    }
+
+    SECTION("Colors are averaged in linear space")
+    {
+        Image img(PixelFormat::RGBA, 2, 1);
+        const std::uint8_t texels[] = { 0, 0, 0, 0, 255, 255, 255, 255 };
+        std::memcpy(img.getPixels(), texels, sizeof(texels));
+
+        std::unique_ptr<Image> mipmaps(img.buildMipmaps(Image::MipmapFilter::Box, true, false));
+        const std::uint8_t* texel = mipmaps->getMipLevel(1);
+        REQUIRE(int(texel[0]) == 188);
+        REQUIRE(int(texel[1]) == 188);
+        REQUIRE(int(texel[2]) == 188);
+        REQUIRE(int(texel[3]) == 128);
+    }
+
+    SECTION("Kaiser filter keeps constant images constant")
+    {
+        for (bool wrap : { false, true })
+        {
+            Image img(PixelFormat::RGB, 16, 8);
+            std::memset(img.getPixels(), 77, img.getSize());
+            std::unique_ptr<Image> mipmaps(img.buildMipmaps(Image::MipmapFilter::Kaiser, true, wrap));
+            for (int mip = 1; mip < mipmaps->getMipLevelCount(); mip++)
+            {
+                int width = std::max(16 >> mip, 1);
+                int height = std::max(8 >> mip, 1);
+                int pitch = (width * 3 + 3) & ~3;
+                for (int y = 0; y < height; y++)
+                {
+                    for (int x = 0; x < width * 3; x++)
+                        REQUIRE(int(mipmaps->getMipLevel(mip)[y * pitch + x]) == 77);
+                }
+            }
+        }
+    }
+
+    SECTION("Same results when built in parallel")
+    {
+        ThreadPool pool(2);
+        std::unique_ptr<Image> img = randomImage(PixelFormat::RGB, 300, 301);
+        for (auto filter : { Image::MipmapFilter::Box, Image::MipmapFilter::Kaiser })
+        {
+            std::unique_ptr<Image> serial(img->buildMipmaps(filter, true, true));
+            std::unique_ptr<Image> parallel(img->buildMipmaps(filter, true, true, &pool));
+            REQUIRE(serial->getMipLevelCount() == 9);
+            for (int mip = 0; mip < serial->getMipLevelCount(); mip++)
+                REQUIRE(mipLevel(*serial, mip) == mipLevel(*parallel, mip));
+        }
+    }
+}
+
+
+TEST_CASE("Texture mipmaps", "[Image]")
+{
+    // The levels of a normal map should be filtered as stored, like the
+    // mipmaps generated by the driver, and not as sRGB colors
+    std::unique_ptr<Image> heightMap = randomImage(PixelFormat::LUMINANCE, 64, 32);
+    std::unique_ptr<Image> normalMap(heightMap->computeNormalMap(2.5f, true));
+    std::unique_ptr<Image> mipmaps(BuildTextureMipmaps(*normalMap, Texture::Wrap));
+    REQUIRE(mipmaps != nullptr);
+    REQUIRE(mipmaps->getMipLevelCount() == 7);
+    REQUIRE(mipLevel(*mipmaps, 0) == mipLevel(*normalMap, 0));
+
+    for (int mip = 1; mip < mipmaps->getMipLevelCount(); mip++)
+    {
+        int srcWidth = std::max(64 >> (mip - 1), 1);
+        int srcHeight = std::max(32 >> (mip - 1), 1);
+        int width = std::max(64 >> mip, 1);
+        int height = std::max(32 >> mip, 1);
+        const std::uint8_t* src = mipmaps->getMipLevel(mip - 1);
+        const std::uint8_t* dst = mipmaps->getMipLevel(mip);
+        for (int y = 0; y < height; y++)
+        {
+            int y0 = std::min(y * 2, srcHeight - 1);
+            int y1 = std::min(y * 2 + 1, srcHeight - 1);
+            for (int x = 0; x < width * 4; x++)
+            {
+                int x0 = std::min((x / 4) * 2, srcWidth - 1) * 4 + x % 4;
+                int x1 = std::min((x / 4) * 2 + 1, srcWidth - 1) * 4 + x % 4;
+                float average = (float(src[y0 * srcWidth * 4 + x0]) + float(src[y0 * srcWidth * 4 + x1]) +
+                                 float(src[y1 * srcWidth * 4 + x0]) + float(src[y1 * srcWidth * 4 + x1])) / 4.0f;
+                INFO("mip " << mip << " texel " << x / 4 << "," << y << " component " << x % 4);
+                REQUIRE(std::abs(float(dst[y * width * 4 + x]) - average) <= 0.5f);
+            }
+        }
+    }
+
+    Image compressed(PixelFormat::DXT1, 8, 8);
+    REQUIRE(BuildTextureMipmaps(compressed, Texture::Wrap) == nullptr);
+    REQUIRE(BuildTextureMipmaps(*mipmaps, Texture::Wrap) == nullptr);
+}
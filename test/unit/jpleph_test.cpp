@@ -0,0 +1,217 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <celcompat/filesystem.h>
+#include <celephem/jpleph.h>
+#include <celutil/bytes.h>
+
+#include <catch.hpp>
+
+using namespace celestia::ephem;
+
+namespace
+{
+
+constexpr unsigned int NRecords = 20;
+constexpr std::uint32_t NCoeffs = 13;
+constexpr std::uint32_t NGranules = 2;
+constexpr double DaysPerInterval = 32.0;
+constexpr double StartDate = 2451536.5;
+constexpr std::uint32_t RecordSize = (JPLEphemeris::JPLEph_NItems - 1) * NCoeffs * NGranules * 3 + 2;
+
+template<typename T>
+void putValue(std::string& buffer, std::size_t offset, T value, bool swap)
+{
+    if (swap)
+    {
+        auto bytes = reinterpret_cast<char*>(&value);
+        for (std::size_t i = 0; i < sizeof(T) / 2; ++i)
+            std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+    }
+    std::memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+// Coefficient j of record i
+double coefficient(unsigned int i, std::uint32_t j)
+{
+    return static_cast<double>((i * 7919u + j * 104729u) % 1000u) - 500.0;
+}
+
+// Synthetic DE405-style ephemeris with 13 coefficients and 2 granules per
+// item, in native or swapped byte order
+std::string makeEphemeris(bool swap)
+{
+    constexpr unsigned int nItems = JPLEphemeris::JPLEph_NItems;
+
+    // The nutations (the last item) and librations are left out
+    std::string data((NRecords + 2) * RecordSize * sizeof(double), '\0');
+
+    // Offsets of the fields in the header record
+    constexpr std::size_t dateOffset = 3 * 84 + 400 * 6;
+    putValue(data, dateOffset, StartDate, swap);
+    putValue(data, dateOffset + 8, StartDate + DaysPerInterval * NRecords, swap);
+    putValue(data, dateOffset + 16, DaysPerInterval, swap);
+    putValue(data, dateOffset + 28, 149597870.691, swap);
+    putValue(data, dateOffset + 36, 81.30056, swap);
+    constexpr std::size_t coeffInfoOffset = dateOffset + 44;
+    for (unsigned int i = 0; i < nItems - 1; ++i)
+    {
+        putValue<std::uint32_t>(data, coeffInfoOffset + i * 12, 3 + i * NCoeffs * NGranules * 3, swap);
+        putValue<std::uint32_t>(data, coeffInfoOffset + i * 12 + 4, NCoeffs, swap);
+        putValue<std::uint32_t>(data, coeffInfoOffset + i * 12 + 8, NGranules, swap);
+    }
+    putValue<std::uint32_t>(data, coeffInfoOffset + nItems * 12, 405, swap);
+
+    // The constants record is left empty
+    for (unsigned int i = 0; i < NRecords; ++i)
+    {
+        std::size_t offset = (i + 2) * RecordSize * sizeof(double);
+        putValue(data, offset, StartDate + DaysPerInterval * i, swap);
+        putValue(data, offset + 8, StartDate + DaysPerInterval * (i + 1), swap);
+        for (std::uint32_t j = 0; j < RecordSize - 2; ++j)
+            putValue(data, offset + (j + 2) * sizeof(double), coefficient(i, j), swap);
+    }
+
+    return data;
+}
+
+std::unique_ptr<JPLEphemeris> loadFromStream(const std::string& data)
+{
+    std::istringstream in(data, std::ios::in | std::ios::binary);
+    return std::unique_ptr<JPLEphemeris>(JPLEphemeris::load(in));
+}
+
+} // end unnamed namespace
+
+TEST_CASE("JPL ephemeris loading", "[JPLEphemeris]")
+{
+    std::string data = makeEphemeris(false);
+
+    SECTION("Header is read")
+    {
+        auto eph = loadFromStream(data);
+        REQUIRE(eph != nullptr);
+        REQUIRE(eph->getDENumber() == 405);
+        REQUIRE(eph->getStartDate() == StartDate);
+        REQUIRE(eph->getEndDate() == StartDate + DaysPerInterval * NRecords);
+        REQUIRE(eph->getRecordSize() == RecordSize);
+        REQUIRE(!eph->getByteSwap());
+    }
+
+    SECTION("Truncated files are rejected")
+    {
+        data.resize(data.size() - 8);
+        REQUIRE(loadFromStream(data) == nullptr);
+    }
+
+    SECTION("Records in the native byte order are used in place")
+    {
+        auto eph = loadFromStream(data);
+        eph->getPlanetPosition(JPLEphemItem::Mars, StartDate + 100.0);
+        REQUIRE(eph->getDecodedRecordCount() == 0);
+    }
+
+    SECTION("Other records are decoded when used")
+    {
+        auto eph = loadFromStream(makeEphemeris(true));
+        REQUIRE(eph->getByteSwap());
+        REQUIRE(eph->getDecodedRecordCount() == 0);
+        eph->getPlanetPosition(JPLEphemItem::Mars, StartDate + 100.0);
+        eph->getPlanetPosition(JPLEphemItem::Venus, StartDate + 101.0);
+        REQUIRE(eph->getDecodedRecordCount() == 1);
+        eph->getPlanetPosition(JPLEphemItem::Mars, StartDate + 200.0);
+        REQUIRE(eph->getDecodedRecordCount() == 2);
+        eph->getPlanetPosition(JPLEphemItem::Mars, StartDate + 100.0);
+        REQUIRE(eph->getDecodedRecordCount() == 2);
+    }
+}
+
+TEST_CASE("JPL ephemeris positions", "[JPLEphemeris]")
+{
+    std::string data = makeEphemeris(false);
+    auto eph = loadFromStream(data);
+    REQUIRE(eph != nullptr);
+
+    SECTION("Chebyshev series are evaluated")
+    {
+        // At the start of the second granule of record 3, u = -1
+        constexpr unsigned int record = 3;
+        double t = StartDate + DaysPerInterval * record + DaysPerInterval / NGranules;
+        auto item = static_cast<std::uint32_t>(JPLEphemItem::Mars);
+        Eigen::Vector3d expected;
+        for (std::uint32_t axis = 0; axis < 3; ++axis)
+        {
+            expected[axis] = 0.0;
+            std::uint32_t offset = item * NCoeffs * NGranules * 3 + NCoeffs * 3 + axis * NCoeffs;
+            for (std::uint32_t j = 0; j < NCoeffs; ++j)
+                expected[axis] += coefficient(record, offset + j) * (j % 2 == 0 ? 1.0 : -1.0);
+        }
+
+        REQUIRE(eph->getPlanetPosition(JPLEphemItem::Mars, t) == expected);
+        REQUIRE(eph->getPlanetPosition(JPLEphemItem::SSB, t) == Eigen::Vector3d::Zero());
+    }
+
+    SECTION("Batches match single positions")
+    {
+        std::array<JPLEphemItem, 6> items
+        {
+            JPLEphemItem::Mercury, JPLEphemItem::Earth, JPLEphemItem::Moon,
+            JPLEphemItem::Sun, JPLEphemItem::SSB, JPLEphemItem::Mercury,
+        };
+
+        for (double t = StartDate - 10.0; t <= eph->getEndDate() + 10.0; t += 3.7)
+        {
+            std::array<Eigen::Vector3d, items.size()> positions;
+            eph->getPlanetPositions(items.data(), items.size(), t, positions.data());
+            for (std::size_t i = 0; i < items.size(); ++i)
+                REQUIRE(positions[i] == eph->getPlanetPosition(items[i], t));
+        }
+    }
+
+    SECTION("Times are clamped to the span")
+    {
+        REQUIRE(eph->getPlanetPosition(JPLEphemItem::Jupiter, StartDate - 100.0) ==
+                eph->getPlanetPosition(JPLEphemItem::Jupiter, StartDate));
+        Eigen::Vector3d end = eph->getPlanetPosition(JPLEphemItem::Jupiter, eph->getEndDate());
+        REQUIRE(eph->getPlanetPosition(JPLEphemItem::Jupiter, eph->getEndDate() + 100.0) == end);
+        REQUIRE(end.allFinite());
+    }
+}
+
+TEST_CASE("JPL ephemeris files", "[JPLEphemeris]")
+{
+    fs::path path = fs::temp_directory_path() / "celestia_jpleph_test.dat";
+    auto reference = loadFromStream(makeEphemeris(false));
+    REQUIRE(reference != nullptr);
+
+    bool swap = GENERATE(false, true);
+    {
+        std::ofstream out(path, std::ios::out | std::ios::binary);
+        std::string data = makeEphemeris(swap);
+        out.write(data.data(), data.size());
+    }
+
+    std::unique_ptr<JPLEphemeris> eph(JPLEphemeris::load(path));
+    REQUIRE(eph != nullptr);
+    REQUIRE(eph->getByteSwap() == swap);
+    REQUIRE(eph->getDENumber() == 405);
+
+    // Decoding more records than are cached
+    for (double t = StartDate; t < eph->getEndDate(); t += 1.3)
+    {
+        REQUIRE(eph->getPlanetPosition(JPLEphemItem::Earth, t) ==
+                reference->getPlanetPosition(JPLEphemItem::Earth, t));
+    }
+
+    eph.reset();
+    fs::remove(path);
+}
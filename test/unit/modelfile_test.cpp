@@ -0,0 +1,185 @@
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <celmodel/mesh.h>
+#include <celmodel/model.h>
+#include <celmodel/modelfile.h>
+
+#include <catch.hpp>
+
+using namespace cmod;
+
+namespace
+{
+
+ResourceHandle
+getHandle(const fs::path&)
+{
+    return InvalidResource;
+}
+
+fs::path
+getSource(ResourceHandle)
+{
+    return fs::path();
+}
+
+// A model with a single mesh of nVertices vertices with the given
+// attributes and distinct values in all of their words
+std::unique_ptr<Model>
+makeModel(std::vector<VertexAttribute>&& attributes, unsigned int nVertices)
+{
+    VertexDescription desc(std::move(attributes));
+    unsigned int stride = desc.strideBytes / sizeof(VWord);
+
+    std::vector<VWord> vertices(stride * nVertices);
+    for (unsigned int i = 0; i < vertices.size(); i++)
+    {
+        float f = static_cast<float>(i) * 0.25f - 100.0f;
+        std::memcpy(&vertices[i], &f, sizeof(f));
+    }
+
+    // Colors are stored byte by byte
+    for (const auto& attr : desc.attributes)
+    {
+        if (attr.format != VertexAttributeFormat::UByte4)
+            continue;
+        for (unsigned int i = 0; i < nVertices; i++)
+            vertices[i * stride + attr.offsetWords] = 0x01020304u + i;
+    }
+
+    std::vector<Index32> indices;
+    for (unsigned int i = 0; i + 2 < nVertices; i++)
+    {
+        indices.push_back(i);
+        indices.push_back(i + 2);
+        indices.push_back(i + 1);
+    }
+
+    Mesh mesh;
+    mesh.setVertexDescription(std::move(desc));
+    mesh.setVertices(nVertices, std::move(vertices));
+    mesh.addGroup(PrimitiveGroupType::TriList, 0, std::move(indices));
+
+    auto model = std::make_unique<Model>();
+    model->addMaterial(Material());
+    model->addMesh(std::move(mesh));
+    return model;
+}
+
+// Check that the vertices of the two meshes have the same attribute values,
+// wherever the attributes are in the vertices
+void
+requireSameVertices(const Mesh& expected, const Mesh& actual)
+{
+    const VertexDescription& expectedDesc = expected.getVertexDescription();
+    const VertexDescription& actualDesc = actual.getVertexDescription();
+    REQUIRE(actual.getVertexCount() == expected.getVertexCount());
+    REQUIRE(actualDesc.attributes.size() == expectedDesc.attributes.size());
+
+    for (const auto& attr : expectedDesc.attributes)
+    {
+        const VertexAttribute& actualAttr = actualDesc.getAttribute(attr.semantic);
+        REQUIRE(actualAttr.format == attr.format);
+
+        unsigned int size = VertexAttribute::getFormatSizeWords(attr.format);
+        for (unsigned int i = 0; i < expected.getVertexCount(); i++)
+        {
+            const VWord* expectedWords = expected.getVertexData() + i * expected.getVertexStrideWords() + attr.offsetWords;
+            const VWord* actualWords = actual.getVertexData() + i * actual.getVertexStrideWords() + actualAttr.offsetWords;
+            REQUIRE(std::vector<VWord>(expectedWords, expectedWords + size) ==
+                    std::vector<VWord>(actualWords, actualWords + size));
+        }
+    }
+
+    REQUIRE(actual.getGroupCount() == expected.getGroupCount());
+    REQUIRE(actual.getGroup(0)->indices == expected.getGroup(0)->indices);
+}
+
+void
+requireRoundTrip(const Model& model, bool aligned)
+{
+    std::ostringstream out;
+    if (aligned)
+        REQUIRE(SaveModelAlignedBinary(&model, out, getSource));
+    else
+        REQUIRE(SaveModelBinary(&model, out, getSource));
+    std::string data = out.str();
+
+    std::istringstream in(data);
+    std::unique_ptr<Model> fromStream = LoadModel(in, getHandle);
+    REQUIRE(fromStream != nullptr);
+    REQUIRE(fromStream->getMeshCount() == 1);
+    requireSameVertices(*model.getMesh(0), *fromStream->getMesh(0));
+
+    std::unique_ptr<Model> fromMemory = LoadModel(data.data(), data.size(), getHandle);
+    REQUIRE(fromMemory != nullptr);
+    REQUIRE(fromMemory->getMeshCount() == 1);
+    requireSameVertices(*model.getMesh(0), *fromMemory->getMesh(0));
+}
+
+} // end unnamed namespace
+
+TEST_CASE("Binary model round trip", "[modelfile]")
+{
+    SECTION("Packed layout")
+    {
+        std::unique_ptr<Model> model = makeModel({
+            { VertexAttributeSemantic::Position, VertexAttributeFormat::Float3, 0 },
+            { VertexAttributeSemantic::Normal,   VertexAttributeFormat::Float3, 3 },
+            { VertexAttributeSemantic::Texture0, VertexAttributeFormat::Float2, 6 },
+        }, 50);
+
+        requireRoundTrip(*model, false);
+        requireRoundTrip(*model, true);
+    }
+
+    SECTION("Unusual layout")
+    {
+        // Attributes of every format, not in memory order
+        std::unique_ptr<Model> model = makeModel({
+            { VertexAttributeSemantic::Texture0,  VertexAttributeFormat::Float2, 9 },
+            { VertexAttributeSemantic::Color0,    VertexAttributeFormat::UByte4, 0 },
+            { VertexAttributeSemantic::Position,  VertexAttributeFormat::Float3, 1 },
+            { VertexAttributeSemantic::PointSize, VertexAttributeFormat::Float1, 4 },
+            { VertexAttributeSemantic::Tangent,   VertexAttributeFormat::Float4, 5 },
+        }, 37);
+        REQUIRE(model->getMesh(0)->getVertexDescription().validate());
+
+        requireRoundTrip(*model, false);
+        requireRoundTrip(*model, true);
+    }
+}
+
+TEST_CASE("Aligned binary model blocks", "[modelfile]")
+{
+    std::unique_ptr<Model> model = makeModel({
+        { VertexAttributeSemantic::Position, VertexAttributeFormat::Float3, 0 },
+        { VertexAttributeSemantic::Color0,   VertexAttributeFormat::UByte4, 3 },
+    }, 20);
+
+    std::ostringstream out;
+    REQUIRE(SaveModelAlignedBinary(model.get(), out, getSource));
+    std::string data = out.str();
+
+    // The vertex data and the indices are stored as they are in memory on
+    // little endian hosts, so they can be found in the file
+    const Mesh* mesh = model->getMesh(0);
+    std::string vertices(reinterpret_cast<const char*>(mesh->getVertexData()),
+                         mesh->getVertexCount() * mesh->getVertexStrideWords() * sizeof(VWord));
+    const std::vector<Index32>& indices = mesh->getGroup(0)->indices;
+    std::string indexData(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(Index32));
+
+    std::size_t vertexOffset = data.find(vertices);
+    REQUIRE(vertexOffset != std::string::npos);
+    REQUIRE(vertexOffset % 16 == 0);
+
+    std::size_t indexOffset = data.find(indexData);
+    REQUIRE(indexOffset != std::string::npos);
+    REQUIRE(indexOffset % 16 == 0);
+}
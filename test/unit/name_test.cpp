@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <celengine/name.h>
+#include <celutil/greek.h>
+#include <celutil/utf8.h>
+
+#include <catch.hpp>
+
+namespace
+{
+
+// The names matching a prefix, found by comparing each of them
+std::vector<std::string> scanCompletion(const std::vector<std::string>& names, const std::string& prefix)
+{
+    std::string prefix2 = ReplaceGreekLetter(prefix);
+    int length = UTF8Length(prefix2);
+
+    std::vector<std::string> completion;
+    for (const std::string& name : names)
+    {
+        std::string fname = ReplaceGreekLetterAbbr(name);
+        if (!UTF8StringCompare(fname, prefix2, length, true))
+            completion.push_back(fname);
+    }
+    std::sort(completion.begin(), completion.end());
+    completion.erase(std::unique(completion.begin(), completion.end()), completion.end());
+    return completion;
+}
+
+std::vector<std::string> sorted(std::vector<std::string> names)
+{
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+} // end unnamed namespace
+
+TEST_CASE("Name completion", "[NameDatabase]")
+{
+    std::vector<std::string> names
+    {
+        "Sirius", "SIRIUS B", "sirrah", "Sol", "ALF Cen", "ALF2 Cen", "BET Cen", "Alfirk",
+        "Épsilon", "Eridanus", "HD 12345", "HD 1234", "HD 2", "Zeta",
+    };
+    for (int i = 0; i < 1000; ++i)
+        names.push_back("Star " + std::to_string(i * 7919 % 10007));
+
+    NameDatabase db;
+    for (std::size_t i = 0; i < names.size(); ++i)
+        db.add(static_cast<AstroCatalog::IndexNumber>(i), names[i]);
+
+    SECTION("Same names as a scan")
+    {
+        for (const char* prefix : { "", "s", "SI", "sir", "Sirius b", "alf", "alpha", "ALF2", "e", "é",
+                                    "HD 123", "Star 1", "Star 99", "x", "Sirius B and more" })
+        {
+            INFO(prefix);
+            REQUIRE(sorted(db.getCompletion(prefix, false)) == scanCompletion(names, prefix));
+        }
+    }
+
+    SECTION("Names added after a completion")
+    {
+        REQUIRE(db.getCompletion("Vega", false).empty());
+        db.add(5000, "Vega");
+        REQUIRE(db.getCompletion("veg", false) == std::vector<std::string>{ "Vega" });
+    }
+}
+
+TEST_CASE("Name completion ranking", "[NameDatabase]")
+{
+    NameDatabase db;
+    AstroCatalog::IndexNumber catalogNumber = 0;
+    for (const char* name : { "SIRIUS C long", "Sirius Ab", "Sirius B", "Sirius", "Sirrah" })
+        db.add(catalogNumber++, name);
+
+    // Names starting with the query as typed, shortest first, then the
+    // names which only match ignoring case
+    std::vector<std::string> expected{ "Sirius", "Sirrah", "Sirius B", "Sirius Ab", "SIRIUS C long" };
+    REQUIRE(db.getCompletion("Sir", false) == expected);
+
+    expected = { "SIRIUS C long", "Sirius", "Sirius B", "Sirius Ab" };
+    REQUIRE(db.getCompletion("SIRIUS", false) == expected);
+}
@@ -0,0 +1,206 @@
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <thread>
+
+#include <celcompat/filesystem.h>
+#include <celutil/resmanager.h>
+
+#include <catch.hpp>
+
+namespace
+{
+
+class TestInfo : public ResourceInfo<int>
+{
+ public:
+    TestInfo(const std::string& _name, bool _canPrepare = true) :
+        name(_name), canPrepare(_canPrepare) {};
+
+    fs::path resolve(const fs::path& baseDir) override
+    {
+        return baseDir / name;
+    }
+
+    // Only used when prepare() isn't supported
+    int* load(const fs::path& path) override
+    {
+        return new int(static_cast<int>(path.string().size()) + 1000);
+    }
+
+    Finisher prepare(const fs::path& path) const override
+    {
+        if (!canPrepare)
+            return Finisher();
+
+        // Files named "missing" fail to load
+        int value = name == "missing" ? 0 : static_cast<int>(path.string().size());
+        return [value]() -> int*
+        {
+            // Long enough for the per-frame budget to be used up
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return value == 0 ? nullptr : new int(value);
+        };
+    }
+
+    std::size_t getMemoryUsage() const override
+    {
+        return 100;
+    }
+
+    std::string name;
+    bool canPrepare;
+};
+
+bool operator<(const TestInfo& a, const TestInfo& b)
+{
+    return a.name < b.name;
+}
+
+// Calls find() once per frame until the resource is no longer loading
+int* findLoaded(ResourceManager<TestInfo>& manager, ResourceHandle h)
+{
+    for (int frame = 0; frame < 10000; ++frame)
+    {
+        manager.startFrame();
+        int* resource = manager.find(h);
+        if (resource != nullptr || manager.getResourceInfo(h)->state != ResourceLoading)
+            return resource;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return nullptr;
+}
+
+} // end unnamed namespace
+
+TEST_CASE("Synchronous resource loading", "[ResourceManager]")
+{
+    ResourceManager<TestInfo> manager("dir");
+    ResourceHandle h = manager.getHandle(TestInfo("abc"));
+
+    REQUIRE(!manager.isAsyncLoading());
+    int* resource = manager.find(h);
+    REQUIRE(resource != nullptr);
+    REQUIRE(*resource == 1007);
+    REQUIRE(manager.getResourceInfo(h)->state == ResourceLoaded);
+}
+
+TEST_CASE("Asynchronous resource loading", "[ResourceManager]")
+{
+    ResourceManager<TestInfo> manager("dir");
+    manager.setAsyncLoading(2);
+    REQUIRE(manager.isAsyncLoading());
+
+    SECTION("Resources become available after loading")
+    {
+        ResourceHandle h = manager.getHandle(TestInfo("abc"));
+        ResourceHandle same = manager.getHandle(TestInfo("abc"));
+        REQUIRE(h == same);
+
+        int* resource = findLoaded(manager, h);
+        REQUIRE(resource != nullptr);
+        REQUIRE(*resource == 7);
+        REQUIRE(manager.getResourceInfo(h)->state == ResourceLoaded);
+        REQUIRE(manager.find(h) == resource);
+    }
+
+    SECTION("Failures are reported")
+    {
+        ResourceHandle h = manager.getHandle(TestInfo("missing"));
+        REQUIRE(findLoaded(manager, h) == nullptr);
+        REQUIRE(manager.getResourceInfo(h)->state == ResourceLoadingFailed);
+    }
+
+    SECTION("Resources without a prepare step are loaded with load()")
+    {
+        ResourceHandle h = manager.getHandle(TestInfo("abc", false));
+        int* resource = findLoaded(manager, h);
+        REQUIRE(resource != nullptr);
+        REQUIRE(*resource == 1007);
+    }
+
+    SECTION("At least one resource per frame is finished within the budget")
+    {
+        manager.setAsyncLoading(2, 0.0);
+        ResourceHandle handles[] =
+        {
+            manager.getHandle(TestInfo("a")),
+            manager.getHandle(TestInfo("b")),
+            manager.getHandle(TestInfo("c")),
+        };
+
+        int nLoaded = 0;
+        for (int frame = 0; frame < 10000 && nLoaded < 3; ++frame)
+        {
+            manager.startFrame();
+            int nLoadedBefore = nLoaded;
+            nLoaded = 0;
+            for (ResourceHandle h : handles)
+            {
+                if (manager.find(h) != nullptr)
+                    ++nLoaded;
+            }
+
+            REQUIRE(nLoaded - nLoadedBefore <= 1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        REQUIRE(nLoaded == 3);
+    }
+}
+
+TEST_CASE("Memory budget", "[ResourceManager]")
+{
+    ResourceManager<TestInfo> manager("dir");
+    manager.setMemoryBudget(250);
+    ResourceHandle a = manager.getHandle(TestInfo("a"));
+    ResourceHandle b = manager.getHandle(TestInfo("b"));
+    ResourceHandle c = manager.getHandle(TestInfo("c"));
+
+    manager.startFrame();
+    REQUIRE(manager.find(a) != nullptr);
+    manager.startFrame();
+    REQUIRE(manager.find(b) != nullptr);
+    REQUIRE(manager.find(c) != nullptr);
+    REQUIRE(manager.getStatistics().residentBytes == 300);
+    REQUIRE(manager.getStatistics().misses == 3);
+
+    SECTION("The least recently used resource is unloaded")
+    {
+        manager.startFrame();
+        REQUIRE(manager.getStatistics().residentBytes == 200);
+        REQUIRE(manager.getStatistics().evictions == 1);
+        REQUIRE(manager.getResourceInfo(a)->state == ResourceNotLoaded);
+        REQUIRE(manager.getResourceInfo(b)->state == ResourceLoaded);
+        REQUIRE(manager.getResourceInfo(c)->state == ResourceLoaded);
+
+        // Unloaded resources are loaded again when needed
+        REQUIRE(manager.find(a) != nullptr);
+        REQUIRE(manager.getStatistics().residentBytes == 300);
+        REQUIRE(manager.getStatistics().misses == 4);
+    }
+
+    SECTION("Resources used in the previous frame are kept")
+    {
+        REQUIRE(manager.find(a) != nullptr);
+        REQUIRE(manager.getStatistics().hits == 1);
+        manager.startFrame();
+        REQUIRE(manager.getStatistics().residentBytes == 300);
+        REQUIRE(manager.getStatistics().evictions == 0);
+
+        // Only as many resources are unloaded as needed to fit the budget
+        manager.startFrame();
+        REQUIRE(manager.getStatistics().residentBytes == 200);
+        REQUIRE(manager.getStatistics().evictions == 1);
+    }
+
+    SECTION("Nothing is unloaded without a budget")
+    {
+        manager.setMemoryBudget(0);
+        manager.startFrame();
+        manager.startFrame();
+        REQUIRE(manager.getStatistics().residentBytes == 300);
+        REQUIRE(manager.getStatistics().evictions == 0);
+    }
+}
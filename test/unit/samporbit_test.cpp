@@ -0,0 +1,240 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <celcompat/filesystem.h>
+#include <celephem/orbit.h>
+#include <celephem/samporbit.h>
+#include <celephem/xyzvbinary.h>
+
+#include <catch.hpp>
+
+using namespace celestia::ephem;
+
+namespace
+{
+
+constexpr double SecondsPerDay = 86400.0;
+
+struct TestSample
+{
+    double t;
+    Eigen::Vector3d position;
+    Eigen::Vector3d velocity; // km/s
+};
+
+// Unevenly spaced samples of a circular orbit, with one duplicate time
+std::vector<TestSample> makeSamples()
+{
+    std::vector<TestSample> samples;
+    double t = 2451545.0;
+    for (int i = 0; i < 1000; ++i)
+    {
+        double angle = t * 0.01;
+        samples.push_back({ t,
+                            Eigen::Vector3d(1.0e6 * std::cos(angle), 1.0e6 * std::sin(angle), 100.0 * i),
+                            Eigen::Vector3d(-1.0e4 * std::sin(angle), 1.0e4 * std::cos(angle), 0.0) / SecondsPerDay });
+        if (i == 500)
+            samples.push_back(samples.back());
+        t += i % 7 == 0 ? 5.0 : 0.25;
+    }
+    return samples;
+}
+
+void writeText(const fs::path& path, const std::vector<TestSample>& samples, bool withVelocities)
+{
+    std::ofstream out(path);
+    out.precision(17);
+    out << "# Test trajectory\n";
+    for (const auto& s : samples)
+    {
+        out << s.t << ' ' << s.position.x() << ' ' << s.position.y() << ' ' << s.position.z();
+        if (withVelocities)
+            out << ' ' << s.velocity.x() << ' ' << s.velocity.y() << ' ' << s.velocity.z();
+        out << '\n';
+    }
+}
+
+void writeBinary(const fs::path& path, const std::vector<TestSample>& samples)
+{
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    char header[sizeof(XYZVBinaryHeader)] = {};
+    std::memcpy(header + offsetof(XYZVBinaryHeader, magic), XYZV_MAGIC.data(), XYZV_MAGIC.size());
+    std::uint16_t byteOrder = __BYTE_ORDER__;
+    std::memcpy(header + offsetof(XYZVBinaryHeader, byteOrder), &byteOrder, sizeof(byteOrder));
+    std::uint16_t digits = std::numeric_limits<double>::digits;
+    std::memcpy(header + offsetof(XYZVBinaryHeader, digits), &digits, sizeof(digits));
+    std::uint64_t count = samples.size();
+    std::memcpy(header + offsetof(XYZVBinaryHeader, count), &count, sizeof(count));
+    out.write(header, sizeof(header));
+
+    for (const auto& s : samples)
+    {
+        out.write(reinterpret_cast<const char*>(&s.t), sizeof(double));
+        out.write(reinterpret_cast<const char*>(s.position.data()), sizeof(double) * 3);
+        out.write(reinterpret_cast<const char*>(s.velocity.data()), sizeof(double) * 3);
+    }
+}
+
+// Linear interpolation between the samples around jd, in Celestia's
+// coordinate system
+Eigen::Vector3d linearPosition(const std::vector<TestSample>& samples, double jd)
+{
+    std::size_t n = 0;
+    while (n < samples.size() && samples[n].t < jd)
+        ++n;
+
+    Eigen::Vector3d pos;
+    if (n == 0)
+        pos = samples.front().position;
+    else if (n == samples.size())
+        pos = samples.back().position;
+    else
+    {
+        const TestSample& s0 = samples[n - 1];
+        const TestSample& s1 = samples[n];
+        pos = s0.position + (jd - s0.t) / (s1.t - s0.t) * (s1.position - s0.position);
+    }
+    return Eigen::Vector3d(pos.x(), pos.z(), -pos.y());
+}
+
+class CountingSampleProc : public OrbitSampleProc
+{
+ public:
+    void sample(double t, const Eigen::Vector3d&, const Eigen::Vector3d&) override
+    {
+        times.push_back(t);
+    }
+
+    std::vector<double> times;
+};
+
+} // end unnamed namespace
+
+TEST_CASE("Sampled trajectories", "[SampledOrbit]")
+{
+    std::vector<TestSample> samples = makeSamples();
+    fs::path xyzPath = fs::temp_directory_path() / "celestia_samporbit_test.xyz";
+    fs::path textPath = fs::temp_directory_path() / "celestia_samporbit_test.xyzv";
+    fs::path binaryPath = fs::temp_directory_path() / "celestia_samporbit_test.xyzvbin";
+    writeText(xyzPath, samples, false);
+    writeText(textPath, samples, true);
+    writeBinary(binaryPath, samples);
+
+    double start = samples.front().t;
+    double end = samples.back().t;
+
+    SECTION("Lookups find the right samples")
+    {
+        auto orbit = LoadSampledTrajectoryDoublePrec(xyzPath, TrajectoryInterpolation::Linear);
+        REQUIRE(orbit != nullptr);
+        for (double jd = start - 10.0; jd < end + 10.0; jd += 0.37)
+        {
+            Eigen::Vector3d expected = linearPosition(samples, jd);
+            REQUIRE((orbit->positionAtTime(jd) - expected).norm() <= 1.0e-6 * expected.norm());
+        }
+
+        for (const auto& s : samples)
+            REQUIRE((orbit->positionAtTime(s.t) - linearPosition(samples, s.t)).norm() <= 1.0e-6);
+    }
+
+    SECTION("Mapped binary files match text files")
+    {
+        auto interpolation = GENERATE(TrajectoryInterpolation::Linear, TrajectoryInterpolation::Cubic);
+        auto text = LoadXYZVTrajectoryDoublePrec(textPath, interpolation);
+        auto binary = LoadXYZVBinaryDoublePrec(binaryPath, interpolation);
+        REQUIRE(text != nullptr);
+        REQUIRE(binary != nullptr);
+        REQUIRE(binary->isThreadSafe());
+        REQUIRE(binary->getBoundingRadius() == text->getBoundingRadius());
+
+        double begin;
+        double finish;
+        binary->getValidRange(begin, finish);
+        REQUIRE(begin == start);
+        REQUIRE(finish == end);
+
+        for (double jd = start - 10.0; jd < end + 10.0; jd += 0.37)
+        {
+            REQUIRE(binary->positionAtTime(jd) == text->positionAtTime(jd));
+            REQUIRE(binary->velocityAtTime(jd) == text->velocityAtTime(jd));
+        }
+
+        // Duplicate samples are skipped
+        CountingSampleProc textSamples;
+        CountingSampleProc binarySamples;
+        text->sample(start, end, textSamples);
+        binary->sample(start, end, binarySamples);
+        REQUIRE(binarySamples.times == textSamples.times);
+        REQUIRE(binarySamples.times.size() == samples.size() - 1);
+    }
+
+    SECTION("Single precision binary files")
+    {
+        auto orbit = LoadXYZVBinarySinglePrec(binaryPath, TrajectoryInterpolation::Linear);
+        REQUIRE(orbit != nullptr);
+        Eigen::Vector3d expected = linearPosition(samples, start + 100.1);
+        REQUIRE((orbit->positionAtTime(start + 100.1) - expected).norm() <= 1.0e-6 * expected.norm());
+    }
+
+    SECTION("Truncated binary files")
+    {
+        fs::resize_file(binaryPath, fs::file_size(binaryPath) - 10);
+        {
+            // Only whole samples are used
+            auto orbit = LoadXYZVBinaryDoublePrec(binaryPath, TrajectoryInterpolation::Linear);
+            REQUIRE(orbit != nullptr);
+            double begin;
+            double finish;
+            orbit->getValidRange(begin, finish);
+            REQUIRE(finish == samples[samples.size() - 2].t);
+        }
+
+        fs::resize_file(binaryPath, 10);
+        REQUIRE(LoadXYZVBinaryDoublePrec(binaryPath, TrajectoryInterpolation::Linear) == nullptr);
+    }
+
+    SECTION("Concurrent lookups")
+    {
+        auto orbit = LoadXYZVBinaryDoublePrec(binaryPath, TrajectoryInterpolation::Cubic);
+        REQUIRE(orbit != nullptr);
+
+        std::vector<double> times;
+        for (double jd = start; jd < end; jd += 0.9)
+            times.push_back(jd);
+
+        std::vector<Eigen::Vector3d> expected;
+        for (double jd : times)
+            expected.push_back(orbit->positionAtTime(jd));
+
+        // Each thread walks through the times in a different order
+        auto lookup = [&](std::size_t stride)
+        {
+            bool ok = true;
+            for (std::size_t i = 0; i < times.size(); ++i)
+            {
+                std::size_t j = (i * stride) % times.size();
+                ok = ok && orbit->positionAtTime(times[j]) == expected[j];
+            }
+            return ok;
+        };
+
+        std::vector<std::future<bool>> results;
+        for (std::size_t stride : { 1, 7, 13, 31 })
+            results.push_back(std::async(std::launch::async, lookup, stride));
+        for (auto& result : results)
+            REQUIRE(result.get());
+    }
+
+    fs::remove(xyzPath);
+    fs::remove(textPath);
+    fs::remove(binaryPath);
+}
@@ -0,0 +1,213 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <celengine/body.h>
+#include <celengine/frame.h>
+#include <celengine/frametree.h>
+#include <celengine/solarsys.h>
+#include <celengine/solarsysstate.h>
+#include <celengine/star.h>
+#include <celengine/timeline.h>
+#include <celengine/timelinephase.h>
+#include <celephem/orbit.h>
+#include <celephem/rotation.h>
+#include <celutil/threadpool.h>
+
+#include <catch.hpp>
+
+using namespace celestia::ephem;
+
+namespace
+{
+
+constexpr double Epoch = 2451545.0;
+
+// A star with planets, moons and many asteroids; a few bodies only exist
+// for part of the time.
+class TestSystem
+{
+ public:
+    explicit TestSystem(int nAsteroids)
+    {
+        solarSystem = std::make_unique<SolarSystem>(&star);
+        rotation = std::make_unique<ConstantOrientation>(Eigen::Quaterniond::Identity());
+
+        for (int i = 0; i < 3; i++)
+        {
+            Body* planet = addBody(solarSystem->getPlanets(), Selection(&star), 1.0e8 * (i + 1), 100.0 * (i + 1),
+                                   solarSystem->getFrameTree());
+            planet->setSatellites(new PlanetarySystem(planet));
+            for (int j = 0; j < i + 1; j++)
+            {
+                // The second moon doesn't exist before the epoch
+                addBody(planet->getSatellites(), Selection(planet), 1.0e5 * (j + 1), 1.0 + j,
+                        planet->getOrCreateFrameTree(), j == 1 ? Epoch : -1.0e10);
+            }
+        }
+
+        for (int i = 0; i < nAsteroids; i++)
+        {
+            addBody(solarSystem->getPlanets(), Selection(&star), 3.0e8 + 1.0e4 * i, 1000.0 + i * 0.1,
+                    solarSystem->getFrameTree());
+        }
+    }
+
+    ~TestSystem()
+    {
+        // Satellites before their primaries
+        while (!bodies.empty())
+            bodies.pop_back();
+    }
+
+    FrameTree& getFrameTree() const { return *solarSystem->getFrameTree(); }
+
+    std::vector<std::unique_ptr<Body>> bodies;
+
+ private:
+    Body* addBody(PlanetarySystem* system, Selection center, double distance, double period,
+                  FrameTree* frameTree, double startTime = -1.0e10)
+    {
+        auto& body = bodies.emplace_back(std::make_unique<Body>(system, "Body " + std::to_string(bodies.size())));
+        auto& orbit = orbits.emplace_back(std::make_unique<EllipticalOrbit>(distance, 0.1, 0.2, 0.3, 0.4, 0.5, period, Epoch));
+
+        auto frame = std::make_shared<J2000EquatorFrame>(center);
+        auto phase = std::make_shared<const TimelinePhase>(body.get(), startTime, 1.0e10,
+                                                           frame, orbit.get(), frame, rotation.get(),
+                                                           frameTree);
+        frameTree->addChild(phase);
+        auto timeline = std::make_unique<Timeline>();
+        timeline->appendPhase(phase);
+        body->setTimeline(timeline.release());
+        return body.get();
+    }
+
+    Star star;
+    std::unique_ptr<SolarSystem> solarSystem;
+    std::unique_ptr<RotationModel> rotation;
+    std::vector<std::unique_ptr<Orbit>> orbits;
+};
+
+// Check that the state holds the bodies in frame tree order, with the
+// same positions as Body computes.
+void checkState(const SolarSystemState& state, const FrameTree& tree, double tdb,
+                std::size_t begin, std::size_t end, std::uint32_t parent)
+{
+    std::size_t i = begin;
+    for (unsigned int child = 0; child < tree.childCount(); child++)
+    {
+        const TimelinePhase* phase = tree.getChild(child).get();
+        if (!phase->includes(tdb))
+            continue;
+
+        REQUIRE(i < end);
+        const SolarSystemState::BodyState& bodyState = state[i];
+        REQUIRE(bodyState.body == phase->body());
+        REQUIRE(bodyState.phase == phase);
+        REQUIRE(bodyState.parent == parent);
+
+        Eigen::Vector3d expected = phase->body()->getAstrocentricPosition(tdb);
+        REQUIRE((bodyState.position - expected).norm() <= 1.0e-9 * expected.norm());
+
+        const FrameTree* subtree = phase->body()->getFrameTree();
+        if (subtree != nullptr)
+            checkState(state, *subtree, tdb, i + 1, bodyState.subtreeEnd, static_cast<std::uint32_t>(i));
+        else
+            REQUIRE(bodyState.subtreeEnd == i + 1);
+
+        i = bodyState.subtreeEnd;
+    }
+    REQUIRE(i == end);
+}
+
+} // end unnamed namespace
+
+TEST_CASE("Solar system state", "[SolarSystemState]")
+{
+    SECTION("Bodies are stored depth first")
+    {
+        TestSystem system(10);
+        SolarSystemState state;
+
+        state.update(system.getFrameTree(), Epoch + 10.0);
+        REQUIRE(state.getTime() == Epoch + 10.0);
+        REQUIRE(state.size() == system.bodies.size());
+        checkState(state, system.getFrameTree(), Epoch + 10.0, 0, state.size(), SolarSystemState::NoParent);
+
+        // The moons which don't exist yet are left out
+        state.update(system.getFrameTree(), Epoch - 10.0);
+        REQUIRE(state.size() == system.bodies.size() - 2);
+        checkState(state, system.getFrameTree(), Epoch - 10.0, 0, state.size(), SolarSystemState::NoParent);
+    }
+
+    SECTION("Positions computed on a thread pool")
+    {
+        TestSystem system(5000);
+        celestia::util::ThreadPool pool(4);
+        SolarSystemState serial;
+        SolarSystemState parallel;
+
+        for (double tdb : { Epoch, Epoch + 123.4 })
+        {
+            serial.update(system.getFrameTree(), tdb);
+            parallel.update(system.getFrameTree(), tdb, &pool);
+            REQUIRE(parallel.size() == serial.size());
+            for (std::size_t i = 0; i < serial.size(); i++)
+            {
+                REQUIRE(parallel[i].body == serial[i].body);
+                REQUIRE(parallel[i].position == serial[i].position);
+            }
+            checkState(parallel, system.getFrameTree(), tdb, 0, parallel.size(), SolarSystemState::NoParent);
+        }
+    }
+
+    SECTION("Groups of bodies are skipped by their bounds")
+    {
+        TestSystem system(5000);
+        system.getFrameTree().recomputeBoundingSphere();
+        SolarSystemState state;
+
+        // The hierarchy is built, refitted, then rebuilt once the asteroids
+        // have moved far along their orbits
+        for (double tdb : { Epoch, Epoch + 0.1, Epoch + 1000.0 })
+        {
+            state.update(system.getFrameTree(), tdb);
+
+            // Without culling, each body orbiting the star is visited once
+            std::vector<int> visits(state.size(), 0);
+            state.forEachChild(SolarSystemState::NoParent,
+                               [](const SolarSystemState::BoundingNode&) { return true; },
+                               [&visits](std::uint32_t i) { visits[i]++; });
+            for (std::size_t i = 0; i < state.size(); i++)
+                REQUIRE(visits[i] == (state[i].parent == SolarSystemState::NoParent ? 1 : 0));
+
+            // All the bodies within a sphere around one of the asteroids
+            // are visited, but not many more
+            Eigen::Vector3d center = state[state.size() / 2].position;
+            double radius = 1.0e6;
+            std::vector<bool> visited(state.size(), false);
+            state.forEachChild(SolarSystemState::NoParent,
+                               [&](const SolarSystemState::BoundingNode& node)
+                               {
+                                   return (node.center - center).norm() <= node.radius + radius;
+                               },
+                               [&visited](std::uint32_t i) { visited[i] = true; });
+
+            std::size_t nVisited = 0;
+            for (std::size_t i = 0; i < state.size(); i++)
+            {
+                if (state[i].parent != SolarSystemState::NoParent)
+                    continue;
+                if ((state[i].position - center).norm() <= radius + state[i].body->getCullingRadius())
+                    REQUIRE(visited[i]);
+                if (visited[i])
+                    nVisited++;
+            }
+            REQUIRE(nVisited >= 1);
+            REQUIRE(nVisited < state.size() / 4);
+        }
+    }
+}
@@ -0,0 +1,560 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <celcompat/filesystem.h>
+#include <celengine/astro.h>
+#include <celengine/compactstarstore.h>
+#include <celengine/stardb.h>
+#include <celengine/staroctree.h>
+#include <celengine/stellarclass.h>
+#include <celutil/binarywrite.h>
+#include <celutil/threadpool.h>
+
+#include <catch.hpp>
+
+namespace
+{
+
+std::string makeStarsDat(std::uint32_t nStars)
+{
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    out.write("CELSTARS", 8);
+    celestia::util::writeLE<std::uint16_t>(out, 0x0100);
+    celestia::util::writeLE<std::uint32_t>(out, nStars);
+
+    StellarClass sc(StellarClass::NormalStar, StellarClass::Spectral_G, 2, StellarClass::Lum_V);
+    std::uint16_t spectralType = sc.packV1();
+
+    // Deterministic pseudo-random positions and magnitudes
+    std::uint32_t seed = 12345;
+    auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+    for (std::uint32_t i = 0; i < nStars; ++i)
+    {
+        // Catalog numbers deliberately not in file order
+        celestia::util::writeLE<std::uint32_t>(out, (i * 7919u) % 100003u + 1u);
+        for (int j = 0; j < 3; ++j)
+            celestia::util::writeLE<float>(out, static_cast<float>(next() % 20000) - 10000.0f);
+        celestia::util::writeLE<std::int16_t>(out, static_cast<std::int16_t>(next() % 4096) - 1024);
+        celestia::util::writeLE<std::uint16_t>(out, spectralType);
+    }
+
+    return out.str();
+}
+
+class VisibleStars : public StarHandler
+{
+ public:
+    void process(const Star& star, float, float) override
+    {
+        catalogNumbers.push_back(star.getIndex());
+    }
+
+    std::vector<AstroCatalog::IndexNumber> catalogNumbers;
+};
+
+std::vector<AstroCatalog::IndexNumber> findVisible(const StarDatabase& starDB)
+{
+    VisibleStars handler;
+    starDB.findVisibleStars(handler,
+                            Eigen::Vector3f(10.0f, -20.0f, 30.0f),
+                            Eigen::Quaternionf::Identity(),
+                            1.0f, 1.5f, 8.0f);
+    std::sort(handler.catalogNumbers.begin(), handler.catalogNumbers.end());
+    return handler.catalogNumbers;
+}
+
+struct VisibleStar
+{
+    AstroCatalog::IndexNumber catalogNumber;
+    float distance;
+    float appMag;
+
+    bool operator==(const VisibleStar& other) const
+    {
+        return catalogNumber == other.catalogNumber && distance == other.distance && appMag == other.appMag;
+    }
+};
+
+class RecordingStarHandler : public StarHandler
+{
+ public:
+    void process(const Star& star, float distance, float appMag) override
+    {
+        stars.push_back({ star.getIndex(), distance, appMag });
+    }
+
+    std::vector<VisibleStar> stars;
+};
+
+class RecordingCompactStarHandler : public CompactStarHandler
+{
+ public:
+    void process(const StarView& star, float distance, float appMag) override
+    {
+        stars.push_back({ star.getIndex(), distance, appMag });
+    }
+
+    std::vector<VisibleStar> stars;
+};
+
+constexpr float testOctreeRootSize = 1.0e9f;
+
+// Builds an octree of randomly placed stars, clustered around the origin
+// with some very close to it, sorting them into sorted.
+StarOctree* buildTestOctree(std::vector<Star>& sorted)
+{
+    constexpr std::uint32_t nStars = 20000;
+
+    StarDetails* details = StarDetails::GetStarDetails(StellarClass(StellarClass::NormalStar,
+                                                                    StellarClass::Spectral_G, 2,
+                                                                    StellarClass::Lum_V));
+    std::vector<Star> unsorted(nStars);
+    std::uint32_t seed = 54321;
+    auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+    for (std::uint32_t i = 0; i < nStars; ++i)
+    {
+        Star& star = unsorted[i];
+        star.setIndex(i);
+        star.setDetails(details);
+        float scale = (i % 10 == 0) ? 2.0f : 2000.0f;
+        star.setPosition((static_cast<float>(next() % 20000) / 10000.0f - 1.0f) * scale,
+                         (static_cast<float>(next() % 20000) / 10000.0f - 1.0f) * scale,
+                         (static_cast<float>(next() % 20000) / 10000.0f - 1.0f) * scale);
+        star.setAbsoluteMagnitude(static_cast<float>(next() % 3000) / 100.0f - 10.0f);
+        if (i % 7 == 0)
+            star.setExtinction(i % 14 == 0 ? 0.01f : -0.001f);
+    }
+
+    DynamicStarOctree root(Eigen::Vector3f(1000.0f, 1000.0f, 1000.0f),
+                           astro::appToAbsMag(6.0f, testOctreeRootSize * std::sqrt(3.0f)));
+    for (const Star& star : unsorted)
+        root.insertObject(star, testOctreeRootSize);
+
+    sorted.resize(nStars);
+    Star* firstStar = sorted.data();
+    StarOctree* octree = nullptr;
+    root.rebuildAndSort(octree, firstStar);
+    return octree;
+}
+
+const Eigen::Vector3f testObservers[] =
+{
+    Eigen::Vector3f(0.0f, 0.0f, 0.0f),
+    Eigen::Vector3f(0.5f, -0.25f, 0.1f),
+    Eigen::Vector3f(1500.0f, -300.0f, 20.0f),
+};
+
+const float testLimits[] = { 2.0f, 6.5f, 12.0f };
+
+} // end unnamed namespace
+
+TEST_CASE("Octree ordered star database", "[StarDatabase]")
+{
+    constexpr std::uint32_t nStars = 5000;
+    std::string v1 = makeStarsDat(nStars);
+
+    StarDatabase unsortedDB;
+    {
+        std::istringstream in(v1, std::ios::in | std::ios::binary);
+        REQUIRE(unsortedDB.loadBinary(in));
+        unsortedDB.finish();
+    }
+
+    std::string v2;
+    {
+        std::istringstream in(v1, std::ios::in | std::ios::binary);
+        std::ostringstream out(std::ios::out | std::ios::binary);
+        REQUIRE(StarDatabase::writeOctreeBinary(in, out));
+        v2 = out.str();
+    }
+
+    SECTION("Stream loading")
+    {
+        StarDatabase sortedDB;
+        std::istringstream in(v2, std::ios::in | std::ios::binary);
+        REQUIRE(sortedDB.loadBinary(in));
+        sortedDB.finish();
+
+        REQUIRE(sortedDB.size() == nStars);
+        for (std::uint32_t i = 0; i < unsortedDB.size(); ++i)
+        {
+            const Star* expected = unsortedDB.getStar(i);
+            const Star* star = sortedDB.find(expected->getIndex());
+            REQUIRE(star != nullptr);
+            REQUIRE(star->getPosition() == expected->getPosition());
+            REQUIRE(star->getAbsoluteMagnitude() == expected->getAbsoluteMagnitude());
+        }
+
+        auto visible = findVisible(unsortedDB);
+        REQUIRE_FALSE(visible.empty());
+        REQUIRE(findVisible(sortedDB) == visible);
+    }
+
+    SECTION("Mapped loading")
+    {
+        fs::path path = fs::temp_directory_path() / "celestia_stardb_test.dat";
+        {
+            std::ofstream out(path, std::ios::out | std::ios::binary);
+            out.write(v2.data(), v2.size());
+        }
+
+        StarDatabase sortedDB;
+        REQUIRE(sortedDB.loadBinary(path));
+        sortedDB.finish();
+        fs::remove(path);
+
+        REQUIRE(sortedDB.size() == nStars);
+        REQUIRE(findVisible(sortedDB) == findVisible(unsortedDB));
+    }
+
+    SECTION("Truncated file")
+    {
+        StarDatabase sortedDB;
+        std::istringstream in(v2.substr(0, v2.size() - 1), std::ios::in | std::ios::binary);
+        REQUIRE_FALSE(sortedDB.loadBinary(in));
+    }
+
+    SECTION("Stars added after loading")
+    {
+        StarDatabase sortedDB;
+        std::istringstream in(v2, std::ios::in | std::ios::binary);
+        REQUIRE(sortedDB.loadBinary(in));
+
+        std::istringstream stc("999999 { RA 10 Dec 10 Distance 10 SpectralType \"G2V\" AbsMag 4.8 }");
+        REQUIRE(sortedDB.load(stc));
+        sortedDB.finish();
+
+        REQUIRE(sortedDB.size() == nStars + 1);
+        REQUIRE(sortedDB.find(999999) != nullptr);
+        for (std::uint32_t i = 0; i < unsortedDB.size(); ++i)
+            REQUIRE(sortedDB.find(unsortedDB.getStar(i)->getIndex()) != nullptr);
+    }
+}
+
+TEST_CASE("Star categories", "[StarDatabase]")
+{
+    StarDatabase starDB;
+    std::istringstream stc("1000 { RA 10 Dec 10 Distance 10 SpectralType \"G2V\" AbsMag 4.8 Category \"Test stars\" }\n"
+                           "1001 { RA 20 Dec 10 Distance 12 SpectralType \"K0V\" AbsMag 5.8 }\n");
+    REQUIRE(starDB.load(stc));
+    starDB.finish();
+
+    const Star* star = starDB.find(1000);
+    REQUIRE(star != nullptr);
+    REQUIRE(star->isInCategory("Test stars"));
+    REQUIRE(star->categoriesCount() == 1);
+
+    star = starDB.find(1001);
+    REQUIRE(star != nullptr);
+    REQUIRE_FALSE(star->isInCategory("Test stars"));
+    REQUIRE(star->getCategories() == nullptr);
+}
+
+TEST_CASE("Catalog number lookups", "[StarDatabase]")
+{
+    constexpr std::uint32_t nStars = 5000;
+    constexpr AstroCatalog::IndexNumber invalidIndex = AstroCatalog::InvalidIndex;
+    StarDatabase starDB;
+    {
+        std::istringstream in(makeStarsDat(nStars), std::ios::in | std::ios::binary);
+        REQUIRE(starDB.loadBinary(in));
+        starDB.finish();
+    }
+
+    // Every star, then numbers which aren't in the catalog
+    std::vector<AstroCatalog::IndexNumber> catalogNumbers;
+    for (std::uint32_t i = 0; i < nStars; ++i)
+        catalogNumbers.push_back(starDB.getStar(i)->getIndex());
+    catalogNumbers.push_back(0);
+    catalogNumbers.push_back(200000);
+    catalogNumbers.push_back(invalidIndex);
+
+    SECTION("Single and bulk lookups")
+    {
+        std::vector<Star*> found(catalogNumbers.size());
+        starDB.find(catalogNumbers, found.data());
+        for (std::size_t i = 0; i < catalogNumbers.size(); ++i)
+        {
+            Star* star = starDB.find(catalogNumbers[i]);
+            REQUIRE(found[i] == star);
+            REQUIRE(star == (i < nStars ? starDB.getStar(static_cast<std::uint32_t>(i)) : nullptr));
+        }
+    }
+
+    SECTION("Cross index")
+    {
+        // HD numbers are the catalog numbers plus 1000000, and the first
+        // star also has a second HD number
+        std::ostringstream out(std::ios::out | std::ios::binary);
+        out.write("CELINDEX", 8);
+        celestia::util::writeLE<std::uint16_t>(out, 0x0100);
+        auto writeEntry = [&out](AstroCatalog::IndexNumber hd, AstroCatalog::IndexNumber hip)
+        {
+            celestia::util::writeLE<std::uint32_t>(out, hd);
+            celestia::util::writeLE<std::uint32_t>(out, hip);
+        };
+        writeEntry(3000000, catalogNumbers[0]);
+        for (std::uint32_t i = 0; i < nStars; ++i)
+            writeEntry(catalogNumbers[i] + 1000000, catalogNumbers[i]);
+
+        std::istringstream in(out.str(), std::ios::in | std::ios::binary);
+        REQUIRE(starDB.loadCrossIndex(StarDatabase::HenryDraper, in));
+
+        std::vector<AstroCatalog::IndexNumber> hdNumbers;
+        for (AstroCatalog::IndexNumber catalogNumber : catalogNumbers)
+            hdNumbers.push_back(catalogNumber + 1000000);
+        std::vector<Star*> found(hdNumbers.size());
+        starDB.searchCrossIndex(StarDatabase::HenryDraper, hdNumbers, found.data());
+        for (std::size_t i = 0; i < hdNumbers.size(); ++i)
+        {
+            Star* star = starDB.searchCrossIndex(StarDatabase::HenryDraper, hdNumbers[i]);
+            REQUIRE(found[i] == star);
+            REQUIRE(star == (i < nStars ? starDB.getStar(static_cast<std::uint32_t>(i)) : nullptr));
+        }
+
+        REQUIRE(starDB.searchCrossIndex(StarDatabase::HenryDraper, 3000000) == starDB.getStar(0));
+        REQUIRE(starDB.crossIndex(StarDatabase::HenryDraper, catalogNumbers[0]) == catalogNumbers[0] + 1000000);
+        REQUIRE(starDB.crossIndex(StarDatabase::HenryDraper, 200000) == invalidIndex);
+        REQUIRE(starDB.searchCrossIndex(StarDatabase::SAO, 1000001) == nullptr);
+    }
+}
+
+TEST_CASE("Star octree cache", "[StarDatabase]")
+{
+    constexpr std::uint32_t nStars = 5000;
+    std::string v1 = makeStarsDat(nStars);
+    fs::path cachePath = fs::temp_directory_path() / "celestia_stardb_test.octree";
+    fs::remove(cachePath);
+
+    StarDatabase uncachedDB;
+    {
+        std::istringstream in(v1, std::ios::in | std::ios::binary);
+        REQUIRE(uncachedDB.loadBinary(in));
+        uncachedDB.setOctreeCacheFile(cachePath);
+        uncachedDB.finish();
+    }
+    REQUIRE(fs::exists(cachePath));
+
+    SECTION("Cache hit")
+    {
+        StarDatabase cachedDB;
+        std::istringstream in(v1, std::ios::in | std::ios::binary);
+        REQUIRE(cachedDB.loadBinary(in));
+        cachedDB.setOctreeCacheFile(cachePath);
+        cachedDB.finish();
+
+        REQUIRE(cachedDB.size() == nStars);
+        for (std::uint32_t i = 0; i < nStars; ++i)
+        {
+            const Star* star = cachedDB.getStar(i);
+            const Star* expected = uncachedDB.getStar(i);
+            REQUIRE(star->getIndex() == expected->getIndex());
+            REQUIRE(star->getPosition() == expected->getPosition());
+        }
+        REQUIRE(findVisible(cachedDB) == findVisible(uncachedDB));
+    }
+
+    SECTION("Catalog changed")
+    {
+        StarDatabase changedDB;
+        std::istringstream in(v1, std::ios::in | std::ios::binary);
+        REQUIRE(changedDB.loadBinary(in));
+
+        std::istringstream stc("999999 { RA 10 Dec 10 Distance 10 SpectralType \"G2V\" AbsMag 4.8 }");
+        REQUIRE(changedDB.load(stc));
+        changedDB.setOctreeCacheFile(cachePath);
+        changedDB.finish();
+
+        REQUIRE(changedDB.size() == nStars + 1);
+        REQUIRE(changedDB.find(999999) != nullptr);
+    }
+
+    fs::remove(cachePath);
+}
+
+TEST_CASE("Star culling table", "[StarOctree]")
+{
+    std::vector<Star> sorted;
+    StarOctree* octree = buildTestOctree(sorted);
+    constexpr float rootSize = testOctreeRootSize;
+
+    StarCullingTable table;
+    table.build(sorted.data(), static_cast<std::uint32_t>(sorted.size()));
+
+    for (const Eigen::Vector3f& observer : testObservers)
+    {
+        // A frustum wide enough that no node is rejected
+        Eigen::Hyperplane<float, 3> frustumPlanes[5];
+        for (auto& plane : frustumPlanes)
+            plane = Eigen::Hyperplane<float, 3>(Eigen::Vector3f::UnitZ(), 1.0e12f);
+
+        for (float limit : testLimits)
+        {
+            VisibleStars expected;
+            octree->processVisibleObjects(expected, observer, frustumPlanes, limit, rootSize);
+            VisibleStars actual;
+            octree->processVisibleObjects(actual, table, observer, frustumPlanes, limit, rootSize);
+
+            REQUIRE(!expected.catalogNumbers.empty());
+            REQUIRE(actual.catalogNumbers == expected.catalogNumbers);
+        }
+    }
+
+    delete octree;
+}
+
+TEST_CASE("Parallel star octree traversal", "[StarOctree]")
+{
+    std::vector<Star> sorted;
+    StarOctree* octree = buildTestOctree(sorted);
+    StarCullingTable table;
+    table.build(sorted.data(), static_cast<std::uint32_t>(sorted.size()));
+
+    celestia::util::ThreadPool pool(4);
+
+    for (const Eigen::Vector3f& observer : testObservers)
+    {
+        // Looking down the z axis, so that some of the subtrees are culled
+        Eigen::Hyperplane<float, 3> frustumPlanes[5];
+        for (auto& plane : frustumPlanes)
+            plane = Eigen::Hyperplane<float, 3>(Eigen::Vector3f::UnitZ(), 1.0e12f);
+        frustumPlanes[4] = Eigen::Hyperplane<float, 3>(-Eigen::Vector3f::UnitZ(), observer);
+
+        for (float limit : testLimits)
+        {
+            VisibleStars expected;
+            octree->processVisibleObjects(expected, observer, frustumPlanes, limit, testOctreeRootSize);
+
+            // Objects are passed on in the same order as by the
+            // sequential traversal
+            VisibleStars actual;
+            octree->processVisibleObjects(actual, observer, frustumPlanes, limit, testOctreeRootSize, pool);
+            REQUIRE(actual.catalogNumbers == expected.catalogNumbers);
+
+            VisibleStars actualTable;
+            octree->processVisibleObjects(actualTable, table, observer, frustumPlanes, limit, testOctreeRootSize, pool);
+            REQUIRE(actualTable.catalogNumbers == expected.catalogNumbers);
+        }
+    }
+
+    delete octree;
+}
+
+TEST_CASE("Compact star store", "[StarDatabase]")
+{
+    constexpr std::uint32_t nStars = 5000;
+    StarDatabase starDB;
+    {
+        std::istringstream in(makeStarsDat(nStars), std::ios::in | std::ios::binary);
+        REQUIRE(starDB.loadBinary(in));
+        std::istringstream stc("999999 { RA 10 Dec 10 Distance 10 SpectralType \"G2V\" AbsMag 4.75 Extinction 0.5 }");
+        REQUIRE(starDB.load(stc));
+        starDB.finish();
+    }
+
+    const Eigen::Vector3f observer(10.0f, -20.0f, 30.0f);
+    const Eigen::Quaternionf orientation(Eigen::AngleAxisf(0.5f, Eigen::Vector3f::UnitY()));
+
+    SECTION("Exact positions")
+    {
+        // Magnitudes from stars.dat and the stc file are multiples of
+        // 1/256, so without quantized positions the store finds exactly the
+        // same stars
+        std::unique_ptr<CompactStarStore> store = starDB.createCompactStore(0.0f);
+        REQUIRE(store != nullptr);
+        REQUIRE(store->size() == starDB.size());
+
+        for (float limit : { 6.0f, 10.0f, 14.0f })
+        {
+            RecordingStarHandler expected;
+            starDB.findVisibleStars(expected, observer, orientation, 1.0f, 1.5f, limit);
+            RecordingCompactStarHandler actual;
+            store->findVisibleStars(actual, observer, orientation, 1.0f, 1.5f, limit);
+
+            REQUIRE(!expected.stars.empty());
+            REQUIRE(actual.stars == expected.stars);
+        }
+
+        RecordingStarHandler expected;
+        starDB.findCloseStars(expected, observer, 2000.0f);
+        RecordingCompactStarHandler actual;
+        store->findCloseStars(actual, observer, 2000.0f);
+        REQUIRE(!expected.stars.empty());
+        REQUIRE(actual.stars == expected.stars);
+    }
+
+    SECTION("Quantized positions")
+    {
+        constexpr float tolerance = 0.1f;
+        std::unique_ptr<CompactStarStore> store = starDB.createCompactStore(tolerance);
+        REQUIRE(store != nullptr);
+        REQUIRE(store->size() == starDB.size());
+        REQUIRE(store->memoryUsage() < starDB.createCompactStore()->memoryUsage());
+
+        for (std::uint32_t i = 0; i < starDB.size(); ++i)
+        {
+            const Star* expected = starDB.getStar(i);
+            std::uint32_t index = store->find(expected->getIndex());
+            REQUIRE(index == i);
+
+            StarView view = store->getStarView(index);
+            REQUIRE(view.getIndex() == expected->getIndex());
+            REQUIRE((view.getPosition() - expected->getPosition()).norm() <= tolerance);
+            REQUIRE(view.getAbsoluteMagnitude() == expected->getAbsoluteMagnitude());
+            REQUIRE(view.getExtinction() == expected->getExtinction());
+            REQUIRE(view.getDetails() == expected->getDetails());
+        }
+        REQUIRE(store->find(1000000000) == store->size());
+
+        // Stars can move by up to the tolerance, so only those that are
+        // clearly inside or outside the magnitude limit must agree
+        constexpr float limit = 6.5f;
+        RecordingStarHandler expected;
+        starDB.findVisibleStars(expected, observer, orientation, 1.0f, 1.5f, limit);
+        RecordingCompactStarHandler actual;
+        store->findVisibleStars(actual, observer, orientation, 1.0f, 1.5f, limit);
+
+        auto byCatalogNumber = [](const VisibleStar& a, const VisibleStar& b) { return a.catalogNumber < b.catalogNumber; };
+        std::sort(expected.stars.begin(), expected.stars.end(), byCatalogNumber);
+        std::sort(actual.stars.begin(), actual.stars.end(), byCatalogNumber);
+        REQUIRE(!expected.stars.empty());
+        for (const VisibleStar& star : expected.stars)
+        {
+            if (star.appMag > limit - 0.01f)
+                continue;
+            auto it = std::lower_bound(actual.stars.begin(), actual.stars.end(), star, byCatalogNumber);
+            REQUIRE(it != actual.stars.end());
+            REQUIRE(it->catalogNumber == star.catalogNumber);
+            REQUIRE(it->distance == Approx(star.distance).margin(tolerance));
+        }
+        for (const VisibleStar& star : actual.stars)
+        {
+            REQUIRE(star.appMag < limit);
+        }
+    }
+
+    SECTION("Full stars on demand")
+    {
+        std::unique_ptr<CompactStarStore> store = starDB.createCompactStore();
+        REQUIRE(store != nullptr);
+
+        std::uint32_t index = store->find(999999);
+        REQUIRE(index < store->size());
+        Star* star = store->getStar(index);
+        REQUIRE(star == store->getStar(index));
+        REQUIRE(star->getIndex() == 999999);
+        REQUIRE(star->getAbsoluteMagnitude() == 4.75f);
+        REQUIRE(star->getExtinction() == store->getStarView(index).getExtinction());
+        REQUIRE(star->getExtinction() != 0.0f);
+        REQUIRE(star->getDetails() == starDB.find(999999)->getDetails());
+    }
+}
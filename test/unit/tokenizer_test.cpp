@@ -517,3 +517,55 @@ TEST_CASE("Tokenizer skips comments", "[Tokenizer]")
 }
 
 
+
+TEST_CASE("Tokenizer replays token lists", "[Tokenizer]")
+{
+    std::istringstream input("Name \"string\"\n"
+                             "42 -3.5 [ ]");
+    Tokenizer recorder(&input);
+    TokenList tokens;
+    for (;;)
+    {
+        Tokenizer::TokenType tokenType = recorder.nextToken();
+        if (tokenType == Tokenizer::TokenBeginArray)
+        {
+            // Stand in for the array contents as a loader's parser would
+            recorder.nextToken();
+            tokens.appendParsedGroup(2, recorder.getLineNumber(), 7);
+            continue;
+        }
+
+        tokens.append(recorder);
+        if (tokenType == Tokenizer::TokenEnd)
+            break;
+    }
+
+    Tokenizer tok(&tokens);
+
+    REQUIRE(tok.nextToken() == Tokenizer::TokenName);
+    REQUIRE(tok.getNameValue() == "Name");
+    REQUIRE(tok.getLineNumber() == 1);
+    REQUIRE(!tok.getParsedGroupIndex().has_value());
+
+    REQUIRE(tok.nextToken() == Tokenizer::TokenString);
+    REQUIRE(tok.getStringValue() == "string");
+
+    REQUIRE(tok.nextToken() == Tokenizer::TokenNumber);
+    REQUIRE(tok.getIntegerValue() == 42);
+    REQUIRE(tok.getLineNumber() == 2);
+
+    tok.pushBack();
+    REQUIRE(tok.nextToken() == Tokenizer::TokenNumber);
+    REQUIRE(tok.getIntegerValue() == 42);
+
+    REQUIRE(tok.nextToken() == Tokenizer::TokenNumber);
+    REQUIRE(tok.getNumberValue() == -3.5);
+    REQUIRE(!tok.getIntegerValue().has_value());
+
+    REQUIRE(tok.nextToken() == Tokenizer::TokenBeginGroup);
+    REQUIRE(tok.getParsedGroupIndex() == std::optional<std::size_t>(7));
+    REQUIRE(tok.nextToken() == Tokenizer::TokenEndGroup);
+
+    REQUIRE(tok.nextToken() == Tokenizer::TokenEnd);
+    REQUIRE(tok.nextToken() == Tokenizer::TokenEnd);
+}
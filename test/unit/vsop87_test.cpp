@@ -0,0 +1,182 @@
+#include <cmath>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <celephem/customorbittype.h>
+#include <celephem/orbit.h>
+#include <celephem/vsop87.h>
+
+#include <catch.hpp>
+
+using namespace celestia::ephem;
+
+namespace
+{
+
+struct ReferencePosition
+{
+    CustomOrbitType type;
+    double jd;
+    Eigen::Vector3d position;
+};
+
+// Positions computed by summing the series term by term with std::cos,
+// from 3000 BCE to 3000 CE
+const ReferencePosition referencePositions[] =
+{
+    { CustomOrbitType::VSOP87Mercury, 625673.5, { 36509506.560490429, -7543206.0642453134, 50171456.999907903 } },
+    { CustomOrbitType::VSOP87Mercury, 1721423.5, { 48179910.547473609, -7376528.0814750427, 34308736.50366199 } },
+    { CustomOrbitType::VSOP87Mercury, 2305447.5, { 40957076.434334397, -7643380.0810547117, 47339107.576621093 } },
+    { CustomOrbitType::VSOP87Mercury, 2451545.0, { -19461798.508240648, -3679752.1944595044, 66913287.302270941 } },
+    { CustomOrbitType::VSOP87Mercury, 2460000.5, { 15223597.920910116, -6790011.1166390888, 66001747.36272908 } },
+    { CustomOrbitType::VSOP87Mercury, 2816787.5, { -36330555.230844989, -1591636.4345248928, 58233167.266639732 } },
+    { CustomOrbitType::VSOP87Venus, 625673.5, { -21787355.579488471, 1302637.4064563904, 106640163.28973523 } },
+    { CustomOrbitType::VSOP87Venus, 1721423.5, { 34500509.694267772, -1204945.4929415477, -102102372.58611974 } },
+    { CustomOrbitType::VSOP87Venus, 2305447.5, { -44447034.195772626, 3806965.0888432208, -97795534.308820426 } },
+    { CustomOrbitType::VSOP87Venus, 2451545.0, { -107456458.7685336, 6135667.6303577023, 4885257.3196080802 } },
+    { CustomOrbitType::VSOP87Venus, 2460000.5, { 72220756.442634687, -3063498.7104844823, -80401302.441049412 } },
+    { CustomOrbitType::VSOP87Venus, 2816787.5, { 106073506.52236013, -6403189.8649635464, 23124832.479956273 } },
+    { CustomOrbitType::VSOP87Earth, 625673.5, { -123800805.34834011, 1136318.0085464439, -81387002.164892763 } },
+    { CustomOrbitType::VSOP87Earth, 1721423.5, { -88802842.323248789, 542242.59733054647, -117556452.49837296 } },
+    { CustomOrbitType::VSOP87Earth, 2305447.5, { -39473916.508521251, 126393.35020122185, -141681538.07728305 } },
+    { CustomOrbitType::VSOP87Earth, 2451545.0, { -26498958.400224093, -410.66091509786429, -144697330.70826885 } },
+    { CustomOrbitType::VSOP87Earth, 2460000.5, { -135038251.90526834, -2501.8703518326902, -60713827.221473448 } },
+    { CustomOrbitType::VSOP87Earth, 2816787.5, { 9832136.8445714805, -333226.15896111669, -146981387.17259014 } },
+    { CustomOrbitType::VSOP87Mars, 625673.5, { 86915452.224957287, 854751.09013427503, -218233493.81017563 } },
+    { CustomOrbitType::VSOP87Mars, 1721423.5, { 49207444.616064131, 3144201.6729111662, -228316878.21128672 } },
+    { CustomOrbitType::VSOP87Mars, 2305447.5, { -128551366.86294556, 7609084.3277201895, -208647500.91387269 } },
+    { CustomOrbitType::VSOP87Mars, 2451545.0, { 208048181.39476296, -5156222.6521488745, 2006674.689574288 } },
+    { CustomOrbitType::VSOP87Mars, 2460000.5, { -98563822.84495905, 7064507.2667051144, -221732566.30715817 } },
+    { CustomOrbitType::VSOP87Mars, 2816787.5, { -168232729.60312665, 264306.55051974644, 165054790.0376668 } },
+    { CustomOrbitType::VSOP87Jupiter, 625673.5, { -435320829.33246911, 12512415.358682472, 667929064.64251578 } },
+    { CustomOrbitType::VSOP87Jupiter, 1721423.5, { -727039405.28486466, 18156403.695319299, 361851664.70681244 } },
+    { CustomOrbitType::VSOP87Jupiter, 2305447.5, { -608453247.32155824, 11717462.619934259, -518584039.94218493 } },
+    { CustomOrbitType::VSOP87Jupiter, 2451545.0, { 598566152.46633482, -15226691.502473591, -439606823.54080111 } },
+    { CustomOrbitType::VSOP87Jupiter, 2460000.5, { 707284585.00800335, -16735220.605058316, -219381385.88819486 } },
+    { CustomOrbitType::VSOP87Jupiter, 2816787.5, { -673957530.93310606, 12704238.045606138, -435571245.95561028 } },
+    { CustomOrbitType::VSOP87Saturn, 625673.5, { -1386101268.3681645, 35480676.355109736, -369877702.1099214 } },
+    { CustomOrbitType::VSOP87Saturn, 1721423.5, { -280906464.61905223, -16347722.450421773, -1315447764.6193218 } },
+    { CustomOrbitType::VSOP87Saturn, 2305447.5, { -1294232830.8055906, 63075227.593278371, 672206638.23538208 } },
+    { CustomOrbitType::VSOP87Saturn, 2451545.0, { 958384427.68483949, -55212836.140142493, -982857276.80633581 } },
+    { CustomOrbitType::VSOP87Saturn, 2460000.5, { 1241394303.2210314, -35749411.905477345, 785163126.71601319 } },
+    { CustomOrbitType::VSOP87Saturn, 2816787.5, { 1261816381.2711453, -61110051.213437773, -605458386.60288262 } },
+    { CustomOrbitType::VSOP87Uranus, 625673.5, { -1828872201.4773419, 36147120.749021187, -2066455685.9179091 } },
+    { CustomOrbitType::VSOP87Uranus, 1721423.5, { 2656657597.4258094, -30115414.12841415, -1342411182.4811437 } },
+    { CustomOrbitType::VSOP87Uranus, 2305447.5, { 2407975199.559629, -24889316.490363915, -1720014461.7323425 } },
+    { CustomOrbitType::VSOP87Uranus, 2451545.0, { 2158979608.0907893, -35621159.771885686, 2054625410.7518377 } },
+    { CustomOrbitType::VSOP87Uranus, 2460000.5, { 1975992548.918942, -17525623.605028398, -2178676634.7398367 } },
+    { CustomOrbitType::VSOP87Uranus, 2816787.5, { 718232204.22921872, -18940922.656967577, 2819441458.6238246 } },
+    { CustomOrbitType::VSOP87Neptune, 625673.5, { -4515402110.996068, 108440200.78890812, 271469717.06425667 } },
+    { CustomOrbitType::VSOP87Neptune, 1721423.5, { -1094297157.0851939, 115639730.05521457, 4397824624.6012564 } },
+    { CustomOrbitType::VSOP87Neptune, 2305447.5, { -3977221234.7180424, 47855664.946360752, -2122294285.1118171 } },
+    { CustomOrbitType::VSOP87Neptune, 2451545.0, { 2515058699.5924697, 19026547.752107892, 3738697856.2923083 } },
+    { CustomOrbitType::VSOP87Neptune, 2460000.5, { 4454442036.8628664, -94123446.739794359, 414266883.80603397 } },
+    { CustomOrbitType::VSOP87Neptune, 2816787.5, { 3800862783.5371633, -38530626.507176988, 2389811862.4760418 } },
+    { CustomOrbitType::VSOP87Sun, 625673.5, { 1124453.6783419906, -28956.046652753288, -455058.20156796568 } },
+    { CustomOrbitType::VSOP87Sun, 1721423.5, { 714224.10423917894, -17282.816392653447, -137594.44618889515 } },
+    { CustomOrbitType::VSOP87Sun, 2305447.5, { 1050367.5618824661, -30597.204361432661, 488154.2657171624 } },
+    { CustomOrbitType::VSOP87Sun, 2451545.0, { -1068354.3385164102, 30864.225121938354, 417145.10204048944 } },
+    { CustomOrbitType::VSOP87Sun, 2460000.5, { -1345116.3182915107, 31762.520496292906, 59237.294323391056 } },
+    { CustomOrbitType::VSOP87Sun, 2816787.5, { 54294.779010768951, 8146.1620301794901, 341780.46873732581 } },
+};
+
+class SampleCollector : public OrbitSampleProc
+{
+ public:
+    void sample(double t, const Eigen::Vector3d& position, const Eigen::Vector3d& velocity) override
+    {
+        times.push_back(t);
+        positions.push_back(position);
+        velocities.push_back(velocity);
+    }
+
+    std::vector<double> times;
+    std::vector<Eigen::Vector3d> positions;
+    std::vector<Eigen::Vector3d> velocities;
+};
+
+} // end unnamed namespace
+
+TEST_CASE("VSOP87 positions match the reference", "[VSOP87]")
+{
+    for (const auto& reference : referencePositions)
+    {
+        std::unique_ptr<Orbit> orbit = CreateVSOP87Orbit(reference.type, "vsop87");
+        REQUIRE(orbit != nullptr);
+
+        Eigen::Vector3d position = orbit->positionAtTime(reference.jd);
+        REQUIRE((position - reference.position).norm() <= 1.0e-9 * reference.position.norm());
+    }
+}
+
+TEST_CASE("VSOP87 cosine", "[VSOP87]")
+{
+    // Arguments in every quadrant, including those just either side of
+    // the multiples of pi/4 where the quadrant changes. A reduction whose
+    // rounding is optimized away is wrong by up to 0.7 in some quadrants;
+    // the tolerance allows for the reassociation of -ffast-math builds.
+    for (double x = -1000.0; x <= 1000.0; x += 0.0123)
+    {
+        INFO("x = " << x);
+        REQUIRE(std::abs(VSOP87Cos(x) - std::cos(x)) <= 1.0e-12);
+    }
+
+    for (int k = -4000; k <= 4000; ++k)
+    {
+        double x = k * 0.78539816339744830962;
+        for (double y : { std::nextafter(x, -1.0e10), x, std::nextafter(x, 1.0e10) })
+        {
+            INFO("y = " << y);
+            REQUIRE(std::abs(VSOP87Cos(y) - std::cos(y)) <= 1.0e-12);
+        }
+    }
+
+    REQUIRE(std::abs(VSOP87Cos(1.0e6 + 0.5) - std::cos(1.0e6 + 0.5)) <= 1.0e-10);
+}
+
+TEST_CASE("VSOP87 batch evaluation", "[VSOP87]")
+{
+    std::unique_ptr<Orbit> orbit = CreateVSOP87Orbit(CustomOrbitType::VSOP87Mars, "vsop87-mars");
+
+    SECTION("Batches give the same positions as single times")
+    {
+        // More than one batch, with times outside the span of the theory
+        std::vector<double> jds;
+        for (double jd = 2451545.0 - 1000.0 * 365.25; jd < 2451545.0 + 1000.0 * 365.25; jd += 1234.5)
+            jds.push_back(jd);
+        jds.push_back(-1.0e8);
+
+        std::vector<Eigen::Vector3d> positions(jds.size());
+        orbit->positionsAtTimes(jds.data(), jds.size(), positions.data());
+        for (std::size_t i = 0; i < jds.size(); ++i)
+        {
+            // The terms are summed in a different order
+            Eigen::Vector3d expected = orbit->positionAtTime(jds[i]);
+            REQUIRE((positions[i] - expected).norm() <= 1.0e-10 * expected.norm());
+        }
+    }
+
+    SECTION("Sampling")
+    {
+        SampleCollector samples;
+        double period = orbit->getPeriod();
+        orbit->sample(2451545.0, 2451545.0 + period, samples);
+
+        // Uniform steps of a 150th of the period
+        REQUIRE(samples.times.size() >= 151);
+        REQUIRE(samples.times.size() <= 152);
+        REQUIRE(samples.times.front() == 2451545.0);
+        REQUIRE(samples.times.back() == 2451545.0 + period);
+        for (std::size_t i = 0; i < samples.times.size(); ++i)
+        {
+            double t = samples.times[i];
+            REQUIRE((samples.positions[i] - orbit->positionAtTime(t)).norm() <= 1.0e-3);
+            Eigen::Vector3d velocity = orbit->velocityAtTime(t);
+            REQUIRE((samples.velocities[i] - velocity).norm() <= 1.0e-5 * velocity.norm());
+        }
+    }
+}